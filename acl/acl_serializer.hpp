@@ -155,10 +155,12 @@ public:
         LOG(LOG_INFO, "ACL SERIALIZER : Data size without header (receive) = %u", size);
         bool flag = this->ini->context.session_id.get().is_empty();
         this->in_items(stream);
-        if (flag && !this->ini->context.session_id.get().is_empty()) {
-            int child_pid = getpid();
+        // session file is named after session process until session_id is known
+        if (flag && !this->ini->context.session_id.get().is_empty()
+        && this->ini->context.session_file_key[0]) {
             char old_session_file[256];
-            sprintf(old_session_file, "%s/redemption/session_%d.pid", PID_PATH, child_pid);
+            sprintf(old_session_file, "%s/redemption/session_%s.pid", PID_PATH,
+                    this->ini->context.session_file_key);
             char new_session_file[256];
             sprintf(new_session_file, "%s/redemption/session_%s.pid", PID_PATH,
                     this->ini->context.session_id.get_cstr());
@@ -36,6 +36,7 @@
 #include "RDP/RDPSerializer.hpp"
 #include "RDP/share.hpp"
 #include "difftimeval.hpp"
+#include "zlib.hpp"
 
 #include "chunked_image_transport.hpp"
 
@@ -113,9 +114,14 @@ struct FileToGraphic
     uint16_t info_medium_size;
     uint16_t info_big_entries;
     uint16_t info_big_size;
+    uint16_t info_full_image_interval;
 
     bool ignore_frame_in_timeval;
 
+    // image chunks of breakpoints are skipped even if there are consumers
+    // (consumers not drawing anything)
+    bool ignore_images;
+
     FileToGraphic(Transport * trans, const timeval begin_capture, const timeval end_capture, bool real_time, uint32_t verbose)
         : stream(65536)
         , trans(trans)
@@ -162,7 +168,9 @@ struct FileToGraphic
         , info_medium_size(0)
         , info_big_entries(0)
         , info_big_size(0)
+        , info_full_image_interval(1)
         , ignore_frame_in_timeval(false)
+        , ignore_images(false)
     {
         init_palette332(this->palette); // We don't really care movies are always 24 bits for now
 
@@ -173,6 +181,26 @@ struct FileToGraphic
             }
         }
 
+        REDOC("Nothing before the last breakpoint preceding begin_capture is needed to draw"
+              " it, it is not read when transport knows where breakpoints are. Movie then"
+              " starts from this breakpoint (record_now, orders count).")
+        if (this->meta_ok && this->timestamp_ok
+        && (this->begin_capture.tv_sec > this->record_now.tv_sec)
+        && !this->remaining_order_count
+        && this->trans->skip_units_before(this->begin_capture, &FileToGraphic::starts_with_full_image)){
+            if (this->verbose) {
+                LOG(LOG_INFO, "replay skipped to breakpoint before %u", (unsigned)this->begin_capture.tv_sec);
+            }
+            this->timestamp_ok = false;
+            this->total_orders_count = 0;
+            while (this->next_order()){
+                this->interpret_order();
+                if (this->timestamp_ok){
+                    break;
+                }
+            }
+        }
+
         Pointer pointer0(Pointer::POINTER_CURSOR0);
         this->ptr_cache.add_pointer_static(pointer0, 0);
 
@@ -190,6 +218,43 @@ struct FileToGraphic
         this->consumers[this->nbconsumers++] = consumer;
     }
 
+    REDOC("Tells from the first bytes of a wrm file if a replay can start from it:"
+          " file starts with a META chunk and its breakpoint image is the whole screen."
+          " Version 3 breakpoints always send the whole screen, version 4 ones say it"
+          " in META after full_image_interval. Files of a capture resumed before"
+          " version 4 start with a timestamp and no image.")
+    static bool starts_with_full_image(const uint8_t * data, size_t len)
+    {
+        StaticStream stream(data, len);
+        if (!stream.in_check_rem(HEADER_SIZE + 2)) {
+            return false;
+        }
+        const uint16_t chunk_type = stream.in_uint16_le();
+        const uint32_t chunk_size = stream.in_uint32_le();
+        stream.in_skip_bytes(2);
+        if (chunk_type != META_FILE) {
+            return false;
+        }
+        const uint16_t version = stream.in_uint16_le();
+        if (version < 4) {
+            return true;
+        }
+        // version, width, height, bpp, 6 cache sizes then full_image_interval
+        const size_t full_image_offset = HEADER_SIZE + 10 * 2 + 2;
+        if ((chunk_size < full_image_offset + 2) || (len < full_image_offset + 2)) {
+            return false;
+        }
+        stream.p = stream.get_data() + full_image_offset;
+        return stream.in_uint16_le() != 0;
+    }
+
+    // image chunks are read by interpret_order()
+    static bool is_image_chunk(uint16_t chunk_type)
+    {
+        return chunk_type == LAST_IMAGE_CHUNK || chunk_type == PARTIAL_IMAGE_CHUNK
+            || chunk_type == LAST_TILES_IMAGE_CHUNK || chunk_type == PARTIAL_TILES_IMAGE_CHUNK;
+    }
+
     bool next_order()
     REDOC("order count set this->stream.p to the beginning of the next order."
           "Most of the times it means not changing it, except when it must read next chunk"
@@ -197,8 +262,7 @@ struct FileToGraphic
           "It update chunk headers (merely remaining orders count) and"
           " reads the next chunk if necessary.")
     {
-        if (this->chunk_type != LAST_IMAGE_CHUNK
-        && this->chunk_type != PARTIAL_IMAGE_CHUNK){
+        if (!is_image_chunk(this->chunk_type)){
             if ((this->stream.p == this->stream.end)
             && (this->remaining_order_count)){
                 LOG(LOG_ERR, "Incomplete order batch at chunk %u "
@@ -229,7 +293,7 @@ struct FileToGraphic
                 this->chunk_size = header.in_uint32_le();
                 this->remaining_order_count = this->chunk_count = header.in_uint16_le();
 
-                if (this->chunk_type != LAST_IMAGE_CHUNK && this->chunk_type != PARTIAL_IMAGE_CHUNK){
+                if (!is_image_chunk(this->chunk_type)){
                     if (this->chunk_size > 65536){
                         LOG(LOG_INFO,"chunk_size (%d) > 65536", this->chunk_size);
                         return false;
@@ -558,6 +622,11 @@ struct FileToGraphic
                 this->info_medium_size    = this->stream.in_uint16_le();
                 this->info_big_entries    = this->stream.in_uint16_le();
                 this->info_big_size       = this->stream.in_uint16_le();
+                if ((this->info_version > 3) && this->stream.in_check_rem(2)) {
+                    // only one wrm out of info_full_image_interval starts with a full image,
+                    // next field tells if this one does (see starts_with_full_image())
+                    this->info_full_image_interval = this->stream.in_uint16_le();
+                }
 
                 this->stream.p = this->stream.end;
 
@@ -726,10 +795,76 @@ struct FileToGraphic
                 }
             break;
 
+            case LAST_TILES_IMAGE_CHUNK:
+            case PARTIAL_TILES_IMAGE_CHUNK:
+            {
+                if (this->nbconsumers && !this->ignore_images){
+                    InChunkedImageTransport chunk_trans(this->chunk_type, this->chunk_size, this->trans);
+
+                    BStream header(2);
+                    chunk_trans.recv(&header.end, 2);
+                    const uint16_t nb_tiles = header.in_uint16_le();
+
+                    z_stream zstrm;
+                    memset(&zstrm, 0, sizeof(zstrm));
+                    if (inflateInit(&zstrm) != Z_OK){
+                        LOG(LOG_ERR, "Failed to read tiles image from WRM (inflateInit)");
+                        throw Error(ERR_WRM);
+                    }
+                    ZRaiiInflateEnd zend(zstrm);
+
+                    uint8_t tile[64 * 64 * 3];
+                    for (uint16_t i = 0; i < nb_tiles; i++){
+                        this->inflate_tiles(zstrm, chunk_trans, tile, 8);
+                        const uint16_t x  = tile[0] | (tile[1] << 8);
+                        const uint16_t y  = tile[2] | (tile[3] << 8);
+                        const uint16_t cx = tile[4] | (tile[5] << 8);
+                        const uint16_t cy = tile[6] | (tile[7] << 8);
+                        if (!cx || !cy || (cx * cy > 64 * 64)
+                        || !this->screen_rect.contains(Rect(x, y, cx, cy))){
+                            LOG(LOG_ERR, "Invalid tile in WRM tiles image (%u, %u, %u, %u)", x, y, cx, cy);
+                            throw Error(ERR_WRM);
+                        }
+                        this->inflate_tiles(zstrm, chunk_trans, tile, cx * cy * 3);
+
+                        REDOC("Tiles are drawn as bitmap updates")
+                        const Bitmap bitmap(tile, cx, cy, 24, Rect(0, 0, cx, cy));
+
+                        RDPBitmapData bitmap_data;
+                        bitmap_data.dest_left      = x;
+                        bitmap_data.dest_top       = y;
+                        bitmap_data.dest_right     = x + cx - 1;
+                        bitmap_data.dest_bottom    = y + cy - 1;
+                        bitmap_data.width          = bitmap.cx;
+                        bitmap_data.height         = bitmap.cy;
+                        bitmap_data.bits_per_pixel = 24;
+                        bitmap_data.flags          = 0;
+                        bitmap_data.bitmap_length  = bitmap.bmp_size;
+
+                        for (size_t cu = 0 ; cu < this->nbconsumers ; cu++){
+                            this->consumers[cu]->draw(bitmap_data, bitmap.data(), bitmap.bmp_size, bitmap);
+                        }
+                    }
+
+                    // end of zlib stream, next order starts after last chunk of image
+                    uint8_t * data;
+                    while (chunk_trans.in_remaining(&data)){
+                    }
+                }
+                else {
+                    REDOC("If no drawable is available ignore images chunks");
+                    this->stream.reset();
+                    this->trans->recv(&this->stream.end, this->chunk_size - HEADER_SIZE);
+                    this->stream.p = this->stream.end;
+                }
+                this->remaining_order_count = 0;
+            }
+            break;
+
             case LAST_IMAGE_CHUNK:
             case PARTIAL_IMAGE_CHUNK:
             {
-                if (this->nbconsumers){
+                if (this->nbconsumers && !this->ignore_images){
                     InChunkedImageTransport chunk_trans(this->chunk_type, this->chunk_size, this->trans);
 
                     png_struct * ppng = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
@@ -863,50 +998,65 @@ struct FileToGraphic
         }
     }
 
-    void play() {
-        bool send_initial_image = true;
+    void inflate_tiles(z_stream & zstrm, InChunkedImageTransport & chunk_trans, uint8_t * data, size_t len)
+    {
+        zstrm.next_out  = data;
+        zstrm.avail_out = len;
+        while (zstrm.avail_out){
+            if (!zstrm.avail_in){
+                zstrm.avail_in = chunk_trans.in_remaining(&zstrm.next_in);
+                if (!zstrm.avail_in){
+                    LOG(LOG_ERR, "Failed to read tiles image from WRM (truncated)");
+                    throw Error(ERR_WRM);
+                }
+            }
+            int ret = inflate(&zstrm, Z_NO_FLUSH);
+            if ((ret != Z_OK && ret != Z_STREAM_END) || (ret == Z_STREAM_END && zstrm.avail_out)){
+                LOG(LOG_ERR, "Failed to read tiles image from WRM (inflate %d)", ret);
+                throw Error(ERR_WRM);
+            }
+        }
+    }
+
+    bool play_order()
+    REDOC("Interpret the order next_order() stepped on and take consumers snapshots"
+          " once begin_capture is reached. Returns false when replay is over"
+          " (orders count or end_capture reached).")
+    {
+        if (this->verbose > 8) {
+            LOG( LOG_INFO, "replay TIMESTAMP (first timestamp) = %u order=%u\n"
+               , (unsigned)this->record_now.tv_sec, (unsigned)this->total_orders_count);
+        }
+        this->interpret_order();
         if (  (this->begin_capture.tv_sec == 0)
-           || (this->begin_capture.tv_sec > this->record_now.tv_sec)
+           || (this->begin_capture.tv_sec < this->record_now.tv_sec)
            || (  (this->begin_capture.tv_sec == this->record_now.tv_sec)
-              && (this->begin_capture.tv_usec > this->record_now.tv_usec)
+              && (this->begin_capture.tv_usec <= this->record_now.tv_usec)
               )
            ) {
-                send_initial_image = false;
-        }
-
-        while (this->next_order()) {
-            if (this->verbose > 8) {
-                LOG( LOG_INFO, "replay TIMESTAMP (first timestamp) = %u order=%u\n"
-                   , (unsigned)this->record_now.tv_sec, (unsigned)this->total_orders_count);
+            for (size_t i = 0; i < this->nbconsumers ; i++) {
+                this->consumers[i]->snapshot( this->record_now, this->mouse_x, this->mouse_y, this->ignore_frame_in_timeval);
             }
-            this->interpret_order();
-            if (  (this->begin_capture.tv_sec == 0)
-               || (this->begin_capture.tv_sec < this->record_now.tv_sec)
-               || (  (this->begin_capture.tv_sec == this->record_now.tv_sec)
-                  && (this->begin_capture.tv_usec <= this->record_now.tv_usec)
-                  )
-               ) {
-                if (send_initial_image) {
-                    send_initial_image = false;
-                }
-                for (size_t i = 0; i < this->nbconsumers ; i++) {
-                    this->consumers[i]->snapshot( this->record_now, this->mouse_x, this->mouse_y, this->ignore_frame_in_timeval);
-                }
 
-                this->ignore_frame_in_timeval = false;
-            }
-            if (this->max_order_count && this->max_order_count <= this->total_orders_count) {
-                break;
-            }
-            if (  this->end_capture.tv_sec
-               && (  (this->end_capture.tv_sec < this->record_now.tv_sec)
-                  || (  (this->end_capture.tv_sec == this->record_now.tv_sec)
-                     && (this->end_capture.tv_usec < this->record_now.tv_usec)
-                     )
-                  )
-               ) {
-                break;
-            }
+            this->ignore_frame_in_timeval = false;
+        }
+        if (this->max_order_count && this->max_order_count <= this->total_orders_count) {
+            return false;
+        }
+        if (  this->end_capture.tv_sec
+           && (  (this->end_capture.tv_sec < this->record_now.tv_sec)
+              || (  (this->end_capture.tv_sec == this->record_now.tv_sec)
+                 && (this->end_capture.tv_usec < this->record_now.tv_usec)
+                 )
+              )
+           ) {
+            return false;
+        }
+        return true;
+    }
+
+    void play() {
+        while (this->next_order() && this->play_order()) {
         }
     }
 };
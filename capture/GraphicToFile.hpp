@@ -42,6 +42,9 @@
 #include "colors.hpp"
 
 #include "RDP/RDPDrawable.hpp"
+#include "zlib.hpp"
+
+#include <vector>
 
 class WRMChunk_Send
 {
@@ -62,10 +65,16 @@ public:
     Transport * trans;
     size_t max;
     BStream stream;
-    OutChunkedBufferingTransport(Transport * trans)
+    uint16_t last_chunk_type;
+    uint16_t partial_chunk_type;
+    OutChunkedBufferingTransport( Transport * trans
+                                , uint16_t last_chunk_type = LAST_IMAGE_CHUNK
+                                , uint16_t partial_chunk_type = PARTIAL_IMAGE_CHUNK)
         : trans(trans)
         , max(SZ-8)
         , stream(SZ)
+        , last_chunk_type(last_chunk_type)
+        , partial_chunk_type(partial_chunk_type)
     {
     }
 
@@ -81,7 +90,7 @@ public:
         size_t to_buffer_len = len;
         while (this->stream.size() + to_buffer_len > max){
             BStream header(8);
-            WRMChunk_Send chunk(header, PARTIAL_IMAGE_CHUNK, max, 1);
+            WRMChunk_Send chunk(header, this->partial_chunk_type, max, 1);
             this->trans->send(header);
             this->trans->send(this->stream);
             size_t to_send = max - this->stream.size();
@@ -100,13 +109,41 @@ public:
         this->stream.mark_end();
         if (this->stream.size() > 0){
             BStream header(8);
-            WRMChunk_Send chunk(header, LAST_IMAGE_CHUNK, this->stream.size(), 1);
+            WRMChunk_Send chunk(header, this->last_chunk_type, this->stream.size(), 1);
             this->trans->send(header);
             this->trans->send(this->stream);
         }
     }
 };
 
+REDOC("Sends data to trans and keeps a copy of it")
+class OutCopyTransport : public Transport
+{
+public:
+    Transport * trans;
+    std::vector<uint8_t> & copy;
+
+    OutCopyTransport(Transport * trans, std::vector<uint8_t> & copy)
+        : trans(trans)
+        , copy(copy)
+    {
+    }
+
+    using Transport::recv;
+    virtual void recv(char ** pbuffer, size_t len) throw (Error) {
+        throw Error(ERR_TRANSPORT_OUTPUT_ONLY_USED_FOR_SEND);
+    }
+
+    using Transport::send;
+    virtual void send(const char * const buffer, size_t len) throw (Error)
+    {
+        this->trans->send(buffer, len);
+        this->copy.insert(this->copy.end(), buffer, buffer + len);
+    }
+
+    virtual void seek(int64_t offset, int whence) throw (Error) { throw Error(ERR_TRANSPORT_SEEK_NOT_AVAILABLE); }
+};
+
 struct GraphicToFile : public RDPSerializer
 REDOC("To keep things easy all chunks have 8 bytes headers"
       " starting with chunk_type, chunk_size"
@@ -132,6 +169,19 @@ REDOC("To keep things easy all chunks have 8 bytes headers"
 
     BStream keyboard_buffer_32;
 
+    // image chunks of last breakpoint and drawable change count when it was made,
+    // sent again as long as nothing is drawn (idle sessions)
+    std::vector<uint8_t> keyframe;
+    uint64_t keyframe_change_count;
+
+    // one breakpoint out of full_image_interval sends a full image, others
+    // send tiles changed since the image of previous breakpoint
+    const unsigned full_image_interval;
+    unsigned nb_tiles_images;
+    uint64_t image_change_count;
+
+    const PngParams png_params;
+
     GraphicToFile(const timeval& now
                 , Transport * trans
                 , const uint16_t width
@@ -155,13 +205,19 @@ REDOC("To keep things easy all chunks have 8 bytes headers"
     , send_input(false)
     , drawable(drawable)
     , keyboard_buffer_32(GTF_SIZE_KEYBUF_REC * sizeof(uint32_t))
+    , keyframe_change_count(0)
+    , full_image_interval(ini.video.full_image_interval)
+    , nb_tiles_images(0)
+    , image_change_count(0)
+    , png_params(ini.video.png_compression_level, ini.video.png_filter)
     {
         last_sent_timer.tv_sec = 0;
         last_sent_timer.tv_usec = 0;
         this->order_count = 0;
 
-        this->send_meta_chunk();
+        this->send_meta_chunk(true);
         this->send_image_chunk();
+        this->image_change_count = this->drawable.drawable.change_count;
     }
 
     ~GraphicToFile(){
@@ -193,11 +249,15 @@ REDOC("To keep things easy all chunks have 8 bytes headers"
         keyboard_buffer_32.out_copy_bytes(input_data_32.get_data(), c * sizeof(uint32_t));
     }
 
-    void send_meta_chunk(void)
+    REDOC("full_image: image chunk of breakpoint is the whole screen, a player can"
+          " start from this META chunk. Only written in version 4, breakpoints of"
+          " version 3 always send the whole screen.")
+    void send_meta_chunk(bool full_image)
     {
         BStream header(8);
-        BStream payload(20);
-        payload.out_uint16_le(3); // WRM FORMAT VERSION 3
+        BStream payload(24);
+        // WRM FORMAT VERSION 4 only when movies may start with tiles images
+        payload.out_uint16_le((this->full_image_interval > 1) ? 4 : 3);
         payload.out_uint16_le(this->width);
         payload.out_uint16_le(this->height);
         payload.out_uint16_le(this->bpp);
@@ -207,6 +267,10 @@ REDOC("To keep things easy all chunks have 8 bytes headers"
         payload.out_uint16_le(this->bmp_cache.medium_size);
         payload.out_uint16_le(this->bmp_cache.big_entries);
         payload.out_uint16_le(this->bmp_cache.big_size);
+        if (this->full_image_interval > 1) {
+            payload.out_uint16_le(this->full_image_interval);
+            payload.out_uint16_le(full_image ? 1 : 0);
+        }
         payload.mark_end();
 
         WRMChunk_Send chunk(header, META_FILE, payload.size(), 1);
@@ -220,7 +284,7 @@ REDOC("To keep things easy all chunks have 8 bytes headers"
     {
         OutChunkedBufferingTransport<65536> png_trans(trans);
 
-        this->drawable.dump_png24(&png_trans, false);
+        this->drawable.dump_png24(&png_trans, false, this->png_params);
     }
 
     void send_timestamp_chunk(bool ignore_time_interval = false)
@@ -258,6 +322,78 @@ REDOC("To keep things easy all chunks have 8 bytes headers"
         this->last_sent_timer = this->timer;
     }
 
+    REDOC("LAST_TILES_IMAGE_CHUNK: tiles of screen changed since previous image,"
+          " split in PARTIAL_TILES_IMAGE_CHUNK like png images. Data is the number"
+          " of tiles (uint16_le) followed by a zlib stream of tiles, each one is x,"
+          " y, cx, cy (uint16_le, cx * cy <= 64 * 64) and cy rows of cx 24 bits"
+          " pixels, top row first, as they are in drawable. Nothing is sent if"
+          " screen did not change."
+          "Tiles are raw rather than xored with previous image: drawing them is the"
+          " same on previous image and on a screen already up to date.")
+    void send_tiles_image_chunks()
+    {
+        const Drawable & drawable = this->drawable.drawable;
+        uint16_t nb_tiles = 0;
+        for (unsigned ty = 0; ty < drawable.dirty_tiles_y; ty++) {
+            for (unsigned tx = 0; tx < drawable.dirty_tiles_x; tx++) {
+                nb_tiles += drawable.tile_changed_since(tx, ty, this->image_change_count);
+            }
+        }
+        if (!nb_tiles) {
+            return;
+        }
+
+        OutChunkedBufferingTransport<65536> tiles_trans(this->trans, LAST_TILES_IMAGE_CHUNK, PARTIAL_TILES_IMAGE_CHUNK);
+        BStream header(2);
+        header.out_uint16_le(nb_tiles);
+        header.mark_end();
+        tiles_trans.send(header);
+
+        z_stream zstrm;
+        memset(&zstrm, 0, sizeof(zstrm));
+        if (deflateInit(&zstrm, Z_DEFAULT_COMPRESSION) != Z_OK) {
+            LOG(LOG_ERR, "GraphicToFile::send_tiles_image_chunks: deflateInit failed");
+            throw Error(ERR_WRM);
+        }
+        ZRaiiDeflateEnd zend(zstrm);
+
+        for (unsigned ty = 0; ty < drawable.dirty_tiles_y; ty++) {
+            for (unsigned tx = 0; tx < drawable.dirty_tiles_x; tx++) {
+                if (!drawable.tile_changed_since(tx, ty, this->image_change_count)) {
+                    continue;
+                }
+                const Rect tile = drawable.tile_rect(tx, ty);
+                BStream tile_header(8);
+                tile_header.out_uint16_le(tile.x);
+                tile_header.out_uint16_le(tile.y);
+                tile_header.out_uint16_le(tile.cx);
+                tile_header.out_uint16_le(tile.cy);
+                this->deflate_tiles(zstrm, tiles_trans, tile_header.get_data(), 8, Z_NO_FLUSH);
+                for (int y = tile.y; y < tile.y + tile.cy; y++) {
+                    this->deflate_tiles(zstrm, tiles_trans, drawable.first_pixel(tile.x, y), tile.cx * drawable.Bpp, Z_NO_FLUSH);
+                }
+            }
+        }
+        this->deflate_tiles(zstrm, tiles_trans, NULL, 0, Z_FINISH);
+        tiles_trans.flush();
+    }
+
+    void deflate_tiles(z_stream & zstrm, Transport & tiles_trans, const uint8_t * data, size_t len, int flush)
+    {
+        uint8_t out[16384];
+        zstrm.next_in  = const_cast<uint8_t *>(data);
+        zstrm.avail_in = len;
+        do {
+            zstrm.next_out  = out;
+            zstrm.avail_out = sizeof(out);
+            if (deflate(&zstrm, flush) == Z_STREAM_ERROR) {
+                LOG(LOG_ERR, "GraphicToFile::deflate_tiles: deflate failed");
+                throw Error(ERR_WRM);
+            }
+            tiles_trans.send(out, sizeof(out) - zstrm.avail_out);
+        } while (zstrm.avail_out == 0);
+    }
+
     void send_save_state_chunk()
     {
         BStream payload(2048);
@@ -424,17 +560,45 @@ REDOC("To keep things easy all chunks have 8 bytes headers"
     }
 
     void breakpoint()
+    {
+        this->breakpoint(this->nb_tiles_images + 1 >= this->full_image_interval, false);
+    }
+
+    REDOC("full_image: send the whole screen rather than tiles changed since previous"
+          " breakpoint (capture resumed after a pause must start from a whole screen)."
+          "ignore_time_interval: time elapsed since previous timestamp is not waited"
+          " by players (pause).")
+    void breakpoint(bool full_image, bool ignore_time_interval)
     {
         this->flush_orders();
         this->flush_bitmaps();
         this->trans->next();
-        this->send_meta_chunk();
-        this->send_timestamp_chunk();
+        this->send_meta_chunk(full_image);
+        this->send_timestamp_chunk(ignore_time_interval);
         this->send_save_state_chunk();
 
-        OutChunkedBufferingTransport<65536> png_trans(trans);
-
-        this->drawable.dump_png24(&png_trans, true);
+        if (!full_image) {
+            this->nb_tiles_images++;
+            this->send_tiles_image_chunks();
+        }
+        else if (this->keyframe.empty()
+        || this->drawable.drawable.changed_since(this->keyframe_change_count)) {
+            this->nb_tiles_images = 0;
+            std::vector<uint8_t> image;
+            image.reserve(this->keyframe.size());
+            OutCopyTransport copy_trans(this->trans, image);
+            OutChunkedBufferingTransport<65536> png_trans(&copy_trans);
+
+            this->drawable.dump_png24(&png_trans, true, this->png_params);
+
+            this->keyframe.swap(image);
+            this->keyframe_change_count = this->drawable.drawable.change_count;
+        }
+        else {
+            this->nb_tiles_images = 0;
+            this->trans->send(&this->keyframe[0], this->keyframe.size());
+        }
+        this->image_change_count = this->drawable.drawable.change_count;
 
 //        this->send_image_chunk();
         this->send_caches_chunk();
@@ -505,6 +669,18 @@ public:
         this->RDPSerializer::draw(cmd, clip, bmp);
     }
 
+    virtual void draw(const RDPMemBlt & cmd, const Rect & clip, const BitmapView & bmp)
+    {
+        this->drawable.draw(cmd, clip, bmp);
+        this->RDPSerializer::draw(cmd, clip, bmp);
+    }
+
+    virtual void draw(const RDPMem3Blt & cmd, const Rect & clip, const BitmapView & bmp)
+    {
+        this->drawable.draw(cmd, clip, bmp);
+        this->RDPSerializer::draw(cmd, clip, bmp);
+    }
+
     virtual void draw(const RDPLineTo& cmd, const Rect & clip)
     {
         this->drawable.draw(cmd, clip);
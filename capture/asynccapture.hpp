@@ -0,0 +1,965 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2013
+   Author(s): Christophe Grosjean
+
+   Session capture done by a thread of its own (ini.video.capture_thread)
+*/
+
+#ifndef _REDEMPTION_CAPTURE_ASYNCCAPTURE_HPP_
+#define _REDEMPTION_CAPTURE_ASYNCCAPTURE_HPP_
+
+#include <pthread.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "capture.hpp"
+#include "difftimeval.hpp"
+
+// Queue of variable size messages with one producer thread and one consumer
+// thread. Producer and consumer only share the positions of the queue, the
+// mutex is only used to sleep when the queue is full (producer) or empty
+// (consumer).
+class CaptureQueue
+{
+    struct Header {
+        uint32_t type;
+        uint32_t size;      // header included, multiple of 8
+    };
+
+    enum { PADDING = 0 };
+
+    // every message but bitmaps must fit
+    enum { MIN_CAPACITY = 65536 };
+
+    uint8_t * buffer;
+    size_t capacity;
+
+    // positions are never wrapped, offset in buffer is position % capacity
+    uint64_t head;      // written by producer
+    uint64_t tail;      // written by consumer
+    int producer_waiting;
+    int consumer_waiting;
+    bool closed;
+
+    size_t reserved;    // size of message being written by producer
+
+    pthread_mutex_t mutex;
+    pthread_cond_t room_cond;
+    pthread_cond_t data_cond;
+
+public:
+    // consumer sleeps at most this long when nobody wakes it up (in ms)
+    enum { CONSUMER_TIMEOUT = 20 };
+
+    explicit CaptureQueue(size_t capacity)
+    : buffer(NULL)
+    , capacity(align8(capacity < MIN_CAPACITY ? MIN_CAPACITY : capacity))
+    , head(0)
+    , tail(0)
+    , producer_waiting(0)
+    , consumer_waiting(0)
+    , closed(false)
+    , reserved(0)
+    {
+        this->buffer = static_cast<uint8_t*>(malloc(this->capacity));
+        if (!this->buffer){
+            LOG(LOG_ERR, "CaptureQueue: failed to allocate %u bytes", (unsigned)this->capacity);
+            throw Error(ERR_RECORDER_ALLOCATION_FAILED);
+        }
+        pthread_mutex_init(&this->mutex, NULL);
+        pthread_cond_init(&this->room_cond, NULL);
+        pthread_cond_init(&this->data_cond, NULL);
+    }
+
+    ~CaptureQueue()
+    {
+        pthread_cond_destroy(&this->data_cond);
+        pthread_cond_destroy(&this->room_cond);
+        pthread_mutex_destroy(&this->mutex);
+        free(this->buffer);
+    }
+
+    static size_t align8(size_t size)
+    {
+        return (size + 7) & ~static_cast<size_t>(7);
+    }
+
+    // Largest message payload the queue can hold
+    size_t max_payload() const
+    {
+        return this->capacity - sizeof(Header);
+    }
+
+    size_t used() const
+    {
+        return __atomic_load_n(&this->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&this->tail, __ATOMIC_ACQUIRE);
+    }
+
+    // Producer: get room for a message payload of size bytes, waiting for the
+    // consumer at most timeout ms (forever if timeout < 0).
+    // Returns NULL if the queue stayed full.
+    uint8_t * reserve(size_t size, int timeout)
+    {
+        const size_t total = align8(sizeof(Header) + size);
+        bool waited = false;
+        timespec deadline;
+        for (;;){
+            const uint64_t tail = __atomic_load_n(&this->tail, __ATOMIC_ACQUIRE);
+            size_t room = this->capacity - (this->head - tail);
+            size_t offset = this->head % this->capacity;
+            size_t contiguous = this->capacity - offset;
+            if (contiguous < total && room >= contiguous){
+                // message must not be split, skip end of buffer
+                Header * pad = reinterpret_cast<Header*>(this->buffer + offset);
+                pad->type = PADDING;
+                pad->size = contiguous;
+                __atomic_store_n(&this->head, this->head + contiguous, __ATOMIC_RELEASE);
+                continue;
+            }
+            if (room >= total){
+                this->reserved = total;
+                return this->buffer + offset + sizeof(Header);
+            }
+
+            if (timeout == 0){
+                return NULL;
+            }
+            if (!waited){
+                waited = true;
+                if (timeout > 0){
+                    timeval now;
+                    gettimeofday(&now, NULL);
+                    uint64_t usec = now.tv_usec + static_cast<uint64_t>(timeout) * 1000;
+                    deadline.tv_sec = now.tv_sec + usec / 1000000;
+                    deadline.tv_nsec = (usec % 1000000) * 1000;
+                }
+            }
+            pthread_mutex_lock(&this->mutex);
+            __atomic_store_n(&this->producer_waiting, 1, __ATOMIC_SEQ_CST);
+            int res = 0;
+            if (__atomic_load_n(&this->tail, __ATOMIC_SEQ_CST) == tail){
+                res = (timeout < 0)
+                    ? pthread_cond_wait(&this->room_cond, &this->mutex)
+                    : pthread_cond_timedwait(&this->room_cond, &this->mutex, &deadline);
+            }
+            __atomic_store_n(&this->producer_waiting, 0, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&this->mutex);
+            if (res == ETIMEDOUT && __atomic_load_n(&this->tail, __ATOMIC_ACQUIRE) == tail){
+                return NULL;
+            }
+        }
+    }
+
+    // Producer: publish message previously reserved. Consumer is woken up
+    // if wake is set or when queue is getting full, otherwise it will see
+    // the message within CONSUMER_TIMEOUT.
+    void commit(uint32_t type, bool wake)
+    {
+        Header * header = reinterpret_cast<Header*>(this->buffer + this->head % this->capacity);
+        header->type = type;
+        header->size = this->reserved;
+        const uint64_t head = this->head + this->reserved;
+        wake = wake || (head - __atomic_load_n(&this->tail, __ATOMIC_RELAXED) > this->capacity / 4);
+        if (wake){
+            __atomic_store_n(&this->head, head, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&this->consumer_waiting, __ATOMIC_SEQ_CST)){
+                pthread_mutex_lock(&this->mutex);
+                pthread_cond_signal(&this->data_cond);
+                pthread_mutex_unlock(&this->mutex);
+            }
+        }
+        else {
+            __atomic_store_n(&this->head, head, __ATOMIC_RELEASE);
+        }
+    }
+
+    // Producer: wait until consumer is done with every message
+    void wait_empty()
+    {
+        for (;;){
+            const uint64_t tail = __atomic_load_n(&this->tail, __ATOMIC_ACQUIRE);
+            if (tail == this->head){
+                return;
+            }
+            pthread_mutex_lock(&this->mutex);
+            __atomic_store_n(&this->producer_waiting, 1, __ATOMIC_SEQ_CST);
+            // consumer may be sleeping until its timeout, wake it up
+            pthread_cond_signal(&this->data_cond);
+            if (__atomic_load_n(&this->tail, __ATOMIC_SEQ_CST) == tail){
+                pthread_cond_wait(&this->room_cond, &this->mutex);
+            }
+            __atomic_store_n(&this->producer_waiting, 0, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&this->mutex);
+        }
+    }
+
+    // Producer: consumer will return NULL from front() once queue is empty
+    void close()
+    {
+        pthread_mutex_lock(&this->mutex);
+        this->closed = true;
+        pthread_cond_signal(&this->data_cond);
+        pthread_mutex_unlock(&this->mutex);
+    }
+
+    // Consumer: wait for next message, NULL when queue is closed and empty
+    const uint8_t * front(uint32_t & type, size_t & size)
+    {
+        for (;;){
+            const uint64_t head = __atomic_load_n(&this->head, __ATOMIC_ACQUIRE);
+            if (this->tail != head){
+                const Header * header = reinterpret_cast<const Header*>(this->buffer + this->tail % this->capacity);
+                if (header->type == PADDING){
+                    this->release(header->size);
+                    continue;
+                }
+                type = header->type;
+                size = header->size - sizeof(Header);
+                return reinterpret_cast<const uint8_t*>(header + 1);
+            }
+
+            pthread_mutex_lock(&this->mutex);
+            if (this->closed){
+                pthread_mutex_unlock(&this->mutex);
+                return NULL;
+            }
+            __atomic_store_n(&this->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&this->head, __ATOMIC_SEQ_CST) == head){
+                timeval now;
+                gettimeofday(&now, NULL);
+                uint64_t usec = now.tv_usec + CONSUMER_TIMEOUT * 1000;
+                timespec deadline;
+                deadline.tv_sec = now.tv_sec + usec / 1000000;
+                deadline.tv_nsec = (usec % 1000000) * 1000;
+                pthread_cond_timedwait(&this->data_cond, &this->mutex, &deadline);
+            }
+            __atomic_store_n(&this->consumer_waiting, 0, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&this->mutex);
+        }
+    }
+
+    // Consumer: done with message returned by front()
+    void pop()
+    {
+        const Header * header = reinterpret_cast<const Header*>(this->buffer + this->tail % this->capacity);
+        this->release(header->size);
+    }
+
+private:
+    void release(size_t size)
+    {
+        __atomic_store_n(&this->tail, this->tail + size, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&this->producer_waiting, __ATOMIC_SEQ_CST)){
+            pthread_mutex_lock(&this->mutex);
+            pthread_cond_signal(&this->room_cond);
+            pthread_mutex_unlock(&this->mutex);
+        }
+    }
+};
+
+// Reports and auth channel values set by capture transports (disk
+// full...) from capture thread, they are queued and forwarded to
+// authentifier by session thread, in the order they were made
+class CaptureReports : public auth_api
+{
+    enum ReportType {
+        AUTH_CHANNEL_TARGET,
+        AUTH_CHANNEL_RESULT,
+        REPORT
+    };
+
+    struct Report {
+        ReportType  type;
+        std::string value;      // target, result or reason
+        std::string message;    // REPORT only
+    };
+
+    auth_api * authentifier;
+    pthread_mutex_t mutex;
+    std::vector<Report> reports;
+    bool pending;
+
+    void push(ReportType type, const char * value, const char * message = "")
+    {
+        Report report;
+        report.type = type;
+        report.value = value;
+        report.message = message;
+
+        pthread_mutex_lock(&this->mutex);
+        this->reports.push_back(report);
+        __atomic_store_n(&this->pending, true, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&this->mutex);
+    }
+
+public:
+    explicit CaptureReports(auth_api * authentifier)
+    : authentifier(authentifier)
+    , pending(false)
+    {
+        pthread_mutex_init(&this->mutex, NULL);
+    }
+
+    virtual ~CaptureReports()
+    {
+        pthread_mutex_destroy(&this->mutex);
+    }
+
+    virtual void set_auth_channel_target(const char * target)
+    {
+        this->push(AUTH_CHANNEL_TARGET, target);
+    }
+
+    virtual void set_auth_channel_result(const char * result)
+    {
+        this->push(AUTH_CHANNEL_RESULT, result);
+    }
+
+    virtual void report(const char * reason, const char * message)
+    {
+        this->push(REPORT, reason, message);
+    }
+
+    // Called by session thread
+    void forward()
+    {
+        if (!__atomic_load_n(&this->pending, __ATOMIC_ACQUIRE)){
+            return;
+        }
+        std::vector<Report> reports;
+        pthread_mutex_lock(&this->mutex);
+        reports.swap(this->reports);
+        __atomic_store_n(&this->pending, false, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&this->mutex);
+        if (this->authentifier){
+            for (size_t i = 0; i < reports.size(); i++){
+                const Report & report = reports[i];
+                switch (report.type){
+                case AUTH_CHANNEL_TARGET:
+                    this->authentifier->set_auth_channel_target(report.value.c_str());
+                    break;
+                case AUTH_CHANNEL_RESULT:
+                    this->authentifier->set_auth_channel_result(report.value.c_str());
+                    break;
+                case REPORT:
+                    this->authentifier->report(report.value.c_str(), report.message.c_str());
+                    break;
+                }
+            }
+        }
+    }
+};
+
+// Capture whose calls are queued by session thread and replayed in the same
+// order by a capture thread, recorded files are the same as with Capture.
+// Drawing orders may be dropped from recording if capture_queue_timeout is
+// set and the capture thread can't keep up.
+class AsyncCapture : public Capture
+{
+    enum {
+        MSG_OPAQUERECT = 1,
+        MSG_SCRBLT,
+        MSG_DESTBLT,
+        MSG_MULTIDSTBLT,
+        MSG_PATBLT,
+        MSG_MEMBLT,
+        MSG_MEM3BLT,
+        MSG_LINETO,
+        MSG_GLYPHINDEX,
+        MSG_POLYGONSC,
+        MSG_POLYGONCB,
+        MSG_POLYLINE,
+        MSG_ELLIPSESC,
+        MSG_ELLIPSECB,
+        MSG_GLYPHCACHE,
+        MSG_BITMAPDATA,
+        MSG_INPUT,
+        MSG_SNAPSHOT,
+        MSG_FLUSH,
+        MSG_PAUSE,
+        MSG_RESUME,
+        MSG_SEND_POINTER,
+        MSG_SET_POINTER,
+        MSG_SET_POINTER_DISPLAY
+    };
+
+    struct BitmapHeader {
+        uint16_t cx;
+        uint16_t cy;
+        uint8_t  bpp;
+        bool     palette;
+    };
+
+    struct SnapshotMsg {
+        timeval now;
+        int x;
+        int y;
+        bool ignore_frame_in_timeval;
+    };
+
+    struct InputMsg {
+        timeval now;
+        size_t size;
+    };
+
+    struct GlyphCacheMsg {
+        uint8_t  cacheId;
+        uint16_t cacheIndex;
+        uint16_t x;
+        uint16_t y;
+        uint16_t cx;
+        uint16_t cy;
+    };
+
+    CaptureQueue queue;
+    CaptureReports reports;
+    const int queue_timeout;    // ms, < 0 never drops orders
+
+    pthread_t thread;
+
+    // set by capture thread
+    int error_id;
+    uint64_t png_time_to_wait;
+    uint64_t wrm_time_to_wait;
+
+public:
+    // accounting, all made by session thread
+    unsigned long nb_messages;      // queued calls
+    unsigned long nb_dropped;       // drawing orders not recorded because queue was full
+    unsigned long nb_waits;         // calls that had to wait for room in queue
+    unsigned long nb_direct;        // calls made by session thread (too large for queue)
+    uint64_t wait_usec;             // time spent waiting for room in queue
+
+    AsyncCapture( const timeval & now, int width, int height, const char * wrm_path
+                , const char * png_path, const char * hash_path, const char * basename
+                , bool clear_png, bool no_timestamp, auth_api * authentifier, Inifile & ini)
+    : Capture( now, width, height, wrm_path, png_path, hash_path, basename
+             , clear_png, no_timestamp, authentifier, ini)
+    , queue(static_cast<size_t>(ini.video.capture_queue_size) * 1024)
+    , reports(authentifier)
+    , queue_timeout(ini.video.capture_queue_timeout ? static_cast<int>(ini.video.capture_queue_timeout) : -1)
+    , error_id(0)
+    , png_time_to_wait(0)
+    , wrm_time_to_wait(0)
+    , nb_messages(0)
+    , nb_dropped(0)
+    , nb_waits(0)
+    , nb_direct(0)
+    , wait_usec(0)
+    {
+        if (this->capture_png){
+            this->png_trans->set_authentifier(&this->reports);
+            this->png_time_to_wait = this->psc->inter_frame_interval_static_capture;
+        }
+        if (this->capture_wrm){
+            if (this->enable_file_encryption){
+                this->crypto_wrm_trans->set_authentifier(&this->reports);
+            }
+            else {
+                this->wrm_trans->set_authentifier(&this->reports);
+            }
+            this->wrm_time_to_wait = this->pnc->inter_frame_interval_native_capture;
+        }
+
+        if (0 != pthread_create(&this->thread, NULL, &AsyncCapture::run, this)){
+            LOG(LOG_ERR, "AsyncCapture: failed to start capture thread (%s)", strerror(errno));
+            throw Error(ERR_RECORDER_THREAD_FAILED);
+        }
+    }
+
+    virtual ~AsyncCapture()
+    {
+        this->queue.close();
+        pthread_join(this->thread, NULL);
+        this->reports.forward();
+        if (this->nb_dropped || this->nb_waits){
+            LOG(LOG_WARNING, "AsyncCapture: %lu calls recorded, %lu drawing orders dropped, "
+                "%lu waits for capture thread (%u ms)",
+                this->nb_messages, this->nb_dropped, this->nb_waits,
+                static_cast<unsigned>(this->wait_usec / 1000));
+        }
+    }
+
+    virtual void request_full_cleaning()
+    {
+        this->queue.wait_empty();
+        this->Capture::request_full_cleaning();
+    }
+
+    virtual void update_config(const Inifile & ini)
+    {
+        this->queue.wait_empty();
+        this->Capture::update_config(ini);
+    }
+
+    virtual void pause()
+    {
+        uint8_t * p = this->reserve(sizeof(timeval), false);
+        new (p) timeval(tvtime());
+        this->commit(MSG_PAUSE, true);
+    }
+
+    virtual void resume()
+    {
+        uint8_t * p = this->reserve(sizeof(timeval), false);
+        new (p) timeval(tvtime());
+        this->commit(MSG_RESUME, true);
+    }
+
+    virtual void snapshot(const timeval & now, int x, int y, bool ignore_frame_in_timeval)
+    {
+        uint8_t * p = this->reserve(sizeof(SnapshotMsg), true);
+        if (p){
+            SnapshotMsg * msg = new (p) SnapshotMsg;
+            msg->now = now;
+            msg->x = x;
+            msg->y = y;
+            msg->ignore_frame_in_timeval = ignore_frame_in_timeval;
+            this->commit(MSG_SNAPSHOT, true);
+        }
+        this->reports.forward();
+
+        // capture thread may not have done this snapshot yet, wait times of
+        // the previous one are close enough
+        this->capture_event.reset();
+        if (this->capture_png) {
+            this->capture_event.update(__atomic_load_n(&this->png_time_to_wait, __ATOMIC_RELAXED));
+        }
+        if (this->capture_wrm) {
+            this->capture_event.update(__atomic_load_n(&this->wrm_time_to_wait, __ATOMIC_RELAXED));
+        }
+    }
+
+    virtual void flush()
+    {
+        this->reserve(0, false);
+        this->commit(MSG_FLUSH, true);
+    }
+
+    virtual void input(const timeval & now, Stream & input_data_32)
+    {
+        const size_t size = input_data_32.size();
+        uint8_t * p = this->reserve(sizeof(InputMsg) + size, false);
+        InputMsg * msg = new (p) InputMsg;
+        msg->now = now;
+        msg->size = size;
+        memcpy(p + sizeof(InputMsg), input_data_32.get_data(), size);
+        this->commit(MSG_INPUT, false);
+    }
+
+    virtual void draw(const RDPOpaqueRect & cmd, const Rect & clip)
+    {
+        this->push_order(MSG_OPAQUERECT, cmd, clip);
+    }
+
+    virtual void draw(const RDPScrBlt & cmd, const Rect & clip)
+    {
+        this->push_order(MSG_SCRBLT, cmd, clip);
+    }
+
+    virtual void draw(const RDPDestBlt & cmd, const Rect & clip)
+    {
+        this->push_order(MSG_DESTBLT, cmd, clip);
+    }
+
+    virtual void draw(const RDPMultiDstBlt & cmd, const Rect & clip)
+    {
+        this->push_order(MSG_MULTIDSTBLT, cmd, clip);
+    }
+
+    virtual void draw(const RDPPatBlt & cmd, const Rect & clip)
+    {
+        this->push_order(MSG_PATBLT, cmd, clip);
+    }
+
+    virtual void draw(const RDPLineTo & cmd, const Rect & clip)
+    {
+        this->push_order(MSG_LINETO, cmd, clip);
+    }
+
+    virtual void draw(const RDPPolygonSC & cmd, const Rect & clip)
+    {
+        this->push_order(MSG_POLYGONSC, cmd, clip);
+    }
+
+    virtual void draw(const RDPPolygonCB & cmd, const Rect & clip)
+    {
+        this->push_order(MSG_POLYGONCB, cmd, clip);
+    }
+
+    virtual void draw(const RDPPolyline & cmd, const Rect & clip)
+    {
+        this->push_order(MSG_POLYLINE, cmd, clip);
+    }
+
+    virtual void draw(const RDPEllipseSC & cmd, const Rect & clip)
+    {
+        this->push_order(MSG_ELLIPSESC, cmd, clip);
+    }
+
+    virtual void draw(const RDPEllipseCB & cmd, const Rect & clip)
+    {
+        this->push_order(MSG_ELLIPSECB, cmd, clip);
+    }
+
+    // Capture devices keep their own glyph cache (fed by RDPGlyphCache),
+    // gly_cache is not used
+    virtual void draw(const RDPGlyphIndex & cmd, const Rect & clip, const GlyphCache * gly_cache)
+    {
+        this->push_order(MSG_GLYPHINDEX, cmd, clip);
+    }
+
+    virtual void draw(const RDPMemBlt & cmd, const Rect & clip, const Bitmap & bmp)
+    {
+        this->draw(cmd, clip, bmp.view());
+    }
+
+    virtual void draw(const RDPMem3Blt & cmd, const Rect & clip, const Bitmap & bmp)
+    {
+        this->draw(cmd, clip, bmp.view());
+    }
+
+    virtual void draw(const RDPMemBlt & cmd, const Rect & clip, const BitmapView & bmp)
+    {
+        if (!this->push_blt(MSG_MEMBLT, cmd, clip, bmp)){
+            this->Capture::draw(cmd, clip, bmp);
+        }
+    }
+
+    virtual void draw(const RDPMem3Blt & cmd, const Rect & clip, const BitmapView & bmp)
+    {
+        if (!this->push_blt(MSG_MEM3BLT, cmd, clip, bmp)){
+            this->Capture::draw(cmd, clip, bmp);
+        }
+    }
+
+    virtual void draw(const RDPGlyphCache & cmd)
+    {
+        const size_t size = cmd.datasize();
+        uint8_t * p = this->reserve(sizeof(GlyphCacheMsg) + size, false);
+        GlyphCacheMsg * msg = new (p) GlyphCacheMsg;
+        msg->cacheId    = cmd.cacheId;
+        msg->cacheIndex = cmd.glyphData_cacheIndex;
+        msg->x          = cmd.glyphData_x;
+        msg->y          = cmd.glyphData_y;
+        msg->cx         = cmd.glyphData_cx;
+        msg->cy         = cmd.glyphData_cy;
+        memcpy(p + sizeof(GlyphCacheMsg), cmd.glyphData_aj, size);
+        this->commit(MSG_GLYPHCACHE, false);
+    }
+
+    virtual void draw( const RDPBitmapData & bitmap_data, const uint8_t * data
+                     , size_t size, const Bitmap & bmp)
+    {
+        const BitmapView view = bmp.view();
+        const size_t offset = CaptureQueue::align8(sizeof(RDPBitmapData) + sizeof(size_t));
+        const size_t data_size = CaptureQueue::align8(size);
+        uint8_t * p = this->reserve_bitmap(offset + data_size, view);
+        if (!p){
+            return;
+        }
+        if (p == this->direct()){
+            this->Capture::draw(bitmap_data, data, size, bmp);
+            return;
+        }
+        new (p) RDPBitmapData(bitmap_data);
+        new (p + sizeof(RDPBitmapData)) size_t(size);
+        memcpy(p + offset, data, size);
+        this->copy_bitmap(p + offset + data_size, view);
+        this->commit(MSG_BITMAPDATA, false);
+    }
+
+    virtual void send_pointer(int cache_idx, const Pointer & cursor)
+    {
+        uint8_t * p = this->reserve(sizeof(int) + sizeof(Pointer), false);
+        new (p) int(cache_idx);
+        new (p + sizeof(int)) Pointer(cursor);
+        this->commit(MSG_SEND_POINTER, false);
+    }
+
+    virtual void set_pointer(int cache_idx)
+    {
+        uint8_t * p = this->reserve(sizeof(int), false);
+        new (p) int(cache_idx);
+        this->commit(MSG_SET_POINTER, false);
+    }
+
+    virtual void set_pointer_display()
+    {
+        this->reserve(0, false);
+        this->commit(MSG_SET_POINTER_DISPLAY, false);
+    }
+
+private:
+    // Returned by reserve_bitmap() when the message is too large for queue,
+    // session thread must then make the call itself
+    uint8_t * direct()
+    {
+        return reinterpret_cast<uint8_t*>(this);
+    }
+
+    // Room for a message in queue. Droppable messages are only waited for
+    // queue_timeout and NULL is returned if queue stays full.
+    uint8_t * reserve(size_t size, bool droppable)
+    {
+        const int error_id = __atomic_load_n(&this->error_id, __ATOMIC_ACQUIRE);
+        if (error_id){
+            throw Error(error_id);
+        }
+
+        uint8_t * p = this->queue.reserve(size, 0);
+        if (!p){
+            const uint64_t start = ustime();
+            p = this->queue.reserve(size, droppable ? this->queue_timeout : -1);
+            this->wait_usec += ustime() - start;
+            this->nb_waits++;
+            if (!p){
+                if (!this->nb_dropped){
+                    LOG(LOG_WARNING, "AsyncCapture: capture thread is late, dropping drawing orders from recording");
+                }
+                this->nb_dropped++;
+                return NULL;
+            }
+        }
+        return p;
+    }
+
+    void commit(uint32_t type, bool wake)
+    {
+        this->queue.commit(type, wake);
+        this->nb_messages++;
+    }
+
+    template<class Cmd>
+    void push_order(uint32_t type, const Cmd & cmd, const Rect & clip)
+    {
+        const size_t offset = CaptureQueue::align8(sizeof(Cmd));
+        uint8_t * p = this->reserve(offset + sizeof(Rect), true);
+        if (p){
+            new (p) Cmd(cmd);
+            new (p + offset) Rect(clip);
+            this->commit(type, false);
+        }
+    }
+
+    template<class Cmd>
+    bool push_blt(uint32_t type, const Cmd & cmd, const Rect & clip, const BitmapView & bmp)
+    {
+        const size_t offset = CaptureQueue::align8(sizeof(Cmd)) + CaptureQueue::align8(sizeof(Rect));
+        uint8_t * p = this->reserve_bitmap(offset, bmp);
+        if (p == this->direct()){
+            return false;
+        }
+        if (p){
+            new (p) Cmd(cmd);
+            new (p + CaptureQueue::align8(sizeof(Cmd))) Rect(clip);
+            this->copy_bitmap(p + offset, bmp);
+            this->commit(type, false);
+        }
+        return true;
+    }
+
+    static size_t bitmap_size(const BitmapView & bmp)
+    {
+        return CaptureQueue::align8(sizeof(BitmapHeader))
+             + ((bmp.original_bpp == 8 && bmp.original_palette) ? sizeof(BGRPalette) : 0)
+             + static_cast<size_t>(bmp.cx) * nbbytes(bmp.original_bpp) * bmp.cy;
+    }
+
+    // Room for size bytes followed by bitmap pixels, direct() if it can't
+    // fit in queue
+    uint8_t * reserve_bitmap(size_t size, const BitmapView & bmp)
+    {
+        size += bitmap_size(bmp);
+        if (size > this->queue.max_payload()){
+            this->queue.wait_empty();
+            this->nb_direct++;
+            return this->direct();
+        }
+        return this->reserve(size, true);
+    }
+
+    // Pixels are stored without padding, palette only for 8 bpp bitmaps
+    static void copy_bitmap(uint8_t * p, const BitmapView & bmp)
+    {
+        BitmapHeader * header = new (p) BitmapHeader;
+        header->cx = bmp.cx;
+        header->cy = bmp.cy;
+        header->bpp = bmp.original_bpp;
+        header->palette = (bmp.original_bpp == 8 && bmp.original_palette);
+        p += CaptureQueue::align8(sizeof(BitmapHeader));
+        if (header->palette){
+            memcpy(p, bmp.original_palette, sizeof(BGRPalette));
+            p += sizeof(BGRPalette);
+        }
+        const size_t line_size = static_cast<size_t>(bmp.cx) * nbbytes(bmp.original_bpp);
+        if (static_cast<ptrdiff_t>(line_size) == bmp.line_size){
+            memcpy(p, bmp.data, line_size * bmp.cy);
+            return;
+        }
+        for (uint16_t y = 0; y < bmp.cy; y++){
+            memcpy(p + y * line_size, bmp.data + y * bmp.line_size, line_size);
+        }
+    }
+
+    static BitmapView bitmap_view(const uint8_t * p)
+    {
+        const BitmapHeader * header = reinterpret_cast<const BitmapHeader*>(p);
+        p += CaptureQueue::align8(sizeof(BitmapHeader));
+        const BGRPalette * palette = NULL;
+        if (header->palette){
+            palette = reinterpret_cast<const BGRPalette*>(p);
+            p += sizeof(BGRPalette);
+        }
+        return BitmapView( header->bpp, palette, header->cx, header->cy, p
+                         , static_cast<ptrdiff_t>(header->cx) * nbbytes(header->bpp));
+    }
+
+    template<class Cmd>
+    void replay_order(const uint8_t * p)
+    {
+        const Cmd & cmd = *reinterpret_cast<const Cmd*>(p);
+        const Rect & clip = *reinterpret_cast<const Rect*>(p + CaptureQueue::align8(sizeof(Cmd)));
+        this->Capture::draw(cmd, clip);
+        cmd.~Cmd();
+    }
+
+    template<class Cmd>
+    void replay_blt(const uint8_t * p)
+    {
+        const Cmd & cmd = *reinterpret_cast<const Cmd*>(p);
+        const size_t offset = CaptureQueue::align8(sizeof(Cmd));
+        const Rect & clip = *reinterpret_cast<const Rect*>(p + offset);
+        this->Capture::draw(cmd, clip, bitmap_view(p + offset + CaptureQueue::align8(sizeof(Rect))));
+        cmd.~Cmd();
+    }
+
+    void replay(uint32_t type, const uint8_t * p)
+    {
+        switch (type){
+        case MSG_OPAQUERECT:  this->replay_order<RDPOpaqueRect>(p);  break;
+        case MSG_SCRBLT:      this->replay_order<RDPScrBlt>(p);      break;
+        case MSG_DESTBLT:     this->replay_order<RDPDestBlt>(p);     break;
+        case MSG_MULTIDSTBLT: this->replay_order<RDPMultiDstBlt>(p); break;
+        case MSG_PATBLT:      this->replay_order<RDPPatBlt>(p);      break;
+        case MSG_LINETO:      this->replay_order<RDPLineTo>(p);      break;
+        case MSG_POLYGONSC:   this->replay_order<RDPPolygonSC>(p);   break;
+        case MSG_POLYGONCB:   this->replay_order<RDPPolygonCB>(p);   break;
+        case MSG_POLYLINE:    this->replay_order<RDPPolyline>(p);    break;
+        case MSG_ELLIPSESC:   this->replay_order<RDPEllipseSC>(p);   break;
+        case MSG_ELLIPSECB:   this->replay_order<RDPEllipseCB>(p);   break;
+        case MSG_MEMBLT:      this->replay_blt<RDPMemBlt>(p);        break;
+        case MSG_MEM3BLT:     this->replay_blt<RDPMem3Blt>(p);       break;
+        case MSG_GLYPHINDEX:
+        {
+            const RDPGlyphIndex & cmd = *reinterpret_cast<const RDPGlyphIndex*>(p);
+            const Rect & clip = *reinterpret_cast<const Rect*>(p + CaptureQueue::align8(sizeof(RDPGlyphIndex)));
+            this->Capture::draw(cmd, clip, NULL);
+            cmd.~RDPGlyphIndex();
+        }
+        break;
+        case MSG_GLYPHCACHE:
+        {
+            const GlyphCacheMsg * msg = reinterpret_cast<const GlyphCacheMsg*>(p);
+            RDPGlyphCache cmd( msg->cacheId, 1, msg->cacheIndex, msg->x, msg->y, msg->cx, msg->cy
+                             , p + sizeof(GlyphCacheMsg));
+            this->Capture::draw(cmd);
+        }
+        break;
+        case MSG_BITMAPDATA:
+        {
+            const RDPBitmapData & bitmap_data = *reinterpret_cast<const RDPBitmapData*>(p);
+            const size_t size = *reinterpret_cast<const size_t*>(p + sizeof(RDPBitmapData));
+            const uint8_t * data = p + CaptureQueue::align8(sizeof(RDPBitmapData) + sizeof(size_t));
+            const BitmapView view = bitmap_view(data + CaptureQueue::align8(size));
+            const Bitmap bmp(view.original_bpp, view);
+            this->Capture::draw(bitmap_data, data, size, bmp);
+        }
+        break;
+        case MSG_INPUT:
+        {
+            const InputMsg * msg = reinterpret_cast<const InputMsg*>(p);
+            StaticStream input_data_32(p + sizeof(InputMsg), msg->size);
+            this->Capture::input(msg->now, input_data_32);
+        }
+        break;
+        case MSG_SNAPSHOT:
+        {
+            const SnapshotMsg * msg = reinterpret_cast<const SnapshotMsg*>(p);
+            this->snapshot_images(msg->now, msg->x, msg->y, msg->ignore_frame_in_timeval);
+            if (this->capture_png) {
+                __atomic_store_n(&this->png_time_to_wait, this->psc->time_to_wait, __ATOMIC_RELAXED);
+            }
+            if (this->capture_wrm) {
+                __atomic_store_n(&this->wrm_time_to_wait, this->pnc->time_to_wait, __ATOMIC_RELAXED);
+            }
+        }
+        break;
+        case MSG_FLUSH:
+            this->Capture::flush();
+        break;
+        case MSG_PAUSE:
+            this->Capture::pause(*reinterpret_cast<const timeval*>(p));
+        break;
+        case MSG_RESUME:
+            this->Capture::resume(*reinterpret_cast<const timeval*>(p));
+        break;
+        case MSG_SEND_POINTER:
+            this->Capture::send_pointer( *reinterpret_cast<const int*>(p)
+                                       , *reinterpret_cast<const Pointer*>(p + sizeof(int)));
+        break;
+        case MSG_SET_POINTER:
+            this->Capture::set_pointer(*reinterpret_cast<const int*>(p));
+        break;
+        case MSG_SET_POINTER_DISPLAY:
+            this->Capture::set_pointer_display();
+        break;
+        }
+    }
+
+    static void * run(void * arg)
+    {
+        AsyncCapture * self = static_cast<AsyncCapture*>(arg);
+        uint32_t type;
+        size_t size;
+        while (const uint8_t * p = self->queue.front(type, size)){
+            if (!__atomic_load_n(&self->error_id, __ATOMIC_RELAXED)){
+                try {
+                    self->replay(type, p);
+                }
+                catch (Error & e) {
+                    LOG(LOG_ERR, "AsyncCapture: capture thread failed (error=%d)", e.id);
+                    __atomic_store_n(&self->error_id, e.id, __ATOMIC_RELEASE);
+                }
+                catch (...) {
+                    LOG(LOG_ERR, "AsyncCapture: capture thread failed");
+                    __atomic_store_n(&self->error_id, static_cast<int>(ERR_RECORDER_THREAD_FAILED), __ATOMIC_RELEASE);
+                }
+            }
+            self->queue.pop();
+        }
+        return NULL;
+    }
+};
+
+#endif
@@ -41,6 +41,8 @@ public:
 
     const bool enable_file_encryption;
 
+    const bool clear_png;
+
     OutFilenameTransport * png_trans;
     StaticCapture        * psc;
 
@@ -66,6 +68,7 @@ public:
             , capture_drawable(ini.video.capture_wrm||(ini.video.png_limit > 0))
             , capture_png(ini.video.png_limit > 0)
             , enable_file_encryption(ini.globals.enable_file_encryption.get())
+            , clear_png(clear_png)
             , png_trans(NULL)
             , psc(NULL)
             , wrm_trans(NULL)
@@ -153,10 +156,13 @@ public:
         delete this->pnc_bmp_cache;
         delete this->drawable;
 
-        clear_files_flv_meta_png(this->png_path.c_str(), this->basename.c_str());
+        // png made by a replay (redrec) are kept
+        if (this->clear_png) {
+            clear_files_flv_meta_png(this->png_path.c_str(), this->basename.c_str());
+        }
     }
 
-    void request_full_cleaning()
+    virtual void request_full_cleaning()
     {
         if (this->enable_file_encryption){
             this->crypto_wrm_trans->request_full_cleaning();
@@ -166,28 +172,29 @@ public:
         }
     }
 
-    void pause() {
+    virtual void pause() {
+        this->pause(tvtime());
+    }
+
+    void pause(const timeval & now) {
         if (this->capture_png) {
-            struct timeval now = tvtime();
             this->psc->pause_snapshot(now);
         }
     }
 
-    void resume() {
+    virtual void resume() {
+        this->resume(tvtime());
+    }
+
+    void resume(const timeval & now) {
         if (this->capture_wrm){
-            if (this->enable_file_encryption) {
-                this->crypto_wrm_trans->next();
-            }
-            else {
-                this->wrm_trans->next();
-            }
-            struct timeval now = tvtime();
+            // new wrm file starts with a whole screen image, a player can start from it
             this->pnc->recorder.timestamp(now);
-            this->pnc->recorder.send_timestamp_chunk(true);
+            this->pnc->recorder.breakpoint(true, true);
         }
     }
 
-    void update_config(const Inifile & ini) {
+    virtual void update_config(const Inifile & ini) {
         if (this->capture_png) {
             this->psc->update_config(ini);
         }
@@ -196,20 +203,36 @@ public:
         }
     }
 
-    void snapshot( const timeval & now, int x, int y, bool ignore_frame_in_timeval) {
+    virtual void snapshot( const timeval & now, int x, int y, bool ignore_frame_in_timeval) {
+        this->snapshot_images(now, x, y, ignore_frame_in_timeval);
+
         this->capture_event.reset();
+        if (this->capture_png) {
+            this->capture_event.update(this->psc->time_to_wait);
+        }
+        if (this->capture_wrm) {
+            this->capture_event.update(this->pnc->time_to_wait);
+        }
+    }
 
+    // Same as snapshot(), capture_event is left untouched
+    void snapshot_images( const timeval & now, int x, int y, bool ignore_frame_in_timeval) {
         if (this->capture_png) {
             this->psc->snapshot( now, x, y, ignore_frame_in_timeval);
-            this->capture_event.update(this->psc->time_to_wait);
         }
         if (this->capture_wrm) {
             this->pnc->snapshot( now, x, y, ignore_frame_in_timeval);
-            this->capture_event.update(this->pnc->time_to_wait);
         }
     }
 
-    void flush() {
+    // image chunk of a breakpoint read by a player
+    virtual void set_row(size_t rownum, const uint8_t * data) {
+        if (this->capture_drawable) {
+            this->drawable->set_row(rownum, data);
+        }
+    }
+
+    virtual void flush() {
         if (this->capture_png) {
             this->psc->flush();
         }
@@ -278,6 +301,24 @@ public:
         }
     }
 
+    void draw(const RDPMemBlt & cmd, const Rect & clip, const BitmapView & bmp) {
+        if (this->capture_wrm) {
+            this->pnc->draw(cmd, clip, bmp);
+        }
+        else if (this->capture_drawable) {
+            this->drawable->draw(cmd, clip, bmp);
+        }
+    }
+
+    void draw(const RDPMem3Blt & cmd, const Rect & clip, const BitmapView & bmp) {
+        if (this->capture_wrm) {
+            this->pnc->draw(cmd, clip, bmp);
+        }
+        else if (this->capture_drawable) {
+            this->drawable->draw(cmd, clip, bmp);
+        }
+    }
+
     void draw(const RDPOpaqueRect & cmd, const Rect & clip) {
         if (this->capture_wrm) {
             this->pnc->draw(cmd, clip);
@@ -60,30 +60,55 @@ public:
             uint16_t remaining = stream.end - stream.p;
             stream.in_copy_bytes(*pbuffer + total_len, remaining);
             total_len += remaining;
-            switch (this->chunk_type){
-            case PARTIAL_IMAGE_CHUNK:
-            {
-                BStream header(8);
-                this->trans->recv(&header.end, 8);
-                this->chunk_type = header.in_uint16_le();
-                this->chunk_size = header.in_uint32_le();
-                this->chunk_count = header.in_uint16_le();
-                this->stream.init(this->chunk_size - 8);
-                this->trans->recv(&this->stream.end, this->chunk_size - 8);
-            }
-            break;
-            case LAST_IMAGE_CHUNK:
+            if (!this->next_chunk()){
                 LOG(LOG_ERR, "Failed to read embedded image from WRM (transport closed)");
                 throw Error(ERR_TRANSPORT_NO_MORE_DATA);
-            break;
-            default:
-                LOG(LOG_ERR, "Failed to read embedded image from WRM");
-                throw Error(ERR_TRANSPORT_READ_FAILED);
-            break;
             }
         }
     }
 
+    // Gives (as read) data of current chunk not read yet, the next chunk of
+    // image is read when current one is over. Returns 0 after the last one.
+    size_t in_remaining(uint8_t ** data)
+    {
+        while (this->stream.p == this->stream.end){
+            if (!this->next_chunk()){
+                return 0;
+            }
+        }
+        *data = this->stream.p;
+        size_t len = this->stream.end - this->stream.p;
+        this->stream.p = this->stream.end;
+        return len;
+    }
+
+private:
+    bool next_chunk()
+    {
+        switch (this->chunk_type){
+        case PARTIAL_IMAGE_CHUNK:
+        case PARTIAL_TILES_IMAGE_CHUNK:
+        {
+            BStream header(8);
+            this->trans->recv(&header.end, 8);
+            this->chunk_type = header.in_uint16_le();
+            this->chunk_size = header.in_uint32_le();
+            this->chunk_count = header.in_uint16_le();
+            this->stream.init(this->chunk_size - 8);
+            this->trans->recv(&this->stream.end, this->chunk_size - 8);
+        }
+        return true;
+        case LAST_IMAGE_CHUNK:
+        case LAST_TILES_IMAGE_CHUNK:
+            return false;
+        default:
+            LOG(LOG_ERR, "Failed to read embedded image from WRM");
+            throw Error(ERR_TRANSPORT_READ_FAILED);
+        }
+    }
+
+public:
+
     using Transport::send;
     virtual void send(const char * const buffer, size_t len) throw (Error)
     {
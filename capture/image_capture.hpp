@@ -55,6 +55,7 @@ public:
     unsigned scaled_width;
     unsigned scaled_height;
     Drawable & drawable;
+    PngParams png_params;
 
     ImageCapture(Transport & trans, unsigned width, unsigned height, Drawable & drawable)
     : trans(trans)
@@ -79,7 +80,10 @@ public:
         this->scaled_height = zoom_height;
     }
 
-    void update_config(const Inifile & ini){}
+    void update_config(const Inifile & ini)
+    {
+        this->png_params = PngParams(ini.video.png_compression_level, ini.video.png_filter);
+    }
 
     virtual void flush()
     {
@@ -96,7 +100,7 @@ public:
         ::transport_dump_png24(&this->trans, this->drawable.data,
                  this->drawable.width, this->drawable.height,
                  this->drawable.rowsize,
-                 true
+                 true, this->png_params
                 );
     }
 
@@ -109,7 +113,7 @@ public:
                    this->drawable.rowsize);
         ::transport_dump_png24(&this->trans, scaled_data,
                      this->scaled_width, this->scaled_height,
-                     this->scaled_width * 3, true);
+                     this->scaled_width * 3, true, this->png_params);
         free(scaled_data);
     }
 
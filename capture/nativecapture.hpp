@@ -166,6 +166,16 @@ public:
         this->recorder.draw(cmd, clip, bmp);
     }
 
+    virtual void draw(const RDPMemBlt & cmd, const Rect & clip, const BitmapView & bmp)
+    {
+        this->recorder.draw(cmd, clip, bmp);
+    }
+
+    virtual void draw(const RDPMem3Blt & cmd, const Rect & clip, const BitmapView & bmp)
+    {
+        this->recorder.draw(cmd, clip, bmp);
+    }
+
     virtual void draw(const RDPOpaqueRect & cmd, const Rect & clip)
     {
         this->recorder.draw(cmd, clip);
@@ -0,0 +1,303 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2013
+   Author(s): Christophe Grosjean
+
+   Replay of a wrm sequence to png images, wrm files decoded in parallel
+*/
+
+#ifndef _REDEMPTION_CAPTURE_PARALLELREPLAY_HPP_
+#define _REDEMPTION_CAPTURE_PARALLELREPLAY_HPP_
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "inbymetasequencetransport.hpp"
+#include "capture.hpp"
+#include "FileToGraphic.hpp"
+
+REDOC("Every wrm file of a sequence (but the first one) starts with a breakpoint"
+      " whose image chunk is the whole screen (or the tiles changed since previous"
+      " file, see video.full_image_interval). Drawing a file from a whole screen"
+      " does not depend on previous files but for a few states not saved in"
+      " breakpoints (glyph and pointer caches, current pointer, png capture times).")
+
+// Keeps what png captures of a replay would be without drawing anything:
+// same rule as StaticCapture::snapshot() for capture times and file
+// numbers, and the last pointer set.
+class PngSchedule : public RDPGraphicDevice {
+public:
+    timeval  start_static_capture;
+    uint64_t inter_frame_interval_static_capture;
+    uint32_t count;
+
+    bool    pointer_set;
+    Pointer pointer;
+
+    PngSchedule(const timeval & now, const Inifile & ini)
+    : start_static_capture(now)
+    , inter_frame_interval_static_capture(ini.video.png_interval * 100000) // png interval is in 1/10 s
+    , count(0)
+    , pointer_set(false)
+    , pointer(Pointer::POINTER_NULL)
+    {
+    }
+
+    virtual void snapshot(const timeval & now, int mouse_x, int mouse_y, bool ignore_frame_in_timeval)
+    {
+        if (static_cast<unsigned>(difftimeval(now, this->start_static_capture))
+            >= static_cast<unsigned>(this->inter_frame_interval_static_capture)) {
+            this->count++;
+            this->start_static_capture = now;
+        }
+    }
+
+    virtual void server_set_pointer(const Pointer & cursor)
+    {
+        this->pointer = cursor;
+        this->pointer_set = true;
+    }
+
+    virtual void draw(const RDPOpaqueRect  & cmd, const Rect & clip) {}
+    virtual void draw(const RDPScrBlt      & cmd, const Rect & clip) {}
+    virtual void draw(const RDPDestBlt     & cmd, const Rect & clip) {}
+    virtual void draw(const RDPMultiDstBlt & cmd, const Rect & clip) {}
+    virtual void draw(const RDPPatBlt      & cmd, const Rect & clip) {}
+    virtual void draw(const RDPMemBlt      & cmd, const Rect & clip, const Bitmap & bmp) {}
+    virtual void draw(const RDPMem3Blt     & cmd, const Rect & clip, const Bitmap & bmp) {}
+    virtual void draw(const RDPMemBlt      & cmd, const Rect & clip, const BitmapView & bmp) {}
+    virtual void draw(const RDPMem3Blt     & cmd, const Rect & clip, const BitmapView & bmp) {}
+    virtual void draw(const RDPLineTo      & cmd, const Rect & clip) {}
+    virtual void draw(const RDPGlyphIndex  & cmd, const Rect & clip, const GlyphCache * gly_cache) {}
+    virtual void draw(const RDPPolygonSC   & cmd, const Rect & clip) {}
+    virtual void draw(const RDPPolygonCB   & cmd, const Rect & clip) {}
+    virtual void draw(const RDPPolyline    & cmd, const Rect & clip) {}
+    virtual void draw(const RDPEllipseSC   & cmd, const Rect & clip) {}
+    virtual void draw(const RDPEllipseCB   & cmd, const Rect & clip) {}
+
+    virtual void flush() {}
+};
+
+// Replay of a wrm sequence to png files identical to the ones a Capture
+// consumer of a FileToGraphic player would make, with up to jobs worker
+// processes each drawing one wrm file.
+//
+// Main process reads the whole sequence without drawing anything (caches
+// are still decoded, images of breakpoints are skipped) and forks a worker
+// when a file starting with a whole screen image starts. Worker inherits
+// player states, reopens the sequence at its file (by file number, several
+// files may start in the same second), loads the image chunk of the
+// breakpoint in its drawable then plays until the next whole screen image
+// (files starting with tiles images are played by the worker of the
+// previous whole screen).
+class ParallelReplay {
+public:
+    const char * infile_prefix;
+    const char * infile_extension;
+    timeval begin_capture;
+    timeval end_capture;
+
+    const char * outfile_path;
+    const char * outfile_basename;
+    unsigned zoom;
+
+    unsigned jobs;
+    Inifile & ini;
+    uint32_t verbose;
+
+    pid_t    pid;
+    unsigned nb_running;
+    unsigned nb_workers;
+    bool     failed;
+
+    ParallelReplay( const char * infile_prefix, const char * infile_extension
+                  , const timeval & begin_capture, const timeval & end_capture
+                  , const char * outfile_path, const char * outfile_basename, unsigned zoom
+                  , unsigned jobs, Inifile & ini, uint32_t verbose)
+    : infile_prefix(infile_prefix)
+    , infile_extension(infile_extension)
+    , begin_capture(begin_capture)
+    , end_capture(end_capture)
+    , outfile_path(outfile_path)
+    , outfile_basename(outfile_basename)
+    , zoom(zoom)
+    , jobs(jobs ? jobs : 1)
+    , ini(ini)
+    , verbose(verbose)
+    , pid(getpid())
+    , nb_running(0)
+    , nb_workers(0)
+    , failed(false)
+    {
+    }
+
+    // whole screen images only, not tiles images
+    static bool is_full_image_chunk(uint16_t chunk_type)
+    {
+        return chunk_type == LAST_IMAGE_CHUNK || chunk_type == PARTIAL_IMAGE_CHUNK;
+    }
+
+    // returns 0 if all png files were made, -1 otherwise
+    int play()
+    {
+        InByMetaSequenceTransport in_wrm_trans(this->infile_prefix, this->infile_extension);
+        FileToGraphic player(&in_wrm_trans, this->begin_capture, this->end_capture, false, this->verbose);
+        PngSchedule schedule(player.record_now, this->ini);
+        const timeval start_capture = player.record_now;
+
+        // first worker starts where player constructor stopped, nothing was drawn yet
+        in_wrm_trans.chunk_info();
+        this->start_worker(player, schedule, start_capture, in_wrm_trans.chunk_num, player.total_orders_count);
+
+        // images are decoded by workers, without drawing anything they are read
+        // one chunk at a time (PARTIAL_IMAGE_CHUNK... LAST_IMAGE_CHUNK)
+        player.ignore_images = true;
+        player.add_consumer(&schedule);
+        try {
+            uint16_t previous_chunk_type = player.chunk_type;
+            while (player.next_order() && player.play_order()) {
+                if (is_full_image_chunk(player.chunk_type) && !is_full_image_chunk(previous_chunk_type)) {
+                    in_wrm_trans.chunk_info();
+                    this->start_worker(player, schedule, start_capture, in_wrm_trans.chunk_num, 0);
+                }
+                previous_chunk_type = player.chunk_type;
+            }
+        }
+        catch (const Error & e) {
+            LOG(LOG_ERR, "replay failed: error %u", e.id);
+            this->failed = true;
+        }
+
+        while (this->nb_running) {
+            this->wait_worker();
+        }
+
+        // workers keep all images, only the last png_limit ones are kept
+        SQ png_seq;
+        sq_init_outfilename( &png_seq, SQF_PATH_FILE_PID_COUNT_EXTENSION, this->outfile_path
+                           , this->outfile_basename, ".png", this->ini.video.capture_groupid);
+        for (uint32_t i = 0; i + this->ini.video.png_limit < schedule.count; i++) {
+            sq_outfilename_unlink(&png_seq, i);
+        }
+
+        if (this->verbose) {
+            LOG(LOG_INFO, "replay made %u png with %u workers", schedule.count, this->nb_workers);
+        }
+        return this->failed ? -1 : 0;
+    }
+
+private:
+    void wait_worker()
+    {
+        int status = 0;
+        if (waitpid(-1, &status, 0) < 0) {
+            LOG(LOG_ERR, "waiting replay worker failed: %s", strerror(errno));
+            this->failed = true;
+            this->nb_running = 0;
+            return;
+        }
+        if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+            this->failed = true;
+        }
+        this->nb_running--;
+    }
+
+    void start_worker( FileToGraphic & player, const PngSchedule & schedule, const timeval & start_capture
+                     , unsigned chunk_num, uint32_t skip_orders)
+    {
+        if (this->nb_running == this->jobs) {
+            this->wait_worker();
+        }
+        pid_t child = fork();
+        if (child < 0) {
+            LOG(LOG_ERR, "replay worker creation failed: %s", strerror(errno));
+            this->failed = true;
+            return;
+        }
+        if (child > 0) {
+            this->nb_running++;
+            this->nb_workers++;
+            return;
+        }
+
+        int status = 0;
+        try {
+            this->play_file(player, schedule, start_capture, chunk_num, skip_orders);
+        }
+        catch (const Error & e) {
+            LOG(LOG_ERR, "replay worker failed: error %u", e.id);
+            status = 1;
+        }
+        // no exit(), objects of main process are not worker's ones
+        _exit(status);
+    }
+
+    REDOC("chunk_num is the number of the file in sequence (see chunk_info())."
+          "skip_orders is the number of orders the player already read in the file,"
+          " it is 0 when player stands on the image chunk of the breakpoint.")
+    void play_file( FileToGraphic & player, const PngSchedule & schedule, const timeval & start_capture
+                  , unsigned chunk_num, uint32_t skip_orders)
+    {
+        InByMetaSequenceTransport in_wrm_trans(this->infile_prefix, this->infile_extension);
+        in_wrm_trans.skip_to_chunk(chunk_num);
+
+        player.trans = &in_wrm_trans;
+        player.remaining_order_count = 0;
+        player.nbconsumers = 0;
+        player.ignore_frame_in_timeval = false;
+        player.ignore_images = false;
+
+        // older images are removed once all workers are done
+        this->ini.video.png_limit = static_cast<unsigned>(-1);
+        Capture capture( start_capture, player.screen_rect.cx, player.screen_rect.cy
+                       , this->outfile_path, this->outfile_path, this->ini.video.hash_path
+                       , this->outfile_basename, false, false, NULL, this->ini);
+        capture.psc->zoom(this->zoom);
+        capture.psc->start_static_capture = schedule.start_static_capture;
+        capture.png_trans->seqno = schedule.count;
+        capture.png_trans->seq.u.outfilename.count = schedule.count;
+        capture.png_trans->seq.u.outfilename.pid = this->pid;
+        if (schedule.pointer_set) {
+            capture.server_set_pointer(schedule.pointer);
+        }
+
+        // orders already read by main process are read again, they don't
+        // change player states (same meta, same timestamp, same save state)
+        for (uint32_t i = 0; skip_orders ? i < skip_orders : !player.nbconsumers; i++) {
+            if (!player.next_order()) {
+                throw Error(ERR_WRM);
+            }
+            if (!skip_orders && is_full_image_chunk(player.chunk_type)) {
+                player.add_consumer(&capture);
+            }
+            player.interpret_order();
+        }
+        if (skip_orders) {
+            player.add_consumer(&capture);
+        }
+
+        while (player.next_order() && player.play_order()) {
+            if (is_full_image_chunk(player.chunk_type)) {
+                // next file, done by next worker from here
+                break;
+            }
+        }
+    }
+};
+
+#endif
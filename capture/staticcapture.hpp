@@ -104,6 +104,8 @@ public:
     }
 
     void update_config(const Inifile & ini){
+        this->ImageCapture::update_config(ini);
+
         if (ini.video.png_limit < this->conf.png_limit) {
             for(size_t i = this->conf.png_limit ; i > ini.video.png_limit ; i--){
                 if (this->trans.seqno >= i){
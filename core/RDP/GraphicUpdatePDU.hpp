@@ -102,8 +102,11 @@ struct GraphicsUpdatePDU : public RDPSerializer {
     HStream buffer_stream_orders;
     HStream buffer_stream_bitmaps;
 
-    ShareData    * sdata_orders;
-    ShareData    * sdata_bitmaps;
+    // output of bulk compressor, reused by every compressed update
+    HStream compressed_stream;
+
+    ShareData    sdata_orders;
+    ShareData    sdata_bitmaps;
 
     uint16_t     & userid;
     int          & shareid;
@@ -140,8 +143,9 @@ struct GraphicsUpdatePDU : public RDPSerializer {
                        , bitmap_cache_version, use_bitmap_comp, op2, ini)
         , buffer_stream_orders(1024, 65536)
         , buffer_stream_bitmaps(1024, 65536)
-        , sdata_orders(NULL)
-        , sdata_bitmaps(NULL)
+        , compressed_stream(1024, 65565)
+        , sdata_orders(this->buffer_stream_orders)
+        , sdata_bitmaps(this->buffer_stream_bitmaps)
         , userid(userid)
         , shareid(shareid)
         , encryptionLevel(encryptionLevel)
@@ -156,15 +160,8 @@ struct GraphicsUpdatePDU : public RDPSerializer {
         this->init_bitmaps();
     }
 
-    ~GraphicsUpdatePDU() {
-        if (this->sdata_orders) { delete this->sdata_orders; }
-        if (this->sdata_bitmaps) { delete this->sdata_bitmaps; }
-    }
-
     void init_orders() {
         if (this->fastpath_support == false) {
-            if (this->sdata_orders) { delete this->sdata_orders; this->sdata_orders = 0; }
-
             if (this->ini.debug.primary_orders > 3) {
                 LOG( LOG_INFO
                    , "GraphicsUpdatePDU::init::Initializing orders batch mcs_userid=%u shareid=%u"
@@ -173,8 +170,7 @@ struct GraphicsUpdatePDU : public RDPSerializer {
             }
 
             if (!this->compression) {
-                this->sdata_orders = new ShareData(this->stream_orders);
-                this->sdata_orders->emit_begin(PDUTYPE2_UPDATE, this->shareid, RDP::STREAM_MED);
+                this->sdata_orders.emit_begin(PDUTYPE2_UPDATE, this->shareid, RDP::STREAM_MED);
             }
             TODO("this is to kind of header, to be treated like other headers");
             this->stream_orders.out_uint16_le(RDP_UPDATE_ORDERS);
@@ -196,8 +192,6 @@ struct GraphicsUpdatePDU : public RDPSerializer {
 
     void init_bitmaps() {
         if (this->fastpath_support == false) {
-            if (this->sdata_bitmaps) { delete this->sdata_bitmaps; }
-            this->sdata_bitmaps = new ShareData(this->stream_bitmaps);
 
             if (this->ini.debug.primary_orders > 3) {
                 LOG( LOG_INFO
@@ -205,7 +199,7 @@ struct GraphicsUpdatePDU : public RDPSerializer {
                    , this->userid
                    , this->shareid);
             }
-            this->sdata_bitmaps->emit_begin(PDUTYPE2_UPDATE, this->shareid, RDP::STREAM_MED);
+            this->sdata_bitmaps.emit_begin(PDUTYPE2_UPDATE, this->shareid, RDP::STREAM_MED);
             TODO("this is to kind of header, to be treated like other headers");
             this->stream_bitmaps.out_uint16_le(RDP_UPDATE_BITMAP);
             this->offset_bitmap_count = this->stream_bitmaps.get_offset();
@@ -229,7 +223,8 @@ public:
         this->flush_orders();
     }
 
-protected:
+    // Also called by front before bitmap updates: flush() sends pending
+    // bitmaps first, orders drawn before them would be painted over them
     virtual void flush_orders()
     {
         if (this->order_count > 0){
@@ -244,7 +239,7 @@ protected:
                 }
 
                 if (!this->compression) {
-                    this->sdata_orders->emit_end();
+                    this->sdata_orders.emit_end();
 
                     BStream sctrl_header(256);
                     ShareControl_Send(sctrl_header, PDUTYPE_DATAPDU, this->userid + GCC::MCS_USERCHANNEL_BASE, this->stream_orders.size());
@@ -273,7 +268,8 @@ protected:
                 else {
                     this->stream_orders.mark_end();
 
-                    HStream  compressed_buffer_stream_orders(1024, 65565);
+                    HStream & compressed_buffer_stream_orders = this->compressed_stream;
+                    compressed_buffer_stream_orders.reset();
                     uint8_t  compressionFlags;
                     uint16_t datalen;
 
@@ -285,14 +281,14 @@ protected:
                     SubStream sdata_s( compressed_buffer_stream_orders, 0
                                      , share_data_header_size);
 
-                    this->sdata_orders = new ShareData(sdata_s);
-                    this->sdata_orders->emit_begin( PDUTYPE2_UPDATE, this->shareid
-                                                  , RDP::STREAM_MED
-                                                  , this->buffer_stream_orders.size()
-                                                  , compressionFlags
-                                                  , datalen
-                                                  );
-                    this->sdata_orders->emit_end();
+                    ShareData sdata(sdata_s);
+                    sdata.emit_begin( PDUTYPE2_UPDATE, this->shareid
+                                    , RDP::STREAM_MED
+                                    , this->buffer_stream_orders.size()
+                                    , compressionFlags
+                                    , datalen
+                                    );
+                    sdata.emit_end();
 
                     compressed_buffer_stream_orders.p += share_data_header_size;
 
@@ -367,7 +363,8 @@ protected:
                     this->trans->send(fastpath_header, this->buffer_stream_orders);
                 }
                 else {
-                    HStream  compressed_buffer_stream_orders(1024, 65565);
+                    HStream & compressed_buffer_stream_orders = this->compressed_stream;
+                    compressed_buffer_stream_orders.reset();
                     uint8_t  compressionFlags;
                     uint16_t datalen;
 
@@ -424,6 +421,7 @@ protected:
         }
     }
 
+protected:
     virtual void flush_bitmaps() {
         if (this->bitmap_count > 0) {
             if (this->ini.debug.primary_orders > 3){
@@ -438,7 +436,7 @@ protected:
                     LOG(LOG_INFO, "GraphicsUpdatePDU::flush_bitmaps:slow-path");
                 }
 
-                this->sdata_bitmaps->emit_end();
+                this->sdata_bitmaps.emit_end();
 
                 BStream sctrl_header(256);
                 ShareControl_Send( sctrl_header
@@ -507,7 +505,8 @@ protected:
                     this->trans->send(fastpath_header, this->buffer_stream_bitmaps);
                 }
                 else {
-                    HStream  compressed_buffer_stream_bitmaps(1024, 65565);
+                    HStream & compressed_buffer_stream_bitmaps = this->compressed_stream;
+                    compressed_buffer_stream_bitmaps.reset();
                     uint16_t datalen;
                     uint8_t  compressionFlags;
 
@@ -66,6 +66,7 @@ public:
 
     virtual void set_row(size_t rownum, const uint8_t * data)
     {
+        this->drawable.mark_dirty(Rect(0, rownum, this->drawable.width, 1));
         memcpy(this->drawable.data + this->drawable.rowsize * rownum, data, this->drawable.rowsize);
     }
 
@@ -157,6 +158,11 @@ public:
     }
 
     void draw(const RDPMemBlt & cmd, const Rect & clip, const Bitmap & bmp)
+    {
+        this->RDPDrawable::draw(cmd, clip, bmp.view());
+    }
+
+    virtual void draw(const RDPMemBlt & cmd, const Rect & clip, const BitmapView & bmp)
     {
         const Rect& rect = clip.intersect(cmd.rect);
         if (rect.isempty()){
@@ -200,6 +206,10 @@ public:
     }
 
     void draw(const RDPMem3Blt & cmd, const Rect & clip, const Bitmap & bmp) {
+        this->RDPDrawable::draw(cmd, clip, bmp.view());
+    }
+
+    virtual void draw(const RDPMem3Blt & cmd, const Rect & clip, const BitmapView & bmp) {
         const Rect& rect = clip.intersect(cmd.rect);
         if (rect.isempty()){
             return ;
@@ -412,7 +422,7 @@ public:
         }
 
         this->drawable.draw_bitmap(
-            Rect(cmd.glyph_x, cmd.glyph_y - cmd.bk.cy, cmd.bk.cx, cmd.bk.cy), glyph_fragments,
+            Rect(cmd.glyph_x, cmd.glyph_y - cmd.bk.cy, cmd.bk.cx, cmd.bk.cy), glyph_fragments.view(),
             false);
     }
 
@@ -420,6 +430,7 @@ public:
     virtual void draw(const RDPColCache & cmd) {}
 
     virtual void set_row(uint16_t r, uint8_t * row){
+        this->drawable.mark_dirty(Rect(0, r, this->drawable.width, 1));
         memcpy(this->drawable.data + this->drawable.rowsize * r, row, this->drawable.rowsize);
     }
     virtual void flush() {}
@@ -551,7 +562,7 @@ public:
 
         const Rect & trect = rectBmp.intersect(this->drawable.width, this->drawable.height);
 
-        this->drawable.draw_bitmap(trect, bmp, false);
+        this->drawable.draw_bitmap(trect, bmp.view(), false);
     }
 
     virtual void send_pointer(int cache_idx, const Pointer & cursor)
@@ -571,11 +582,11 @@ public:
             Pointer.x, Pointer.y);
     }
 
-    virtual void dump_png24(Transport * trans, bool bgr) {
+    virtual void dump_png24(Transport * trans, bool bgr, const PngParams & params = PngParams()) {
         ::transport_dump_png24(trans, this->drawable.data,
             this->drawable.width, this->drawable.height,
             this->drawable.rowsize,
-            bgr);
+            bgr, params);
     }
 };
 
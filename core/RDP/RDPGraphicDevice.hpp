@@ -62,6 +62,18 @@ struct RDPGraphicDevice {
     virtual void draw(const RDPPatBlt      & cmd, const Rect & clip) = 0;
     virtual void draw(const RDPMemBlt      & cmd, const Rect & clip, const Bitmap & bmp) = 0;
     virtual void draw(const RDPMem3Blt     & cmd, const Rect & clip, const Bitmap & bmp) = 0;
+
+    // Drawing a part of a larger bitmap. Devices able to use the pixels in
+    // place should override these, default is to draw a copy.
+    virtual void draw(const RDPMemBlt      & cmd, const Rect & clip, const BitmapView & bmp) {
+        const Bitmap copy(bmp.original_bpp, bmp);
+        this->draw(cmd, clip, copy);
+    }
+    virtual void draw(const RDPMem3Blt     & cmd, const Rect & clip, const BitmapView & bmp) {
+        const Bitmap copy(bmp.original_bpp, bmp);
+        this->draw(cmd, clip, copy);
+    }
+
     virtual void draw(const RDPLineTo      & cmd, const Rect & clip) = 0;
     virtual void draw(const RDPGlyphIndex  & cmd, const Rect & clip, const GlyphCache * gly_cache) = 0;
     virtual void draw(const RDPPolygonSC   & cmd, const Rect & clip) = 0;
@@ -107,6 +107,8 @@ enum {
     LAST_IMAGE_CHUNK    = 0x1000,   // 4096
     PARTIAL_IMAGE_CHUNK = 0x1001,   // 4097
     SAVE_STATE          = 0x1002,   // 4098
+    LAST_TILES_IMAGE_CHUNK    = 0x1003,   // 4099
+    PARTIAL_TILES_IMAGE_CHUNK = 0x1004,   // 4100
 };
 
 struct RDPSerializer : public RDPGraphicDevice
@@ -315,6 +317,11 @@ public:
     }
 
     virtual void draw(const RDPMemBlt & cmd, const Rect & clip, const Bitmap & oldbmp)
+    {
+        this->RDPSerializer::draw(cmd, clip, oldbmp.view());
+    }
+
+    virtual void draw(const RDPMemBlt & cmd, const Rect & clip, const BitmapView & oldbmp)
     {
         uint32_t res = this->bmp_cache.cache_bitmap(oldbmp);
         uint8_t cache_id = (res >> 16) & 0x3;
@@ -339,6 +346,10 @@ public:
     }
 
     virtual void draw(const RDPMem3Blt & cmd, const Rect & clip, const Bitmap & oldbmp) {
+        this->RDPSerializer::draw(cmd, clip, oldbmp.view());
+    }
+
+    virtual void draw(const RDPMem3Blt & cmd, const Rect & clip, const BitmapView & oldbmp) {
         uint32_t res = this->bmp_cache.cache_bitmap(oldbmp);
         uint8_t cache_id = (res >> 16) & 0x3;
         uint16_t cache_idx = res;
@@ -472,13 +483,18 @@ public:
         this->bitmap_count++;
     }
 
-    virtual void draw( const RDPBitmapData & bitmap_data, const uint8_t * data
-                     , size_t size, const Bitmap & bmp) {
+    // bitmap update payload copied as it is, pixels are not needed
+    void send_bitmap_data(const RDPBitmapData & bitmap_data, const uint8_t * data, size_t size) {
         this->reserve_bitmap(bitmap_data.struct_size() + size);
 
         bitmap_data.emit(this->stream_bitmaps);
         this->stream_bitmaps.out_copy_bytes(data, size);
     }
+
+    virtual void draw( const RDPBitmapData & bitmap_data, const uint8_t * data
+                     , size_t size, const Bitmap & bmp) {
+        this->send_bitmap_data(bitmap_data, data, size);
+    }
 };
 
 #endif
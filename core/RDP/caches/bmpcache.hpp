@@ -27,9 +27,19 @@ enum {
 };
 
 #include "bitmap.hpp"
+#include "RDP/caches/persistentbmpstore.hpp"
 
 struct BmpCache {
 
+    enum {
+        MAXIMUM_NUMBER_OF_CACHE_ENTRIES = 8192,
+        // Digest index is twice as large as a cache to keep probe sequences short
+        INDEX_SIZE = 16384,
+        INDEX_MASK = INDEX_SIZE - 1,
+        // No cidx can have this value (and also used as end of LRU list marker)
+        FREE_ENTRY = 0xFFFF
+    };
+
     const uint8_t bpp;
     uint16_t small_entries;
     uint16_t small_size;
@@ -38,23 +48,52 @@ struct BmpCache {
     uint16_t big_entries;
     uint16_t big_size;
 
-    const Bitmap * cache[3][8192];
-    uint32_t stamps[3][8192];
-    //uint32_t crc[3][8192];
-    uint8_t sha1[3][8192][20];
+    const Bitmap * cache[3][MAXIMUM_NUMBER_OF_CACHE_ENTRIES];
+    uint32_t stamps[3][MAXIMUM_NUMBER_OF_CACHE_ENTRIES];
+    //uint32_t crc[3][MAXIMUM_NUMBER_OF_CACHE_ENTRIES];
+    uint8_t digest[3][MAXIMUM_NUMBER_OF_CACHE_ENTRIES][20];
     uint32_t stamp;
+
+    // How bitmap content is identified
+    const BitmapFingerprint fingerprint;
+    // When digests match, also compare bitmap data before reporting a hit
+    const bool verify_content;
+
+    // Optional proxy wide store of compressed bitmaps (not owned)
+    PersistentBmpStore * persistent_store;
+
+    // Open addressing (linear probing) table from bitmap digest to cidx,
+    // only contains used cache entries.
+    uint16_t index[3][INDEX_SIZE];
+
+    // Cache entries ordered by stamp, least recently stamped at head.
+    // Unused entries are kept at head in cidx order, hence they are evicted first.
+    uint16_t lru_prev[3][MAXIMUM_NUMBER_OF_CACHE_ENTRIES];
+    uint16_t lru_next[3][MAXIMUM_NUMBER_OF_CACHE_ENTRIES];
+    uint16_t lru_head[3];
+    uint16_t lru_tail[3];
+
+    // Bitmaps are converted here before lookup, so that cache hits don't
+    // allocate anything (cell sizes are 16 bits values).
+    uint8_t scratch[65536];
+
     public:
         BmpCache(const uint8_t bpp,
                  uint16_t small_entries = 8192, uint16_t small_size = 768,
                  uint16_t medium_entries = 8192, uint16_t medium_size = 3072,
-                 uint16_t big_entries = 8192, uint16_t big_size = 12288)
+                 uint16_t big_entries = 8192, uint16_t big_size = 12288,
+                 BitmapFingerprint fingerprint = BITMAP_FINGERPRINT_FAST,
+                 bool verify_content = false)
             : bpp(bpp)
-            , small_entries(small_entries)
+            , small_entries(std::min<uint16_t>(small_entries, MAXIMUM_NUMBER_OF_CACHE_ENTRIES))
             , small_size(small_size)
-            , medium_entries(medium_entries)
+            , medium_entries(std::min<uint16_t>(medium_entries, MAXIMUM_NUMBER_OF_CACHE_ENTRIES))
             , medium_size(medium_size)
-            , big_entries(big_entries)
+            , big_entries(std::min<uint16_t>(big_entries, MAXIMUM_NUMBER_OF_CACHE_ENTRIES))
             , big_size(big_size)
+            , fingerprint(fingerprint)
+            , verify_content(verify_content)
+            , persistent_store(NULL)
         {
             this->reset_values();
         }
@@ -65,7 +104,7 @@ struct BmpCache {
     private:
         void destroy_cache(){
             for (uint8_t cid = 0; cid < 3; cid++){
-                for (uint16_t cidx = 0 ; cidx < 8192; cidx++){
+                for (uint16_t cidx = 0 ; cidx < MAXIMUM_NUMBER_OF_CACHE_ENTRIES; cidx++){
                     delete this->cache[cid][cidx];
                 }
             }
@@ -75,13 +114,120 @@ struct BmpCache {
         {
             this->stamp = 0;
             for (size_t cid = 0; cid < 3 ; cid++){
-                for (size_t cidx = 0; cidx < 8192 ; cidx++){
+                for (size_t cidx = 0; cidx < MAXIMUM_NUMBER_OF_CACHE_ENTRIES ; cidx++){
                     this->cache[cid][cidx] = NULL;
                     this->stamps[cid][cidx] = 0;
                     //this->crc[cid][cidx] = 0;
-                    bzero(this->sha1[cid][cidx], 20);
+                    bzero(this->digest[cid][cidx], 20);
+                }
+                for (size_t i = 0; i < INDEX_SIZE ; i++){
+                    this->index[cid][i] = FREE_ENTRY;
+                }
+
+                const uint16_t entries = this->entries(cid);
+                this->lru_head[cid] = entries ? 0 : FREE_ENTRY;
+                this->lru_tail[cid] = entries ? entries - 1 : FREE_ENTRY;
+                for (uint16_t cidx = 0; cidx < entries ; cidx++){
+                    this->lru_prev[cid][cidx] = cidx ? cidx - 1 : FREE_ENTRY;
+                    this->lru_next[cid][cidx] = (cidx + 1 < entries) ? cidx + 1 : FREE_ENTRY;
+                }
+            }
+        }
+
+        uint16_t entries(uint8_t id) const {
+            return (id == 0) ? this->small_entries
+                 : (id == 1) ? this->medium_entries
+                 : this->big_entries;
+        }
+
+        static uint16_t index_home(const uint8_t (&sig)[20]) {
+            return (sig[0] | (sig[1] << 8)) & INDEX_MASK;
+        }
+
+        void index_insert(uint8_t id, uint16_t cidx) {
+            uint16_t i = index_home(this->digest[id][cidx]);
+            while (this->index[id][i] != FREE_ENTRY){
+                i = (i + 1) & INDEX_MASK;
+            }
+            this->index[id][i] = cidx;
+        }
+
+        void index_remove(uint8_t id, uint16_t cidx) {
+            uint16_t i = index_home(this->digest[id][cidx]);
+            while (this->index[id][i] != cidx){
+                if (this->index[id][i] == FREE_ENTRY){
+                    return;
+                }
+                i = (i + 1) & INDEX_MASK;
+            }
+            // backward shift deletion: move up following entries of the probe
+            // sequence that would otherwise become unreachable
+            for (uint16_t j = (i + 1) & INDEX_MASK
+                ; this->index[id][j] != FREE_ENTRY
+                ; j = (j + 1) & INDEX_MASK){
+                const uint16_t home = index_home(this->digest[id][this->index[id][j]]);
+                if (((j - home) & INDEX_MASK) >= ((j - i) & INDEX_MASK)){
+                    this->index[id][i] = this->index[id][j];
+                    i = j;
+                }
+            }
+            this->index[id][i] = FREE_ENTRY;
+        }
+
+        // returns the lowest matching cidx, or FREE_ENTRY if bitmap is not in cache
+        uint16_t index_find(uint8_t id, const uint8_t (&sig)[20], uint16_t cx, uint16_t cy, const uint8_t * data, size_t size) const {
+            const uint16_t entries = this->entries(id);
+            uint16_t found = FREE_ENTRY;
+            for (uint16_t i = index_home(sig)
+                ; this->index[id][i] != FREE_ENTRY
+                ; i = (i + 1) & INDEX_MASK){
+                const uint16_t cidx = this->index[id][i];
+                if (cidx < found
+                && cidx < entries
+                && 0 == memcmp(sig, this->digest[id][cidx], sizeof(sig))
+                && this->cache[id][cidx]->cx == cx
+                && this->cache[id][cidx]->cy == cy
+                && (!this->verify_content
+                   || (this->cache[id][cidx]->bmp_size == size
+                      && 0 == memcmp(this->cache[id][cidx]->data(), data, size)))){
+                    found = cidx;
                 }
             }
+            return found;
+        }
+
+        // move cidx at tail of LRU list (most recently stamped)
+        void lru_touch(uint8_t id, uint16_t cidx) {
+            if (cidx >= this->entries(id) || this->lru_tail[id] == cidx){
+                return;
+            }
+            const uint16_t prev = this->lru_prev[id][cidx];
+            const uint16_t next = this->lru_next[id][cidx];
+            if (prev == FREE_ENTRY){
+                this->lru_head[id] = next;
+            }
+            else {
+                this->lru_next[id][prev] = next;
+            }
+            this->lru_prev[id][next] = prev;
+
+            this->lru_prev[id][cidx] = this->lru_tail[id];
+            this->lru_next[id][cidx] = FREE_ENTRY;
+            this->lru_next[id][this->lru_tail[id]] = cidx;
+            this->lru_tail[id] = cidx;
+        }
+
+        void set_entry(uint8_t id, uint16_t idx, const Bitmap * const bmp, const uint8_t (&sig)[20]) {
+            if (this->cache[id][idx]){
+                this->index_remove(id, idx);
+                delete this->cache[id][idx];
+            }
+            this->cache[id][idx] = bmp;
+            this->stamps[id][idx] = ++stamp;
+            //this->crc[id][idx] = bmp_crc;
+            memcpy(this->digest[id][idx], sig, 20);
+            this->index_insert(id, idx);
+            this->lru_touch(id, idx);
         }
 
     public:
@@ -92,14 +238,20 @@ struct BmpCache {
         }
 
         void put(uint8_t id, uint16_t idx, const Bitmap * const bmp){
-            delete this->cache[id][idx];
-            this->cache[id][idx] = bmp;
-            this->stamps[id][idx] = ++stamp;
-            bmp->compute_sha1(this->sha1[id][idx]);
+            uint8_t bmp_digest[20];
+            bmp->compute_fingerprint(bmp_digest, this->fingerprint);
+            this->set_entry(id, idx, bmp, bmp_digest);
+        }
+
+        // Compressed form of bitmaps added to cache will be looked for in store
+        // (or computed and saved to store).
+        void set_persistent_store(PersistentBmpStore * store){
+            this->persistent_store = (store && store->is_open()) ? store : NULL;
         }
 
         void restamp(uint8_t id, uint16_t idx){
             this->stamps[id][idx] = ++stamp;
+            this->lru_touch(id, idx);
         }
 
         const Bitmap * get(uint8_t id, uint16_t idx){
@@ -113,26 +265,23 @@ struct BmpCache {
 
         TODO("palette to use for conversion when we are in 8 bits mode should be passed from memblt.cache_id, not stored in bitmap");
         uint32_t cache_bitmap(const Bitmap & oldbmp){
-            const Bitmap * bmp = new Bitmap(this->bpp, oldbmp);
-
-            uint8_t bmp_sha1[20];
-            bmp->compute_sha1(bmp_sha1);
+            return this->cache_bitmap(oldbmp.view());
+        }
 
-            uint16_t oldest_cidx = 0;
-            unsigned oldstamp = this->stamps[0][0];
+        // Pixels of view are only copied (converted to cache bpp) if they
+        // are not already in cache.
+        uint32_t cache_bitmap(const BitmapView & view){
+            const uint16_t cx = align4(view.cx);
+            const uint16_t cy = view.cy;
 
-            uint16_t entries = 0;
             uint8_t id = 0;
-            uint32_t bmp_size = bmp->bmp_size;
+            uint32_t bmp_size = view.aligned_line_size(this->bpp) * cy;
 
             if (bmp_size <= this->small_size) {
-                entries = this->small_entries;
                 id = 0;
             } else if (bmp_size <= this->medium_size) {
-                entries = this->medium_entries;
                 id = 1;
             } else if (bmp_size <= this->big_size) {
-                entries = this->big_entries;
                 id = 2;
             }
             else {
@@ -142,25 +291,29 @@ struct BmpCache {
                 throw Error(ERR_BITMAP_CACHE_TOO_BIG);
             }
 
-            for (uint16_t cidx = 0 ; cidx < entries; cidx++){
-                if (/*bmp_crc == this->crc[id][cidx]
-                && */0 == memcmp(bmp_sha1, this->sha1[id][cidx], sizeof(bmp_sha1))
-                && this->cache[id][cidx]->cx == bmp->cx
-                && this->cache[id][cidx]->cy == bmp->cy){
-                    delete bmp;
-                    return (BITMAP_FOUND_IN_CACHE << 24)|(id<<16)|cidx;
-                }
-                if (this->stamps[id][cidx] < oldstamp){
-                    oldest_cidx = cidx;
-                    oldstamp = this->stamps[id][cidx];
-                }
+            Bitmap::copy_view(view, this->bpp, this->scratch);
+
+            uint8_t bmp_digest[20];
+            Bitmap::compute_fingerprint(this->scratch, cx, cy, this->bpp, bmp_digest, this->fingerprint);
+
+            const uint16_t cidx = this->index_find(id, bmp_digest, cx, cy, this->scratch, bmp_size);
+            if (cidx != FREE_ENTRY){
+                return (BITMAP_FOUND_IN_CACHE << 24)|(id<<16)|cidx;
+            }
+
+            const Bitmap * bmp = new Bitmap(this->bpp, view.original_palette, cx, cy, this->scratch, bmp_size);
+
+            if (this->persistent_store
+            && !this->persistent_store->load(bmp_digest, *bmp, this->fingerprint)){
+                this->persistent_store->save(bmp_digest, *bmp, this->fingerprint);
             }
-            // find oldest stamp (or 0) and replace bitmap
-            delete this->cache[id][oldest_cidx];
-            this->cache[id][oldest_cidx] = bmp;
-            this->stamps[id][oldest_cidx] = ++stamp;
-            //this->crc[id][oldest_cidx] = bmp_crc;
-            memcpy(this->sha1[id][oldest_cidx], bmp_sha1, 20);
+
+            // replace least recently stamped (or unused) entry, or entry 0 if
+            // it is not older than entry 0 of the small bitmap cache, as the
+            // former stamp scan did (recorded traces depend on cache indexes)
+            const uint16_t head = this->lru_head[id];
+            const uint16_t oldest_cidx = ((head != FREE_ENTRY) && (this->stamps[id][head] < this->stamps[0][0])) ? head : 0;
+            this->set_entry(id, oldest_cidx, bmp, bmp_digest);
             return (BITMAP_ADDED_TO_CACHE << 24)|(id<<16)|oldest_cidx;
         }
 };
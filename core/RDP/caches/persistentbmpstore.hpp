@@ -0,0 +1,388 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2013
+   Author(s): Christophe Grosjean
+
+   Proxy wide store of compressed bitmaps, shared by session processes
+   through a memory mapped file.
+*/
+
+#ifndef _REDEMPTION_CORE_RDP_CACHES_PERSISTENTBMPSTORE_HPP_
+#define _REDEMPTION_CORE_RDP_CACHES_PERSISTENTBMPSTORE_HPP_
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "log.hpp"
+#include "bitmap.hpp"
+#include "stream.hpp"
+
+// The store is a set associative table of fixed size slots. Each set holds
+// WAYS slots, the victim in a full set is chosen from slot stamps using the
+// configured eviction policy.
+//
+// Writers serialize through flock() on the store file. Readers do not lock,
+// each slot carries a sequence number (odd while being written) and a read is
+// discarded if the sequence changed while data was copied.
+//
+// Entries are shared with sessions of other users, they are identified by
+// the SHA1 of bitmap content (whatever fingerprint the bitmap cache uses)
+// followed by bitmap dimensions and bits per pixel.
+//
+// The store file lives in a directory only accessible by proxy user. A store
+// file of another geometry or version is never resized in place (other
+// processes may have it mapped), a new file is created and renamed over it.
+struct PersistentBmpStore {
+    enum EvictionPolicy {
+        EVICTION_LRU,   // stamp is updated on every hit
+        EVICTION_FIFO   // stamp is only set when slot is written
+    };
+
+    enum {
+        MAGIC = 0x53504d42, // "BMPS"
+        STORE_VERSION = 2,
+        WAYS = 4,
+        SLOT_SIZE = 8192,
+        KEY_SIZE = 28
+    };
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t nb_sets;
+        uint32_t slot_size;
+        uint32_t clock;
+        uint32_t pad;
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t stores;
+        uint64_t evictions;
+    };
+
+    struct Slot {
+        uint32_t seq;
+        uint32_t stamp;
+        uint8_t  key[KEY_SIZE];
+        uint32_t size;   // 0 if slot is unused
+        uint8_t  data[SLOT_SIZE - 40];
+    };
+
+    EvictionPolicy policy;
+    int fd;
+    uint8_t * map;
+    size_t map_size;
+    Header * header;
+    Slot * slots;
+    BStream compress_buffer;
+
+    // session local counters (header counters are proxy wide)
+    uint64_t session_hits;
+    uint64_t session_misses;
+
+    PersistentBmpStore(const char * directory, unsigned size_in_megabytes, EvictionPolicy policy)
+        : policy(policy)
+        , fd(-1)
+        , map(NULL)
+        , map_size(0)
+        , header(NULL)
+        , slots(NULL)
+        , compress_buffer(SLOT_SIZE * 4)
+        , session_hits(0)
+        , session_misses(0)
+    {
+        uint32_t nb_sets = (static_cast<uint64_t>(size_in_megabytes) * 1024 * 1024) / (SLOT_SIZE * WAYS);
+        if (nb_sets == 0){
+            LOG(LOG_WARNING, "Persistent bitmap store disabled: size too small (%u MB)", size_in_megabytes);
+            return;
+        }
+
+        if ((::mkdir(directory, S_IRWXU) < 0) && (errno != EEXIST)){
+            LOG(LOG_WARNING, "Persistent bitmap store disabled: can't create %s (%s)", directory, strerror(errno));
+            return;
+        }
+        const int dir_fd = ::open(directory, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        struct stat st;
+        if ((dir_fd < 0) || (::fstat(dir_fd, &st) < 0)
+        || (st.st_uid != ::geteuid()) || (st.st_mode & (S_IRWXG | S_IRWXO))){
+            LOG(LOG_WARNING, "Persistent bitmap store disabled: %s is not a private directory of proxy user",
+                directory);
+            if (dir_fd >= 0){
+                ::close(dir_fd);
+            }
+            return;
+        }
+
+        this->fd = ::openat(dir_fd, "rdpproxy_bitmaps.store", O_RDWR | O_NOFOLLOW | O_CLOEXEC);
+        if ((this->fd < 0) || !this->map_store(nb_sets)){
+            this->close();
+            this->create_store(dir_fd, nb_sets);
+        }
+        ::close(dir_fd);
+    }
+
+    ~PersistentBmpStore()
+    {
+        this->close();
+    }
+
+private:
+    size_t file_size(uint32_t nb_sets) const
+    {
+        return sizeof(Header) + static_cast<size_t>(nb_sets) * WAYS * SLOT_SIZE;
+    }
+
+    // Maps store file if it has expected geometry and version
+    bool map_store(uint32_t nb_sets)
+    {
+        struct stat st;
+        if ((::fstat(this->fd, &st) < 0) || !S_ISREG(st.st_mode) || (st.st_uid != ::geteuid())
+        || (static_cast<size_t>(st.st_size) != this->file_size(nb_sets))){
+            return false;
+        }
+
+        void * p = ::mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+        if (p == MAP_FAILED){
+            return false;
+        }
+        this->map = static_cast<uint8_t*>(p);
+        this->map_size = st.st_size;
+        this->header = reinterpret_cast<Header*>(this->map);
+        this->slots = reinterpret_cast<Slot*>(this->map + sizeof(Header));
+
+        // header is written before file is renamed to its final name
+        if (this->header->magic != MAGIC
+        || this->header->version != STORE_VERSION
+        || this->header->nb_sets != nb_sets
+        || this->header->slot_size != SLOT_SIZE){
+            this->close();
+            return false;
+        }
+        return true;
+    }
+
+    // New (empty) store file, sized and initialized while no other process
+    // can see it, then renamed over former store file if any.
+    void create_store(int dir_fd, uint32_t nb_sets)
+    {
+        char tmpname[64];
+        snprintf(tmpname, sizeof(tmpname), "rdpproxy_bitmaps.store.%d", ::getpid());
+        ::unlinkat(dir_fd, tmpname, 0);
+
+        this->fd = ::openat(dir_fd, tmpname, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, S_IRUSR | S_IWUSR);
+        if (this->fd < 0){
+            LOG(LOG_WARNING, "Persistent bitmap store disabled: can't create store file (%s)", strerror(errno));
+            return;
+        }
+
+        ::flock(this->fd, LOCK_EX);
+        if (::ftruncate(this->fd, this->file_size(nb_sets)) < 0){
+            LOG(LOG_WARNING, "Persistent bitmap store disabled: can't resize store file (%s)", strerror(errno));
+            ::unlinkat(dir_fd, tmpname, 0);
+            this->close();
+            return;
+        }
+
+        void * p = ::mmap(NULL, this->file_size(nb_sets), PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+        if (p == MAP_FAILED){
+            LOG(LOG_WARNING, "Persistent bitmap store disabled: can't map store file (%s)", strerror(errno));
+            ::unlinkat(dir_fd, tmpname, 0);
+            this->close();
+            return;
+        }
+        this->map = static_cast<uint8_t*>(p);
+        this->map_size = this->file_size(nb_sets);
+        this->header = reinterpret_cast<Header*>(this->map);
+        this->slots = reinterpret_cast<Slot*>(this->map + sizeof(Header));
+
+        // new file is zero filled: all slots are unused
+        this->header->magic = MAGIC;
+        this->header->version = STORE_VERSION;
+        this->header->nb_sets = nb_sets;
+        this->header->slot_size = SLOT_SIZE;
+
+        if (::renameat(dir_fd, tmpname, dir_fd, "rdpproxy_bitmaps.store") < 0){
+            LOG(LOG_WARNING, "Persistent bitmap store disabled: can't rename store file (%s)", strerror(errno));
+            ::unlinkat(dir_fd, tmpname, 0);
+            this->close();
+            return;
+        }
+        ::flock(this->fd, LOCK_UN);
+    }
+
+    void close()
+    {
+        if (this->map){
+            ::munmap(this->map, this->map_size);
+            this->map = NULL;
+            this->header = NULL;
+            this->slots = NULL;
+        }
+        if (this->fd >= 0){
+            ::close(this->fd);
+            this->fd = -1;
+        }
+    }
+
+    // Fast fingerprints can be forged by a session to pollute bitmaps seen
+    // by other sessions, store keys always use SHA1 of bitmap content.
+    static void make_key(uint8_t (&key)[KEY_SIZE], const uint8_t (&digest)[20], const Bitmap & bmp, BitmapFingerprint mode)
+    {
+        if (mode == BITMAP_FINGERPRINT_SHA1){
+            memcpy(key, digest, 20);
+        }
+        else {
+            uint8_t sha1[20];
+            bmp.compute_fingerprint(sha1, BITMAP_FINGERPRINT_SHA1);
+            memcpy(key, sha1, 20);
+        }
+        key[20] = bmp.cx;
+        key[21] = bmp.cx >> 8;
+        key[22] = bmp.cy;
+        key[23] = bmp.cy >> 8;
+        key[24] = bmp.original_bpp;
+        key[25] = 0;
+        key[26] = 0;
+        key[27] = 0;
+    }
+
+    Slot * set_of(const uint8_t (&key)[KEY_SIZE]) const
+    {
+        uint32_t h = key[2] | (key[3] << 8) | (key[4] << 16) | (static_cast<uint32_t>(key[5]) << 24);
+        return this->slots + static_cast<size_t>(h % this->header->nb_sets) * WAYS;
+    }
+
+    uint32_t next_stamp()
+    {
+        return __sync_add_and_fetch(&this->header->clock, 1);
+    }
+
+public:
+    bool is_open() const
+    {
+        return this->map != NULL;
+    }
+
+    // If a compressed form of bitmap is known, memoize it in bitmap.
+    bool load(const uint8_t (&digest)[20], const Bitmap & bmp, BitmapFingerprint mode)
+    {
+        uint8_t key[KEY_SIZE];
+        make_key(key, digest, bmp, mode);
+
+        Slot * set = this->set_of(key);
+        for (size_t way = 0; way < WAYS; way++){
+            Slot & slot = set[way];
+            uint32_t seq = slot.seq;
+            __sync_synchronize();
+            if ((seq & 1) || slot.size == 0 || slot.size > sizeof(slot.data)
+            || 0 != memcmp(slot.key, key, KEY_SIZE)){
+                continue;
+            }
+            uint32_t size = slot.size;
+            this->compress_buffer.reset();
+            memcpy(this->compress_buffer.get_data(), slot.data, size);
+            __sync_synchronize();
+            if (slot.seq != seq){
+                // slot was rewritten by another session while we were reading it
+                continue;
+            }
+            if (this->policy == EVICTION_LRU){
+                // readers don't take the lock, stamp is only ever stored whole
+                __atomic_store_n(&slot.stamp, this->next_stamp(), __ATOMIC_RELAXED);
+            }
+            bmp.set_compressed_data(this->compress_buffer.get_data(), size);
+            __sync_add_and_fetch(&this->header->hits, 1);
+            this->session_hits++;
+            return true;
+        }
+        __sync_add_and_fetch(&this->header->misses, 1);
+        this->session_misses++;
+        return false;
+    }
+
+    // Compress bitmap (memoized in bitmap) and share the result with other sessions.
+    void save(const uint8_t (&digest)[20], const Bitmap & bmp, BitmapFingerprint mode)
+    {
+        this->compress_buffer.reset();
+        bmp.compress(this->compress_buffer);
+        size_t size = this->compress_buffer.get_offset();
+        if (size == 0 || size > sizeof(this->slots[0].data)){
+            return;
+        }
+
+        uint8_t key[KEY_SIZE];
+        make_key(key, digest, bmp, mode);
+
+        ::flock(this->fd, LOCK_EX);
+        Slot * set = this->set_of(key);
+        Slot * victim = &set[0];
+        for (size_t way = 0; way < WAYS; way++){
+            Slot & slot = set[way];
+            if (slot.size != 0 && 0 == memcmp(slot.key, key, KEY_SIZE)){
+                // already stored by another session
+                ::flock(this->fd, LOCK_UN);
+                return;
+            }
+            if (slot.size == 0){
+                if (victim->size != 0){
+                    victim = &slot;
+                }
+            }
+            else if (victim->size != 0
+                 && __atomic_load_n(&slot.stamp, __ATOMIC_RELAXED) < __atomic_load_n(&victim->stamp, __ATOMIC_RELAXED)){
+                victim = &slot;
+            }
+        }
+        if (victim->size != 0){
+            __sync_add_and_fetch(&this->header->evictions, 1);
+        }
+
+        victim->seq++;
+        __sync_synchronize();
+        memcpy(victim->key, key, KEY_SIZE);
+        memcpy(victim->data, this->compress_buffer.get_data(), size);
+        victim->size = size;
+        __atomic_store_n(&victim->stamp, this->next_stamp(), __ATOMIC_RELAXED);
+        __sync_synchronize();
+        victim->seq++;
+        ::flock(this->fd, LOCK_UN);
+
+        __sync_add_and_fetch(&this->header->stores, 1);
+    }
+
+    void log_statistics() const
+    {
+        if (!this->is_open()){
+            return;
+        }
+        uint64_t hits = this->header->hits;
+        uint64_t misses = this->header->misses;
+        LOG(LOG_INFO, "Persistent bitmap store: session hits=%llu misses=%llu, "
+            "proxy hits=%llu misses=%llu hit_rate=%u%% stores=%llu evictions=%llu",
+            (unsigned long long)this->session_hits, (unsigned long long)this->session_misses,
+            (unsigned long long)hits, (unsigned long long)misses,
+            (unsigned)((hits + misses) ? (hits * 100) / (hits + misses) : 0),
+            (unsigned long long)this->header->stores, (unsigned long long)this->header->evictions);
+    }
+};
+
+#endif
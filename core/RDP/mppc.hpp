@@ -28,6 +28,7 @@
 #define _REDEMPTION_CORE_RDP_MPPC_HPP_
 
 #include <stdint.h>
+#include <algorithm>
 
 #include "error.hpp"
 #include "stream.hpp"
@@ -422,6 +423,8 @@ public:
 };  // rdp_mppc_dec
 
 
+struct rdp_mppc_enc_match_finder;
+
 struct rdp_mppc_enc {
     static const size_t HASH_BUF_LEN = (1024 * 64); /* 16 bit hash table size */
 
@@ -510,6 +513,20 @@ public:
             outputBuffer, bits_left, opb_index);
     }
 
+    typedef void (* encode_copy_tuple_t)(uint32_t copy_offset, int lom, char * outputBuffer,
+        int & bits_left, int & opb_index);
+
+    /**
+     * encode data at historyBuffer[offset, offset + len) as literals and
+     * copy-tuples found by a hash chains match finder (RDP 4.0 and 5.0)
+     *
+     * @return  false if encoded data grew as large as uncompressed data
+     */
+    static inline bool encode_chained(rdp_mppc_enc_match_finder & mf,
+        const char * historyBuffer, int offset, int len, int max_lom,
+        encode_copy_tuple_t encode_copy_tuple, char * outputBuffer,
+        int & bits_left, int & opb_index);
+
     virtual bool compress(uint8_t * srcData, int len, uint8_t & flags, uint16_t & compressedLength) = 0;
 
     virtual void get_compressed_data(Stream & stream) const = 0;
@@ -520,6 +537,158 @@ public:
 };  // struct rdp_mppc_enc
 
 
+// Hash chains match finder used by bulk compressors above effort level 0.
+// hash_table keeps the last position of each 3 bytes signature and prev
+// links each position of history buffer to the previous one sharing its
+// signature, so that several candidates are tried for every position.
+struct rdp_mppc_enc_match_finder {
+    static const uint16_t NO_POSITION = 0xFFFF;
+
+    // Compressor effort levels:
+    // 0: one candidate per position (RDP 4.0 and 5.0 compressors keep
+    //    their former single entry hash table at this level)
+    // 1: up to 8 candidates per position
+    // 2: up to 32 candidates per position and lazy matching
+    enum {
+        LEVEL_FAST = 0,
+        LEVEL_CHAIN,
+        LEVEL_LAZY,
+        LEVEL_MAX = LEVEL_LAZY
+    };
+
+    uint16_t * hash_table;
+    uint16_t * prev;
+    int        max_chain;   /* candidates tried for each position                     */
+    int        nice_lom;    /* a match that long is good enough, stop looking further */
+    bool       lazy;        /* try a longer match at next position before using one   */
+
+    rdp_mppc_enc_match_finder(int buf_len, int level) {
+        this->hash_table = static_cast<uint16_t *>(malloc(rdp_mppc_enc::HASH_BUF_LEN * 2));
+        this->prev       = static_cast<uint16_t *>(malloc(buf_len * 2));
+        this->max_chain  = (level >= LEVEL_LAZY)  ? 32  :
+                           (level >= LEVEL_CHAIN) ? 8   :
+                                                    1   ;
+        this->nice_lom   = (level >= LEVEL_LAZY)  ? 128 : 32;
+        this->lazy       = (level >= LEVEL_LAZY);
+        this->reset();
+    }
+
+    ~rdp_mppc_enc_match_finder() {
+        free(this->hash_table);
+        free(this->prev);
+    }
+
+    void reset() {
+        memset(this->hash_table, 0xFF, rdp_mppc_enc::HASH_BUF_LEN * 2);
+    }
+
+    // cheaper than rdp_mppc_enc::signature(), any hash of 3 bytes will do
+    static inline uint32_t hash(const char * v) {
+        const uint8_t * p = reinterpret_cast<const uint8_t *>(v);
+        return (((p[0] << 16) | (p[1] << 8) | p[2]) * 2654435761u) >> 16;
+    }
+
+    // add position pos (3 bytes must be available) to hash chains
+    void update(const char * historyBuffer, int pos) {
+        uint32_t h = hash(historyBuffer + pos);
+        this->prev[pos]     = this->hash_table[h];
+        this->hash_table[h] = pos;
+    }
+
+    static inline int match_length(const char * a, const char * b, int max_lom) {
+        int lom = 0;
+        while ((lom < max_lom) && (a[lom] == b[lom])) {
+            lom++;
+        }
+        return lom;
+    }
+
+    /**
+     * find longest match for data at pos among positions already added to
+     * hash chains
+     *
+     * @param   end         end of data to compress
+     * @param   max_lom     longest match allowed by protocol
+     * @param   match_pos   position of match found
+     *
+     * @return  length of match, 0 if none at least 3 bytes long was found
+     */
+    int find_match(const char * historyBuffer, int pos, int end, int max_lom, int & match_pos) const {
+        int limit = std::min(end - pos, max_lom);
+        if (limit < 3) {
+            return 0;
+        }
+
+        const char * data = historyBuffer + pos;
+        int best = 2;
+        int candidate = this->hash_table[hash(data)];
+        for (int chain = this->max_chain; (candidate != NO_POSITION) && (chain > 0); chain--) {
+            const char * p = historyBuffer + candidate;
+            if ((p[best] == data[best]) && (p[0] == data[0]) && (p[1] == data[1])) {
+                int lom = match_length(p, data, limit);
+                if (lom > best) {
+                    best      = lom;
+                    match_pos = candidate;
+                    if ((lom >= this->nice_lom) || (lom == limit)) {
+                        break;
+                    }
+                }
+            }
+            candidate = this->prev[candidate];
+        }
+        return (best >= 3) ? best : 0;
+    }
+};  // struct rdp_mppc_enc_match_finder
+
+inline bool rdp_mppc_enc::encode_chained(rdp_mppc_enc_match_finder & mf,
+    const char * historyBuffer, int offset, int len, int max_lom,
+    encode_copy_tuple_t encode_copy_tuple, char * outputBuffer,
+    int & bits_left, int & opb_index) {
+    const int end      = offset + len;
+    int       inserted = offset;    /* positions before are in hash chains */
+
+    for (int pos = offset; pos < end; ) {
+        if (opb_index >= len) {
+            return false;
+        }
+
+        for (; (inserted < pos) && (inserted + 3 <= end); inserted++) {
+            mf.update(historyBuffer, inserted);
+        }
+        int match_pos = 0;
+        int lom       = mf.find_match(historyBuffer, pos, end, max_lom, match_pos);
+
+        /* lazy matching: if match starting at next byte is longer, */
+        /* current byte is better sent as literal                   */
+        while (mf.lazy && lom && (lom < mf.nice_lom) && (pos + 4 <= end)) {
+            if (inserted == pos) {
+                mf.update(historyBuffer, inserted++);
+            }
+            int next_pos = 0;
+            int next_lom = mf.find_match(historyBuffer, pos + 1, end, max_lom, next_pos);
+            if (next_lom <= lom) {
+                break;
+            }
+            rdp_mppc_enc::encode_literal(historyBuffer[pos], outputBuffer, bits_left, opb_index);
+            pos++;
+            lom       = next_lom;
+            match_pos = next_pos;
+        }
+
+        if (!lom) {
+            rdp_mppc_enc::encode_literal(historyBuffer[pos], outputBuffer, bits_left, opb_index);
+            pos++;
+            continue;
+        }
+
+        encode_copy_tuple(pos - match_pos, lom, outputBuffer, bits_left, opb_index);
+        pos += lom;
+    }
+
+    return (opb_index < len);
+}
+
+
 #include "mppc_40.hpp"
 #include "mppc_50.hpp"
 #include "mppc_60.hpp"
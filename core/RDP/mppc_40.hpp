@@ -445,12 +445,14 @@ struct rdp_mppc_40_enc : public rdp_mppc_enc {
     int        flags;               /* PACKET_COMPRESSED, PACKET_AT_FRONT, PACKET_FLUSHED etc */
     int        flagsHold;
     int        first_pkt;           /* this is the first pkt passing through enc */
-    uint16_t * hash_table;
+    uint16_t * hash_table;          /* level 0 only                              */
+
+    rdp_mppc_enc_match_finder * match_finder;   /* levels above 0 */
 
     /**
      * Initialize rdp_mppc_40_enc structure
      */
-    rdp_mppc_40_enc() : rdp_mppc_enc() {
+    explicit rdp_mppc_40_enc(int level = rdp_mppc_enc_match_finder::LEVEL_FAST) : rdp_mppc_enc() {
         this->historyBuffer     = NULL; /* contains uncompressed data */
         this->outputBuffer      = NULL; /* contains compressed data */
         this->outputBufferPlus  = NULL;
@@ -461,6 +463,7 @@ struct rdp_mppc_40_enc : public rdp_mppc_enc {
         this->flagsHold         = 0;
         this->first_pkt         = 0;    /* this is the first pkt passing through enc */
         this->hash_table        = NULL;
+        this->match_finder      = NULL;
 
         this->buf_len = RDP_40_HIST_BUF_LEN;
 
@@ -469,7 +472,12 @@ struct rdp_mppc_40_enc : public rdp_mppc_enc {
         this->historyBuffer    = static_cast<char *>(calloc(this->buf_len, 1));
         this->outputBufferPlus = static_cast<char *>(calloc(this->buf_len + 64 + 8, 1));
         this->outputBuffer     = this->outputBufferPlus + 64;
-        this->hash_table       = static_cast<uint16_t *>(calloc(rdp_mppc_enc::HASH_BUF_LEN, 2));
+        if (level > rdp_mppc_enc_match_finder::LEVEL_FAST) {
+            this->match_finder = new rdp_mppc_enc_match_finder(this->buf_len, level);
+        }
+        else {
+            this->hash_table   = static_cast<uint16_t *>(calloc(rdp_mppc_enc::HASH_BUF_LEN, 2));
+        }
     }
 
     /**
@@ -479,6 +487,7 @@ struct rdp_mppc_40_enc : public rdp_mppc_enc {
         free(this->historyBuffer);
         free(this->outputBufferPlus);
         free(this->hash_table);
+        delete this->match_finder;
     }
 
     virtual void mini_dump() {
@@ -495,8 +504,10 @@ struct rdp_mppc_40_enc : public rdp_mppc_enc {
         LOG(LOG_INFO, "flags=0x%X",            this->flags);
         LOG(LOG_INFO, "flagsHold=0x%X",        this->flagsHold);
         LOG(LOG_INFO, "first_pkt=%d",          this->first_pkt);
-        LOG(LOG_INFO, "hash_table");
-        hexdump_d(reinterpret_cast<uint8_t *>(this->hash_table), 16);
+        if (this->hash_table) {
+            LOG(LOG_INFO, "hash_table");
+            hexdump_d(reinterpret_cast<uint8_t *>(this->hash_table), 16);
+        }
     }
 
     virtual void dump() {
@@ -511,8 +522,10 @@ struct rdp_mppc_40_enc : public rdp_mppc_enc {
         LOG(LOG_INFO, "flags=0x%X",            this->flags);
         LOG(LOG_INFO, "flagsHold=0x%X",        this->flagsHold);
         LOG(LOG_INFO, "first_pkt=%d",          this->first_pkt);
-        LOG(LOG_INFO, "hash_table");
-        hexdump_d(reinterpret_cast<uint8_t *>(this->hash_table), rdp_mppc_enc::HASH_BUF_LEN * 2);
+        if (this->hash_table) {
+            LOG(LOG_INFO, "hash_table");
+            hexdump_d(reinterpret_cast<uint8_t *>(this->hash_table), rdp_mppc_enc::HASH_BUF_LEN * 2);
+        }
     }
 
 // 3.1.8.4.1 RDP 4.0
@@ -579,6 +592,37 @@ struct rdp_mppc_40_enc : public rdp_mppc_enc {
 //    A length-of-match value of 120 is encoded as the binary value 111110 111000.
 //    A length-of-match value of 4097 is encoded as the binary value 111111111110 000000000001.
 
+    static inline void encode_copy_tuple(uint32_t copy_offset, int lom, char * outputBuffer,
+        int & bits_left, int & opb_index) {
+        /* encode copy_offset and insert into output buffer */
+        const int nbbits[3]  = {10, 12, 16};
+        const int headers[3] = {0x3c0, 0xe00, 0xc000};
+        const int base[3]    = {0, 0x40, 0x140};
+        int range = (copy_offset <= 0x3F)  ? 0 :
+                    (copy_offset <= 0x13F) ? 1 :
+                                             2 ;
+        rdp_mppc_enc::insert_n_bits(nbbits[range],
+            headers[range]|(copy_offset - base[range]),
+            outputBuffer, bits_left, opb_index);
+
+        int log_lom = 8 * sizeof(lom) - 1 - __builtin_clz(lom);
+
+        /* encode length of match and insert into output buffer */
+        rdp_mppc_enc::insert_n_bits(
+            (lom == 3) ? 1 : 2 * log_lom,
+            (lom == 3) ? 0 : (((((1 << log_lom) - 1) & 0xFFE) << log_lom) | (lom - (1 << log_lom))),
+            outputBuffer, bits_left, opb_index);
+    }
+
+    void reset_matches() {
+        if (this->match_finder) {
+            this->match_finder->reset();
+        }
+        else {
+            memset(this->hash_table, 0, rdp_mppc_enc::HASH_BUF_LEN * 2);
+        }
+    }
+
     /**
      * encode (compress) data using RDP 4.0 protocol
      *
@@ -595,7 +639,6 @@ struct rdp_mppc_40_enc : public rdp_mppc_enc {
 
         int        opb_index    = 0;                    /* index into outputBuffer                        */
         int        bits_left    = 8;                    /* unused bits in current uint8_t in outputBuffer */
-        uint16_t * hash_table   = this->hash_table;     /* hash table for pattern matching                */
         char     * outputBuffer = this->outputBuffer;   /* points to enc->outputBuffer                    */
 
         TODO("this memset should not be necessary");
@@ -612,12 +655,51 @@ struct rdp_mppc_40_enc : public rdp_mppc_enc {
             /* historyBuffer cannot hold srcData - rewind it */
             this->historyOffset =  0;
             this->flagsHold     |= PACKET_AT_FRONT;
-            memset(hash_table, 0, rdp_mppc_enc::HASH_BUF_LEN * 2);
+            this->reset_matches();
         }
 
         /* add / append new data to historyBuffer */
         memcpy(&(this->historyBuffer[this->historyOffset]), srcData, len);
 
+        if (this->match_finder) {
+            if (!rdp_mppc_enc::encode_chained(*this->match_finder, this->historyBuffer,
+                    this->historyOffset, len, 8191, rdp_mppc_40_enc::encode_copy_tuple,
+                    outputBuffer, bits_left, opb_index)) {
+                opb_index = len;
+            }
+        }
+        else {
+            this->compress_40_single(srcData, len, outputBuffer, bits_left, opb_index);
+        }
+
+        if (opb_index >= len) {
+            /* compressed data longer or same size than uncompressed data */
+            /* give up */
+            this->historyOffset = 0;
+            this->reset_matches();
+            this->flagsHold |= PACKET_FLUSHED;
+            this->first_pkt =  1;
+
+            return true;
+        }
+
+        this->historyOffset += len;
+        this->flags         |= PACKET_COMPRESSED;
+        /* if bits_left == 8, opb_index has already been incremented */
+        this->bytes_in_opb =  opb_index + (bits_left != 8);
+        this->flags        |= this->flagsHold;
+        this->flagsHold    =  0;
+
+        return true;
+    }
+
+    /**
+     * level 0: one candidate per position given by hash table
+     */
+    void compress_40_single(uint8_t * srcData, int len, char * outputBuffer, int & bits_left,
+        int & opb_index) {
+        uint16_t * hash_table = this->hash_table;   /* hash table for pattern matching */
+
         int      ctr         = 0;
         uint32_t copy_offset = 0;   /* pattern match starts here... */
 
@@ -665,25 +747,8 @@ struct rdp_mppc_40_enc : public rdp_mppc_enc {
                     }
                 }
 
-                /* encode copy_offset and insert into output buffer */
                 copy_offset = this->historyOffset + ctr - previous_match;
-                const int nbbits[3]  = {10, 12, 16};
-                const int headers[3] = {0x3c0, 0xe00, 0xc000};
-                const int base[3]    = {0, 0x40, 0x140};
-                int range = (copy_offset <= 0x3F)  ? 0 :
-                            (copy_offset <= 0x13F) ? 1 :
-                                                     2 ;
-                rdp_mppc_enc::insert_n_bits(nbbits[range],
-                    headers[range]|(copy_offset - base[range]),
-                    outputBuffer, bits_left, opb_index);
-
-                int log_lom = 8 * sizeof(lom) - 1 - __builtin_clz(lom);
-
-                /* encode length of match and insert into output buffer */
-                rdp_mppc_enc::insert_n_bits(
-                    (lom == 3) ? 1 : 2 * log_lom,
-                    (lom == 3) ? 0 : (((((1 << log_lom) - 1) & 0xFFE) << log_lom) | (lom - (1 << log_lom))),
-                    outputBuffer, bits_left, opb_index);
+                rdp_mppc_40_enc::encode_copy_tuple(copy_offset, lom, outputBuffer, bits_left, opb_index);
             }
         }
 
@@ -693,26 +758,6 @@ struct rdp_mppc_40_enc : public rdp_mppc_enc {
                 opb_index);
             ctr++;
         }
-
-        if (opb_index >= len) {
-            /* compressed data longer or same size than uncompressed data */
-            /* give up */
-            this->historyOffset = 0;
-            memset(hash_table, 0, rdp_mppc_enc::HASH_BUF_LEN * 2);
-            this->flagsHold |= PACKET_FLUSHED;
-            this->first_pkt =  1;
-
-            return true;
-        }
-
-        this->historyOffset += len;
-        this->flags         |= PACKET_COMPRESSED;
-        /* if bits_left == 8, opb_index has already been incremented */
-        this->bytes_in_opb =  opb_index + (bits_left != 8);
-        this->flags        |= this->flagsHold;
-        this->flagsHold    =  0;
-
-        return true;
     }
 
     virtual bool compress(uint8_t * srcData, int len, uint8_t & flags, uint16_t & compressedLength) {
@@ -138,6 +138,43 @@ static uint16_t LOMBaseLUT[] = {
     82, 98, 114, 130, 194, 258, 514, 2, 2
 };
 
+// Huffman codes matching HuffLenLEC and HuffLenLOM, bits are sent least
+// significant first (encoder side of HuffIndexLEC and HuffIndexLOM)
+
+static uint16_t HuffCodeLEC[] = {
+    0x0004, 0x0024, 0x0014, 0x0011, 0x0051, 0x0031, 0x0071, 0x0009, 0x0049, 0x0029, 0x0069, 0x0015,
+    0x0095, 0x0055, 0x00d5, 0x0035, 0x00b5, 0x0075, 0x001d, 0x00f5, 0x011d, 0x009d, 0x019d, 0x005d,
+    0x000d, 0x008d, 0x015d, 0x00dd, 0x01dd, 0x003d, 0x013d, 0x00bd, 0x004d, 0x01bd, 0x007d, 0x006b,
+    0x017d, 0x00fd, 0x01fd, 0x0003, 0x0103, 0x0083, 0x0183, 0x026b, 0x0043, 0x016b, 0x036b, 0x00eb,
+    0x0143, 0x00c3, 0x02eb, 0x01c3, 0x01eb, 0x0023, 0x03eb, 0x0123, 0x00a3, 0x01a3, 0x001b, 0x021b,
+    0x0063, 0x011b, 0x0163, 0x00e3, 0x00cd, 0x01e3, 0x0013, 0x0113, 0x0093, 0x031b, 0x009b, 0x029b,
+    0x0193, 0x0053, 0x019b, 0x039b, 0x005b, 0x025b, 0x015b, 0x035b, 0x0153, 0x00d3, 0x00db, 0x02db,
+    0x01db, 0x03db, 0x003b, 0x023b, 0x013b, 0x01d3, 0x033b, 0x00bb, 0x02bb, 0x01bb, 0x03bb, 0x007b,
+    0x002d, 0x027b, 0x017b, 0x037b, 0x00fb, 0x02fb, 0x01fb, 0x03fb, 0x0007, 0x0207, 0x0107, 0x0307,
+    0x0087, 0x0287, 0x0187, 0x0387, 0x0033, 0x0047, 0x0247, 0x0147, 0x0347, 0x00c7, 0x02c7, 0x01c7,
+    0x0133, 0x03c7, 0x0027, 0x0227, 0x0127, 0x0327, 0x00a7, 0x00b3, 0x0019, 0x01b3, 0x0073, 0x02a7,
+    0x0173, 0x01a7, 0x03a7, 0x0067, 0x00f3, 0x0267, 0x0167, 0x0367, 0x00e7, 0x02e7, 0x01e7, 0x03e7,
+    0x01f3, 0x0017, 0x0217, 0x0117, 0x0317, 0x0097, 0x0297, 0x0197, 0x0397, 0x0057, 0x0257, 0x0157,
+    0x0357, 0x00d7, 0x02d7, 0x01d7, 0x03d7, 0x0037, 0x0237, 0x0137, 0x0337, 0x00b7, 0x02b7, 0x01b7,
+    0x03b7, 0x0077, 0x0277, 0x07ff, 0x0177, 0x0377, 0x00f7, 0x02f7, 0x01f7, 0x03f7, 0x03ff, 0x000f,
+    0x020f, 0x010f, 0x030f, 0x008f, 0x028f, 0x018f, 0x038f, 0x004f, 0x024f, 0x014f, 0x034f, 0x00cf,
+    0x000b, 0x02cf, 0x01cf, 0x03cf, 0x002f, 0x022f, 0x010b, 0x012f, 0x032f, 0x00af, 0x02af, 0x01af,
+    0x008b, 0x03af, 0x006f, 0x026f, 0x018b, 0x016f, 0x036f, 0x00ef, 0x02ef, 0x01ef, 0x03ef, 0x001f,
+    0x021f, 0x011f, 0x031f, 0x009f, 0x029f, 0x019f, 0x039f, 0x005f, 0x004b, 0x025f, 0x015f, 0x035f,
+    0x00df, 0x02df, 0x01df, 0x03df, 0x003f, 0x023f, 0x013f, 0x033f, 0x00bf, 0x02bf, 0x014b, 0x01bf,
+    0x00ad, 0x00cb, 0x01cb, 0x03bf, 0x002b, 0x007f, 0x027f, 0x017f, 0x012b, 0x037f, 0x00ff, 0x02ff,
+    0x00ab, 0x01ab, 0x006d, 0x0059, 0x17ff, 0x0fff, 0x0039, 0x0079, 0x01ff, 0x0005, 0x0045, 0x0034,
+    0x000c, 0x002c, 0x001c, 0x0000, 0x003c, 0x0002, 0x0022, 0x0010, 0x0012, 0x0008, 0x0032, 0x000a,
+    0x002a, 0x001a, 0x003a, 0x0006, 0x0026, 0x0016, 0x0036, 0x000e, 0x002e, 0x001e, 0x003e, 0x0001,
+    0x00ed, 0x0018, 0x0021, 0x0025, 0x0065
+};
+
+static uint16_t HuffCodeLOM[] = {
+    0x0001, 0x0000, 0x0002, 0x0009, 0x0006, 0x0005, 0x000d, 0x000b, 0x0003, 0x001b, 0x0007, 0x0017,
+    0x0037, 0x000f, 0x004f, 0x006f, 0x002f, 0x00ef, 0x001f, 0x005f, 0x015f, 0x009f, 0x00df, 0x01df,
+    0x003f, 0x013f, 0x00bf, 0x01bf, 0x007f, 0x017f, 0x00ff, 0x01ff
+};
+
 struct rdp_mppc_60_dec : public rdp_mppc_dec {
 protected:
     static const size_t RDP_60_HIST_BUF_LEN      = 1024 * 64;
@@ -571,4 +608,347 @@ public:
     }
 };  // struct rdp_mppc_60_dec
 
+
+struct rdp_mppc_60_enc : public rdp_mppc_enc {
+    static const int RDP_60_HIST_BUF_LEN = 1024 * 64;
+    static const int RDP_60_MAX_LOM      = 769; /* LoM codes 28 and 29 are never used */
+
+    char     * historyBuffer;       /* contains uncompressed data */
+    char     * outputBuffer;        /* contains compressed data */
+    char     * outputBufferPlus;
+    int        historyOffset;       /* next free slot in historyBuffer */
+    int        buf_len;             /* length of historyBuffer */
+    int        bytes_in_opb;        /* compressed bytes available in outputBuffer */
+    int        flags;               /* PACKET_COMPRESSED, PACKET_AT_FRONT, PACKET_FLUSHED etc */
+    int        flagsHold;
+    int        first_pkt;           /* this is the first pkt passing through enc */
+    int        hashed;              /* positions of historyBuffer before are in hash chains */
+    uint16_t   offset_cache[4];     /* same as decompressor offset cache */
+
+    rdp_mppc_enc_match_finder match_finder;
+
+    /**
+     * Initialize rdp_mppc_60_enc structure
+     */
+    explicit rdp_mppc_60_enc(int level = rdp_mppc_enc_match_finder::LEVEL_FAST)
+    : rdp_mppc_enc()
+    , historyOffset(0)
+    , buf_len(RDP_60_HIST_BUF_LEN)
+    , bytes_in_opb(0)
+    , flags(0)
+    , flagsHold(0)
+    , first_pkt(1)
+    , hashed(0)
+    , match_finder(RDP_60_HIST_BUF_LEN, level) {
+        this->historyBuffer    = static_cast<char *>(calloc(this->buf_len, 1));
+        this->outputBufferPlus = static_cast<char *>(calloc(this->buf_len + 64 + 8, 1));
+        this->outputBuffer     = this->outputBufferPlus + 64;
+        memset(this->offset_cache, 0, sizeof(this->offset_cache));
+    }
+
+    /**
+     * Deinitialize rdp_mppc_60_enc structure
+     */
+    virtual ~rdp_mppc_60_enc() {
+        free(this->historyBuffer);
+        free(this->outputBufferPlus);
+    }
+
+    virtual void mini_dump() {
+        LOG(LOG_INFO, "Type=RDP 6.0 bulk compressor");
+        LOG(LOG_INFO, "historyBuffer");
+        hexdump_d(this->historyBuffer,         16);
+        LOG(LOG_INFO, "outputBuffer");
+        hexdump_d(this->outputBuffer,          16);
+        LOG(LOG_INFO, "historyOffset=%d",      this->historyOffset);
+        LOG(LOG_INFO, "buf_len=%d",            this->buf_len);
+        LOG(LOG_INFO, "bytes_in_opb=%d",       this->bytes_in_opb);
+        LOG(LOG_INFO, "flags=0x%X",            this->flags);
+        LOG(LOG_INFO, "flagsHold=0x%X",        this->flagsHold);
+        LOG(LOG_INFO, "first_pkt=%d",          this->first_pkt);
+        LOG(LOG_INFO, "offsetCache");
+        hexdump_d(reinterpret_cast<const char *>(this->offset_cache), sizeof(this->offset_cache));
+    }
+
+    virtual void dump() {
+        LOG(LOG_INFO, "Type=RDP 6.0 bulk compressor");
+        LOG(LOG_INFO, "historyBuffer");
+        hexdump_d(this->historyBuffer,         this->buf_len);
+        LOG(LOG_INFO, "outputBufferPlus");
+        hexdump_d(this->outputBufferPlus,      this->buf_len + 64);
+        LOG(LOG_INFO, "historyOffset=%d",      this->historyOffset);
+        LOG(LOG_INFO, "buf_len=%d",            this->buf_len);
+        LOG(LOG_INFO, "bytes_in_opb=%d",       this->bytes_in_opb);
+        LOG(LOG_INFO, "flags=0x%X",            this->flags);
+        LOG(LOG_INFO, "flagsHold=0x%X",        this->flagsHold);
+        LOG(LOG_INFO, "first_pkt=%d",          this->first_pkt);
+        LOG(LOG_INFO, "offsetCache");
+        hexdump_d(reinterpret_cast<const char *>(this->offset_cache), sizeof(this->offset_cache));
+    }
+
+private:
+    static inline void insert_bits(uint32_t bits, int n, char * outputBuffer,
+        uint32_t & pending, int & pending_bits, int & opb_index) {
+        pending      |= bits << pending_bits;
+        pending_bits += n;
+        for (; pending_bits >= 8; pending_bits -= 8) {
+            outputBuffer[opb_index++] =   pending;
+            pending                   >>= 8;
+        }
+    }
+
+    static inline int copy_offset_index(uint32_t copy_offset) {
+        return std::upper_bound(CopyOffsetBaseLUT, CopyOffsetBaseLUT + 32, copy_offset + 1) - CopyOffsetBaseLUT - 1;
+    }
+
+    static inline int lom_index(int lom) {
+        return std::upper_bound(LOMBaseLUT, LOMBaseLUT + 28, lom) - LOMBaseLUT - 1;
+    }
+
+    // bits needed to send copy_offset and lom, for short matches only worth
+    // sending if cheaper than literals
+    static inline int copy_tuple_bits(uint32_t copy_offset, int lom) {
+        int o = copy_offset_index(copy_offset);
+        int l = lom_index(lom);
+        return HuffLenLEC[257 + o] + CopyOffsetBitsLUT[o] + HuffLenLOM[l] + LOMBitsLUT[l];
+    }
+
+    void flush() {
+        this->historyOffset = 0;
+        this->hashed        = 0;
+        this->match_finder.reset();
+        memset(this->offset_cache, 0, sizeof(this->offset_cache));
+        /* decompressor history is not moved when it is reset */
+        this->flagsHold = (this->flagsHold & ~PACKET_AT_FRONT) | PACKET_FLUSHED;
+    }
+
+    /**
+     * find match for data at pos, either repeating an offset of offset cache
+     * or given by hash chains
+     *
+     * @param   copy_offset   copy offset of match from hash chains
+     * @param   cache_index   index of offset cache entry used, -1 if none
+     *
+     * @return  length of match, 0 if no match is worth it
+     */
+    int find_match(int pos, int end, uint32_t & copy_offset, int & cache_index) {
+        const char * data  = this->historyBuffer + pos;
+        const int    limit = (end - pos < RDP_60_MAX_LOM) ? end - pos : RDP_60_MAX_LOM;
+
+        int cache_lom = 0;
+        cache_index = -1;
+        for (int i = 0; i < 4; i++) {
+            int offset = this->offset_cache[i];
+            if ((offset == 0) || (offset > pos)) {
+                continue;
+            }
+            int lom = rdp_mppc_enc_match_finder::match_length(data, data - offset, limit);
+            if (lom > cache_lom) {
+                cache_lom   = lom;
+                cache_index = i;
+            }
+        }
+
+        int match_pos = 0;
+        int lom = (cache_lom < limit)
+                ? this->match_finder.find_match(this->historyBuffer, pos, end, RDP_60_MAX_LOM, match_pos)
+                : 0;
+
+        /* offset cache entries are much cheaper to send than copy offsets */
+        if ((cache_lom >= 2) && (cache_lom + 1 >= lom)) {
+            return cache_lom;
+        }
+        cache_index = -1;
+        if (lom == 0) {
+            return 0;
+        }
+        copy_offset = pos - match_pos;
+        if (lom < 5) {
+            int literal_bits = 0;
+            for (int i = 0; i < lom; i++) {
+                literal_bits += HuffLenLEC[static_cast<uint8_t>(data[i])];
+            }
+            if (copy_tuple_bits(copy_offset, lom) >= literal_bits) {
+                return 0;
+            }
+        }
+        return lom;
+    }
+
+    /**
+     * encode new data at historyBuffer[historyOffset, historyOffset + len)
+     *
+     * @return  false if encoded data grew as large as uncompressed data
+     */
+    bool encode(int len, int & opb_index) {
+        const char * historyBuffer = this->historyBuffer;
+        char       * outputBuffer  = this->outputBuffer;
+        uint32_t     pending       = 0;     /* bits not yet in outputBuffer */
+        int          pending_bits  = 0;
+        const int    end           = this->historyOffset + len;
+
+        for (int pos = this->historyOffset; pos < end; ) {
+            if (opb_index >= len) {
+                return false;
+            }
+
+            for (; (this->hashed < pos) && (this->hashed + 3 <= end); this->hashed++) {
+                this->match_finder.update(historyBuffer, this->hashed);
+            }
+            uint32_t copy_offset = 0;
+            int      cache_index = -1;
+            int      lom         = this->find_match(pos, end, copy_offset, cache_index);
+
+            /* lazy matching: if match starting at next byte is longer, */
+            /* current byte is better sent as literal                   */
+            while (this->match_finder.lazy && lom && (lom < this->match_finder.nice_lom)
+                && (pos + 4 <= end) && (opb_index < len)) {
+                if (this->hashed == pos) {
+                    this->match_finder.update(historyBuffer, this->hashed++);
+                }
+                uint32_t next_copy_offset = 0;
+                int      next_cache_index = -1;
+                int      next_lom = this->find_match(pos + 1, end, next_copy_offset, next_cache_index);
+                if (next_lom <= lom) {
+                    break;
+                }
+                uint8_t c = historyBuffer[pos];
+                insert_bits(HuffCodeLEC[c], HuffLenLEC[c], outputBuffer, pending, pending_bits, opb_index);
+                pos++;
+                lom         = next_lom;
+                copy_offset = next_copy_offset;
+                cache_index = next_cache_index;
+            }
+
+            if (!lom) {
+                uint8_t c = historyBuffer[pos];
+                insert_bits(HuffCodeLEC[c], HuffLenLEC[c], outputBuffer, pending, pending_bits, opb_index);
+                pos++;
+                continue;
+            }
+
+            if (cache_index >= 0) {
+                insert_bits(HuffCodeLEC[289 + cache_index], HuffLenLEC[289 + cache_index],
+                    outputBuffer, pending, pending_bits, opb_index);
+                std::swap(this->offset_cache[0], this->offset_cache[cache_index]);
+            }
+            else {
+                int o = copy_offset_index(copy_offset);
+                insert_bits(HuffCodeLEC[257 + o], HuffLenLEC[257 + o], outputBuffer, pending, pending_bits,
+                    opb_index);
+                if (CopyOffsetBitsLUT[o]) {
+                    insert_bits(copy_offset + 1 - CopyOffsetBaseLUT[o], CopyOffsetBitsLUT[o],
+                        outputBuffer, pending, pending_bits, opb_index);
+                }
+                this->offset_cache[3] = this->offset_cache[2];
+                this->offset_cache[2] = this->offset_cache[1];
+                this->offset_cache[1] = this->offset_cache[0];
+                this->offset_cache[0] = copy_offset;
+            }
+
+            int l = lom_index(lom);
+            insert_bits(HuffCodeLOM[l], HuffLenLOM[l], outputBuffer, pending, pending_bits, opb_index);
+            if (LOMBitsLUT[l]) {
+                insert_bits(lom - LOMBaseLUT[l], LOMBitsLUT[l], outputBuffer, pending, pending_bits,
+                    opb_index);
+            }
+            pos += lom;
+        }
+
+        /* end of stream marker */
+        insert_bits(HuffCodeLEC[256], HuffLenLEC[256], outputBuffer, pending, pending_bits, opb_index);
+        if (pending_bits) {
+            outputBuffer[opb_index++] = pending;
+        }
+
+        return (opb_index < len);
+    }
+
+public:
+// 3.1.8.1 RDP 6.0
+// ===============
+
+// RDP 6.0 has a 64 kilobytes history buffer. Literals, copy-offsets, offset
+// cache indexes and the end of stream marker are Huffman coded in one
+// alphabet (HuffLenLEC), lengths of match in another (HuffLenLOM). The last
+// four copy-offsets used are kept in an offset cache by both endpoints.
+
+// When new data does not fit in history buffer, its last 32 kilobytes are
+// moved to the beginning of the buffer (PACKET_AT_FRONT).
+
+    /**
+     * encode (compress) data using RDP 6.0 protocol
+     *
+     * @param   srcData       uncompressed data
+     * @param   len           length of srcData
+     *
+     * @return  true on success, false on failure
+     */
+    bool compress_60(uint8_t * srcData, int len) {
+        this->flags = PACKET_COMPR_TYPE_RDP6;
+
+        if ((srcData == NULL) || (len <= 0) || (len >= this->buf_len))
+            return false;
+
+        if (this->first_pkt) {
+            this->first_pkt = 0;
+            this->flush();
+        }
+        else if (this->historyOffset + len >= this->buf_len) {
+            const int keep = this->buf_len / 2;
+            if ((this->historyOffset >= keep) && (keep + len < this->buf_len)) {
+                /* slide historyBuffer as decompressor does */
+                memmove(this->historyBuffer, this->historyBuffer + this->historyOffset - keep, keep);
+                this->historyOffset =  keep;
+                this->hashed        =  0;
+                this->match_finder.reset();
+                this->flagsHold     |= PACKET_AT_FRONT;
+            }
+            else {
+                this->flush();
+            }
+        }
+
+        /* add / append new data to historyBuffer */
+        memcpy(this->historyBuffer + this->historyOffset, srcData, len);
+
+        int opb_index = 0;
+        if (!this->encode(len, opb_index)) {
+            /* compressed data longer or same size than uncompressed data */
+            /* give up */
+            this->flush();
+            return true;
+        }
+
+        this->historyOffset += len;
+        this->bytes_in_opb  =  opb_index;
+        this->flags         |= PACKET_COMPRESSED | this->flagsHold;
+        this->flagsHold     =  0;
+
+        return true;
+    }
+
+    virtual bool compress(uint8_t * srcData, int len, uint8_t & flags, uint16_t & compressedLength) {
+        bool compress_result = this->compress_60(srcData, len);
+        if (this->flags & PACKET_COMPRESSED) {
+            flags            = this->flags;
+            compressedLength = this->bytes_in_opb;
+        }
+        else {
+            flags            = 0;
+            compressedLength = 0;
+        }
+        return compress_result;
+    }
+
+    virtual void get_compressed_data(Stream & stream) const {
+        if (stream.room() < static_cast<size_t>(this->bytes_in_opb)) {
+            LOG(LOG_ERR, "rdp_mppc_60_enc::get_compressed_data: Buffer too small");
+            throw Error(ERR_BUFFER_TOO_SMALL);
+        }
+
+        stream.out_copy_bytes(this->outputBuffer, this->bytes_in_opb);
+    }
+};  // struct rdp_mppc_60_enc
+
 #endif  // #ifndef _REDEMPTION_CORE_RDP_MPPC_60_HPP_
\ No newline at end of file
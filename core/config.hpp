@@ -508,6 +508,7 @@ struct Inifile : public FieldObserver {
         char      listen_address[256];
         bool      enable_ip_transparent;
         char      certificate_password[256];
+        unsigned  session_prefork;        // number of session processes started before clients connect
 
         char png_path[1024];
         char wrm_path[1024];
@@ -546,6 +547,13 @@ struct Inifile : public FieldObserver {
         BoolField disable_ctrl_alt_del; // AUTHID_DISABLECTRLALTDEL //
 
         bool rdp_compression;
+        unsigned rdp_compression_max_type;  // 0: RDP 4.0, 1: RDP 5.0, 2: RDP 6.0
+        unsigned rdp_compression_level;     // 0: fast, 1: hash chains, 2: hash chains and lazy matching
+
+        unsigned bitmap_tiling; // 0: 32x32 tiles, 1: largest client cache cell, 2: as 1 plus bitmap updates for full screen
+
+        unsigned bitmap_cache_fingerprint;    // 0: fast hash, 1: SHA1
+        bool     bitmap_cache_verify_content; // compare bitmap data when fingerprints match
     } client;
 
     struct {
@@ -567,6 +575,15 @@ struct Inifile : public FieldObserver {
         bool allow_authentification_retries;
     } mod_vnc;
 
+    // Section "bitmap_store"
+    struct {
+        bool     enable;           // share compressed bitmaps between sessions
+        char     path[1024];       // directory of the memory mapped store file
+        unsigned size;             // store size in megabytes
+        unsigned eviction_policy;  // 0 - LRU, 1 - FIFO
+        bool     log_statistics;   // log hit and miss counters at end of session
+    } bitmap_store;
+
     // Section "video"
     struct {
         unsigned capture_flags;   // 1 PNG capture, 2 WRM
@@ -587,7 +604,11 @@ struct Inifile : public FieldObserver {
         unsigned capture_groupid;
         unsigned frame_interval;  // time between 2 frame captures (in 1/100 seconds)
         unsigned break_interval;  // time between 2 wrm movies (in seconds)
+        unsigned full_image_interval; // number of wrm movies between 2 starting with a full screen image,
+                                      //  others start with tiles changed since previous movie (0 or 1 : always full)
         unsigned png_limit;       // number of png captures to keep
+        unsigned png_compression_level; // zlib level of png images, 0 (fastest) to 9 (smallest)
+        unsigned png_filter;      // 0 - adaptive (libpng), 1 - none, 2 - sub, 3 - up, 4 - paeth
         char     replay_path[1024];
 
         int l_bitrate;            // bitrate for low quality
@@ -624,6 +645,10 @@ struct Inifile : public FieldObserver {
         bool disable_keyboard_log_syslog;
         bool disable_keyboard_log_wrm;
         bool disable_keyboard_log_ocr;
+
+        bool     capture_thread;          // record session in a thread of its own
+        unsigned capture_queue_size;      // size of queue of orders waiting to be recorded (in KiB)
+        unsigned capture_queue_timeout;   // drop orders when queue is full for more than this (in ms), 0 never drops
     } video;
 
     // Section "debug"
@@ -674,6 +699,7 @@ struct Inifile : public FieldObserver {
     struct {
         unsigned           selector_focus;           // --
         char               movie[1024];              // --
+        char               session_file_key[32];     // -- session_<key>.pid until session_id is known, empty if no session file
 
         UnsignedField      opt_bitrate;              // AUTHID_OPT_BITRATE //
         UnsignedField      opt_framerate;            // AUTHID_OPT_FRAMERATE //
@@ -822,6 +848,7 @@ public:
         strcpy(this->globals.listen_address, "0.0.0.0");
         this->globals.enable_ip_transparent  = false;
         strcpy(this->globals.certificate_password, "inquisition");
+        this->globals.session_prefork        = 0;
 
         strcpy(this->globals.png_path, PNG_PATH);
         strcpy(this->globals.wrm_path, WRM_PATH);
@@ -872,6 +899,11 @@ public:
         this->client.tls_support                         = true;
         this->client.bogus_neg_request                   = false;
         this->client.rdp_compression                     = false;
+        this->client.rdp_compression_max_type            = 1;
+        this->client.rdp_compression_level               = 0;
+        this->client.bitmap_tiling                       = 0;
+        this->client.bitmap_cache_fingerprint            = 0;
+        this->client.bitmap_cache_verify_content         = false;
 
         this->client.disable_ctrl_alt_del.attach_ini(this, AUTHID_DISABLECTRLALTDEL);
         this->client.disable_ctrl_alt_del.set(false);
@@ -895,6 +927,14 @@ public:
         this->mod_vnc.allow_authentification_retries = false;
         // End Section "mod_vnc"
 
+        // Begin section "bitmap_store"
+        this->bitmap_store.enable          = false;
+        strcpy(this->bitmap_store.path, "/tmp/rdpproxy_bitmaps/");
+        this->bitmap_store.size            = 64;
+        this->bitmap_store.eviction_policy = 0;
+        this->bitmap_store.log_statistics  = false;
+        // End Section "bitmap_store"
+
         // Begin section video
         this->video.capture_flags = 1; // 1 png, 2 wrm, 4 flv, 8 ocr
         this->video.capture_wrm   = true;
@@ -911,7 +951,10 @@ public:
         this->video.capture_groupid = 33;
         this->video.frame_interval  = 40;         // 2,5 frame per second
         this->video.break_interval  = 600;        // 10 minutes interval
+        this->video.full_image_interval = 1;
         this->video.png_limit       = 3;
+        this->video.png_compression_level = 6;  // libpng default
+        this->video.png_filter      = 0;
         strcpy(this->video.replay_path, "/tmp/");
 
         this->video.l_bitrate   = 20000;
@@ -943,6 +986,10 @@ public:
         this->video.disable_keyboard_log_syslog = false;
         this->video.disable_keyboard_log_wrm    = false;
         this->video.disable_keyboard_log_ocr    = false;
+
+        this->video.capture_thread        = false;
+        this->video.capture_queue_size    = 8192;
+        this->video.capture_queue_timeout = 0;
         // End section "video"
 
 
@@ -1018,6 +1065,7 @@ public:
 
         this->context.selector_focus              = 0;
         this->context.movie[0]                    = 0;
+        this->context.session_file_key[0]         = 0;
 
 
         this->context.opt_bitrate.set(40000);
@@ -1205,6 +1253,9 @@ public:
             else if (0 == strcmp(key, "enable_ip_transparent")){
                 this->globals.enable_ip_transparent = bool_from_cstr(value);
             }
+            else if (0 == strcmp(key, "session_prefork")){
+                this->globals.session_prefork = ulong_from_cstr(value);
+            }
             else if (0 == strcmp(key, "certificate_password")){
                 strncpy(this->globals.certificate_password, value, sizeof(this->globals.certificate_password));
                 this->globals.certificate_password[sizeof(this->globals.certificate_password) - 1] = 0;
@@ -1270,9 +1321,24 @@ public:
             else if (0 == strcmp(key, "rdp_compression")){
                 this->client.rdp_compression = bool_from_cstr(value);
             }
+            else if (0 == strcmp(key, "rdp_compression_max_type")){
+                this->client.rdp_compression_max_type = ulong_from_cstr(value);
+            }
+            else if (0 == strcmp(key, "rdp_compression_level")){
+                this->client.rdp_compression_level = ulong_from_cstr(value);
+            }
             else if (0 == strcmp(key, "disable_ctrl_alt_del")){
                 this->client.disable_ctrl_alt_del.set_from_cstr(value);
             }
+            else if (0 == strcmp(key, "bitmap_tiling")){
+                this->client.bitmap_tiling = ulong_from_cstr(value);
+            }
+            else if (0 == strcmp(key, "bitmap_cache_fingerprint")){
+                this->client.bitmap_cache_fingerprint = (0 == strcasecmp(value, "sha1")) ? 1 : 0;
+            }
+            else if (0 == strcmp(key, "bitmap_cache_verify_content")){
+                this->client.bitmap_cache_verify_content = bool_from_cstr(value);
+            }
         }
         else if (0 == strcmp(context, "mod_rdp")){
             if (0 == strcmp(key, "rdp_compression")) {
@@ -1299,6 +1365,26 @@ public:
                 this->mod_vnc.allow_authentification_retries = bool_from_cstr(value);
             }
         }
+        else if (0 == strcmp(context, "bitmap_store")){
+            if (0 == strcmp(key, "enable")) {
+                this->bitmap_store.enable = bool_from_cstr(value);
+            }
+            else if (0 == strcmp(key, "path")) {
+                pathncpy(this->bitmap_store.path, value, sizeof(this->bitmap_store.path));
+            }
+            else if (0 == strcmp(key, "size")) {
+                this->bitmap_store.size = ulong_from_cstr(value);
+            }
+            else if (0 == strcmp(key, "eviction_policy")) {
+                this->bitmap_store.eviction_policy = (0 == strcasecmp(value, "fifo")) ? 1 : 0;
+            }
+            else if (0 == strcmp(key, "log_statistics")) {
+                this->bitmap_store.log_statistics = bool_from_cstr(value);
+            }
+            else {
+                LOG(LOG_ERR, "unknown parameter %s in section [%s]", key, context);
+            }
+        }
         else if (0 == strcmp(context, "video")){
             if (0 == strcmp(key, "capture_flags")){
                 this->video.capture_flags   = ulong_from_cstr(value);
@@ -1328,9 +1414,23 @@ public:
             else if (0 == strcmp(key, "break_interval")){
                 this->video.break_interval   = ulong_from_cstr(value);
             }
+            else if (0 == strcmp(key, "full_image_interval")){
+                this->video.full_image_interval = ulong_from_cstr(value);
+            }
             else if (0 == strcmp(key, "png_limit")){
                 this->video.png_limit   = ulong_from_cstr(value);
             }
+            else if (0 == strcmp(key, "png_compression_level")){
+                const unsigned level = ulong_from_cstr(value);
+                this->video.png_compression_level = (level > 9) ? 9 : level;
+            }
+            else if (0 == strcmp(key, "png_filter")){
+                this->video.png_filter = (0 == strcasecmp(value, "none"))  ? 1
+                                       : (0 == strcasecmp(value, "sub"))   ? 2
+                                       : (0 == strcasecmp(value, "up"))    ? 3
+                                       : (0 == strcasecmp(value, "paeth")) ? 4
+                                       : 0;
+            }
             else if (0 == strcmp(key, "replay_path")){
                 strncpy(this->video.replay_path, value, sizeof(this->video.replay_path));
                 this->video.replay_path[sizeof(this->video.replay_path) - 1] = 0;
@@ -1398,6 +1498,15 @@ public:
                 this->video.disable_keyboard_log_wrm    = 0 != (this->video.disable_keyboard_log.get() & 2);
                 this->video.disable_keyboard_log_ocr    = 0 != (this->video.disable_keyboard_log.get() & 4);
             }
+            else if (0 == strcmp(key, "capture_thread")){
+                this->video.capture_thread        = bool_from_cstr(value);
+            }
+            else if (0 == strcmp(key, "capture_queue_size")){
+                this->video.capture_queue_size    = ulong_from_cstr(value);
+            }
+            else if (0 == strcmp(key, "capture_queue_timeout")){
+                this->video.capture_queue_timeout = ulong_from_cstr(value);
+            }
             else {
                 LOG(LOG_ERR, "unknown parameter %s in section [%s]", key, context);
             }
@@ -189,7 +189,10 @@ enum {
     ERR_VNC_ZLIB_INFLATE,
     ERR_VNC_ZRLE_DATA_TRUNCATED,
     ERR_VNC_ZRLE_PROTOCOL,
+    // unused since ZRLE decoder keeps partial data, kept so that following
+    // error numbers are not changed
     ERR_VNC_NEED_MORE_DATA,
+    ERR_VNC_TIGHT_PROTOCOL,
 
     ERR_XUP_BAD_BPP = 11000,
 
@@ -233,6 +236,7 @@ enum {
     ERR_RECORDER_FILE_CRYPTED,
 
     ERR_RECORDER_SNAPSHOT_FAILED,
+    ERR_RECORDER_THREAD_FAILED,
 
     ERR_BITMAP_LOAD_FAILED = 17000,
     ERR_BITMAP_LOAD_UNKNOWN_TYPE_FILE,
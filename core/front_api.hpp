@@ -61,6 +61,15 @@ class FrontAPI : public DrawApi {
     virtual void send_fastpath_data(Stream & data) {}
 
     virtual void intersect_order_caps(int idx, uint8_t * proxy_order_caps) {}
+
+    // Sends a bitmap update to client as received from server, without
+    // decoding it. Returns false (nothing sent) when client can't use the
+    // payload as it is or when pixels are needed (session capture), caller
+    // then decodes the bitmap and draws it.
+    virtual bool pass_through_bitmap_update( const RDPBitmapData & bitmap_data
+                                           , const uint8_t * data, size_t size) {
+        return false;
+    }
 };
 
 #endif
@@ -36,6 +36,7 @@
 
 #include "log.hpp"
 #include "server.hpp"
+#include "reactor.hpp"
 
 #if !defined(IP_TRANSPARENT)
 #define IP_TRANSPARENT 19
@@ -113,16 +114,13 @@ struct Listen {
 
 
         LOG(LOG_INFO, "Listen: listening on socket %d", this->sck);
-        if (0 != listen(this->sck, 2)) {
+        // a short backlog drops connections arriving in bursts, clients
+        // then only retry after a SYN timeout (1s, 3s, 7s...)
+        if (0 != listen(this->sck, SOMAXCONN)) {
             LOG(LOG_ERR, "Listen: error listening on socket\n");
             goto end_of_listener;
         }
 
-        TODO("We should find a way to generalize the select loop concept "
-             "say select is waiting on a bunch of transport objects or such "
-             "and whenever of of those wake-up it should get a chance to act "
-             "read data, write data, accept incoming connections, perform some task, etc.")
-
         return;
 
         end_of_listener:;
@@ -135,15 +133,14 @@ struct Listen {
 
     TODO("Some values (server, timeout) become only necessary when calling check");
     void run() {
+        Reactor reactor;
+        reactor.add_fd(this->sck);
         while (1) {
-            fd_set rfds;
-            FD_ZERO(&rfds);
-            FD_SET(this->sck, &rfds);
             struct timeval timeout;
             timeout.tv_sec = this->timeout_sec;
             timeout.tv_usec = 0;
 
-            switch (select(this->sck + 1, &rfds, 0, 0, &timeout)){
+            switch (reactor.wait(timeout)){
             default:
                 if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINPROGRESS) || (errno == EINTR)) {
                     continue; /* these are not really errors */
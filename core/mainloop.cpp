@@ -235,7 +235,7 @@ void redemption_main_loop(Inifile & ini, unsigned uid, unsigned gid)
 {
     init_signals();
 
-    SessionServer ss(uid, gid);
+    SessionServer ss(uid, gid, ini.globals.session_prefork);
     //    Inifile ini(CFG_PATH "/" RDPPROXY_INI);
     uint32_t s_addr = inet_addr(ini.globals.listen_address);
     if (s_addr == INADDR_NONE) { s_addr = INADDR_ANY; }
@@ -247,5 +247,6 @@ void redemption_main_loop(Inifile & ini, unsigned uid, unsigned gid)
                      , 60                                 /* timeout sec           */
                      , ini.globals.enable_ip_transparent
                      );
+    ss.prefork(listener.sck);
     listener.run();
 }
@@ -0,0 +1,313 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2013
+   Author(s): Christophe Grosjean
+
+   Event loop waiting on wait_obj, backed by epoll
+*/
+
+#ifndef _REDEMPTION_CORE_REACTOR_HPP_
+#define _REDEMPTION_CORE_REACTOR_HPP_
+
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+#include "log.hpp"
+#include "error.hpp"
+#include "wait_obj.hpp"
+#include "difftimeval.hpp"
+
+// Usage is the same as with select(), each loop:
+//  - watch() every wait_obj that should wake up the loop,
+//  - wait(),
+//  - test wait_obj with is_set().
+//
+// Unlike fd_set, file descriptors stay registered in epoll between loops,
+// epoll_ctl() is only called when a wait_obj is watched for the first time,
+// when its fd changed or when it was not watched during the last loop.
+// Timers of watched objects are kept in a min heap updated when the timer
+// of a wait_obj is set.
+//
+// A wait_obj whose transport already holds received data (read-ahead) is
+// marked with set_ready() after watch(): wait() does not block and the
+// object is set, as the socket may have nothing left for epoll to report.
+class Reactor : public wait_obj_watcher
+{
+    struct Watched {
+        wait_obj * obj;
+        int fd;         // fd registered in epoll, -1 if none
+        bool in_use;    // watched since last wait()
+    };
+
+    struct Timer {
+        timeval trigger;
+        wait_obj * obj;
+        unsigned seq;   // timer_seq of obj when timer was set
+    };
+
+    // heap order: earliest trigger on top
+    struct later {
+        bool operator()(const Timer & a, const Timer & b) const {
+            return lessthantimeval(b.trigger, a.trigger);
+        }
+    };
+
+    enum { MAX_EVENTS = 16 };
+
+    int epfd;
+    std::vector<Watched> watched;
+    std::vector<int> raw_fds;
+    std::vector<Timer> timers;
+    std::vector<int> ready_fds;
+    std::vector<int> pending_fds;   // set_ready() since last wait()
+
+public:
+    unsigned epoll_ctl_count;   // number of epoll_ctl() calls, for tests
+
+    Reactor()
+    : epfd(epoll_create1(EPOLL_CLOEXEC))
+    , epoll_ctl_count(0)
+    {
+        if (this->epfd < 0){
+            LOG(LOG_ERR, "Reactor: epoll_create failed (%s)", strerror(errno));
+            throw Error(ERR_SOCKET_ERROR, errno);
+        }
+    }
+
+    virtual ~Reactor()
+    {
+        for (size_t i = 0; i < this->watched.size(); i++){
+            this->watched[i].obj->watcher = NULL;
+        }
+        close(this->epfd);
+    }
+
+    // Wake up the loop when obj fd is readable or obj timer expires
+    void watch(wait_obj & obj)
+    {
+        Watched * w = this->find(obj);
+        if (!w){
+            if (obj.watcher){
+                LOG(LOG_WARNING, "Reactor: wait_obj already watched by another reactor");
+                return;
+            }
+            Watched entry = { &obj, -1, false };
+            this->watched.push_back(entry);
+            w = &this->watched.back();
+            obj.watcher = this;
+            this->on_timer_changed(obj);
+        }
+        w->in_use = true;
+        int fd = (obj.obj > 0) ? obj.obj : -1;
+        if (fd != w->fd){
+            if (w->fd >= 0){
+                this->ctl(EPOLL_CTL_DEL, w->fd);
+            }
+            if (fd >= 0){
+                this->ctl(EPOLL_CTL_ADD, fd);
+            }
+            w->fd = fd;
+            // having a fd or not changes whether timer is used
+            this->on_timer_changed(obj);
+        }
+    }
+
+    void unwatch(wait_obj & obj)
+    {
+        for (size_t i = 0; i < this->watched.size(); i++){
+            if (this->watched[i].obj == &obj){
+                this->release(i);
+                return;
+            }
+        }
+    }
+
+    // Plain file descriptor (not owned), stays registered until remove_fd()
+    void add_fd(int fd)
+    {
+        this->raw_fds.push_back(fd);
+        this->ctl(EPOLL_CTL_ADD, fd);
+    }
+
+    void remove_fd(int fd)
+    {
+        std::vector<int>::iterator it = std::find(this->raw_fds.begin(), this->raw_fds.end(), fd);
+        if (it != this->raw_fds.end()){
+            this->raw_fds.erase(it);
+            this->ctl(EPOLL_CTL_DEL, fd);
+        }
+    }
+
+    // Data is pending in user space for obj, next wait() returns at once
+    // and obj is set (only meaningful for a wait_obj with a fd)
+    void set_ready(wait_obj & obj)
+    {
+        if (obj.obj > 0){
+            this->pending_fds.push_back(obj.obj);
+        }
+    }
+
+    // Same return value and errno as select()
+    int wait(const timeval & max_timeout)
+    {
+        // objects not watched since last wait() are not interesting anymore
+        for (size_t i = this->watched.size(); i > 0; i--){
+            if (!this->watched[i-1].in_use){
+                this->release(i-1);
+            }
+        }
+        for (size_t i = 0; i < this->watched.size(); i++){
+            this->watched[i].in_use = false;
+        }
+
+        timeval timeout = max_timeout;
+        while (!this->timers.empty()){
+            const Timer & top = this->timers.front();
+            if (top.seq != top.obj->timer_seq || !top.obj->has_timer()){
+                std::pop_heap(this->timers.begin(), this->timers.end(), later());
+                this->timers.pop_back();
+                continue;
+            }
+            timeval remain = how_long_to_wait(top.trigger, tvtime());
+            if (lessthantimeval(remain, timeout)){
+                timeout = remain;
+            }
+            break;
+        }
+
+        // round up, waking up before trigger time would only loop again
+        int timeout_ms = timeout.tv_sec * 1000 + (timeout.tv_usec + 999) / 1000;
+        if (!this->pending_fds.empty()){
+            timeout_ms = 0;
+        }
+
+        this->ready_fds.clear();
+        struct epoll_event events[MAX_EVENTS];
+        int num = epoll_wait(this->epfd, events, MAX_EVENTS, timeout_ms);
+        for (int i = 0; i < num; i++){
+            this->ready_fds.push_back(events[i].data.fd);
+        }
+        if (num >= 0){
+            for (size_t i = 0; i < this->pending_fds.size(); i++){
+                int fd = this->pending_fds[i];
+                if (!this->is_ready(fd)){
+                    this->ready_fds.push_back(fd);
+                    num++;
+                }
+            }
+        }
+        this->pending_fds.clear();
+        return num;
+    }
+
+    bool is_ready(int fd) const
+    {
+        return std::find(this->ready_fds.begin(), this->ready_fds.end(), fd) != this->ready_fds.end();
+    }
+
+    bool is_set(wait_obj & obj)
+    {
+        return obj.is_set((obj.obj > 0) && this->is_ready(obj.obj));
+    }
+
+    size_t nb_timers() const
+    {
+        return this->timers.size();
+    }
+
+    virtual void on_timer_changed(wait_obj & obj)
+    {
+        if (!obj.has_timer()){
+            return;
+        }
+        Timer timer = { obj.trigger_time, &obj, obj.timer_seq };
+        this->timers.push_back(timer);
+        std::push_heap(this->timers.begin(), this->timers.end(), later());
+
+        // drop outdated timers hidden below the top of heap
+        if (this->timers.size() > 4 * this->watched.size() + 16){
+            this->purge_timers(NULL);
+        }
+    }
+
+    virtual void on_destroyed(wait_obj & obj)
+    {
+        // fd must leave epoll before being closed by wait_obj
+        this->unwatch(obj);
+    }
+
+private:
+    Watched * find(const wait_obj & obj)
+    {
+        for (size_t i = 0; i < this->watched.size(); i++){
+            if (this->watched[i].obj == &obj){
+                return &this->watched[i];
+            }
+        }
+        return NULL;
+    }
+
+    void release(size_t i)
+    {
+        Watched w = this->watched[i];
+        this->watched.erase(this->watched.begin() + i);
+        if (w.fd >= 0){
+            this->ctl(EPOLL_CTL_DEL, w.fd);
+        }
+        w.obj->watcher = NULL;
+        this->purge_timers(w.obj);
+    }
+
+    // remove timers of obj and outdated timers
+    void purge_timers(const wait_obj * obj)
+    {
+        size_t j = 0;
+        for (size_t i = 0; i < this->timers.size(); i++){
+            const Timer & t = this->timers[i];
+            if (t.obj != obj && t.seq == t.obj->timer_seq && t.obj->has_timer()){
+                this->timers[j++] = t;
+            }
+        }
+        this->timers.resize(j);
+        std::make_heap(this->timers.begin(), this->timers.end(), later());
+    }
+
+    void ctl(int op, int fd)
+    {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        this->epoll_ctl_count++;
+        if (epoll_ctl(this->epfd, op, fd, &ev) < 0){
+            if (op == EPOLL_CTL_ADD && errno == EEXIST){
+                this->epoll_ctl_count++;
+                epoll_ctl(this->epfd, EPOLL_CTL_MOD, fd, &ev);
+            }
+            // EPOLL_CTL_DEL of an already closed fd fails, epoll forgot it anyway
+            else if (op != EPOLL_CTL_DEL){
+                LOG(LOG_WARNING, "Reactor: epoll_ctl failed on fd %d (%s)", fd, strerror(errno));
+            }
+        }
+    }
+};
+
+#endif
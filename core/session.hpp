@@ -44,6 +44,7 @@
 
 #include "config.hpp"
 #include "wait_obj.hpp"
+#include "reactor.hpp"
 #include "transport.hpp"
 #include "bitmap.hpp"
 
@@ -91,68 +92,43 @@ struct Session {
     SocketTransport * ptr_auth_trans;
     wait_obj        * ptr_auth_event;
 
-    Session(wait_obj & front_event, int sck, Inifile * ini)
+    SocketTransport * front_trans;
+    ModuleManager   * mm;
+    PauseRecord     * pause_record;
+
+    BackEvent_t signal;
+    time_t      start_time;
+    bool        run_session;     // false once session is over
+
+    // Runs the whole session, returns when client is disconnected.
+    // front: built by new_front() before client connected, owned by session
+    Session(wait_obj & front_event, int sck, Inifile * ini, Front * front = NULL)
             : front_event(front_event)
             , ini(ini)
             , verbose(this->ini->debug.session)
+            , front(NULL)
             , acl(NULL)
             , ptr_auth_trans(NULL)
-            , ptr_auth_event(NULL) {
+            , ptr_auth_event(NULL)
+            , front_trans(NULL)
+            , mm(NULL)
+            , pause_record(NULL)
+            , signal(BACK_EVENT_NONE)
+            , start_time(0)
+            , run_session(false) {
         try {
-            SocketTransport front_trans("RDP Client", sck, "", 0, this->ini->debug.front);
-            // Contruct auth_trans (SocketTransport) and auth_event (wait_obj)
-            //  here instead of inside Sessionmanager
-
-            this->ptr_auth_trans = NULL;
-            this->ptr_auth_event = NULL;
-            this->acl            = NULL;
-
-            this->internal_state = SESSION_STATE_ENTRY;
-
-            const bool enable_fastpath = true;
-            const bool mem3blt_support = true;
-
-            this->front = new Front( &front_trans, SHARE_PATH "/" DEFAULT_FONT_NAME, &this->gen
-                                   , ini, enable_fastpath, mem3blt_support
-                                   , ini->client.rdp_compression);
-
-            ModuleManager mm(*this->front, *this->ini);
-            BackEvent_t signal = BACK_EVENT_NONE;
-
-            // Under conditions (if this->ini->video.inactivity_pause == true)
-            PauseRecord pause_record(this->ini->video.inactivity_timeout);
-
-            if (this->verbose) {
-                LOG(LOG_INFO, "Session::session_main_loop() starting");
-            }
-
-            time_t start_time = time(NULL);
+            this->init(sck, this->gen, front);
 
             struct timeval time_mark = { 3, 0 };
 
-            bool run_session = true;
+            // wait_objs stay registered from one loop to the next, only
+            // changes (new module, acl opened or closed...) cost a syscall
+            Reactor reactor;
 
-            while (run_session) {
-                unsigned max = 0;
-                fd_set rfds;
-                fd_set wfds;
+            while (this->run_session) {
+                this->watch(reactor);
 
-                FD_ZERO(&rfds);
-                FD_ZERO(&wfds);
-                struct timeval timeout = time_mark;
-
-                this->front_event.add_to_fd_set(rfds, max, timeout);
-                if (this->front->capture) {
-                    this->front->capture->capture_event.add_to_fd_set(rfds, max, timeout);
-                }
-                TODO("Looks like acl and mod can be unified into a common class, where events can happen");
-                TODO("move ptr_auth_event to acl");
-                if (this->acl) {
-                    this->ptr_auth_event->add_to_fd_set(rfds, max, timeout);
-                }
-                mm.mod->event.add_to_fd_set(rfds, max, timeout);
-
-                int num = select(max + 1, &rfds, &wfds, 0, &timeout);
+                int num = reactor.wait(time_mark);
 
                 if (num < 0) {
                     if (errno == EINTR) {
@@ -164,101 +140,11 @@ struct Session {
                     // ENOMEM: no enough memory in kernel (unlikely fort 3 sockets)
 
                     LOG(LOG_ERR, "Proxy data wait loop raised error %u : %s", errno, strerror(errno));
-                    run_session = false;
+                    this->run_session = false;
                     continue;
                 }
 
-                time_t now = time(NULL);
-                if (this->front_event.is_set(rfds)) {
-                    try {
-                        this->front->incoming(*mm.mod);
-                    } catch (...) {
-                        run_session = false;
-                        continue;
-                    };
-                }
-
-                try {
-                    if (this->front->up_and_running) {
-                        if (this->ini->video.inactivity_pause
-                            && mm.connected
-                            && this->front->capture) {
-                            pause_record.check(now, *this->front);
-                        }
-
-                        // Process incoming module trafic
-                        if (mm.mod->event.is_set(rfds)) {
-                            mm.mod->draw_event(now);
-
-                            if (mm.mod->event.signal != BACK_EVENT_NONE) {
-                                signal = mm.mod->event.signal;
-                                mm.mod->event.reset();
-                            }
-                        }
-                        if (this->front->capture
-                            && this->front->capture->capture_event.is_set(rfds)) {
-                            this->front->periodic_snapshot();
-                        }
-                        // Incoming data from ACL, or opening acl
-                        if (!this->acl) {
-                            if (!mm.last_module) { // acl never opened or closed by me (close box)
-                                try {
-                                    int client_sck = ip_connect(this->ini->globals.authip,
-                                                                this->ini->globals.authport,
-                                                                30,
-                                                                1000,
-                                                                this->ini->debug.auth);
-
-                                    if (client_sck == -1) {
-                                        LOG(LOG_ERR, "Failed to connect to authentifier");
-                                        throw Error(ERR_SOCKET_CONNECT_FAILED);
-                                    }
-
-                                    this->ptr_auth_trans = new SocketTransport( "Authentifier"
-                                                                                , client_sck
-                                                                                , this->ini->globals.authip
-                                                                                , this->ini->globals.authport
-                                                                                , this->ini->debug.auth
-                                                                                );
-                                    this->ptr_auth_event = new wait_obj(this->ptr_auth_trans->sck);
-                                    this->acl = new SessionManager( this->ini
-                                                                    , *this->ptr_auth_trans
-                                                                    , start_time // proxy start time
-                                                                    , now        // acl start time
-                                                                   );
-                                    signal = BACK_EVENT_NEXT;
-                                }
-                                catch (...) {
-                                    mm.invoke_close_box("No authentifier available",signal, now);
-                                }
-                            }
-                        }
-                        else {
-                            if (this->ptr_auth_event->is_set(rfds)) {
-                                // acl received updated values
-                                this->acl->receive();
-                            }
-                        }
-
-                        if (this->acl) {
-                            run_session = this->acl->check(mm, now, front_trans, signal);
-                        }
-                        else if (signal == BACK_EVENT_STOP) {
-                            mm.mod->event.reset();
-                            run_session = false;
-                        }
-                        if (mm.last_module) {
-                            if (this->acl) {
-                                delete this->acl;
-                                this->acl = NULL;
-                            }
-                        }
-                    }
-                } catch (Error & e) {
-                    LOG(LOG_INFO, "Session::Session exception = %d!\n", e.id);
-                    time_t now = time(NULL);
-                    mm.invoke_close_box(e.errmsg(), signal, now);
-                };
+                this->process(reactor);
             }
 
             this->front->disconnect();
@@ -270,26 +156,216 @@ struct Session {
             LOG(LOG_INFO, "Session::Session other exception in Init\n");
         }
         LOG(LOG_INFO, "Session::Client Session Disconnected\n");
-        this->front->stop_capture();
+        if (this->front) {
+            this->front->stop_capture();
+        }
+        // client socket is closed when Session returns
+        this->release_connection();
+    }
+
+    // Front of a session, trans may be given later (see SessionServer
+    // pooled processes): font loading and SSL init are done here
+    static Front * new_front(Transport * trans, Random & gen, Inifile * ini)
+    {
+        const bool enable_fastpath = true;
+        const bool mem3blt_support = true;
+
+        return new Front( trans, SHARE_PATH "/" DEFAULT_FONT_NAME, &gen
+                        , ini, enable_fastpath, mem3blt_support
+                        , ini->client.rdp_compression);
+    }
+
+private:
+    void init(int sck, Random & gen, Front * front = NULL)
+    {
+        this->front = front;
+        this->front_trans = new SocketTransport("RDP Client", sck, "", 0, this->ini->debug.front);
+        // Contruct auth_trans (SocketTransport) and auth_event (wait_obj)
+        //  here instead of inside Sessionmanager
+
+        this->internal_state = SESSION_STATE_ENTRY;
+
+        if (this->front) {
+            this->front->trans = this->front_trans;
+        }
+        else {
+            this->front = new_front(this->front_trans, gen, this->ini);
+        }
+
+        this->mm = new ModuleManager(*this->front, *this->ini);
+
+        // Under conditions (if this->ini->video.inactivity_pause == true)
+        this->pause_record = new PauseRecord(this->ini->video.inactivity_timeout);
+
+        if (this->verbose) {
+            LOG(LOG_INFO, "Session::session_main_loop() starting");
+        }
+
+        this->start_time = time(NULL);
+        this->run_session = true;
     }
 
+public:
+    // Register in reactor every wait_obj that can wake up the session
+    void watch(Reactor & reactor)
+    {
+        reactor.watch(this->front_event);
+        // data already read ahead by transport is not reported by socket
+        if (this->front_trans->has_pending_data()) {
+            reactor.set_ready(this->front_event);
+        }
+        if (this->front->capture) {
+            reactor.watch(this->front->capture->capture_event);
+        }
+        TODO("Looks like acl and mod can be unified into a common class, where events can happen");
+        TODO("move ptr_auth_event to acl");
+        if (this->acl) {
+            reactor.watch(*this->ptr_auth_event);
+            if (this->ptr_auth_trans->has_pending_data()) {
+                reactor.set_ready(*this->ptr_auth_event);
+            }
+        }
+        reactor.watch(this->mm->mod->event);
+        if (this->mm->mod_transport && this->mm->mod_transport->has_pending_data()) {
+            reactor.set_ready(this->mm->mod->event);
+        }
+    }
+
+    // Handle events reported by reactor, clears run_session when session is over
+    void process(Reactor & reactor)
+    {
+        ModuleManager & mm = *this->mm;
+
+        time_t now = time(NULL);
+        if (reactor.is_set(this->front_event)) {
+            try {
+                this->front->incoming(*mm.mod);
+            } catch (...) {
+                this->run_session = false;
+                return;
+            };
+        }
+
+        try {
+            if (this->front->up_and_running) {
+                if (this->ini->video.inactivity_pause
+                    && mm.connected
+                    && this->front->capture) {
+                    this->pause_record->check(now, *this->front);
+                }
+
+                // Process incoming module trafic
+                if (reactor.is_set(mm.mod->event)) {
+                    // everything sent to client during this turn is written at once
+                    TransportBatch batch(*this->front_trans);
+                    mm.mod->draw_event(now);
+
+                    if (mm.mod->event.signal != BACK_EVENT_NONE) {
+                        this->signal = mm.mod->event.signal;
+                        mm.mod->event.reset();
+                    }
+                    batch.end();
+                }
+                if (this->front->capture
+                    && reactor.is_set(this->front->capture->capture_event)) {
+                    this->front->periodic_snapshot();
+                }
+                // Incoming data from ACL, or opening acl
+                if (!this->acl) {
+                    if (!mm.last_module) { // acl never opened or closed by me (close box)
+                        try {
+                            int client_sck = ip_connect(this->ini->globals.authip,
+                                                        this->ini->globals.authport,
+                                                        30,
+                                                        1000,
+                                                        this->ini->debug.auth);
+
+                            if (client_sck == -1) {
+                                LOG(LOG_ERR, "Failed to connect to authentifier");
+                                throw Error(ERR_SOCKET_CONNECT_FAILED);
+                            }
+
+                            this->ptr_auth_trans = new SocketTransport( "Authentifier"
+                                                                        , client_sck
+                                                                        , this->ini->globals.authip
+                                                                        , this->ini->globals.authport
+                                                                        , this->ini->debug.auth
+                                                                        );
+                            this->ptr_auth_event = new wait_obj(this->ptr_auth_trans->sck);
+                            this->acl = new SessionManager( this->ini
+                                                            , *this->ptr_auth_trans
+                                                            , this->start_time // proxy start time
+                                                            , now              // acl start time
+                                                           );
+                            this->signal = BACK_EVENT_NEXT;
+                        }
+                        catch (...) {
+                            mm.invoke_close_box("No authentifier available", this->signal, now);
+                        }
+                    }
+                }
+                else {
+                    if (reactor.is_set(*this->ptr_auth_event)) {
+                        // acl received updated values
+                        this->acl->receive();
+                    }
+                }
+
+                if (this->acl) {
+                    this->run_session = this->acl->check(mm, now, *this->front_trans, this->signal);
+                }
+                else if (this->signal == BACK_EVENT_STOP) {
+                    mm.mod->event.reset();
+                    this->run_session = false;
+                }
+                if (mm.last_module) {
+                    if (this->acl) {
+                        delete this->acl;
+                        this->acl = NULL;
+                    }
+                }
+            }
+        } catch (Error & e) {
+            LOG(LOG_INFO, "Session::Session exception = %d!\n", e.id);
+            // close box is drawn in updates of its own
+            this->front->cancel_update();
+            time_t now = time(NULL);
+            mm.invoke_close_box(e.errmsg(), this->signal, now);
+        };
+    }
+
+private:
+    // Close module and client connection
+    void release_connection()
+    {
+        delete this->pause_record;
+        this->pause_record = NULL;
+        delete this->mm;
+        this->mm = NULL;
+        delete this->front_trans;
+        this->front_trans = NULL;
+    }
+
+public:
     ~Session() {
+        this->release_connection();
         delete this->front;
         if (this->acl) { delete this->acl; }
         if (this->ptr_auth_event) { delete this->ptr_auth_event; }
         if (this->ptr_auth_trans) { delete this->ptr_auth_trans; }
-        // Suppress Session file from disk (original name with PID or renamed with session_id)
-        if (!this->ini->context.session_id.get().is_empty()) {
-            char new_session_file[256];
-            snprintf( new_session_file, sizeof(new_session_file), "%s/session_%s.pid"
-                    , PID_PATH , this->ini->context.session_id.get_cstr());
-            unlink(new_session_file);
-        }
-        else {
-            int child_pid = getpid();
-            char old_session_file[256];
-            sprintf(old_session_file, "%s/session_%d.pid", PID_PATH, child_pid);
-            unlink(old_session_file);
+        // Suppress Session file from disk (original name or renamed with
+        // session_id)
+        if (this->ini->context.session_file_key[0]) {
+            char session_file[256];
+            if (!this->ini->context.session_id.get().is_empty()) {
+                snprintf( session_file, sizeof(session_file), "%s/redemption/session_%s.pid"
+                        , PID_PATH , this->ini->context.session_id.get_cstr());
+            }
+            else {
+                snprintf( session_file, sizeof(session_file), "%s/redemption/session_%s.pid"
+                        , PID_PATH , this->ini->context.session_file_key);
+            }
+            unlink(session_file);
         }
     }
 };
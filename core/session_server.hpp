@@ -21,10 +21,14 @@
 #ifndef _REDEMPTION_CORE_SESSION_SERVER_HPP_
 #define _REDEMPTION_CORE_SESSION_SERVER_HPP_
 
+#include <vector>
+
 #include "config.hpp"
 #include "ssl_calls.hpp"
 #include "server.hpp"
 #include "session.hpp"
+#include "netutils.hpp"
+#include "genrandom.hpp"
 
 class SessionServer : public Server
 {
@@ -32,10 +36,79 @@ class SessionServer : public Server
     unsigned uid;
     unsigned gid;
 
+    // Session process started in advance (ini.globals.session_prefork),
+    // waiting for the client socket sent by listener through a unix socket
+    struct PooledProcess {
+        pid_t pid;
+        int   sck;
+    };
+    unsigned pool_size;
+    std::vector<PooledProcess> pool;
+
+    UdevRandom gen;
+
 public:
-    SessionServer(unsigned uid, unsigned gid) :
+    unsigned long pool_hits;    // connections given to a pooled process
+    unsigned long pool_misses;  // connections that had to wait for a fork
+
+    SessionServer(unsigned uid, unsigned gid, unsigned pool_size = 0) :
         uid(uid)
-        , gid(gid) {
+        , gid(gid)
+        , pool_size(pool_size)
+        , pool_hits(0)
+        , pool_misses(0) {
+    }
+
+    virtual ~SessionServer()
+    {
+        // pooled processes exit when they see listener is gone
+        this->close_pool();
+    }
+
+    // Read configuration of a new session
+    virtual void load_configuration(Inifile & ini)
+    {
+        ConfigurationLoader cfg_loader(ini, CFG_PATH "/" RDPPROXY_INI);
+    }
+
+    // Front built by pooled processes before client is there
+    virtual Front * new_front(Inifile & ini)
+    {
+        return Session::new_front(NULL, this->gen, &ini);
+    }
+
+    // Start missing pooled processes. Called once listening socket is
+    // opened, and again after each connection
+    void prefork(int incoming_sck)
+    {
+        while (this->pool.size() < this->pool_size){
+            int sv[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0){
+                LOG(LOG_ERR, "Error creating socket pair for session process pool : %s\n", strerror(errno));
+                return;
+            }
+            pid_t pid = fork();
+            switch (pid) {
+            case 0: /* child */
+                close(incoming_sck);
+                close(sv[0]);
+                this->close_pool();
+                this->run_pooled_process(sv[1]);
+                _exit(0);
+            case -1:
+                LOG(LOG_ERR, "Error creating process for session process pool : %s\n", strerror(errno));
+                close(sv[0]);
+                close(sv[1]);
+                return;
+            default: /* father */
+                {
+                    close(sv[1]);
+                    PooledProcess process = { pid, sv[0] };
+                    this->pool.push_back(process);
+                }
+                break;
+            }
+        }
     }
 
     virtual Server_status start(int incoming_sck)
@@ -56,115 +129,51 @@ public:
             _exit(1);
         }
 
-        char text[256];
         char source_ip[256];
         int source_port = 0;
-        char target_ip[256];
-        int target_port = 0;
-        char real_target_ip[256];
 
         strcpy(source_ip, inet_ntoa(u.s4.sin_addr));
         source_port = ntohs(u.s4.sin_port);
+
+        while (!this->pool.empty()) {
+            PooledProcess process = this->pool.front();
+            this->pool.erase(this->pool.begin());
+            bool sent = send_fd(process.sck, sck);
+            close(process.sck);
+            if (sent) {
+                close(sck);
+                this->pool_hits++;
+                LOG(LOG_INFO, "Connection from %s given to session process %u (pool hits=%lu misses=%lu)",
+                    source_ip, (unsigned)process.pid, this->pool_hits, this->pool_misses);
+                this->prefork(incoming_sck);
+                return START_OK;
+            }
+            LOG(LOG_WARNING, "Session process %u of pool is gone", (unsigned)process.pid);
+        }
+        this->pool_misses++;
+
         /* start new process */
         pid_t pid = fork();
         switch (pid) {
         case 0: /* child */
             {
                 close(incoming_sck);
+                this->close_pool();
 
                 Inifile ini;
-                ConfigurationLoader cfg_loader(ini, CFG_PATH "/" RDPPROXY_INI);
-                if (ini.debug.session){
-                    LOG(LOG_INFO, "Setting new session socket to %d\n", sck);
-                }
-
-                union
-                {
-                    struct sockaddr s;
-                    struct sockaddr_storage ss;
-                    struct sockaddr_in s4;
-                    struct sockaddr_in6 s6;
-                } localAddress;
-                socklen_t addressLength = sizeof(localAddress);
-
-
-                if (-1 == getsockname(sck, &localAddress.s, &addressLength)){
-                    LOG(LOG_INFO, "getsockname failed error=%s", strerror(errno));
-                    _exit(1);
-                }
-
-                target_port = ntohs(localAddress.s4.sin_port);
-                strcpy(real_target_ip, inet_ntoa(localAddress.s4.sin_addr));
-
-                if (ini.globals.enable_ip_transparent) {
-                    strcpy(target_ip, inet_ntoa(localAddress.s4.sin_addr));
-
-                    LOG(LOG_INFO, "src=%s sport=%d dst=%s dport=%d", source_ip, source_port, target_ip, target_port);
-
-                    int fd = open("/proc/net/ip_conntrack", O_RDONLY);
-                    // source and dest are inverted because we get the information we want from reply path rule
-                    int res = parse_ip_conntrack(fd, target_ip, source_ip, target_port, source_port, real_target_ip, sizeof(real_target_ip), 1);
-                    if (res){
-                        LOG(LOG_WARNING, "Failed to get transparent proxy target from ip_conntrack: %d", fd);
-                    }
-                    close(fd);
-
-                    setgid(this->gid);
-                    setuid(this->uid);
-                }
-
-                LOG(LOG_INFO, "src=%s sport=%d dst=%s dport=%d", source_ip, source_port, real_target_ip, target_port);
-
-                int nodelay = 1;
-                if (0 == setsockopt(sck, IPPROTO_TCP, TCP_NODELAY, (char*)&nodelay, sizeof(nodelay))){
-                    wait_obj front_event(sck);
-                    //                SocketTransport front_trans("RDP Client", sck, ini.debug.front);
-
-                    // Create session file
-                    int child_pid = getpid();
-                    char session_file[256];
-                    sprintf(session_file, "%s/redemption/session_%d.pid", PID_PATH, child_pid);
-                    int fd = open(session_file, O_WRONLY | O_CREAT, S_IRWXU);
-                    if (fd == -1) {
-                        LOG(LOG_ERR, "Writing process id to SESSION ID FILE failed. Maybe no rights ?:%d:%d\n", errno, strerror(errno));
-                        _exit(1);
-                    }
-                    size_t lg = snprintf(text, 255, "%d", child_pid);
-                    if (write(fd, text, lg) == -1) {
-                        LOG(LOG_ERR, "Couldn't write pid to %s: %s", PID_PATH "/redemption/session_<pid>.pid", strerror(errno));
-                        _exit(1);
-                    }
-                    close(fd);
-
-                    // Launch session
-                    LOG(LOG_INFO, "New session on %u (pid=%u) from %s to %s", (unsigned)sck, (unsigned)child_pid, source_ip, real_target_ip);
-                    ini.context_set_value(AUTHID_HOST, source_ip);
-                    ini.context_set_value(AUTHID_TARGET, real_target_ip);
-                    if (ini.globals.enable_ip_transparent
-                        &&  strncmp(target_ip, real_target_ip, strlen(real_target_ip))) {
-                        ini.context_set_value(AUTHID_REAL_TARGET_DEVICE, real_target_ip);
-                    }
-                    Session session(front_event, sck, &ini);
-
-                    // Suppress session file
-                    unlink(session_file);
-
-                    if (ini.debug.session){
-                        LOG(LOG_INFO, "Session::end of Session(%u)", sck);
-                    }
-
-                    shutdown(sck, 2);
-                    close(sck);
-                }
-                else {
-                    LOG(LOG_ERR, "Failed to set socket TCP_NODELAY option on client socket");
-                }
+                this->load_configuration(ini);
+                this->run_session(sck, source_ip, source_port, ini, NULL);
                 return START_WANT_STOP;
             }
             break;
         default: /* father */
             {
                 close(sck);
+                if (this->pool_size) {
+                    LOG(LOG_INFO, "Session process pool empty (pool hits=%lu misses=%lu)",
+                        this->pool_hits, this->pool_misses);
+                }
+                this->prefork(incoming_sck);
             }
             break;
         case -1:
@@ -174,6 +183,153 @@ public:
         }
         return START_FAILED;
     }
+
+private:
+    void close_pool()
+    {
+        for (size_t i = 0; i < this->pool.size(); i++) {
+            close(this->pool[i].sck);
+        }
+        this->pool.clear();
+    }
+
+    // Body of pooled processes: everything that does not depend on client
+    // is done before waiting for client socket
+    void run_pooled_process(int pool_sck)
+    {
+        Inifile ini;
+        this->load_configuration(ini);
+        Front * front = this->new_front(ini);
+
+        int sck = recv_fd(pool_sck);
+        close(pool_sck);
+        if (sck < 0) {
+            // listener is gone
+            delete front;
+            return;
+        }
+
+        union
+        {
+            struct sockaddr s;
+            struct sockaddr_storage ss;
+            struct sockaddr_in s4;
+            struct sockaddr_in6 s6;
+        } u;
+        socklen_t sin_size = sizeof(u);
+        memset(&u, 0, sin_size);
+        if (-1 == getpeername(sck, &u.s, &sin_size)) {
+            LOG(LOG_INFO, "getpeername failed error=%s", strerror(errno));
+            delete front;
+            close(sck);
+            return;
+        }
+
+        char source_ip[256];
+        strcpy(source_ip, inet_ntoa(u.s4.sin_addr));
+        int source_port = ntohs(u.s4.sin_port);
+
+        this->run_session(sck, source_ip, source_port, ini, front);
+    }
+
+protected:
+    // Session on accepted socket sck, front is NULL or made by new_front()
+    // and then owned by session
+    virtual void run_session(int sck, const char * source_ip, int source_port, Inifile & ini, Front * front)
+    {
+        char text[256];
+        char target_ip[256];
+        int target_port = 0;
+        char real_target_ip[256];
+
+        if (ini.debug.session){
+            LOG(LOG_INFO, "Setting new session socket to %d\n", sck);
+        }
+
+        union
+        {
+            struct sockaddr s;
+            struct sockaddr_storage ss;
+            struct sockaddr_in s4;
+            struct sockaddr_in6 s6;
+        } localAddress;
+        socklen_t addressLength = sizeof(localAddress);
+
+
+        if (-1 == getsockname(sck, &localAddress.s, &addressLength)){
+            LOG(LOG_INFO, "getsockname failed error=%s", strerror(errno));
+            _exit(1);
+        }
+
+        target_port = ntohs(localAddress.s4.sin_port);
+        strcpy(real_target_ip, inet_ntoa(localAddress.s4.sin_addr));
+
+        if (ini.globals.enable_ip_transparent) {
+            strcpy(target_ip, inet_ntoa(localAddress.s4.sin_addr));
+
+            LOG(LOG_INFO, "src=%s sport=%d dst=%s dport=%d", source_ip, source_port, target_ip, target_port);
+
+            int fd = open("/proc/net/ip_conntrack", O_RDONLY);
+            // source and dest are inverted because we get the information we want from reply path rule
+            int res = parse_ip_conntrack(fd, target_ip, source_ip, target_port, source_port, real_target_ip, sizeof(real_target_ip), 1);
+            if (res){
+                LOG(LOG_WARNING, "Failed to get transparent proxy target from ip_conntrack: %d", fd);
+            }
+            close(fd);
+
+            setgid(this->gid);
+            setuid(this->uid);
+        }
+
+        LOG(LOG_INFO, "src=%s sport=%d dst=%s dport=%d", source_ip, source_port, real_target_ip, target_port);
+
+        int nodelay = 1;
+        if (0 == setsockopt(sck, IPPROTO_TCP, TCP_NODELAY, (char*)&nodelay, sizeof(nodelay))){
+            wait_obj front_event(sck);
+            //                SocketTransport front_trans("RDP Client", sck, ini.debug.front);
+
+            // Create session file
+            int child_pid = getpid();
+            snprintf(ini.context.session_file_key, sizeof(ini.context.session_file_key), "%d", child_pid);
+            char session_file[256];
+            sprintf(session_file, "%s/redemption/session_%s.pid", PID_PATH, ini.context.session_file_key);
+            int fd = open(session_file, O_WRONLY | O_CREAT, S_IRWXU);
+            if (fd == -1) {
+                LOG(LOG_ERR, "Writing process id to SESSION ID FILE failed. Maybe no rights ?:%d:%d\n", errno, strerror(errno));
+                _exit(1);
+            }
+            size_t lg = snprintf(text, 255, "%d", child_pid);
+            if (write(fd, text, lg) == -1) {
+                LOG(LOG_ERR, "Couldn't write pid to %s: %s", PID_PATH "/redemption/session_<pid>.pid", strerror(errno));
+                _exit(1);
+            }
+            close(fd);
+
+            // Launch session
+            LOG(LOG_INFO, "New session on %u (pid=%u) from %s to %s", (unsigned)sck, (unsigned)child_pid, source_ip, real_target_ip);
+            ini.context_set_value(AUTHID_HOST, source_ip);
+            ini.context_set_value(AUTHID_TARGET, real_target_ip);
+            if (ini.globals.enable_ip_transparent
+                &&  strncmp(target_ip, real_target_ip, strlen(real_target_ip))) {
+                ini.context_set_value(AUTHID_REAL_TARGET_DEVICE, real_target_ip);
+            }
+            Session session(front_event, sck, &ini, front);
+
+            // Suppress session file
+            unlink(session_file);
+
+            if (ini.debug.session){
+                LOG(LOG_INFO, "Session::end of Session(%u)", sck);
+            }
+
+            shutdown(sck, 2);
+            close(sck);
+        }
+        else {
+            LOG(LOG_ERR, "Failed to set socket TCP_NODELAY option on client socket");
+            delete front;
+        }
+    }
 };
 
 #endif
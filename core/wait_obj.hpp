@@ -38,6 +38,15 @@ enum BackEvent_t {
     BACK_EVENT_REFRESH,
 };
 
+class wait_obj;
+
+// Told about changes of the wait_obj it watches (see Reactor)
+struct wait_obj_watcher
+{
+    virtual void on_timer_changed(wait_obj & obj) = 0;
+    virtual void on_destroyed(wait_obj & obj) = 0;
+    virtual ~wait_obj_watcher() {}
+};
 
 class wait_obj
 {
@@ -48,6 +57,8 @@ public:
     struct timeval trigger_time;
     bool           object_and_time;
     bool           waked_up_by_time;
+    wait_obj_watcher * watcher;
+    unsigned       timer_seq;   // changes whenever timer is set or reset
 
     wait_obj(int sck, bool object_and_time = false)
     : obj(sck)
@@ -55,17 +66,28 @@ public:
     , signal(BACK_EVENT_NONE)
     , object_and_time(object_and_time)
     , waked_up_by_time(false)
+    , watcher(NULL)
+    , timer_seq(0)
     {
         this->trigger_time = tvtime();
     }
 
     ~wait_obj()
     {
+        if (this->watcher){
+            this->watcher->on_destroyed(*this);
+        }
         if (this->obj > 0){
             close(this->obj);
         }
     }
 
+    // true if trigger_time must be waited for
+    bool has_timer() const
+    {
+        return ((this->obj <= 0) || this->object_and_time) && this->set_state;
+    }
+
     void add_to_fd_set(fd_set & rfds, unsigned & max, timeval & timeout)
     {
         if (this->obj > 0){
@@ -73,7 +95,7 @@ public:
             max = ((unsigned)this->obj > max)?this->obj:max;
         }
 //        else if (this->set_state) {
-        if (((this->obj <= 0) || this->object_and_time) && this->set_state) {
+        if (this->has_timer()) {
             struct timeval now;
             now = tvtime();
             timeval remain = how_long_to_wait(this->trigger_time, now);
@@ -86,14 +108,21 @@ public:
     void reset()
     {
         this->set_state = false;
+        this->timer_seq++;
     }
 
     bool is_set(fd_set & rfds)
+    {
+        return this->is_set((this->obj > 0) && FD_ISSET(this->obj, &rfds));
+    }
+
+    // fd_ready: data is available on obj
+    bool is_set(bool fd_ready)
     {
         this->waked_up_by_time = false;
 
         if (this->obj > 0) {
-            bool res = FD_ISSET(this->obj, &rfds);
+            bool res = fd_ready;
 
             if (res || !this->object_and_time) {
                 return res;
@@ -124,6 +153,7 @@ public:
         // this->trigger_time.tv_sec = (sum_usec / 1000000) + now.tv_sec;
         // this->trigger_time.tv_usec = sum_usec % 1000000;
         this->trigger_time = addusectimeval(idle_usec, now);
+        this->timer_changed();
     }
 
     // Idle time in microsecond
@@ -134,6 +164,7 @@ public:
             timeval new_trigger = addusectimeval(idle_usec, now);
             if (lessthantimeval(new_trigger, this->trigger_time)) {
                 this->trigger_time = new_trigger;
+                this->timer_changed();
             }
         }
         else {
@@ -141,6 +172,14 @@ public:
         }
     }
 
+    void timer_changed()
+    {
+        this->timer_seq++;
+        if (this->watcher){
+            this->watcher->on_timer_changed(*this);
+        }
+    }
+
     bool can_recv()
     {
         fd_set rfds;
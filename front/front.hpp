@@ -50,9 +50,11 @@
 #include "rect.hpp"
 #include "region.hpp"
 #include "capture.hpp"
+#include "asynccapture.hpp"
 #include "font.hpp"
 #include "bitmap.hpp"
 #include "RDP/caches/bmpcache.hpp"
+#include "RDP/caches/persistentbmpstore.hpp"
 #include "RDP/caches/fontcache.hpp"
 #include "RDP/caches/pointercache.hpp"
 #include "RDP/caches/brushcache.hpp"
@@ -91,6 +93,7 @@ public:
     Capture * capture;
 
     BmpCache * bmp_cache;
+    PersistentBmpStore * bmp_store;
     GraphicsUpdatePDU * orders;
     Keymap2 keymap;
     CHANNELS::ChannelDefArray channel_list;
@@ -166,6 +169,7 @@ public:
         , capture_state(CAPTURE_STATE_UNKNOWN)
         , capture(NULL)
         , bmp_cache(NULL)
+        , bmp_store(NULL)
         , orders(NULL)
         , up_and_running(0)
         , share_id(65538)
@@ -269,6 +273,13 @@ public:
             delete this->bmp_cache;
         }
 
+        if (this->bmp_store) {
+            if (this->ini->bitmap_store.log_statistics) {
+                this->bmp_store->log_statistics();
+            }
+            delete this->bmp_store;
+        }
+
         if (this->orders) {
             delete this->orders;
         }
@@ -487,15 +498,28 @@ public:
             canonical_path(ini.globals.movie_path.get_cstr(), path,
                 sizeof(path), basename, sizeof(basename), extension,
                 sizeof(extension));
-            this->capture = new Capture( now, width, height
-                                       , ini.video.record_path
-                                       , ini.video.record_tmp_path
-                                       , ini.video.hash_path, basename
-                                       , true
-                                       , false
-                                       , authentifier
-                                       , ini
-                                       );
+            if (ini.video.capture_thread) {
+                this->capture = new AsyncCapture( now, width, height
+                                                , ini.video.record_path
+                                                , ini.video.record_tmp_path
+                                                , ini.video.hash_path, basename
+                                                , true
+                                                , false
+                                                , authentifier
+                                                , ini
+                                                );
+            }
+            else {
+                this->capture = new Capture( now, width, height
+                                           , ini.video.record_path
+                                           , ini.video.record_tmp_path
+                                           , ini.video.hash_path, basename
+                                           , true
+                                           , false
+                                           , authentifier
+                                           , ini
+                                           );
+            }
             if (this->nomouse) {
                 this->capture->set_pointer_display();
             }
@@ -572,11 +596,17 @@ public:
             this->mppc_enc = NULL;
         }
         if (this->client_info.rdp_compression) {
-            if (this->client_info.rdp_compression_type >= PACKET_COMPR_TYPE_64K) {
-                this->mppc_enc = new rdp_mppc_50_enc();
+            const int type  = std::min<int>(this->client_info.rdp_compression_type,
+                                            this->ini->client.rdp_compression_max_type);
+            const int level = this->ini->client.rdp_compression_level;
+            if (type >= PACKET_COMPR_TYPE_RDP6) {
+                this->mppc_enc = new rdp_mppc_60_enc(level);
+            }
+            else if (type >= PACKET_COMPR_TYPE_64K) {
+                this->mppc_enc = new rdp_mppc_50_enc(level);
             }
             else {
-                this->mppc_enc = new rdp_mppc_40_enc();
+                this->mppc_enc = new rdp_mppc_40_enc(level);
             }
         }
 
@@ -589,7 +619,24 @@ public:
                         this->client_info.cache2_entries,
                         this->client_info.cache2_size,
                         this->client_info.cache3_entries,
-                        this->client_info.cache3_size);
+                        this->client_info.cache3_size,
+                        (this->ini->client.bitmap_cache_fingerprint == 1)
+                            ? BITMAP_FINGERPRINT_SHA1
+                            : BITMAP_FINGERPRINT_FAST,
+                        this->ini->client.bitmap_cache_verify_content);
+
+        // compressed bitmaps are shared with other sessions only if client uses them
+        if (this->ini->bitmap_store.enable && this->client_info.use_bitmap_comp) {
+            if (!this->bmp_store) {
+                this->bmp_store = new PersistentBmpStore(
+                                this->ini->bitmap_store.path,
+                                this->ini->bitmap_store.size,
+                                (this->ini->bitmap_store.eviction_policy == 1)
+                                    ? PersistentBmpStore::EVICTION_FIFO
+                                    : PersistentBmpStore::EVICTION_LRU);
+            }
+            this->bmp_cache->set_persistent_store(this->bmp_store);
+        }
 
         delete this->orders;
         this->orders = new GraphicsUpdatePDU(
@@ -632,6 +679,10 @@ public:
             LOG(LOG_INFO, "Front::begin_update()");
         }
         this->order_level++;
+        if (this->order_level == 1) {
+            // PDUs of the update are written to client at once by outermost end_update()
+            this->trans->begin_batch();
+        }
     }
 
     virtual void end_update()
@@ -641,14 +692,51 @@ public:
         }
         this->order_level--;
         if (!this->up_and_running) {
+            if (this->order_level == 0) {
+                this->trans->end_batch();
+            }
             LOG(LOG_ERR, "Front is not up and running.");
             throw Error(ERR_RDP_EXPECTING_CONFIRMACTIVEPDU);
         }
         if (this->order_level == 0) {
-            this->flush();
+            try {
+                this->flush();
+            }
+            catch (...) {
+                this->end_update_batch();
+                throw;
+            }
+            this->trans->end_batch();
+        }
+    }
+
+    // Ends updates a mod left open (exception thrown between begin_update()
+    // and end_update()), otherwise nothing would be written to client anymore
+    void cancel_update()
+    {
+        if (this->order_level > 0) {
+            if (this->verbose & 64) {
+                LOG(LOG_INFO, "Front::cancel_update() level=%d", this->order_level);
+            }
+            this->order_level = 0;
+            this->end_update_batch();
         }
     }
 
+private:
+    // batch ends even if its data can't be written, error reported is the
+    // one being handled
+    void end_update_batch()
+    {
+        try {
+            this->trans->end_batch();
+        }
+        catch (...) {
+        }
+    }
+
+public:
+
     void disconnect() throw (Error)
     {
         if (this->verbose & 1){
@@ -3932,10 +4020,107 @@ public:
         }
     }
 
+    // Side of the square tiles used to split bitmaps too large for one client
+    // cache entry. In tiling mode 0 this is always 32, otherwise tiles are as
+    // large as the biggest cache cell negotiated with client (cache entries
+    // can't be used for widths of 128 or more, see draw(RDPMemBlt)).
+    uint16_t bitmap_tile_size() const
+    {
+        if (this->ini->client.bitmap_tiling == 0){
+            return 32;
+        }
+        const uint32_t Bpp = ::nbbytes(this->client_info.bpp);
+        uint16_t tile_size = 64;
+        while (tile_size > 32 && Bpp * tile_size * tile_size > this->client_info.cache3_size){
+            tile_size -= 16;
+        }
+        return tile_size;
+    }
+
+    // In tiling mode 2 MemBlt copying at least half of the screen (full screen
+    // refreshes) are sent as bitmap updates: such bitmaps are seldom reused and
+    // caching them costs one cache order per tile and evicts useful entries.
+    bool use_bitmap_update(const Rect & visible, uint8_t rop) const
+    {
+        return this->ini->client.bitmap_tiling >= 2
+            && rop == 0xCC
+            && this->client_info.bpp != 8
+            && this->client_info.bpp != 32
+            && static_cast<uint32_t>(visible.cx) * visible.cy * 2
+               >= static_cast<uint32_t>(this->client_info.width) * this->client_info.height;
+    }
+
+    void draw_bitmap_update(const Rect & dst, uint16_t srcx, uint16_t srcy, const Bitmap & bitmap)
+    {
+        if (this->verbose & 64){
+            LOG(LOG_INFO, "front::draw:draw_bitmap_update((%u, %u, %u, %u) (%u, %u)",
+                 dst.x, dst.y, dst.cx, dst.cy, srcx, srcy);
+        }
+
+        // every uncompressed tile must fit in one bitmap update packet
+        const uint16_t TILE_CX = 64;
+        const uint16_t TILE_CY = std::min<uint16_t>(64, 7680 / (TILE_CX * ::nbbytes(this->client_info.bpp)));
+
+        BStream stream(TILE_CX * TILE_CY * 4 * 2);
+
+        // orders drawn before must reach client before the bitmaps
+        this->orders->flush_orders();
+
+        for (int y = 0; y < dst.cy ; y += TILE_CY) {
+            int cy = std::min<int>(TILE_CY, dst.cy - y);
+
+            for (int x = 0; x < dst.cx ; x += TILE_CX) {
+                int cx = std::min<int>(TILE_CX, dst.cx - x);
+
+                const Bitmap client_bmp(this->client_info.bpp, bitmap.view(Rect(srcx + x, srcy + y, cx, cy)));
+
+                RDPBitmapData bitmap_data;
+                bitmap_data.dest_left      = dst.x + x;
+                bitmap_data.dest_top       = dst.y + y;
+                bitmap_data.dest_right     = dst.x + x + cx - 1;
+                bitmap_data.dest_bottom    = dst.y + y + cy - 1;
+                bitmap_data.width          = client_bmp.cx;
+                bitmap_data.height         = client_bmp.cy;
+                bitmap_data.bits_per_pixel = client_bmp.original_bpp;
+
+                const uint8_t * data = client_bmp.data();
+                size_t size = client_bmp.bmp_size;
+
+                stream.reset();
+                if (this->client_info.use_bitmap_comp){
+                    client_bmp.compress(stream);
+                }
+                if (stream.get_offset() && stream.get_offset() < size){
+                    data = stream.get_data();
+                    size = stream.get_offset();
+
+                    bitmap_data.flags                  = BITMAP_COMPRESSION;
+                    bitmap_data.bitmap_length          = size + 8; // TS_CD_HEADER
+                    bitmap_data.cb_comp_main_body_size = size;
+                    bitmap_data.cb_scan_width          = client_bmp.line_size;
+                    bitmap_data.cb_uncompressed_size   = client_bmp.bmp_size;
+                }
+                else {
+                    bitmap_data.flags         = 0;
+                    bitmap_data.bitmap_length = size;
+                }
+
+                this->orders->draw(bitmap_data, data, size, client_bmp);
+                if (  this->capture
+                   && (this->capture_state == CAPTURE_STATE_STARTED)){
+                    this->capture->draw(bitmap_data, data, size, client_bmp);
+                }
+                this->bitmap_update_count++;
+            }
+        }
+    }
+
     void draw_vnc(const Rect & rect, const uint8_t bpp, const BGRPalette & palette332, const uint8_t * raw, uint32_t need_size)
     {
-        const uint16_t TILE_CX = 32;
-        const uint16_t TILE_CY = 32;
+        const uint16_t TILE_CX = this->bitmap_tile_size();
+        const uint16_t TILE_CY = TILE_CX;
+
+        const BitmapView vnc_bmp = BitmapView::from_top_down(bpp, &palette332, rect.cx, rect.cy, raw);
 
         for (int y = 0; y < rect.cy ; y += TILE_CY) {
             int cy = std::min(TILE_CY, (uint16_t)(rect.cy - y));
@@ -3946,7 +4131,7 @@ public:
                 const Rect dst_tile(rect.x + x, rect.y + y, cx, cy);
                 const Rect src_tile(x, y, cx, cy);
 
-                const Bitmap tiled_bmp(raw, rect.cx, rect.cy, bpp, src_tile);
+                const BitmapView tiled_bmp = vnc_bmp.sub_view(src_tile);
                 const RDPMemBlt cmd2(0, dst_tile, 0xCC, 0, 0, 0);
                 this->orders->draw(cmd2, dst_tile, tiled_bmp);
                 if (  this->capture
@@ -3974,22 +4159,13 @@ public:
 //        }
 
 
-        if (src_tile == Rect(0, 0, bitmap.cx, bitmap.cy)){
-            const RDPMemBlt cmd2(0, dst_tile, cmd.rop, 0, 0, 0);
-            this->orders->draw(cmd2, clip, bitmap);
-            if (  this->capture
-               && (this->capture_state == CAPTURE_STATE_STARTED)){
-                this->capture->draw(cmd2, clip, bitmap);
-            }
-        }
-        else {
-            const Bitmap tiled_bmp(bitmap, src_tile);
-            const RDPMemBlt cmd2(0, dst_tile, cmd.rop, 0, 0, 0);
-            this->orders->draw(cmd2, clip, tiled_bmp);
-            if (  this->capture
-               && (this->capture_state == CAPTURE_STATE_STARTED)){
-                this->capture->draw(cmd2, clip, tiled_bmp);
-            }
+        // tile pixels are used in place, they are only copied if they go to cache
+        const BitmapView tiled_bmp = bitmap.view(src_tile);
+        const RDPMemBlt cmd2(0, dst_tile, cmd.rop, 0, 0, 0);
+        this->orders->draw(cmd2, clip, tiled_bmp);
+        if (  this->capture
+           && (this->capture_state == CAPTURE_STATE_STARTED)){
+            this->capture->draw(cmd2, clip, tiled_bmp);
         }
     }
 
@@ -4011,8 +4187,8 @@ public:
         }
 
         // if not we have to split it
-        const uint16_t TILE_CX = 32;
-        const uint16_t TILE_CY = 32;
+        const uint16_t TILE_CX = this->bitmap_tile_size();
+        const uint16_t TILE_CY = TILE_CX;
 
         const uint16_t dst_x = cmd.rect.x;
         const uint16_t dst_y = cmd.rect.y;
@@ -4039,6 +4215,16 @@ public:
             const Rect dst_tile(dst_x, dst_y, dst_cx, dst_cy);
             const Rect src_tile(cmd.srcx, cmd.srcy, dst_cx, dst_cy);
             this->draw_tile(dst_tile, src_tile, cmd, bitmap, clip);
+            return;
+        }
+
+        const Rect visible = Rect(dst_x, dst_y, dst_cx, dst_cy).intersect(clip)
+                           .intersect(this->client_info.width, this->client_info.height);
+        if (visible.isempty()){
+            return;
+        }
+        if (this->use_bitmap_update(visible, cmd.rop)){
+            this->draw_bitmap_update(visible, cmd.srcx + (visible.x - dst_x), cmd.srcy + (visible.y - dst_y), bitmap);
         }
         else {
             for (int y = 0; y < dst_cy ; y += TILE_CY) {
@@ -4073,42 +4259,22 @@ public:
         const BGRColor back_color24 = color_decode_opaquerect(cmd.back_color, this->mod_bpp, this->mod_palette);
         const BGRColor fore_color24 = color_decode_opaquerect(cmd.fore_color, this->mod_bpp, this->mod_palette);
 
-        if (src_tile == Rect(0, 0, bitmap.cx, bitmap.cy)){
-            RDPMem3Blt cmd2(0, dst_tile, cmd.rop, 0, 0, cmd.back_color, cmd.fore_color, cmd.brush, 0);
-
-            if (this->client_info.bpp != this->mod_bpp){
-                cmd2.back_color= color_encode(back_color24, this->client_info.bpp);
-                cmd2.fore_color= color_encode(fore_color24, this->client_info.bpp);
-                // this may change the brush add send it to to remote cache
-            }
+        const BitmapView tiled_bmp = bitmap.view(src_tile);
+        RDPMem3Blt cmd2(0, dst_tile, cmd.rop, 0, 0, cmd.back_color, cmd.fore_color, cmd.brush, 0);
 
-            this->orders->draw(cmd2, clip, bitmap);
-            if (  this->capture
-               && (this->capture_state == CAPTURE_STATE_STARTED)){
-                cmd2.back_color= back_color24;
-                cmd2.fore_color= fore_color24;
-
-                this->capture->draw(cmd2, clip, bitmap);
-            }
+        if (this->client_info.bpp != this->mod_bpp){
+            cmd2.back_color= color_encode(back_color24, this->client_info.bpp);
+            cmd2.fore_color= color_encode(fore_color24, this->client_info.bpp);
+            // this may change the brush add send it to to remote cache
         }
-        else {
-            const Bitmap tiled_bmp(bitmap, src_tile);
-            RDPMem3Blt cmd2(0, dst_tile, cmd.rop, 0, 0, cmd.back_color, cmd.fore_color, cmd.brush, 0);
-
-            if (this->client_info.bpp != this->mod_bpp){
-                cmd2.back_color= color_encode(back_color24, this->client_info.bpp);
-                cmd2.fore_color= color_encode(fore_color24, this->client_info.bpp);
-                // this may change the brush add send it to to remote cache
-            }
 
-            this->orders->draw(cmd2, clip, tiled_bmp);
-            if (  this->capture
-               && (this->capture_state == CAPTURE_STATE_STARTED)){
-                cmd2.back_color= back_color24;
-                cmd2.fore_color= fore_color24;
+        this->orders->draw(cmd2, clip, tiled_bmp);
+        if (  this->capture
+           && (this->capture_state == CAPTURE_STATE_STARTED)){
+            cmd2.back_color= back_color24;
+            cmd2.fore_color= fore_color24;
 
-                this->capture->draw(cmd2, clip, tiled_bmp);
-            }
+            this->capture->draw(cmd2, clip, tiled_bmp);
         }
     }
 
@@ -4130,8 +4296,8 @@ public:
         }
 
         // if not we have to split it
-        const uint16_t TILE_CX = 32;
-        const uint16_t TILE_CY = 32;
+        const uint16_t TILE_CX = this->bitmap_tile_size();
+        const uint16_t TILE_CY = TILE_CX;
 
         const uint16_t dst_x = cmd.rect.x;
         const uint16_t dst_y = cmd.rect.y;
@@ -4503,9 +4669,37 @@ public:
         proxy_order_caps[idx] &= this->client_order_caps.orderSupport[idx];
     }
 
+    // Payload of bitmap update can be sent to client as it is: same color
+    // depth and compressed only if client supports bitmap compression.
+    bool bitmap_update_accepted(const RDPBitmapData & bitmap_data) const
+    {
+        return bitmap_data.bits_per_pixel == this->client_info.bpp
+            && (!(bitmap_data.flags & BITMAP_COMPRESSION) || this->client_info.use_bitmap_comp);
+    }
+
+    virtual bool pass_through_bitmap_update( const RDPBitmapData & bitmap_data
+                                           , const uint8_t * data, size_t size) {
+        if (  (this->capture && (this->capture_state == CAPTURE_STATE_STARTED))
+           || !this->bitmap_update_accepted(bitmap_data)) {
+            return false;
+        }
+        this->orders->flush_orders();
+        this->orders->send_bitmap_data(bitmap_data, data, size);
+        return true;
+    }
+
     virtual void draw(const RDPBitmapData & bitmap_data, const uint8_t * data
                      , size_t size, const Bitmap & bmp) {
 //        LOG(LOG_INFO, "Front::draw(BitmapUpdate)");
+        if (!this->bitmap_update_accepted(bitmap_data)) {
+            // converted (and compressed again) for client
+            const Rect dst( bitmap_data.dest_left, bitmap_data.dest_top
+                          , std::min<int>(bitmap_data.dest_right - bitmap_data.dest_left + 1, bmp.cx)
+                          , std::min<int>(bitmap_data.dest_bottom - bitmap_data.dest_top + 1, bmp.cy));
+            this->draw_bitmap_update(dst, 0, 0, bmp);
+            return;
+        }
+        this->orders->flush_orders();
         this->orders->draw(bitmap_data, data, size, bmp);
         if (  this->capture
            && (this->capture_state == CAPTURE_STATE_STARTED)) {
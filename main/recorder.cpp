@@ -35,6 +35,7 @@
 #include "inbymetasequencetransport.hpp"
 #include "capture.hpp"
 #include "FileToGraphic.hpp"
+#include "parallelreplay.hpp"
 
 
 int main(int argc, char** argv)
@@ -62,6 +63,7 @@ int main(int argc, char** argv)
     uint32_t wrm_break_interval = 86400;
     uint32_t order_count = 0;
     unsigned zoom = 100;
+    unsigned jobs = 1;
 
     boost::program_options::options_description desc("Options");
     desc.add_options()
@@ -86,6 +88,7 @@ int main(int argc, char** argv)
     ("clear", boost::program_options::value<uint32_t>(&clear), "Clear old capture files with same prefix (default on)")
     ("verbose", boost::program_options::value<uint32_t>(&verbose), "more logs")
     ("zoom", boost::program_options::value<uint32_t>(&zoom), "scaling factor for png capture (default 100%)")
+    ("jobs,j", boost::program_options::value<uint32_t>(&jobs), "number of wrm files decoded in parallel for png capture (default 1)")
     ;
 
     Inifile ini;
@@ -132,11 +135,6 @@ int main(int argc, char** argv)
         exit(-1);
     };
 
-    timeval begin_capture;
-    begin_capture.tv_sec = begin_cap; begin_capture.tv_usec = 0;
-    timeval end_capture;
-    end_capture.tv_sec = end_cap; end_capture.tv_usec = 0;
-
     char infile_path[1024];
     char infile_basename[1024];
     char infile_extension[128];
@@ -156,11 +154,8 @@ int main(int argc, char** argv)
 //    InByFilenameTransport in_wrm_trans(input_filename.c_str());
     TODO("before continuing to work with input file, check if it's mwrm or wrm and use right object in both cases")
 
-    TODO("also check if it contains any wrm at all and at wich one we should start depending on input time")
     TODO("if start and stop time are outside wrm, users should also be warned")
 
-
-    unsigned count = 0;
     try {
         InByMetaSequenceTransport in_wrm_trans_tmp(infile_prefix, infile_extension);
         in_wrm_trans_tmp.next_chunk_info();
@@ -170,14 +165,13 @@ int main(int argc, char** argv)
             // begin_capture.tv_usec is 0
             begin_cap += in_wrm_trans_tmp.begin_chunk_time;
         }
-        if (end_cap < 31536000){ // less than 1 year, it is relative not absolute timestamp
+        if (end_cap && (end_cap < 31536000)){ // less than 1 year, it is relative not absolute timestamp, 0 is none
             // begin_capture.tv_usec is 0
             end_cap += in_wrm_trans_tmp.begin_chunk_time;
         }
         while (begin_cap >= in_wrm_trans_tmp.end_chunk_time){
             in_wrm_trans_tmp.next_chunk_info();
         }
-        count = in_wrm_trans_tmp.chunk_num;
     }
     catch (const Error & e) {
         if (e.id == static_cast<unsigned>(ERR_TRANSPORT_NO_MORE_DATA)){
@@ -186,13 +180,10 @@ int main(int argc, char** argv)
         exit(-1);
     };
 
-    InByMetaSequenceTransport in_wrm_trans(infile_prefix, infile_extension);
-    for (unsigned i = 1; i < count ; i++){
-        in_wrm_trans.next_chunk_info();
-    }
-
-    FileToGraphic player(&in_wrm_trans, begin_capture, end_capture, false, verbose);
-    player.max_order_count = order_count;
+    timeval begin_capture;
+    begin_capture.tv_sec = begin_cap; begin_capture.tv_usec = 0;
+    timeval end_capture;
+    end_capture.tv_sec = end_cap; end_capture.tv_usec = 0;
 
     const char * outfile_fullpath = output_filename.c_str();
     char outfile_path[1024];
@@ -209,6 +200,27 @@ int main(int argc, char** argv)
         clear_files_flv_meta_png(outfile_path, outfile_basename);
     }
 
+    int return_code = 0;
+
+    REDOC("wrm files are decoded in parallel only for png capture: a wrm capture is"
+          " one sequence and orders count is counted from the beginning of the movie")
+    if ((jobs > 1) && (ini.video.png_limit > 0) && !ini.video.capture_wrm && !order_count) {
+        try {
+            ParallelReplay replay( infile_prefix, infile_extension, begin_capture, end_capture
+                                 , outfile_path, outfile_basename, zoom, jobs, ini, verbose);
+            return_code = replay.play();
+        }
+        catch (Error e) {
+            return_code = -1;
+        }
+        return return_code;
+    }
+
+    // player starts from the wrm file containing begin_capture
+    InByMetaSequenceTransport in_wrm_trans(infile_prefix, infile_extension);
+    FileToGraphic player(&in_wrm_trans, begin_capture, end_capture, false, verbose);
+    player.max_order_count = order_count;
+
     Capture capture( player.record_now, player.screen_rect.cx, player.screen_rect.cy
                    , outfile_path, outfile_path, ini.video.hash_path, outfile_basename, false
                    , false, NULL, ini);
@@ -217,7 +229,6 @@ int main(int argc, char** argv)
     }
     player.add_consumer(&capture);
 
-    int return_code = 0;
     try {
         player.play();
     }
@@ -218,7 +218,11 @@ int main(int argc, char * argv[]) {
                 front_event.add_to_fd_set(rfds, max, timeout);
                 mod.event.add_to_fd_set(rfds, max, timeout);
 
-                if (mod.event.is_set(rfds)) {
+                // data already read ahead by transports is not signaled by select
+                const bool front_pending = front_trans.has_pending_data();
+                const bool mod_pending   = mod_trans.has_pending_data();
+
+                if (mod.event.is_set(rfds) || front_pending || mod_pending) {
                     timeout.tv_sec  = 0;
                     timeout.tv_usec = 0;
                 }
@@ -234,7 +238,7 @@ int main(int argc, char * argv[]) {
                     break;
                 }
 
-                if (front_event.is_set(rfds)) {
+                if (front_pending || front_event.is_set(rfds)) {
                     try {
                         front.incoming(mod);
                     }
@@ -245,7 +249,8 @@ int main(int argc, char * argv[]) {
                 }
 
                 if (front.up_and_running) {
-                    if (mod.event.is_set(rfds)) {
+                    if (mod_pending || mod.event.is_set(rfds)) {
+                        TransportBatch batch(front_trans);
                         mod.draw_event(time(NULL));
                         if (mod.event.signal != BACK_EVENT_NONE) {
                             mod_event_signal = mod.event.signal;
@@ -257,6 +262,7 @@ int main(int argc, char * argv[]) {
                         if (mod_event_signal == BACK_EVENT_NEXT) {
                             run_session = false;
                         }
+                        batch.end();
                     }
                 }
             } catch (Error & e) {
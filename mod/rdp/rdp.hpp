@@ -151,6 +151,10 @@ struct mod_rdp : public mod_api {
     bool enable_transparent_mode;
 
     size_t recv_bmp_update;
+    // bitmap update rectangles sent to front without being decoded, and
+    // decoded ones (session capture or color depth conversion)
+    size_t passed_through_bmp_update;
+    size_t decoded_bmp_update;
 
     rdp_mppc_unified_dec mppc_dec;
 
@@ -239,6 +243,8 @@ struct mod_rdp : public mod_api {
         , enable_rdp_bulk_compression(enable_rdp_bulk_compression)
         , enable_transparent_mode(enable_transparent_mode)
         , recv_bmp_update(0)
+        , passed_through_bmp_update(0)
+        , decoded_bmp_update(0)
         , error_message(error_message)
         , disconnect_on_logon_user_change(disconnect_on_logon_user_change)
         , open_session_timeout(open_session_timeout)
@@ -380,6 +386,8 @@ struct mod_rdp : public mod_api {
                 this->orders.recv_order_count);
             LOG(LOG_INFO, "~mod_rdp(): Recv bmp update count = %llu",
                 this->recv_bmp_update);
+            LOG(LOG_INFO, "~mod_rdp(): Passed through bmp update rectangles = %llu, decoded = %llu",
+                this->passed_through_bmp_update, this->decoded_bmp_update);
         }
     }
 
@@ -4308,6 +4316,19 @@ public:
                 //                    bufsize, bitmap.bmp_size, width, height, bpp);
                 //            }
                 const uint8_t * data = stream.in_uint8p(bmpdata.bitmap_size());
+
+            TODO("this is to protect rdesktop different color depth works with mstsc and xfreerdp");
+            const bool same_bpp = this->enable_bitmap_update
+                               && (bmpdata.bits_per_pixel == this->front_bpp)
+                               && !((bmpdata.bits_per_pixel == 8) && (this->front_bpp != 8));
+
+            // pixels are only needed when front can't send payload as it is
+            if (same_bpp && this->front.pass_through_bitmap_update(bmpdata, data, bmpdata.bitmap_size())) {
+                this->passed_through_bmp_update++;
+                continue;
+            }
+            this->decoded_bmp_update++;
+
             Bitmap bitmap( bmpdata.bits_per_pixel
                            , &this->orders.global_palette
                            , bmpdata.width
@@ -4340,10 +4361,7 @@ public:
                      );
             }
 
-            TODO("this is to protect rdesktop different color depth works with mstsc and xfreerdp");
-            if (!this->enable_bitmap_update
-               || (bmpdata.bits_per_pixel != this->front_bpp)
-               || ((bmpdata.bits_per_pixel == 8) && (this->front_bpp != 8))) {
+            if (!same_bpp) {
                 this->front.draw(RDPMemBlt(0, boundary, 0xCC, 0, 0, 0), boundary, bitmap);
             }
             else {
@@ -4410,7 +4428,7 @@ public:
 
     virtual void end_update()
     {
-        this->front.begin_update();
+        this->front.end_update();
     }
 
     virtual void draw(const RDPGlyphCache & cmd)
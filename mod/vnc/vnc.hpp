@@ -47,13 +47,15 @@
 #include "internal/internal_mod.hpp"
 #include "internal/widget2/notify_api.hpp"
 
+#include "zrle.hpp"
+
 // got extracts of VNC documentation from
 // http://tigervnc.sourceforge.net/cgi-bin/rfbproto
 
 #define MAX_VNC_2_RDP_CLIP_DATA_SIZE 8000
 
 //###############################################################################################################
-struct mod_vnc : public InternalMod, public NotifyApi {
+struct mod_vnc : public InternalMod, public NotifyApi, public ZRLEDrawApi {
 //###############################################################################################################
     FlatVNCAuthentification challenge;
 
@@ -93,7 +95,15 @@ struct mod_vnc : public InternalMod, public NotifyApi {
 
     bool opt_clipboard;  // true clipboard available, false clipboard unavailable
 
-    z_stream zstrm;
+    ZRLEDecoder zrle;
+
+    // Tight zlib streams, they last as long as the connection
+    z_stream tight_zstrm[4];
+
+    // Adjacent solid tiles (ZRLE, Hextile, Tight fill) of the same color not
+    // sent yet, they are drawn as a single OpaqueRect
+    Rect     solid_tiles_rect;
+    uint32_t solid_tiles_color;
 
     enum {
         ASK_PASSWORD,
@@ -139,17 +149,19 @@ struct mod_vnc : public InternalMod, public NotifyApi {
             , incr(0)
             , to_vnc_large_clipboard_data(2 * MAX_VNC_2_RDP_CLIP_DATA_SIZE + 2)
             , opt_clipboard(clipboard)
+            , solid_tiles_color(0)
             , state(WAIT_SECURITY_TYPES)
             , ini(ini)
             , allow_authentification_retries(allow_authentification_retries || !(*password)) {
     //--------------------------------------------------------------------------------------------------------------
         LOG(LOG_INFO, "Creation of new mod 'VNC'");
 
-        memset(&zstrm, 0, sizeof(zstrm));
-        if (inflateInit(&this->zstrm) != Z_OK)
-        {
-            LOG(LOG_ERR, "vnc zlib initialization failed");
-            throw Error(ERR_VNC_ZLIB_INITIALIZATION);
+        for (int i = 0; i < 4; i++) {
+            memset(&this->tight_zstrm[i], 0, sizeof(this->tight_zstrm[i]));
+            if (inflateInit(&this->tight_zstrm[i]) != Z_OK) {
+                LOG(LOG_ERR, "vnc zlib initialization failed");
+                throw Error(ERR_VNC_ZLIB_INITIALIZATION);
+            }
         }
 
         init_palette332(this->palette332);
@@ -178,7 +190,9 @@ struct mod_vnc : public InternalMod, public NotifyApi {
     //==============================================================================================================
     virtual ~mod_vnc()
     {
-        inflateEnd(&this->zstrm);
+        for (int i = 0; i < 4; i++) {
+            inflateEnd(&this->tight_zstrm[i]);
+        }
 
         this->screen.clear();
     }
@@ -891,396 +905,457 @@ struct mod_vnc : public InternalMod, public NotifyApi {
     } // draw_event
 
     private:
-    struct ZRLEUpdateContext
+    // Pixels are little endian values, with 15 or 16 bpp true colors they can
+    // be used as RDP orders colors
+    bool native_orders() const
     {
-        uint8_t Bpp;
-
-        uint16_t x;
-        uint16_t cx;
-
-        uint16_t cx_remain;
-        uint16_t cy_remain;
+        return (this->bpp == 15) || (this->bpp == 16);
+    }
 
-        uint16_t tile_x;
-        uint16_t tile_y;
+    void flush_solid_tiles()
+    {
+        if (!this->solid_tiles_rect.isempty()) {
+            const RDPOpaqueRect orect(this->solid_tiles_rect, this->solid_tiles_color);
+            this->front.begin_update();
+            this->front.draw(orect, Rect(0, 0, this->front_width, this->front_height));
+            this->front.end_update();
 
-        BStream data_remain;
+            this->solid_tiles_rect = Rect();
+        }
+    }
 
-        ZRLEUpdateContext() : data_remain(16384) {}
-    };
-    void lib_framebuffer_update_zrle(HStream & uncompressed_data_buffer,
-        ZRLEUpdateContext & update_context)
+    // Sends tile as an OpaqueRect, merged with previous solid tile when they
+    // are adjacent. Returns false when pixels are not usable as orders colors.
+    bool solid_tile(const Rect & tile, uint32_t color)
     {
-        if (this->verbose) {
-            LOG(LOG_INFO,
-                "VNC Encoding: ZRLE, uncompressed length=%lu remaining data size=%lu",
-                uncompressed_data_buffer.in_remain(),
-                update_context.data_remain.size());
+        if (!this->native_orders()) {
+            return false;
         }
 
-        if (update_context.data_remain.size())
-        {
-            uncompressed_data_buffer.copy_to_head(
-                update_context.data_remain.get_data(),
-                update_context.data_remain.size());
-            uncompressed_data_buffer.p = uncompressed_data_buffer.get_data();
-
-            update_context.data_remain.reset();
+        Rect & solid_rect = this->solid_tiles_rect;
+        if (!solid_rect.isempty()
+        && (this->solid_tiles_color == color)
+        && (solid_rect.y == tile.y) && (solid_rect.cy == tile.cy)
+        && (solid_rect.x + solid_rect.cx == tile.x)) {
+            solid_rect.cx += tile.cx;
+            return true;
         }
 
-        uint16_t   tile_cx;
-        uint16_t   tile_cy;
-        uint8_t    tile_data[16384];    // max size with 16 bpp
-        uint16_t   tile_data_length;
-        uint16_t   tile_data_length_remain;
-
-        uint8_t  * remaining_data        = NULL;
-        uint16_t   remaining_data_length = 0;
-        uint8_t    subencoding           = 127;     // Unauthorized value
-
-        try
-        {
-            while (uncompressed_data_buffer.in_remain())
-            {
-                tile_cx = std::min<uint16_t>(update_context.cx_remain, 64);
-                tile_cy = std::min<uint16_t>(update_context.cy_remain, 64);
+        this->flush_solid_tiles();
+        solid_rect              = tile;
+        this->solid_tiles_color = color;
+        return true;
+    }
 
-                const uint8_t * tile_data_p = tile_data;
+    virtual bool draw_zrle_solid_tile(const Rect & tile, uint32_t color)
+    {
+        return this->solid_tile(tile, color);
+    }
 
-                tile_data_length = tile_cx * tile_cy * update_context.Bpp;
-                if (tile_data_length > sizeof(tile_data))
-                {
-                    LOG(LOG_ERR,
-                        "VNC Encoding: ZRLE, tile buffer too small (%u < %u)",
-                        sizeof(tile_data), tile_data_length);
-                    throw Error(ERR_BUFFER_TOO_SMALL);
-                }
+    virtual void draw_zrle_tile(const Rect & tile, const uint8_t * pixels, size_t length,
+                                const uint8_t * two_colors_palette)
+    {
+        this->flush_solid_tiles();
 
-                remaining_data        = uncompressed_data_buffer.p;
-                remaining_data_length = uncompressed_data_buffer.in_remain();
+        if (!two_colors_palette || !this->native_orders()
+        || !this->two_colors_orders(tile, pixels, two_colors_palette)) {
+            this->front.begin_update();
+            this->front.draw_vnc(tile, this->bpp, this->palette332, pixels, length);
+            this->front.end_update();
+        }
+    }
 
-                subencoding = uncompressed_data_buffer.in_uint8();
+    // Draws a tile using only two colors as a background OpaqueRect and
+    // OpaqueRects for the runs of the other color, returns false (nothing
+    // drawn) when it takes too many orders.
+    bool two_colors_orders(const Rect & tile, const uint8_t * pixels, const uint8_t * palette)
+    {
+        enum { MAX_FOREGROUND_RECTS = 16 };
 
-                if (this->verbose) {
-                    LOG(LOG_INFO, "VNC Encoding: ZRLE, subencoding = %d",
-                        subencoding);
-                }
+        uint16_t back_color = palette[0] | (palette[1] << 8);
+        uint16_t fore_color = palette[2] | (palette[3] << 8);
 
-                if (!subencoding)
-                {
-                    if (this->verbose) {
-                        LOG(LOG_INFO, "VNC Encoding: ZRLE, Raw pixel data");
-                    }
+        const uint32_t nb_pixels = tile.cx * tile.cy;
+        uint32_t       nb_fore   = 0;
+        for (uint32_t i = 0; i < nb_pixels; i++) {
+            nb_fore += ((pixels[i * 2] | (pixels[i * 2 + 1] << 8)) == fore_color);
+        }
+        if (nb_fore * 2 > nb_pixels) {
+            std::swap(back_color, fore_color);
+        }
 
-                    if (uncompressed_data_buffer.in_remain() < tile_data_length)
-                    {
-                        throw Error(ERR_VNC_NEED_MORE_DATA);
-                    }
+        Rect   rects[MAX_FOREGROUND_RECTS];
+        size_t nb_rects = 0;
 
-                    tile_data_p = uncompressed_data_buffer.in_uint8p(tile_data_length);
+        for (uint16_t y = 0; y < tile.cy; y++) {
+            const uint8_t * line = pixels + y * tile.cx * 2;
+            uint16_t x = 0;
+            while (x < tile.cx) {
+                if ((line[x * 2] | (line[x * 2 + 1] << 8)) != fore_color) {
+                    x++;
+                    continue;
+                }
+                const uint16_t run_x = x;
+                while ((x < tile.cx) && ((line[x * 2] | (line[x * 2 + 1] << 8)) == fore_color)) {
+                    x++;
                 }
-                else if (subencoding == 1)
-                {
-                    if (this->verbose) {
-                        LOG(LOG_INFO,
-                            "VNC Encoding: ZRLE, Solid tile (single color)");
-                    }
-
-                    if (uncompressed_data_buffer.in_remain() < update_context.Bpp)
-                    {
-                        throw Error(ERR_VNC_NEED_MORE_DATA);
-                    }
-
-                    const uint8_t * cpixel_pattern = uncompressed_data_buffer.in_uint8p(update_context.Bpp);
-
-                    uint8_t * tmp_tile_data = tile_data;
-
-                    for (int i = 0; i < tile_cx; i++, tmp_tile_data += update_context.Bpp)
-                        memcpy(tmp_tile_data, cpixel_pattern, update_context.Bpp);
-
-                    uint16_t line_size = tile_cx * update_context.Bpp;
 
-                    for (int i = 1; i < tile_cy; i++, tmp_tile_data += line_size)
-                        memcpy(tmp_tile_data, tile_data, line_size);
+                // same columns run on previous line extends its rect
+                size_t i = 0;
+                while ((i < nb_rects)
+                && ((rects[i].x != tile.x + run_x) || (rects[i].cx != x - run_x)
+                   || (rects[i].y + rects[i].cy != tile.y + y))) {
+                    i++;
                 }
-                else if ((subencoding >= 2) && (subencoding <= 16))
-                {
-                    if (this->verbose) {
-                        LOG(LOG_INFO,
-                            "VNC Encoding: ZRLE, Packed palette types, "
-                                "palette size=%d",
-                            subencoding);
-                    }
+                if (i < nb_rects) {
+                    rects[i].cy++;
+                }
+                else if (nb_rects < MAX_FOREGROUND_RECTS) {
+                    rects[nb_rects++] = Rect(tile.x + run_x, tile.y + y, x - run_x, 1);
+                }
+                else {
+                    return false;
+                }
+            }
+        }
 
-                    const uint8_t  * palette;
-                    const uint8_t    palette_count = subencoding;
-                    const uint16_t   palette_size  = palette_count * update_context.Bpp;
+        const Rect clip(0, 0, this->front_width, this->front_height);
+        this->front.begin_update();
+        this->front.draw(RDPOpaqueRect(tile, back_color), clip);
+        for (size_t i = 0; i < nb_rects; i++) {
+            this->front.draw(RDPOpaqueRect(rects[i], fore_color), clip);
+        }
+        this->front.end_update();
+        return true;
+    }
 
-                    if (uncompressed_data_buffer.in_remain() < palette_size)
-                    {
-                        throw Error(ERR_VNC_NEED_MORE_DATA);
-                    }
+    static uint32_t pixel_value(const uint8_t * pixel, uint8_t Bpp)
+    {
+        uint32_t value = 0;
+        for (uint8_t i = 0; i < Bpp; i++) {
+            value |= pixel[i] << (i * 8);
+        }
+        return value;
+    }
 
-                    palette = uncompressed_data_buffer.in_uint8p(palette_size);
+    static void out_pixel(uint8_t * dest, uint32_t value, uint8_t Bpp)
+    {
+        for (uint8_t i = 0; i < Bpp; i++) {
+            dest[i] = value >> (i * 8);
+        }
+    }
 
-                    uint16_t   packed_pixels_length;
+    static void fill_pixels(uint8_t * dest, const uint8_t * pixel, uint8_t Bpp, size_t count)
+    {
+        for (uint8_t * end = dest + count * Bpp; dest < end; dest += Bpp) {
+            memcpy(dest, pixel, Bpp);
+        }
+    }
 
-                    if (palette_count == 2)
-                    {
-                        packed_pixels_length = (tile_cx + 7) / 8 * tile_cy;
-                    }
-                    else if ((palette_count == 3) || (palette_count == 4))
-                    {
-                        packed_pixels_length = (tile_cx + 3) / 4 * tile_cy;
-                    }
-                    else// if ((palette_count >= 5) && (palette_count <= 16))
-                    {
-                        packed_pixels_length = (tile_cx + 1) / 2 * tile_cy;
-                    }
+    //==============================================================================================================
+    void lib_framebuffer_update_hextile(uint16_t x, uint16_t y, uint16_t cx, uint16_t cy, uint8_t Bpp)
+    //==============================================================================================================
+    {
+        // Rectangle is split in 16x16 tiles, each tile is either raw pixels or
+        // a background color with optional subrectangles of foreground color
+        // (or of their own colors). Background and foreground colors are kept
+        // from a tile to the next one.
+        enum {
+            RAW                  = 1,
+            BACKGROUND_SPECIFIED = 2,
+            FOREGROUND_SPECIFIED = 4,
+            ANY_SUBRECTS         = 8,
+            SUBRECTS_COLOURED    = 16
+        };
+
+        enum { MAX_SUBRECT_ORDERS = 16 };
+
+        uint8_t background[4] = { 0, 0, 0, 0 };
+        uint8_t foreground[4] = { 0, 0, 0, 0 };
+        uint8_t tile_data[16 * 16 * 4];
+
+        BStream stream(255 * (4 + 2));
+
+        for (int tile_y = y; tile_y < y + cy; tile_y += 16) {
+            for (int tile_x = x; tile_x < x + cx; tile_x += 16) {
+                const Rect   tile(tile_x, tile_y, std::min(16, x + cx - tile_x), std::min(16, y + cy - tile_y));
+                const size_t tile_length = tile.cx * tile.cy * Bpp;
+
+                stream.reset();
+                this->t->recv(&stream.end, 1);
+                const uint8_t subencoding = stream.in_uint8();
+
+                if (subencoding & RAW) {
+                    uint8_t * tmp = tile_data;
+                    this->t->recv(&tmp, tile_length);
+
+                    this->flush_solid_tiles();
+                    this->front.begin_update();
+                    this->front.draw_vnc(tile, this->bpp, this->palette332, tile_data, tile_length);
+                    this->front.end_update();
+                    continue;
+                }
 
-                    if (uncompressed_data_buffer.in_remain() < packed_pixels_length)
-                    {
-                        throw Error(ERR_VNC_NEED_MORE_DATA);
+                stream.reset();
+                this->t->recv(&stream.end,
+                      ((subencoding & BACKGROUND_SPECIFIED) ? Bpp : 0)
+                    + ((subencoding & FOREGROUND_SPECIFIED) ? Bpp : 0)
+                    + ((subencoding & ANY_SUBRECTS)         ? 1   : 0));
+                if (subencoding & BACKGROUND_SPECIFIED) {
+                    stream.in_copy_bytes(background, Bpp);
+                }
+                if (subencoding & FOREGROUND_SPECIFIED) {
+                    stream.in_copy_bytes(foreground, Bpp);
+                }
+                const uint8_t nb_subrects = (subencoding & ANY_SUBRECTS) ? stream.in_uint8() : 0;
+
+                if (!nb_subrects) {
+                    if (!this->solid_tile(tile, pixel_value(background, Bpp))) {
+                        fill_pixels(tile_data, background, Bpp, tile.cx * tile.cy);
+                        this->front.begin_update();
+                        this->front.draw_vnc(tile, this->bpp, this->palette332, tile_data, tile_length);
+                        this->front.end_update();
                     }
+                    continue;
+                }
 
-                    const uint8_t * packed_pixels = uncompressed_data_buffer.in_uint8p(packed_pixels_length);
-
-                    uint8_t * tmp_tile_data = tile_data;
-
-                    tile_data_length_remain = tile_data_length;
-
-                    uint8_t         pixel_remain         = tile_cx;
-                    const uint8_t * packed_pixels_remain = packed_pixels;
-                    uint8_t         current              = 0;
-                    uint8_t         index                = 0;
-
-                    uint8_t palette_index;
-
-                    while (tile_data_length_remain >= update_context.Bpp)
-                    {
-                        pixel_remain--;
-
-                        if (!index)
-                        {
-                            current = *packed_pixels_remain;
-                            packed_pixels_remain++;
-                        }
-
-                        if (palette_count == 2)
-                        {
-                            palette_index = (current & 0x80) >> 7;
-                            current <<= 1;
-                            index++;
-
-                            if (!pixel_remain || (index > 7))
-                            {
-                                index = 0;
-                            }
-                        }
-                        else if ((palette_count == 3) || (palette_count == 4))
-                        {
-                            palette_index = (current & 0xC0) >> 6;
-                            current <<= 2;
-                            index++;
-
-                            if (!pixel_remain || (index > 3))
-                            {
-                                index = 0;
-                            }
-                        }
-                        else// if ((palette_count >= 5) && (palette_count <= 16))
-                        {
-                            palette_index = (current & 0xF0) >> 4;
-                            current <<= 4;
-                            index++;
-
-                            if (!pixel_remain || (index > 1))
-                            {
-                                index = 0;
-                            }
-                        }
-
-                        if (!pixel_remain)
-                        {
-                            pixel_remain = tile_cx;
-                        }
+                const bool coloured = (subencoding & SUBRECTS_COLOURED);
+                stream.reset();
+                this->t->recv(&stream.end, nb_subrects * (2 + (coloured ? Bpp : 0)));
 
-                        const uint8_t * cpixel_pattern = palette + palette_index * update_context.Bpp;
+                this->flush_solid_tiles();
 
-                        memcpy(tmp_tile_data, cpixel_pattern, update_context.Bpp);
+                const bool orders = this->native_orders() && (nb_subrects <= MAX_SUBRECT_ORDERS);
+                const Rect clip(0, 0, this->front_width, this->front_height);
 
-                        tmp_tile_data           += update_context.Bpp;
-                        tile_data_length_remain -= update_context.Bpp;
-                    }
+                this->front.begin_update();
+                if (orders) {
+                    this->front.draw(RDPOpaqueRect(tile, pixel_value(background, Bpp)), clip);
                 }
-                else if ((subencoding >= 17) && (subencoding <= 127))
-                {
-                    LOG(LOG_ERR, "VNC Encoding: ZRLE, unused");
-                    throw Error(ERR_VNC_ZRLE_PROTOCOL);
+                else {
+                    fill_pixels(tile_data, background, Bpp, tile.cx * tile.cy);
                 }
-                else if (subencoding == 128)
-                {
-                    if (this->verbose) {
-                        LOG(LOG_INFO, "VNC Encoding: ZRLE, Plain RLE");
+                for (uint8_t i = 0; i < nb_subrects; i++) {
+                    const uint8_t * color = coloured ? stream.in_uint8p(Bpp) : foreground;
+                    const uint8_t   xy    = stream.in_uint8();
+                    const uint8_t   wh    = stream.in_uint8();
+
+                    const Rect subrect = Rect( tile.x + (xy >> 4), tile.y + (xy & 0xF)
+                                             , (wh >> 4) + 1, (wh & 0xF) + 1).intersect(tile);
+                    if (orders) {
+                        this->front.draw(RDPOpaqueRect(subrect, pixel_value(color, Bpp)), clip);
                     }
-
-                    tile_data_length_remain = tile_data_length;
-
-                    uint16_t   run_length    = 0;
-                    uint8_t  * tmp_tile_data = tile_data;
-
-                    while (tile_data_length_remain >= update_context.Bpp)
-                    {
-
-                        if (uncompressed_data_buffer.in_remain() < update_context.Bpp)
-                        {
-                            throw Error(ERR_VNC_NEED_MORE_DATA);
-                        }
-
-                        const uint8_t * cpixel_pattern = uncompressed_data_buffer.in_uint8p(update_context.Bpp);
-
-                        run_length = 1;
-
-                        while (true)
-                        {
-                            if (uncompressed_data_buffer.in_remain() < 1)
-                            {
-                                throw Error(ERR_VNC_NEED_MORE_DATA);
-                            }
-
-                            uint8_t byte_value = uncompressed_data_buffer.in_uint8();
-                            run_length += byte_value;
-
-                            if (byte_value != 255)
-                                break;
-                        }
-
-                        // LOG(LOG_INFO, "VNC Encoding: ZRLE, run length=%u", run_length);
-
-                        while ((tile_data_length_remain >= update_context.Bpp) && run_length)
-                        {
-                            memcpy(tmp_tile_data, cpixel_pattern, update_context.Bpp);
-
-                            tmp_tile_data           += update_context.Bpp;
-                            tile_data_length_remain -= update_context.Bpp;
-
-                            run_length--;
+                    else {
+                        for (int line = subrect.y; line < subrect.y + subrect.cy; line++) {
+                            fill_pixels( tile_data + ((line - tile.y) * tile.cx + subrect.x - tile.x) * Bpp
+                                       , color, Bpp, subrect.cx);
                         }
                     }
-
-                    // LOG(LOG_INFO, "VNC Encoding: ZRLE, run_length=%u", run_length);
-
-                    REDASSERT(!run_length);
-                    REDASSERT(!tile_data_length_remain);
                 }
-                else if (subencoding == 129)
-                {
-                    LOG(LOG_ERR, "VNC Encoding: ZRLE, unused");
-                    throw Error(ERR_VNC_ZRLE_PROTOCOL);
+                if (!orders) {
+                    this->front.draw_vnc(tile, this->bpp, this->palette332, tile_data, tile_length);
                 }
-                else
-                {
-                    if (this->verbose) {
-                        LOG(LOG_INFO, "VNC Encoding: ZRLE, Palette RLE");
-                    }
-
-                    const uint8_t  * palette;
-                    const uint8_t    palette_count = subencoding - 128;
-                    const uint16_t   palette_size  = palette_count * update_context.Bpp;
-
-                    if (uncompressed_data_buffer.in_remain() < palette_size)
-                    {
-                        throw Error(ERR_VNC_NEED_MORE_DATA);
-                    }
+                this->front.end_update();
+            }
+        }
 
-                    palette = uncompressed_data_buffer.in_uint8p(palette_size);
+        this->flush_solid_tiles();
+    }
 
-                    tile_data_length_remain = tile_data_length;
+    // Gradient filter: pixels are sent as the difference, color component
+    // by color component, with the prediction left + up - up left
+    void tight_gradient_filter(const uint8_t * data, uint8_t * pixels, uint16_t cx, uint16_t cy, uint8_t Bpp)
+    {
+        const int     max[3]   = { this->red_max,   this->green_max,   this->blue_max   };
+        const uint8_t shift[3] = { this->red_shift, this->green_shift, this->blue_shift };
+        const size_t  line     = cx * Bpp;
+
+        for (int y = 0; y < cy; y++) {
+            for (int x = 0; x < cx; x++) {
+                uint8_t * pixel = pixels + y * line + x * Bpp;
+
+                const uint32_t diff    = pixel_value(data + y * line + x * Bpp, Bpp);
+                const uint32_t left    = x           ? pixel_value(pixel - Bpp, Bpp)        : 0;
+                const uint32_t up      = y           ? pixel_value(pixel - line, Bpp)       : 0;
+                const uint32_t up_left = (x && y)    ? pixel_value(pixel - line - Bpp, Bpp) : 0;
+
+                uint32_t value = 0;
+                for (int c = 0; c < 3; c++) {
+                    int prediction = static_cast<int>((left >> shift[c]) & max[c])
+                                   + static_cast<int>((up >> shift[c]) & max[c])
+                                   - static_cast<int>((up_left >> shift[c]) & max[c]);
+                    prediction = std::min(std::max(prediction, 0), max[c]);
+                    value |= ((prediction + ((diff >> shift[c]) & max[c])) & max[c]) << shift[c];
+                }
+                out_pixel(pixel, value, Bpp);
+            }
+        }
+    }
 
-                    uint16_t   run_length    = 0;
-                    uint8_t  * tmp_tile_data = tile_data;
+    //==============================================================================================================
+    void lib_framebuffer_update_tight(uint16_t x, uint16_t y, uint16_t cx, uint16_t cy, uint8_t Bpp)
+    //==============================================================================================================
+    {
+        // compression control: bits 0-3 reset zlib streams 0-3, bits 4-7 are
+        // 1000 for fill, 1001 for jpeg, 0fss for basic compression with zlib
+        // stream ss and f set when a filter id follows
+        enum { FILL_COMPRESSION = 8, JPEG_COMPRESSION = 9 };
+        enum { COPY_FILTER = 0, PALETTE_FILTER = 1, GRADIENT_FILTER = 2 };
+
+        const Rect rect(x, y, cx, cy);
+        const Rect clip(0, 0, this->front_width, this->front_height);
+
+        BStream stream(256 * 4);
+        this->t->recv(&stream.end, 1);
+        const uint8_t control = stream.in_uint8();
+
+        for (int i = 0; i < 4; i++) {
+            if (control & (1 << i)) {
+                inflateReset(&this->tight_zstrm[i]);
+            }
+        }
 
-                    while (tile_data_length_remain >= update_context.Bpp)
-                    {
-                        if (uncompressed_data_buffer.in_remain() < 1)
-                        {
-                            throw Error(ERR_VNC_NEED_MORE_DATA);
-                        }
+        // TPIXELs are 3 bytes only for 32 bpp pixels with 24 bits depth,
+        // mod_vnc asks for 16 bpp pixels
+        const uint8_t compression = control >> 4;
+        if (compression == FILL_COMPRESSION) {
+            stream.reset();
+            this->t->recv(&stream.end, Bpp);
 
-                        uint8_t         palette_index  = uncompressed_data_buffer.in_uint8();
-                        const uint8_t * cpixel_pattern = palette + (palette_index & 0x7F) * update_context.Bpp;
+            if (!this->solid_tile(rect, pixel_value(stream.get_data(), Bpp))) {
+                BStream pixels(cx * cy * Bpp);
+                fill_pixels(pixels.get_data(), stream.get_data(), Bpp, cx * cy);
+                this->front.begin_update();
+                this->front.draw_vnc(rect, this->bpp, this->palette332, pixels.get_data(), cx * cy * Bpp);
+                this->front.end_update();
+            }
+            this->flush_solid_tiles();
+            return;
+        }
+        if (compression >= JPEG_COMPRESSION) {
+            // JPEG is only used when client asks for a JPEG quality level
+            LOG(LOG_ERR, "VNC Encoding: Tight, unsupported compression control 0x%02X", control);
+            throw Error(ERR_VNC_TIGHT_PROTOCOL);
+        }
 
-                        run_length = 1;
+        uint8_t filter = COPY_FILTER;
+        if (compression & 4) {
+            stream.reset();
+            this->t->recv(&stream.end, 1);
+            filter = stream.in_uint8();
+        }
 
-                        if (palette_index & 0x80)
-                        {
-                            while (true)
-                            {
-                                if (uncompressed_data_buffer.in_remain() < 1)
-                                {
-                                    throw Error(ERR_VNC_NEED_MORE_DATA);
-                                }
+        unsigned nb_colors   = 0;
+        uint8_t  palette[256 * 4];
+        size_t   data_length = cx * cy * Bpp;
+        if (filter == PALETTE_FILTER) {
+            stream.reset();
+            this->t->recv(&stream.end, 1);
+            nb_colors = stream.in_uint8() + 1;
 
-                                uint8_t byte_value = uncompressed_data_buffer.in_uint8();
-                                run_length += byte_value;
+            uint8_t * tmp = palette;
+            this->t->recv(&tmp, nb_colors * Bpp);
 
-                                if (byte_value != 255)
-                                    break;
-                            }
-                        }
+            data_length = (nb_colors == 2) ? (cx + 7) / 8 * cy : cx * cy;
+        }
+        else if ((filter != COPY_FILTER) && (filter != GRADIENT_FILTER)) {
+            LOG(LOG_ERR, "VNC Encoding: Tight, unknown filter %u", filter);
+            throw Error(ERR_VNC_TIGHT_PROTOCOL);
+        }
 
-                        // LOG(LOG_INFO, "VNC Encoding: ZRLE, run length=%u", run_length);
+        // data shorter than 12 bytes is not compressed
+        BStream data(data_length);
+        if (data_length < 12) {
+            this->t->recv(&data.end, data_length);
+        }
+        else {
+            // compact length: 7 bits per byte, high bit set when a byte
+            // follows, at most 3 bytes
+            size_t compressed_length = 0;
+            for (int i = 0; i < 3; i++) {
+                stream.reset();
+                this->t->recv(&stream.end, 1);
+                const uint8_t byte = stream.in_uint8();
+                compressed_length |= (i < 2 ? (byte & 0x7F) : byte) << (i * 7);
+                if (!(byte & 0x80)) {
+                    break;
+                }
+            }
 
-                        while ((tile_data_length_remain >= update_context.Bpp) && run_length)
-                        {
-                            memcpy(tmp_tile_data, cpixel_pattern, update_context.Bpp);
+            BStream compressed(compressed_length);
+            this->t->recv(&compressed.end, compressed_length);
+
+            z_stream & zstrm = this->tight_zstrm[compression & 3];
+            zstrm.next_in   = compressed.get_data();
+            zstrm.avail_in  = compressed_length;
+            zstrm.next_out  = data.get_data();
+            zstrm.avail_out = data_length;
+            int zlib_result = inflate(&zstrm, Z_SYNC_FLUSH);
+
+            // rest of input is the end of the flush, it gives no data
+            while ((zlib_result == Z_OK) && zstrm.avail_in && !zstrm.avail_out) {
+                uint8_t tail;
+                zstrm.next_out  = &tail;
+                zstrm.avail_out = 1;
+                zlib_result = inflate(&zstrm, Z_SYNC_FLUSH);
+                if (!zstrm.avail_out) {
+                    LOG(LOG_ERR, "VNC Encoding: Tight, more data than rectangle size");
+                    throw Error(ERR_VNC_TIGHT_PROTOCOL);
+                }
+                zstrm.avail_out = 0;
+            }
+            if ((zlib_result != Z_OK) && (zlib_result != Z_BUF_ERROR)) {
+                LOG(LOG_ERR, "vnc zlib decompression failed (%d)", zlib_result);
+                throw Error(ERR_VNC_ZLIB_INFLATE);
+            }
+            if (zstrm.avail_out) {
+                LOG(LOG_ERR, "VNC Encoding: Tight, rectangle data truncated");
+                throw Error(ERR_VNC_TIGHT_PROTOCOL);
+            }
+        }
 
-                            tmp_tile_data           += update_context.Bpp;
-                            tile_data_length_remain -= update_context.Bpp;
+        if (filter == COPY_FILTER) {
+            this->front.begin_update();
+            this->front.draw_vnc(rect, this->bpp, this->palette332, data.get_data(), cx * cy * Bpp);
+            this->front.end_update();
+            return;
+        }
 
-                            run_length--;
-                        }
+        BStream pixels(cx * cy * Bpp);
+        if (filter == PALETTE_FILTER) {
+            // 1 bit per pixel with 2 colors (lines padded to a byte), a byte
+            // per pixel otherwise
+            const uint8_t * index_p = data.get_data();
+            uint8_t       * pixel   = pixels.get_data();
+            for (int line = 0; line < cy; line++) {
+                for (int col = 0; col < cx; col++, pixel += Bpp) {
+                    const unsigned index = (nb_colors == 2)
+                                         ? (index_p[col / 8] >> (7 - col % 8)) & 1
+                                         : index_p[col];
+                    if (index >= nb_colors) {
+                        LOG(LOG_ERR, "VNC Encoding: Tight, palette index %u out of palette (%u colors)",
+                            index, nb_colors);
+                        throw Error(ERR_VNC_TIGHT_PROTOCOL);
                     }
-
-                    // LOG(LOG_INFO, "VNC Encoding: ZRLE, run_length=%u", run_length);
-
-                    REDASSERT(!run_length);
-                    REDASSERT(!tile_data_length_remain);
+                    memcpy(pixel, palette + index * Bpp, Bpp);
                 }
+                index_p += (nb_colors == 2) ? (cx + 7) / 8 : cx;
+            }
 
-                this->front.begin_update();
-                this->front.draw_vnc(
-                    Rect(update_context.tile_x, update_context.tile_y,
-                        tile_cx, tile_cy),
-                    this->bpp, this->palette332, tile_data_p,
-                    tile_data_length);
-                this->front.end_update();
-
-                update_context.cx_remain -= tile_cx;
-                update_context.tile_x    += tile_cx;
-
-                if (!update_context.cx_remain)
-                {
-                    update_context.cx_remain =  update_context.cx;
-                    update_context.cy_remain -= tile_cy;
-
-                    update_context.tile_x =  update_context.x;
-                    update_context.tile_y += tile_cy;
-                }
+            if ((nb_colors == 2) && this->native_orders()
+            && this->two_colors_orders(rect, pixels.get_data(), palette)) {
+                return;
             }
         }
-        catch (Error & e)
-        {
-            if (e.id != ERR_VNC_NEED_MORE_DATA)
-                throw;
-            else
-            {
-                update_context.data_remain.out_copy_bytes(remaining_data,
-                    remaining_data_length);
-                update_context.data_remain.mark_end();
-            }
+        else {
+            this->tight_gradient_filter(data.get_data(), pixels.get_data(), cx, cy, Bpp);
         }
+
+        this->front.begin_update();
+        this->front.draw_vnc(rect, this->bpp, this->palette332, pixels.get_data(), cx * cy * Bpp);
+        this->front.end_update();
     }
+
     //==============================================================================================================
     void lib_framebuffer_update() throw (Error) {
     //==============================================================================================================
@@ -1410,7 +1485,10 @@ struct mod_vnc : public InternalMod, public NotifyApi {
             }
             break;
             case 5: /* Hextile */
-LOG(LOG_INFO, "VNC Encoding: Hextile, Bpp = %u, x=%u, y=%u, cx=%u, cy=%u", Bpp, x, y, cx, cy);
+                this->lib_framebuffer_update_hextile(x, y, cx, cy, Bpp);
+            break;
+            case 7: /* Tight */
+                this->lib_framebuffer_update_tight(x, y, cx, cy, Bpp);
             break;
             case 16:    /* ZRLE */
             {
@@ -1425,56 +1503,30 @@ LOG(LOG_INFO, "VNC Encoding: Hextile, Bpp = %u, x=%u, y=%u, cx=%u, cy=%u", Bpp,
                         zlib_compressed_data_length);
                 }
 
-                if (zlib_compressed_data_length > 65536)
-                {
-                    LOG(LOG_ERR,
-                        "VNC Encoding: ZRLE, compressed data buffer too small "
-                            "(65536 < %lu)",
-                        zlib_compressed_data_length);
-                    throw Error(ERR_BUFFER_TOO_SMALL);
-                }
+                this->zrle.start(x, y, cx, cy, Bpp);
 
+                // compressed data is decoded as it is received
                 BStream zlib_compressed_data(65536);
-                this->t->recv(&zlib_compressed_data.end,
-                    zlib_compressed_data_length);
-                REDASSERT(zlib_compressed_data.in_remain() == zlib_compressed_data_length);
-
-                ZRLEUpdateContext zrle_update_context;
-
-                zrle_update_context.Bpp       = Bpp;
-                zrle_update_context.x         = x;
-                zrle_update_context.cx        = cx;
-                zrle_update_context.cx_remain = cx;
-                zrle_update_context.cy_remain = cy;
-                zrle_update_context.tile_x    = x;
-                zrle_update_context.tile_y    = y;
-
-                zstrm.avail_in = zlib_compressed_data_length;
-                zstrm.next_in  = zlib_compressed_data.get_data();
-
-                while (zstrm.avail_in > 0)
+                while (zlib_compressed_data_length)
                 {
-                    HStream zlib_uncompressed_data_buffer(16384, 49152);
-
-                    zstrm.avail_out = zlib_uncompressed_data_buffer.get_capacity();
-                    zstrm.next_out  = zlib_uncompressed_data_buffer.get_data();
+                    const uint32_t length = std::min<uint32_t>(
+                        zlib_compressed_data_length, zlib_compressed_data.get_capacity());
 
-                    int zlib_result = inflate(&zstrm, Z_NO_FLUSH);
+                    zlib_compressed_data.reset();
+                    this->t->recv(&zlib_compressed_data.end, length);
 
-                    if (zlib_result != Z_OK)
-                    {
-                        LOG(LOG_ERR, "vnc zlib decompression failed (%d)", zlib_result);
-                        throw Error(ERR_VNC_ZLIB_INFLATE);
-                    }
+                    this->zrle.decode(zlib_compressed_data.get_data(), length, *this);
 
-                    zlib_uncompressed_data_buffer.out_skip_bytes(
-                        zlib_uncompressed_data_buffer.get_capacity() - zstrm.avail_out);
-                    zlib_uncompressed_data_buffer.mark_end();
-                    zlib_uncompressed_data_buffer.rewind();
+                    zlib_compressed_data_length -= length;
+                }
 
-                    this->lib_framebuffer_update_zrle(
-                        zlib_uncompressed_data_buffer, zrle_update_context);
+                if (!this->zrle.done())
+                {
+                    LOG(LOG_ERR, "VNC Encoding: ZRLE, rectangle data truncated");
+                    throw Error(ERR_VNC_ZRLE_DATA_TRUNCATED);
                 }
+
+                this->flush_solid_tiles();
             }
             break;
             case 0xffffff11: /* cursor */
@@ -0,0 +1,487 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2013
+   Author(s): Christophe Grosjean
+
+   VNC ZRLE decoder. Compressed data is given as it comes from the server,
+   in chunks of any size: it is inflated into a ring buffer and tiles are
+   decoded by a state machine that stops where inflated data ends and
+   resumes there when the next chunk is given.
+*/
+
+#ifndef _REDEMPTION_MOD_VNC_ZRLE_HPP_
+#define _REDEMPTION_MOD_VNC_ZRLE_HPP_
+
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+
+#include <algorithm>
+
+#include "log.hpp"
+#include "error.hpp"
+#include "rect.hpp"
+
+// Receives the tiles decoded by ZRLEDecoder
+class ZRLEDrawApi
+{
+public:
+    // Solid tile, color is the little endian value of the CPIXEL. Returns
+    // false when tile should rather be given as pixels to draw_zrle_tile().
+    virtual bool draw_zrle_solid_tile(const Rect & tile, uint32_t color) = 0;
+
+    // Tile pixels (CPIXELs, line by line from top), two_colors_palette is
+    // the 2 CPIXELs used by tile when it is a two colors palette tile,
+    // NULL otherwise.
+    virtual void draw_zrle_tile(const Rect & tile, const uint8_t * pixels, size_t length,
+                                const uint8_t * two_colors_palette) = 0;
+
+    virtual ~ZRLEDrawApi()
+    {}
+};
+
+class ZRLEDecoder
+{
+    enum {
+        RING_SIZE = 65536,      // power of 2
+        TILE_SIZE = 64
+    };
+
+    enum {
+        TILE_HEADER,
+        SOLID,
+        RAW,
+        PALETTE,
+        PACKED,
+        PLAIN_RLE_PIXEL,
+        PALETTE_RLE_INDEX,
+        RUN_LENGTH,
+        DONE
+    };
+
+    // the zlib stream lasts as long as the connection
+    z_stream zstrm;
+
+    uint8_t  ring[RING_SIZE];
+    uint32_t rpos;              // ring read and write positions, never
+    uint32_t wpos;              // wrapped, only masked when used
+
+    int state;
+
+    // rectangle being decoded
+    uint8_t  Bpp;
+    int      x;
+    int      y;
+    int      right;
+    int      bottom;
+
+    // tile being decoded
+    int      tile_x;
+    int      tile_y;
+    uint16_t tile_cx;
+    uint16_t tile_cy;
+    size_t   tile_length;
+    size_t   tile_pos;
+    uint8_t  tile_data[TILE_SIZE * TILE_SIZE * 4];
+
+    uint8_t  palette[16 * 4];
+    uint8_t  palette_count;
+    bool     packed;
+    uint16_t packed_x;
+    uint8_t  run_pixel[4];
+    uint32_t run_length;
+    bool     run_of_palette;
+
+public:
+    ZRLEDecoder()
+    : rpos(0)
+    , wpos(0)
+    , state(DONE)
+    , Bpp(0)
+    , x(0)
+    , y(0)
+    , right(0)
+    , bottom(0)
+    , tile_x(0)
+    , tile_y(0)
+    , tile_cx(0)
+    , tile_cy(0)
+    , tile_length(0)
+    , tile_pos(0)
+    , palette_count(0)
+    , packed(false)
+    , packed_x(0)
+    , run_length(0)
+    , run_of_palette(false)
+    {
+        memset(&this->zstrm, 0, sizeof(this->zstrm));
+        if (inflateInit(&this->zstrm) != Z_OK) {
+            LOG(LOG_ERR, "vnc zlib initialization failed");
+            throw Error(ERR_VNC_ZLIB_INITIALIZATION);
+        }
+    }
+
+    ~ZRLEDecoder()
+    {
+        inflateEnd(&this->zstrm);
+    }
+
+    // Starts a ZRLE rectangle, Bpp is the size of a CPIXEL
+    void start(uint16_t x, uint16_t y, uint16_t cx, uint16_t cy, uint8_t Bpp)
+    {
+        if (!Bpp || (Bpp > 4)) {
+            LOG(LOG_ERR, "VNC Encoding: ZRLE, unsupported pixel size %u", Bpp);
+            throw Error(ERR_VNC_BAD_BPP);
+        }
+
+        this->Bpp    = Bpp;
+        this->x      = x;
+        this->y      = y;
+        this->right  = x + cx;
+        this->bottom = y + cy;
+
+        this->tile_x = x;
+        this->tile_y = y;
+        this->state  = (cx && cy) ? TILE_HEADER : DONE;
+        this->set_tile_size();
+    }
+
+    // True once every tile of rectangle has been drawn
+    bool done() const
+    {
+        return this->state == DONE;
+    }
+
+    // Inflates and decodes a chunk of compressed data of current rectangle,
+    // tiles are given to drawer as soon as they are complete.
+    void decode(const uint8_t * data, size_t length, ZRLEDrawApi & drawer)
+    {
+        this->zstrm.next_in  = const_cast<uint8_t *>(data);
+        this->zstrm.avail_in = length;
+
+        for (;;) {
+            const uint32_t widx     = this->wpos & (RING_SIZE - 1);
+            const uint32_t room     = std::min<uint32_t>( RING_SIZE - widx
+                                                        , RING_SIZE - (this->wpos - this->rpos));
+            const uint32_t avail_in = this->zstrm.avail_in;
+            uint32_t       produced = 0;
+
+            if (room) {
+                this->zstrm.next_out  = this->ring + widx;
+                this->zstrm.avail_out = room;
+
+                const int zlib_result = inflate(&this->zstrm, Z_NO_FLUSH);
+                if ((zlib_result != Z_OK) && (zlib_result != Z_BUF_ERROR)) {
+                    LOG(LOG_ERR, "vnc zlib decompression failed (%d)", zlib_result);
+                    throw Error(ERR_VNC_ZLIB_INFLATE);
+                }
+
+                produced = room - this->zstrm.avail_out;
+                this->wpos += produced;
+            }
+
+            const uint32_t rpos = this->rpos;
+            this->run(drawer);
+
+            if (!produced && (rpos == this->rpos) && (avail_in == this->zstrm.avail_in)) {
+                break;
+            }
+        }
+
+        if (this->zstrm.avail_in) {
+            LOG(LOG_ERR, "VNC Encoding: ZRLE, %u bytes of data after end of rectangle",
+                this->zstrm.avail_in);
+            throw Error(ERR_VNC_ZRLE_PROTOCOL);
+        }
+
+        if (this->done() && this->in_avail()) {
+            LOG(LOG_ERR, "VNC Encoding: ZRLE, %u decompressed bytes after end of rectangle",
+                this->in_avail());
+            throw Error(ERR_VNC_ZRLE_PROTOCOL);
+        }
+    }
+
+private:
+    void set_tile_size()
+    {
+        this->tile_cx     = std::min(this->right - this->tile_x, static_cast<int>(TILE_SIZE));
+        this->tile_cy     = std::min(this->bottom - this->tile_y, static_cast<int>(TILE_SIZE));
+        this->tile_length = this->tile_cx * this->tile_cy * this->Bpp;
+    }
+
+    Rect tile_rect() const
+    {
+        return Rect(this->tile_x, this->tile_y, this->tile_cx, this->tile_cy);
+    }
+
+    void next_tile()
+    {
+        this->tile_x += this->tile_cx;
+        if (this->tile_x >= this->right) {
+            this->tile_x =  this->x;
+            this->tile_y += this->tile_cy;
+        }
+
+        if (this->tile_y >= this->bottom) {
+            this->state = DONE;
+        }
+        else {
+            this->state = TILE_HEADER;
+            this->set_tile_size();
+        }
+    }
+
+    void end_tile(ZRLEDrawApi & drawer)
+    {
+        drawer.draw_zrle_tile( this->tile_rect(), this->tile_data, this->tile_length
+                             , (this->palette_count == 2) ? this->palette : NULL);
+        this->next_tile();
+    }
+
+    uint32_t in_avail() const
+    {
+        return this->wpos - this->rpos;
+    }
+
+    uint8_t in_uint8()
+    {
+        return this->ring[this->rpos++ & (RING_SIZE - 1)];
+    }
+
+    void in_copy_bytes(uint8_t * dest, uint32_t length)
+    {
+        const uint32_t ridx  = this->rpos & (RING_SIZE - 1);
+        const uint32_t first = std::min<uint32_t>(length, RING_SIZE - ridx);
+        memcpy(dest, this->ring + ridx, first);
+        memcpy(dest + first, this->ring, length - first);
+        this->rpos += length;
+    }
+
+    // writes count times pixel at end of tile (stops at end of tile)
+    void out_pixels(const uint8_t * pixel, uint32_t count)
+    {
+        uint8_t *       p   = this->tile_data + this->tile_pos;
+        const uint8_t * end = p + std::min<size_t>( static_cast<size_t>(count) * this->Bpp
+                                                  , this->tile_length - this->tile_pos);
+        if (this->Bpp == 2) {
+            for (; p < end; p += 2) {
+                memcpy(p, pixel, 2);
+            }
+        }
+        else {
+            for (; p < end; p += this->Bpp) {
+                memcpy(p, pixel, this->Bpp);
+            }
+        }
+        this->tile_pos = p - this->tile_data;
+    }
+
+    // Decodes inflated data until it is exhausted or rectangle is complete
+    void run(ZRLEDrawApi & drawer)
+    {
+        for (;;) {
+            switch (this->state) {
+            case TILE_HEADER:
+            {
+                if (!this->in_avail()) {
+                    return;
+                }
+
+                const uint8_t subencoding = this->in_uint8();
+
+                this->tile_pos      = 0;
+                this->palette_count = 0;
+
+                if (subencoding == 0) {
+                    this->state = RAW;
+                }
+                else if (subencoding == 1) {
+                    this->state = SOLID;
+                }
+                else if (subencoding <= 16) {
+                    this->palette_count = subencoding;
+                    this->packed        = true;
+                    this->packed_x      = 0;
+                    this->state         = PALETTE;
+                }
+                else if (subencoding == 128) {
+                    this->state = PLAIN_RLE_PIXEL;
+                }
+                else if (subencoding >= 130) {
+                    this->palette_count = subencoding - 128;
+                    this->packed        = false;
+                    this->state         = PALETTE;
+                }
+                else {
+                    LOG(LOG_ERR, "VNC Encoding: ZRLE, unused subencoding %u", subencoding);
+                    throw Error(ERR_VNC_ZRLE_PROTOCOL);
+                }
+            }
+            break;
+            case SOLID:
+            {
+                if (this->in_avail() < this->Bpp) {
+                    return;
+                }
+
+                this->in_copy_bytes(this->run_pixel, this->Bpp);
+
+                uint32_t color = 0;
+                for (uint8_t i = 0; i < this->Bpp; i++) {
+                    color |= this->run_pixel[i] << (i * 8);
+                }
+
+                if (drawer.draw_zrle_solid_tile(this->tile_rect(), color)) {
+                    this->next_tile();
+                }
+                else {
+                    this->out_pixels(this->run_pixel, this->tile_cx * this->tile_cy);
+                    this->end_tile(drawer);
+                }
+            }
+            break;
+            case RAW:
+            {
+                const uint32_t length = std::min<size_t>( this->in_avail()
+                                                        , this->tile_length - this->tile_pos);
+                if (!length) {
+                    return;
+                }
+
+                this->in_copy_bytes(this->tile_data + this->tile_pos, length);
+                this->tile_pos += length;
+
+                if (this->tile_pos == this->tile_length) {
+                    this->end_tile(drawer);
+                }
+            }
+            break;
+            case PALETTE:
+            {
+                const uint32_t palette_size = this->palette_count * this->Bpp;
+                if (this->in_avail() < palette_size) {
+                    return;
+                }
+
+                this->in_copy_bytes(this->palette, palette_size);
+                this->state = this->packed ? PACKED : PALETTE_RLE_INDEX;
+            }
+            break;
+            case PACKED:
+            {
+                // 1, 2 or 4 bits per palette index, lines padded to a byte
+                const unsigned bits = (this->palette_count == 2) ? 1
+                                    : (this->palette_count <= 4) ? 2
+                                    :                              4;
+                const uint8_t  mask = (1 << bits) - 1;
+
+                uint32_t avail = this->in_avail();
+                if (!avail) {
+                    return;
+                }
+
+                while (avail && (this->tile_pos < this->tile_length)) {
+                    const uint8_t  byte = this->in_uint8();
+                    const unsigned n    = std::min<unsigned>(8 / bits, this->tile_cx - this->packed_x);
+                    for (unsigned i = 0; i < n; i++) {
+                        const uint8_t index = (byte >> (8 - bits * (i + 1))) & mask;
+                        if (index >= this->palette_count) {
+                            LOG(LOG_ERR, "VNC Encoding: ZRLE, palette index %u out of palette (%u colors)",
+                                index, this->palette_count);
+                            throw Error(ERR_VNC_ZRLE_PROTOCOL);
+                        }
+                        memcpy(this->tile_data + this->tile_pos, this->palette + index * this->Bpp,
+                            this->Bpp);
+                        this->tile_pos += this->Bpp;
+                    }
+                    this->packed_x += n;
+                    if (this->packed_x == this->tile_cx) {
+                        this->packed_x = 0;
+                    }
+                    avail--;
+                }
+
+                if (this->tile_pos == this->tile_length) {
+                    this->end_tile(drawer);
+                }
+            }
+            break;
+            case PLAIN_RLE_PIXEL:
+            {
+                if (this->in_avail() < this->Bpp) {
+                    return;
+                }
+
+                this->in_copy_bytes(this->run_pixel, this->Bpp);
+                this->run_length     = 1;
+                this->run_of_palette = false;
+                this->state          = RUN_LENGTH;
+            }
+            break;
+            case PALETTE_RLE_INDEX:
+            {
+                if (!this->in_avail()) {
+                    return;
+                }
+
+                const uint8_t index = this->in_uint8();
+                if ((index & 0x7F) >= this->palette_count) {
+                    LOG(LOG_ERR, "VNC Encoding: ZRLE, palette index %u out of palette (%u colors)",
+                        index & 0x7F, this->palette_count);
+                    throw Error(ERR_VNC_ZRLE_PROTOCOL);
+                }
+
+                memcpy(this->run_pixel, this->palette + (index & 0x7F) * this->Bpp, this->Bpp);
+                if (index & 0x80) {
+                    this->run_length     = 1;
+                    this->run_of_palette = true;
+                    this->state          = RUN_LENGTH;
+                }
+                else {
+                    this->out_pixels(this->run_pixel, 1);
+                    if (this->tile_pos == this->tile_length) {
+                        this->end_tile(drawer);
+                    }
+                }
+            }
+            break;
+            case RUN_LENGTH:
+            {
+                if (!this->in_avail()) {
+                    return;
+                }
+
+                const uint8_t byte_value = this->in_uint8();
+                this->run_length += byte_value;
+
+                if (byte_value != 255) {
+                    this->out_pixels(this->run_pixel, this->run_length);
+                    this->state = this->run_of_palette ? PALETTE_RLE_INDEX : PLAIN_RLE_PIXEL;
+                    if (this->tile_pos == this->tile_length) {
+                        this->end_tile(drawer);
+                    }
+                }
+            }
+            break;
+            default: // DONE
+                return;
+            }
+        }
+    }
+};
+
+#endif
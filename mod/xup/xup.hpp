@@ -327,7 +327,7 @@ enum {
 
     virtual void end_update()
     {
-        this->front.begin_update();
+        this->front.end_update();
     }
 
     virtual void draw(const RDPOpaqueRect & cmd, const Rect & clip)
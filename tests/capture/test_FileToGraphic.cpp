@@ -31,6 +31,7 @@
 #include "staticcapture.hpp"
 #include "nativecapture.hpp"
 #include "FileToGraphic.hpp"
+#include "inbymetasequencetransport.hpp"
 
 BOOST_AUTO_TEST_CASE(TestSample0WRM)
 {
@@ -110,6 +111,38 @@ BOOST_AUTO_TEST_CASE(TestSample0WRM)
     sq_outfilename_unlink(&(out_wrm_trans.seq), 2);
 }
 
+// Replay of sample.mwrm from 1352304940 starts at the breakpoint of third
+// wrm file, final screen is the same as replaying the whole movie
+BOOST_AUTO_TEST_CASE(TestSkipToBreakpoint)
+{
+    timeval end_capture;
+    end_capture.tv_sec = 0; end_capture.tv_usec = 0;
+
+    timeval begin_all;
+    begin_all.tv_sec = 0; begin_all.tv_usec = 0;
+    InByMetaSequenceTransport all_trans("./tests/fixtures/sample", ".mwrm");
+    FileToGraphic all_player(&all_trans, begin_all, end_capture, false, 0);
+    BOOST_CHECK_EQUAL((unsigned)1352304810, (unsigned)all_player.record_now.tv_sec);
+    RDPDrawable all_drawable(all_player.screen_rect.cx, all_player.screen_rect.cy);
+    all_player.add_consumer(&all_drawable);
+    all_player.play();
+
+    timeval begin_capture;
+    begin_capture.tv_sec = 1352304940; begin_capture.tv_usec = 0;
+    InByMetaSequenceTransport skip_trans("./tests/fixtures/sample", ".mwrm");
+    FileToGraphic skip_player(&skip_trans, begin_capture, end_capture, false, 0);
+    BOOST_CHECK_EQUAL(3u, skip_trans.chunk_num);
+    BOOST_CHECK_EQUAL((unsigned)1352304930, (unsigned)skip_player.record_now.tv_sec);
+    RDPDrawable skip_drawable(skip_player.screen_rect.cx, skip_player.screen_rect.cy);
+    skip_player.add_consumer(&skip_drawable);
+    skip_player.play();
+
+    BOOST_CHECK_EQUAL((unsigned)all_player.record_now.tv_sec, (unsigned)skip_player.record_now.tv_sec);
+    BOOST_CHECK(skip_player.total_orders_count < all_player.total_orders_count);
+    BOOST_CHECK(0 == memcmp(all_drawable.drawable.data, skip_drawable.drawable.data
+                           , all_drawable.drawable.rowsize * all_drawable.drawable.height));
+}
+
 //BOOST_AUTO_TEST_CASE(TestSecondPart)
 //{
 //    const char * input_filename = "./tests/fixtures/sample1.wrm";
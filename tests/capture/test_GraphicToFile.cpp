@@ -36,6 +36,7 @@
 #include "nativecapture.hpp"
 #include "FileToGraphic.hpp"
 #include "GraphicToFile.hpp"
+#include "counttransport.hpp"
 #include "image_capture.hpp"
 
 const char expected_stripped_wrm[] =
@@ -487,3 +488,139 @@ BOOST_AUTO_TEST_CASE(TestCaptureToWrmReplayToPng)
    ::unlink("./testcap.wrm");
 }
 
+
+// image chunks made by a fresh encoding of drawable
+static std::vector<uint8_t> encode_keyframe(RDPDrawable & drawable)
+{
+    std::vector<uint8_t> image;
+    CountTransport trans;
+    OutCopyTransport copy_trans(&trans, image);
+    OutChunkedBufferingTransport<65536> png_trans(&copy_trans);
+    drawable.dump_png24(&png_trans, true);
+    return image;
+}
+
+BOOST_AUTO_TEST_CASE(TestBreakpointKeyframeReuse)
+{
+    struct timeval now;
+    now.tv_usec = 0;
+    now.tv_sec = 1000;
+
+    Rect screen_rect(0, 0, 800, 600);
+    CountTransport trans;
+    Inifile ini;
+    BmpCache bmp_cache(24, 600, 256, 300, 1024, 262, 4096);
+    RDPDrawable drawable(screen_rect.cx, screen_rect.cy);
+    GraphicToFile consumer(now, &trans, screen_rect.cx, screen_rect.cy, 24, bmp_cache, drawable, ini);
+
+    consumer.draw(RDPOpaqueRect(screen_rect, GREEN), screen_rect);
+    consumer.breakpoint();
+    const std::vector<uint8_t> first = consumer.keyframe;
+    BOOST_CHECK(!first.empty());
+    BOOST_CHECK(first == encode_keyframe(drawable));
+
+    // nothing drawn: same image chunks sent again
+    uint64_t sent = trans.total_sent;
+    now.tv_sec++;
+    consumer.timestamp(now);
+    consumer.breakpoint();
+    BOOST_CHECK(first == consumer.keyframe);
+    BOOST_CHECK(trans.total_sent - sent > first.size());
+
+    // screen changed: image is encoded again
+    consumer.draw(RDPOpaqueRect(Rect(0, 50, 700, 30), BLUE), screen_rect);
+    consumer.breakpoint();
+    BOOST_CHECK(first != consumer.keyframe);
+    BOOST_CHECK(consumer.keyframe == encode_keyframe(drawable));
+}
+
+// Screen is changed behind recorder back between breakpoints (no orders
+// recorded), only images of breakpoints can tell
+static void record_breakpoints(unsigned full_image_interval, RDPDrawable & drawable, std::vector<uint8_t> & wrm)
+{
+    struct timeval now;
+    now.tv_usec = 0;
+    now.tv_sec = 1000;
+
+    Rect screen_rect(0, 0, 800, 600);
+    CountTransport count_trans;
+    OutCopyTransport trans(&count_trans, wrm);
+
+    Inifile ini;
+    ini.video.full_image_interval = full_image_interval;
+    BmpCache bmp_cache(24, 600, 256, 300, 1024, 262, 4096);
+    GraphicToFile consumer(now, &trans, screen_rect.cx, screen_rect.cy, 24, bmp_cache, drawable, ini);
+    consumer.draw(RDPOpaqueRect(screen_rect, GREEN), screen_rect);
+
+    drawable.draw(RDPOpaqueRect(Rect(100, 100, 200, 50), BLUE), screen_rect);
+    now.tv_sec++;
+    consumer.timestamp(now);
+    consumer.breakpoint();
+
+    // last column and row of tiles are smaller
+    drawable.draw(RDPOpaqueRect(Rect(700, 550, 100, 50), RED), screen_rect);
+    now.tv_sec++;
+    consumer.timestamp(now);
+    consumer.breakpoint();
+
+    now.tv_sec++;
+    consumer.timestamp(now);
+    consumer.breakpoint();
+
+    drawable.draw(RDPOpaqueRect(Rect(0, 300, 800, 10), WHITE), screen_rect);
+    now.tv_sec++;
+    consumer.timestamp(now);
+    consumer.breakpoint();
+
+    consumer.draw(RDPOpaqueRect(Rect(10, 10, 30, 30), YELLOW), screen_rect);
+    now.tv_sec++;
+    consumer.timestamp(now);
+    consumer.flush();
+}
+
+BOOST_AUTO_TEST_CASE(TestTilesImageRoundTrip)
+{
+    size_t wrm_size[2] = {};
+    for (unsigned full_image_interval = 1; full_image_interval <= 3; full_image_interval += 2) {
+        RDPDrawable drawable(800, 600);
+        std::vector<uint8_t> wrm;
+        record_breakpoints(full_image_interval, drawable, wrm);
+        wrm_size[full_image_interval / 2] = wrm.size();
+
+        // first breakpoint is the whole screen
+        BOOST_CHECK(FileToGraphic::starts_with_full_image(&wrm[0], wrm.size()));
+
+        GeneratorTransport in_trans(reinterpret_cast<const char *>(&wrm[0]), wrm.size());
+        timeval begin_capture = {0, 0};
+        timeval end_capture = {0, 0};
+        FileToGraphic player(&in_trans, begin_capture, end_capture, false, 0);
+        BOOST_CHECK_EQUAL(full_image_interval, player.info_full_image_interval);
+        RDPDrawable replayed(800, 600);
+        player.add_consumer(&replayed);
+
+        unsigned nb_full_images = 0;
+        unsigned nb_tiles_images = 0;
+        while (player.next_order()) {
+            if (player.chunk_type == LAST_IMAGE_CHUNK || player.chunk_type == PARTIAL_IMAGE_CHUNK) {
+                nb_full_images++;
+            }
+            if (player.chunk_type == LAST_TILES_IMAGE_CHUNK || player.chunk_type == PARTIAL_TILES_IMAGE_CHUNK) {
+                nb_tiles_images++;
+            }
+            player.interpret_order();
+        }
+
+        // first image is read by player constructor
+        if (full_image_interval == 1) {
+            BOOST_CHECK_EQUAL(4, nb_full_images);
+            BOOST_CHECK_EQUAL(0, nb_tiles_images);
+        }
+        else {
+            // breakpoint 3 sends a full image
+            BOOST_CHECK_EQUAL(1, nb_full_images);
+            BOOST_CHECK_EQUAL(3, nb_tiles_images);
+        }
+        BOOST_CHECK_EQUAL(0, memcmp(drawable.drawable.data, replayed.drawable.data, drawable.drawable.pix_len));
+    }
+    BOOST_CHECK(wrm_size[1] < wrm_size[0]);
+}
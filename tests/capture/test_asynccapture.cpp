@@ -0,0 +1,265 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2013
+   Author(s): Christophe Grosjean
+
+   Unit test of capture done by a capture thread
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestAsyncCapture
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+#include "asynccapture.hpp"
+
+#include <string>
+
+static std::string file_content(const SQ * seq, uint32_t count)
+{
+    char filename[1024];
+    sq_outfilename_get_name(seq, filename, sizeof(filename), count);
+    std::string content;
+    FILE * f = fopen(filename, "rb");
+    if (f){
+        char buffer[4096];
+        size_t len;
+        while ((len = fread(buffer, 1, sizeof(buffer), f)) > 0){
+            content.append(buffer, len);
+        }
+        fclose(f);
+    }
+    return content;
+}
+
+// Content of wrm files, files are removed
+static std::vector<std::string> wrm_files(const char * basename)
+{
+    SQ wrm_seq;
+    sq_init_outfilename(&wrm_seq, SQF_PATH_FILE_PID_COUNT_EXTENSION, "./", basename, ".wrm", 0);
+    std::vector<std::string> files;
+    for (uint32_t i = 0; sq_outfilename_filesize(&wrm_seq, i) > 0; i++){
+        files.push_back(file_content(&wrm_seq, i));
+        sq_outfilename_unlink(&wrm_seq, i);
+    }
+    SQ meta_seq;
+    sq_init_outfilename(&meta_seq, SQF_PATH_FILE_PID_EXTENSION, "./", basename, ".mwrm", 0);
+    sq_outfilename_unlink(&meta_seq, 0);
+    return files;
+}
+
+// Same calls as a session would make, wrm files made by Capture and by
+// AsyncCapture must be the same
+static void record_session(Capture & capture, const Rect & scr, timeval now)
+{
+    const Bitmap screen_bmp(FIXTURES_PATH "/color_image.bmp");
+    BStream input(16);
+
+    capture.draw(RDPOpaqueRect(scr, GREEN), scr);
+    capture.snapshot(now, 0, 0, false);
+
+    for (int i = 0; i < 40; i++){
+        const Rect r(i * 16, i * 12, 200, 150);
+        capture.draw(RDPOpaqueRect(r, i * 0x010203), scr);
+        const Bitmap tile(screen_bmp, Rect(i * 4, i * 8, 64, 48));
+        capture.draw(RDPMemBlt(0, Rect(r.x, r.y, 64, 48), 0xCC, 0, 0, 0), scr, tile);
+        capture.draw(RDPMemBlt(0, Rect(r.x, r.y, 64, 64), 0xCC, 0, 0, 0), scr
+                    , screen_bmp.view().sub_view(Rect(i * 8, i * 4, 64, 64)));
+        capture.draw(RDPScrBlt(Rect(r.x + 10, r.y + 10, 50, 50), 0xCC, r.x, r.y), scr);
+        capture.draw(RDPLineTo(1, r.x, r.y, r.x + r.cx, r.y + r.cy, BLUE, 0x0D, RDPPen(0, 1, RED)), scr);
+        capture.draw(RDPPatBlt(r, 0x5A, BLACK, WHITE, RDPBrush(0, 0, 3, 0xaa, (const uint8_t *)"\xaa\x55\xaa\x55\xaa\x55\xaa")), scr);
+
+        if (i % 8 == 0){
+            const uint8_t glyph[] = { 0xff, 0x81, 0x81, 0x81, 0x81, 0x81, 0x81, 0xff };
+            capture.draw(RDPGlyphCache(7, 1, i / 8, 0, -8, 8, 8, glyph));
+            const uint8_t text[] = { static_cast<uint8_t>(i / 8) };
+            capture.draw(RDPGlyphIndex(7, 0x03, 8, 4, WHITE, BLACK, Rect(r.x, r.y, 16, 8)
+                                      , Rect(r.x, r.y, 16, 8), RDPBrush(), r.x, r.y + 8, 1, text), scr, NULL);
+            capture.server_set_pointer(Pointer(i % 16 ? Pointer::POINTER_CURSOR0 : Pointer::POINTER_CURSOR1));
+        }
+
+        input.reset();
+        input.out_uint32_le('a' + i % 26);
+        input.mark_end();
+        capture.input(now, input);
+
+        capture.flush();
+        now.tv_usec += 350000;
+        if (now.tv_usec >= 1000000){
+            now.tv_usec -= 1000000;
+            now.tv_sec++;
+        }
+        capture.snapshot(now, r.x, r.y, false);
+    }
+
+    // bitmap update larger than a small queue
+    const Bitmap band(screen_bmp, Rect(0, 100, 320, 80));
+    RDPBitmapData bitmap_data;
+    bitmap_data.dest_left      = 0;
+    bitmap_data.dest_top       = 100;
+    bitmap_data.dest_right     = band.cx - 1;
+    bitmap_data.dest_bottom    = 100 + band.cy - 1;
+    bitmap_data.width          = band.cx;
+    bitmap_data.height         = band.cy;
+    bitmap_data.bits_per_pixel = band.original_bpp;
+    bitmap_data.flags          = 0;
+    bitmap_data.bitmap_length  = 4096;
+    capture.draw(bitmap_data, band.data(), 4096, band);
+    capture.flush();
+}
+
+static void check_same_wrm(unsigned queue_size)
+{
+    Inifile ini;
+    ini.video.frame_interval = 100;     // one timestamp every second
+    ini.video.break_interval = 5;       // one WRM file every 5 seconds
+    ini.video.png_limit = 3;
+    ini.video.png_interval = 30;
+    ini.video.capture_wrm = true;
+    ini.globals.enable_file_encryption.set(false);
+    ini.video.capture_queue_size = queue_size;
+
+    Rect scr(0, 0, 800, 600);
+    timeval now;
+    now.tv_sec = 1000;
+    now.tv_usec = 0;
+
+    {
+        Capture capture(now, scr.cx, scr.cy, "./", "./", "/tmp/", "sync_capture", true, false, NULL, ini);
+        record_session(capture, scr, now);
+    }
+    std::vector<std::string> expected = wrm_files("sync_capture");
+    BOOST_CHECK(expected.size() > 2);
+
+    unsigned long nb_direct = 0;
+    {
+        AsyncCapture capture(now, scr.cx, scr.cy, "./", "./", "/tmp/", "async_capture", true, false, NULL, ini);
+        record_session(capture, scr, now);
+        BOOST_CHECK_EQUAL(0u, capture.nb_dropped);
+        nb_direct = capture.nb_direct;
+    }
+    std::vector<std::string> got = wrm_files("async_capture");
+
+    // a full screen bitmap doesn't fit a small queue, it is recorded by
+    // session thread
+    BOOST_CHECK_EQUAL(queue_size < 1024, nb_direct > 0);
+
+    BOOST_CHECK_EQUAL(expected.size(), got.size());
+    for (size_t i = 0; i < expected.size() && i < got.size(); i++){
+        BOOST_CHECK(expected[i] == got[i]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestAsyncCaptureSameWrm)
+{
+    check_same_wrm(8192);
+}
+
+BOOST_AUTO_TEST_CASE(TestAsyncCaptureSmallQueue)
+{
+    // queue wraps many times and session thread has to wait
+    check_same_wrm(64);
+}
+
+BOOST_AUTO_TEST_CASE(TestAsyncCaptureDrop)
+{
+    Inifile ini;
+    ini.video.capture_wrm = true;
+    ini.video.png_limit = 0;
+    ini.globals.enable_file_encryption.set(false);
+    ini.video.capture_queue_size = 64;
+    ini.video.capture_queue_timeout = 1;
+
+    Rect scr(0, 0, 800, 600);
+    timeval now;
+    now.tv_sec = 1000;
+    now.tv_usec = 0;
+
+    const Bitmap screen_bmp(FIXTURES_PATH "/color_image.bmp");
+    {
+        AsyncCapture capture(now, scr.cx, scr.cy, "./", "./", "/tmp/", "drop_capture", true, false, NULL, ini);
+        // session thread is much faster than capture thread compressing and
+        // caching bitmaps: some of them are dropped, other orders go through
+        for (int i = 0; i < 2000; i++){
+            const Rect r((i * 7) % 700, (i * 5) % 500, 64, 64);
+            capture.draw(RDPMemBlt(0, r, 0xCC, 0, 0, 0), scr
+                        , screen_bmp.view().sub_view(Rect(i % 500, i % 400, 64, 64)));
+        }
+        capture.flush();
+        capture.update_config(ini);     // waits for capture thread
+        BOOST_CHECK(capture.nb_messages > 0);
+        BOOST_CHECK_EQUAL(2001u, capture.nb_messages + capture.nb_dropped);
+    }
+    wrm_files("drop_capture");
+}
+
+// Keeps calls made to authentifier, with the thread they were made from
+class RecordingAuthentifier : public auth_api {
+public:
+    std::string calls;
+    bool        other_thread;
+    pthread_t   session_thread;
+
+    RecordingAuthentifier()
+    : other_thread(false)
+    , session_thread(pthread_self())
+    {}
+
+    void record(const char * call, const char * value)
+    {
+        this->other_thread = this->other_thread || !pthread_equal(pthread_self(), this->session_thread);
+        this->calls += call;
+        this->calls += "=";
+        this->calls += value;
+        this->calls += ";";
+    }
+
+    virtual void set_auth_channel_target(const char * target) { this->record("target", target); }
+    virtual void set_auth_channel_result(const char * result) { this->record("result", result); }
+    virtual void report(const char * reason, const char * message) { this->record(reason, message); }
+};
+
+static void * report_from_thread(void * arg)
+{
+    auth_api * reports = static_cast<auth_api *>(arg);
+    reports->set_auth_channel_target("TEST_TARGET");
+    reports->report("FILESYSTEM_FULL", "100|/tmp");
+    reports->set_auth_channel_result("TEST_RESULT");
+    return NULL;
+}
+
+BOOST_AUTO_TEST_CASE(TestCaptureReportsForwardedBySessionThread)
+{
+    RecordingAuthentifier authentifier;
+    CaptureReports reports(&authentifier);
+
+    pthread_t thread;
+    BOOST_REQUIRE_EQUAL(0, pthread_create(&thread, NULL, &report_from_thread, &reports));
+    pthread_join(thread, NULL);
+
+    // nothing reaches authentifier until session thread forwards
+    BOOST_CHECK_EQUAL(std::string(""), authentifier.calls);
+    reports.forward();
+    BOOST_CHECK_EQUAL(std::string("target=TEST_TARGET;FILESYSTEM_FULL=100|/tmp;result=TEST_RESULT;"),
+                      authentifier.calls);
+    BOOST_CHECK(!authentifier.other_thread);
+
+    reports.forward();
+    BOOST_CHECK_EQUAL(std::string("target=TEST_TARGET;FILESYSTEM_FULL=100|/tmp;result=TEST_RESULT;"),
+                      authentifier.calls);
+}
@@ -27,6 +27,8 @@
 
 #define LOGPRINT
 #include "capture.hpp"
+#include "FileToGraphic.hpp"
+#include "inbymetasequencetransport.hpp"
 
 BOOST_AUTO_TEST_CASE(TestSplittedCapture)
 {
@@ -125,3 +127,73 @@ BOOST_AUTO_TEST_CASE(TestSplittedCapture)
         sq_outfilename_unlink(&meta_seq, 0);
     }
 }
+
+static void replay_to(const char * prefix, time_t begin, RDPDrawable & drawable)
+{
+    InByMetaSequenceTransport in_wrm_trans(prefix, ".mwrm");
+    timeval begin_capture = {begin, 0};
+    timeval end_capture = {0, 0};
+    FileToGraphic player(&in_wrm_trans, begin_capture, end_capture, false, 0);
+    player.add_consumer(&drawable);
+    player.play();
+}
+
+BOOST_AUTO_TEST_CASE(TestResumedCaptureStartsWithFullImage)
+{
+    Inifile ini;
+    ini.video.frame_interval = 100; // one timestamp every second
+    ini.video.break_interval = 3;
+    ini.video.full_image_interval = 3;
+    ini.video.png_limit = 0;
+    ini.video.capture_wrm = true;
+    ini.globals.enable_file_encryption.set(false);
+
+    char prefix[1024];
+    {
+        timeval now;
+        now.tv_usec = 0;
+        now.tv_sec = 1000;
+        Rect scr(0, 0, 800, 600);
+        Capture capture(now, scr.cx, scr.cy, "./", "./", "/tmp/", "resumed_capture", false, false, NULL, ini);
+        // second file starts with tiles
+        for (int i = 0; i < 5; i++) {
+            capture.draw(RDPOpaqueRect(Rect(i * 50, i * 40, 100, 80), (i & 1) ? BLUE : RED), scr);
+            now.tv_sec++;
+            capture.snapshot(now, 0, 0, false);
+        }
+        capture.pause(now);
+        now.tv_sec += 5;
+        // third file starts with the whole screen, fourth one with tiles
+        capture.resume(now);
+        for (int i = 5; i < 8; i++) {
+            capture.draw(RDPOpaqueRect(Rect(i * 50, i * 40, 100, 80), (i & 1) ? BLUE : RED), scr);
+            now.tv_sec++;
+            capture.snapshot(now, 0, 0, false);
+        }
+        capture.flush();
+        snprintf(prefix, sizeof(prefix), "./resumed_capture-%06u", getpid());
+    }
+
+    {
+        InByMetaSequenceTransport in_wrm_trans(prefix, ".mwrm");
+        timeval tv = {1012, 0};
+        BOOST_CHECK(in_wrm_trans.skip_units_before(tv, &FileToGraphic::starts_with_full_image));
+        BOOST_CHECK_EQUAL(3, in_wrm_trans.chunk_num);
+    }
+
+    // replay from resumed file ends on the same screen as whole replay
+    RDPDrawable whole(800, 600);
+    replay_to(prefix, 0, whole);
+    RDPDrawable resumed(800, 600);
+    replay_to(prefix, 1012, resumed);
+    BOOST_CHECK_EQUAL(0, memcmp(whole.drawable.data, resumed.drawable.data, whole.drawable.pix_len));
+
+    SQ wrm_seq;
+    sq_init_outfilename(&wrm_seq, SQF_PATH_FILE_PID_COUNT_EXTENSION, "./", "resumed_capture", ".wrm", 0);
+    for (uint32_t i = 0; sq_outfilename_filesize(&wrm_seq, i) > 0; i++){
+        sq_outfilename_unlink(&wrm_seq, i);
+    }
+    SQ meta_seq;
+    sq_init_outfilename(&meta_seq, SQF_PATH_FILE_PID_EXTENSION, "./", "resumed_capture", ".mwrm", 0);
+    sq_outfilename_unlink(&meta_seq, 0);
+}
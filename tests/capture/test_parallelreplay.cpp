@@ -0,0 +1,211 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2013
+   Author(s): Christophe Grosjean
+
+   Unit test of png replay made by parallel workers
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestParallelReplay
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+#include "parallelreplay.hpp"
+
+#include <string>
+#include <vector>
+
+static std::string file_content(const SQ * seq, uint32_t count)
+{
+    char filename[1024];
+    sq_outfilename_get_name(seq, filename, sizeof(filename), count);
+    std::string content;
+    FILE * f = fopen(filename, "rb");
+    if (f){
+        char buffer[4096];
+        size_t len;
+        while ((len = fread(buffer, 1, sizeof(buffer), f)) > 0){
+            content.append(buffer, len);
+        }
+        fclose(f);
+    }
+    return content;
+}
+
+// Content of png files (empty for missing ones), files are removed
+static std::vector<std::string> png_files(const char * basename, uint32_t max)
+{
+    SQ png_seq;
+    sq_init_outfilename(&png_seq, SQF_PATH_FILE_PID_COUNT_EXTENSION, "./", basename, ".png", 0);
+    std::vector<std::string> files;
+    for (uint32_t i = 0; i < max; i++){
+        files.push_back(file_content(&png_seq, i));
+        if (!files.back().empty()){
+            sq_outfilename_unlink(&png_seq, i);
+        }
+    }
+    return files;
+}
+
+// same as redrec without jobs
+static void replay(const char * prefix, const timeval & begin_capture, const timeval & end_capture, Inifile & ini)
+{
+    InByMetaSequenceTransport in_wrm_trans(prefix, ".mwrm");
+    FileToGraphic player(&in_wrm_trans, begin_capture, end_capture, false, 0);
+    Capture capture( player.record_now, player.screen_rect.cx, player.screen_rect.cy
+                   , "./", "./", "/tmp/", "single_replay", false, false, NULL, ini);
+    player.add_consumer(&capture);
+    player.play();
+}
+
+static void check_same_png(const char * prefix, unsigned begin, unsigned end, unsigned png_limit, unsigned jobs)
+{
+    Inifile ini;
+    ini.video.png_limit = png_limit;
+    ini.video.png_interval = 50;    // one png every 5 seconds
+    ini.video.capture_wrm = false;
+
+    timeval begin_capture;
+    begin_capture.tv_sec = begin; begin_capture.tv_usec = 0;
+    timeval end_capture;
+    end_capture.tv_sec = end; end_capture.tv_usec = 0;
+
+    replay(prefix, begin_capture, end_capture, ini);
+    std::vector<std::string> expected = png_files("single_replay", 100);
+
+    ParallelReplay parallel( prefix, ".mwrm", begin_capture, end_capture
+                           , "./", "parallel_replay", 100, jobs, ini, 0);
+    BOOST_CHECK_EQUAL(0, parallel.play());
+    // one worker starts where player constructor stopped, then one per file
+    BOOST_CHECK(parallel.nb_workers > 1);
+    std::vector<std::string> got = png_files("parallel_replay", 100);
+
+    unsigned nb_png = 0;
+    for (size_t i = 0; i < expected.size(); i++){
+        BOOST_CHECK(expected[i] == got[i]);
+        nb_png += !expected[i].empty();
+    }
+    BOOST_CHECK(nb_png > 0);
+    BOOST_CHECK(nb_png <= png_limit);
+}
+
+BOOST_AUTO_TEST_CASE(TestParallelReplayWholeMovie)
+{
+    check_same_png("./tests/fixtures/sample", 0, 0, 100, 3);
+}
+
+BOOST_AUTO_TEST_CASE(TestParallelReplayPngLimit)
+{
+    // only the last png are kept, files played one after the other
+    check_same_png("./tests/fixtures/sample", 0, 0, 5, 1);
+}
+
+BOOST_AUTO_TEST_CASE(TestParallelReplayBeginEnd)
+{
+    // starts from the breakpoint of the second file, stops in the third one
+    check_same_png("./tests/fixtures/sample", 1352304900, 1352304960, 100, 4);
+}
+
+BOOST_AUTO_TEST_CASE(TestParallelReplayTilesImages)
+{
+    // one wrm out of 2 starts with tiles changed since previous one, they are
+    // played by the worker of the previous wrm
+    Inifile ini;
+    ini.video.frame_interval = 100;
+    ini.video.break_interval = 3;
+    ini.video.full_image_interval = 2;
+    ini.video.png_limit = 0;
+    ini.video.capture_wrm = true;
+    ini.globals.enable_file_encryption.set(false);
+
+    char prefix[1024];
+    {
+        timeval now;
+        now.tv_sec = 1000;
+        now.tv_usec = 0;
+        Rect scr(0, 0, 800, 600);
+        Capture capture(now, scr.cx, scr.cy, "./", "./", "/tmp/", "tiles_replay", false, false, NULL, ini);
+        for (int i = 0; i < 14; i++) {
+            capture.draw(RDPOpaqueRect(Rect(i * 50, i * 40, 100, 80), (i & 1) ? BLUE : RED), scr);
+            now.tv_sec++;
+            capture.snapshot(now, 0, 0, false);
+        }
+        capture.flush();
+        snprintf(prefix, sizeof(prefix), "./tiles_replay-%06u", getpid());
+    }
+
+    check_same_png(prefix, 0, 0, 100, 2);
+
+    SQ wrm_seq;
+    sq_init_outfilename(&wrm_seq, SQF_PATH_FILE_PID_COUNT_EXTENSION, "./", "tiles_replay", ".wrm", 0);
+    for (uint32_t i = 0; sq_outfilename_filesize(&wrm_seq, i) > 0; i++){
+        sq_outfilename_unlink(&wrm_seq, i);
+    }
+    SQ meta_seq;
+    sq_init_outfilename(&meta_seq, SQF_PATH_FILE_PID_EXTENSION, "./", "tiles_replay", ".mwrm", 0);
+    sq_outfilename_unlink(&meta_seq, 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestParallelReplaySameSecondFiles)
+{
+    // capture resumed less than one second after a breakpoint: two files
+    // start in the same second, workers find their file by its number
+    Inifile ini;
+    ini.video.frame_interval = 10;
+    ini.video.break_interval = 3;
+    ini.video.png_limit = 0;
+    ini.video.capture_wrm = true;
+    ini.globals.enable_file_encryption.set(false);
+
+    char prefix[1024];
+    {
+        timeval now;
+        now.tv_sec = 1000;
+        now.tv_usec = 0;
+        Rect scr(0, 0, 800, 600);
+        Capture capture(now, scr.cx, scr.cy, "./", "./", "/tmp/", "same_second_replay", false, false, NULL, ini);
+        for (int i = 0; i < 14; i++) {
+            capture.draw(RDPOpaqueRect(Rect(i * 50, i * 40, 100, 80), (i & 1) ? BLUE : RED), scr);
+            now.tv_usec += 500000;
+            if (now.tv_usec == 1000000) {
+                now.tv_sec++;
+                now.tv_usec = 0;
+            }
+            capture.snapshot(now, 0, 0, false);
+            if (i == 6) {
+                capture.pause(now);
+                now.tv_usec += 200000;
+                capture.resume(now);
+            }
+        }
+        capture.flush();
+        snprintf(prefix, sizeof(prefix), "./same_second_replay-%06u", getpid());
+    }
+
+    check_same_png(prefix, 0, 0, 100, 3);
+
+    SQ wrm_seq;
+    sq_init_outfilename(&wrm_seq, SQF_PATH_FILE_PID_COUNT_EXTENSION, "./", "same_second_replay", ".wrm", 0);
+    for (uint32_t i = 0; sq_outfilename_filesize(&wrm_seq, i) > 0; i++){
+        sq_outfilename_unlink(&wrm_seq, i);
+    }
+    SQ meta_seq;
+    sq_init_outfilename(&meta_seq, SQF_PATH_FILE_PID_EXTENSION, "./", "same_second_replay", ".mwrm", 0);
+    sq_outfilename_unlink(&meta_seq, 0);
+}
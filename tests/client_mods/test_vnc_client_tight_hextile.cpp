@@ -0,0 +1,198 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2013
+   Author(s): Christophe Grosjean
+
+   Unit test of the RDP orders sent to front for VNC Hextile and Tight
+   updates
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestVncClientTightHextile
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+#include "log.hpp"
+
+#include "../front/count_front.hpp"
+
+static uint16_t pixel(const std::vector<uint8_t> & bitmap, size_t i)
+{
+    return bitmap[i * 2] | (bitmap[i * 2 + 1] << 8);
+}
+
+BOOST_AUTO_TEST_CASE(TestHextileOrders)
+{
+    ClientInfo info(1, true, true);
+    info.keylayout = 0x040C;
+    info.bpp       = 16;
+    info.width     = 256;
+    info.height    = 128;
+
+    CountFront front(info, 0);
+
+    const char outdata[] =
+    {
+// Socket VNC Target (3) sending 12 bytes
+ /* 0000 */ "\x52\x46\x42\x20\x30\x30\x33\x2e\x30\x30\x33\x0a"                 // RFB 003.003.
+// Socket VNC Target (3) sending 1 bytes
+ /* 0000 */ "\x01"                                                             // .
+// Socket VNC Target (3) sending 20 bytes
+ /* 0000 */ "\x00\x00\x00\x00\x10\x10\x00\x01\x00\x1f\x00\x3f\x00\x1f\x0b\x05" // ...........?....
+ /* 0010 */ "\x00\x00\x00\x00"                                                 // ....
+// Socket VNC Target (3) sending 16 bytes
+ /* 0000 */ "\x02\x00\x00\x03\x00\x00\x00\x05\x00\x00\x00\x01\xff\xff\xff\x11" // ................
+// Socket VNC Target (3) sending 10 bytes
+ /* 0000 */ "\x03\x00\x00\x00\x00\x00\x01\x00\x00\x80"                         // ..........
+// Socket VNC Target (3) sending 10 bytes
+ /* 0000 */ "\x03\x01\x00\x00\x00\x00\x01\x00\x00\x80"                         // ..........
+    };
+
+    const char indata[] =
+    {
+// Socket VNC Target (3) receiving 12 bytes
+ /* 0000 */ "\x52\x46\x42\x20\x30\x30\x33\x2e\x30\x30\x38\x0a"                 // RFB 003.008.
+// Socket VNC Target (3) receiving 4 bytes
+ /* 0000 */ "\x00\x00\x00\x01"                                                 // ....
+// security level is 1 (1 = none, 2 = standard)
+// Socket VNC Target (3) receiving 24 bytes
+ /* 0000 */ "\x01\x00\x00\x80\x10\x10\x00\x01\x00\x1f\x00\x3f\x00\x1f\x0b\x05" // ...........?....
+ /* 0010 */ "\x00\x00\x00\x00\x00\x00\x00\x04"                                 // ........
+// VNC received: width=256 height=128 bpp=16 depth=16 endianess=0 true_color=1 red_max=31 green_max=63 blue_max=31 red_shift=11 green_shift=5 blue_shift=0
+// Socket VNC Target (3) receiving 4 bytes
+ /* 0000 */ "\x51\x45\x4d\x55"                                                 // QEMU
+// FramebufferUpdate, 3 Hextile rectangles:
+// - (0, 0, 48, 16): blue background tile, tile with no subencoding (same
+//   background), red background tile with 2 white subrects
+// - (0, 16, 4, 2): raw tile
+// - (16, 16, 16, 16): black background tile with 20 colored 1x1 subrects
+ /* 0000 */ "\x00\x00\x00\x03\x00\x00\x00\x00\x00\x30\x00\x10\x00\x00\x00\x05" // .........0......
+ /* 0010 */ "\x02\x1f\x00\x00\x0e\x00\xf8\xff\xff\x02\x22\x31\xa0\x0f\x00\x00" // ...........1....
+ /* 0020 */ "\x00\x10\x00\x04\x00\x02\x00\x00\x00\x05\x01\x00\x40\x01\x40\x02" // ............@.@.
+ /* 0030 */ "\x40\x03\x40\x04\x40\x05\x40\x06\x40\x07\x40\x00\x10\x00\x10\x00" // @.@.@.@.@.@.....
+ /* 0040 */ "\x10\x00\x10\x00\x00\x00\x05\x1a\x00\x00\x14\x00\x01\x00\x00\x00" // ................
+ /* 0050 */ "\x02\x10\x00\x00\x03\x20\x00\x00\x04\x30\x00\x00\x05\x40\x00\x00" // ..... ...0...@..
+ /* 0060 */ "\x06\x50\x00\x00\x07\x60\x00\x00\x08\x70\x00\x00\x09\x80\x00\x00" // .P...`...p......
+ /* 0070 */ "\x0a\x90\x00\x00\x0b\xa0\x00\x00\x0c\xb0\x00\x00\x0d\xc0\x00\x00" // ................
+ /* 0080 */ "\x0e\xd0\x00\x00\x0f\xe0\x00\x00\x10\xf0\x00\x00\x11\x01\x00\x00" // ................
+ /* 0090 */ "\x12\x11\x00\x00\x13\x21\x00\x00\x14\x31\x00"                     // .....!...1.
+    };
+
+    run_update(front, info, "5,1,-239" /* encodings: Hextile,CopyRect,Cursor pseudo-encoding */,
+               indata, sizeof(indata) - 1, outdata, sizeof(outdata) - 1);
+
+    // 2 blue tiles merged, background and subrects of red tile
+    BOOST_CHECK_EQUAL(4, front.nb_opaque_rect);
+    BOOST_CHECK_EQUAL(Rect(0, 0, 32, 16), front.first_opaque_rect);
+    BOOST_CHECK_EQUAL(0x001F, front.first_opaque_rect_color);
+
+    // raw tile and tile with too many subrects
+    BOOST_REQUIRE_EQUAL(2, front.nb_bitmap);
+    BOOST_CHECK_EQUAL(0x4000, pixel(front.bitmaps[0], 0));
+    BOOST_CHECK_EQUAL(0x4007, pixel(front.bitmaps[0], 7));
+    BOOST_CHECK_EQUAL(0x0100, pixel(front.bitmaps[1], 0));
+    BOOST_CHECK_EQUAL(0x1000, pixel(front.bitmaps[1], 15));
+    BOOST_CHECK_EQUAL(0x1100, pixel(front.bitmaps[1], 16));
+    BOOST_CHECK_EQUAL(0x0000, pixel(front.bitmaps[1], 20));
+}
+
+BOOST_AUTO_TEST_CASE(TestTightOrders)
+{
+    ClientInfo info(1, true, true);
+    info.keylayout = 0x040C;
+    info.bpp       = 16;
+    info.width     = 256;
+    info.height    = 128;
+
+    CountFront front(info, 0);
+
+    const char outdata[] =
+    {
+// Socket VNC Target (3) sending 12 bytes
+ /* 0000 */ "\x52\x46\x42\x20\x30\x30\x33\x2e\x30\x30\x33\x0a"                 // RFB 003.003.
+// Socket VNC Target (3) sending 1 bytes
+ /* 0000 */ "\x01"                                                             // .
+// Socket VNC Target (3) sending 20 bytes
+ /* 0000 */ "\x00\x00\x00\x00\x10\x10\x00\x01\x00\x1f\x00\x3f\x00\x1f\x0b\x05" // ...........?....
+ /* 0010 */ "\x00\x00\x00\x00"                                                 // ....
+// Socket VNC Target (3) sending 16 bytes
+ /* 0000 */ "\x02\x00\x00\x03\x00\x00\x00\x07\x00\x00\x00\x01\xff\xff\xff\x11" // ................
+// Socket VNC Target (3) sending 10 bytes
+ /* 0000 */ "\x03\x00\x00\x00\x00\x00\x01\x00\x00\x80"                         // ..........
+// Socket VNC Target (3) sending 10 bytes
+ /* 0000 */ "\x03\x01\x00\x00\x00\x00\x01\x00\x00\x80"                         // ..........
+    };
+
+    const char indata[] =
+    {
+// Socket VNC Target (3) receiving 12 bytes
+ /* 0000 */ "\x52\x46\x42\x20\x30\x30\x33\x2e\x30\x30\x38\x0a"                 // RFB 003.008.
+// Socket VNC Target (3) receiving 4 bytes
+ /* 0000 */ "\x00\x00\x00\x01"                                                 // ....
+// security level is 1 (1 = none, 2 = standard)
+// Socket VNC Target (3) receiving 24 bytes
+ /* 0000 */ "\x01\x00\x00\x80\x10\x10\x00\x01\x00\x1f\x00\x3f\x00\x1f\x0b\x05" // ...........?....
+ /* 0010 */ "\x00\x00\x00\x00\x00\x00\x00\x04"                                 // ........
+// VNC received: width=256 height=128 bpp=16 depth=16 endianess=0 true_color=1 red_max=31 green_max=63 blue_max=31 red_shift=11 green_shift=5 blue_shift=0
+// Socket VNC Target (3) receiving 4 bytes
+ /* 0000 */ "\x51\x45\x4d\x55"                                                 // QEMU
+// FramebufferUpdate, 6 Tight rectangles:
+// - (0, 32, 32, 16): green fill
+// - (0, 48, 16, 8): 2 colors palette with a white bar, zlib stream 0
+// - (32, 32, 8, 1): copy filter, zlib stream 1
+// - (40, 32, 2, 2): gradient filter, not compressed (less than 12 bytes)
+// - (48, 32, 8, 4): 4 colors palette, zlib stream 0 reset
+// - (32, 33, 8, 1): copy filter, zlib stream 1 continued
+ /* 0000 */ "\x00\x00\x00\x06\x00\x00\x00\x20\x00\x20\x00\x10\x00\x00\x00\x07" // ....... . ......
+ /* 0010 */ "\x80\xe0\x07\x00\x00\x00\x30\x00\x10\x00\x08\x00\x00\x00\x07\x40" // ......0........@
+ /* 0020 */ "\x01\x01\x00\x00\xff\xff\x0d\x78\x9c\xe2\x67\xe0\x47\x81\x00\x00" // .......x..g.G...
+ /* 0030 */ "\x00\x00\xff\xff\x00\x20\x00\x20\x00\x08\x00\x01\x00\x00\x00\x07" // ..... . ........
+ /* 0040 */ "\x10\x18\x78\x9c\x62\x10\x60\x14\x60\x12\x60\x16\x60\x11\x60\x15" // ..x.b.`.`.`.`.`.
+ /* 0050 */ "\x60\x13\x60\x17\x00\x00\x00\x00\xff\xff\x00\x28\x00\x20\x00\x02" // `.`........(. ..
+ /* 0060 */ "\x00\x02\x00\x00\x00\x07\x60\x02\x41\x08\x41\x08\x41\x08\x41\x08" // ......`.A.A.A.A.
+ /* 0070 */ "\x00\x30\x00\x20\x00\x08\x00\x04\x00\x00\x00\x07\x41\x01\x03\x1f" // .0. ........A...
+ /* 0080 */ "\x00\xe0\x07\x00\xf8\xff\xff\x16\x78\x9c\x62\x60\x64\x62\x66\x00" // ........x.b`dbf.
+ /* 0090 */ "\x62\x28\xc5\x00\xa5\x18\xa1\x14\x13\x00\x00\x00\xff\xff\x00\x20" // b(............. 
+ /* 00a0 */ "\x00\x21\x00\x08\x00\x01\x00\x00\x00\x07\x10\x16\x62\x50\x60\x54" // .!..........bP`T
+ /* 00b0 */ "\x60\x52\x60\x56\x60\x51\x60\x55\x60\x53\x60\x57\x00\x00\x00\x00" // `R`V`Q`U`S`W....
+ /* 00c0 */ "\xff\xff"                                                         // ..
+    };
+
+    run_update(front, info, "7,1,-239" /* encodings: Tight,CopyRect,Cursor pseudo-encoding */,
+               indata, sizeof(indata) - 1, outdata, sizeof(outdata) - 1);
+
+    // fill, background and bar of 2 colors palette rectangle
+    BOOST_CHECK_EQUAL(3, front.nb_opaque_rect);
+    BOOST_CHECK_EQUAL(Rect(0, 32, 32, 16), front.first_opaque_rect);
+    BOOST_CHECK_EQUAL(0x07E0, front.first_opaque_rect_color);
+
+    BOOST_REQUIRE_EQUAL(4, front.nb_bitmap);
+    BOOST_CHECK_EQUAL(0x1000, pixel(front.bitmaps[0], 0));
+    BOOST_CHECK_EQUAL(0x1007, pixel(front.bitmaps[0], 7));
+    BOOST_CHECK_EQUAL(0x0841, pixel(front.bitmaps[1], 0));
+    BOOST_CHECK_EQUAL(0x1082, pixel(front.bitmaps[1], 1));
+    BOOST_CHECK_EQUAL(0x1082, pixel(front.bitmaps[1], 2));
+    BOOST_CHECK_EQUAL(0x2104, pixel(front.bitmaps[1], 3));
+    BOOST_CHECK_EQUAL(0x001F, pixel(front.bitmaps[2], 0));
+    BOOST_CHECK_EQUAL(0x07E0, pixel(front.bitmaps[2], 1));
+    BOOST_CHECK_EQUAL(0x07E0, pixel(front.bitmaps[2], 8));
+    BOOST_CHECK_EQUAL(0xFFFF, pixel(front.bitmaps[2], 3));
+    BOOST_CHECK_EQUAL(0xF800, pixel(front.bitmaps[2], 31));
+    BOOST_CHECK_EQUAL(0x2000, pixel(front.bitmaps[3], 0));
+    BOOST_CHECK_EQUAL(0x2007, pixel(front.bitmaps[3], 7));
+}
@@ -0,0 +1,111 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2013
+   Author(s): Christophe Grosjean
+
+   Unit test of the RDP orders sent to front for VNC ZRLE and CopyRect
+   updates
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestVncClientZRLE
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+#include "log.hpp"
+
+#include "../front/count_front.hpp"
+
+BOOST_AUTO_TEST_CASE(TestZRLEOrders)
+{
+    ClientInfo info(1, true, true);
+    info.keylayout = 0x040C;
+    info.bpp       = 16;
+    info.width     = 256;
+    info.height    = 128;
+
+    CountFront front(info, 0);
+
+    const char outdata[] =
+    {
+// Socket VNC Target (3) sending 12 bytes
+ /* 0000 */ "\x52\x46\x42\x20\x30\x30\x33\x2e\x30\x30\x33\x0a"                 // RFB 003.003.
+// Socket VNC Target (3) sending 1 bytes
+ /* 0000 */ "\x01"                                                             // .
+// Socket VNC Target (3) sending 20 bytes
+ /* 0000 */ "\x00\x00\x00\x00\x10\x10\x00\x01\x00\x1f\x00\x3f\x00\x1f\x0b\x05" // ...........?....
+ /* 0010 */ "\x00\x00\x00\x00"                                                 // ....
+// Socket VNC Target (3) sending 16 bytes
+ /* 0000 */ "\x02\x00\x00\x03\x00\x00\x00\x10\x00\x00\x00\x01\xff\xff\xff\x11" // ................
+// Socket VNC Target (3) sending 10 bytes
+ /* 0000 */ "\x03\x00\x00\x00\x00\x00\x01\x00\x00\x80"                         // ..........
+// Socket VNC Target (3) sending 10 bytes
+ /* 0000 */ "\x03\x01\x00\x00\x00\x00\x01\x00\x00\x80"                         // ..........
+    };
+
+    const char indata[] =
+    {
+// Socket VNC Target (3) receiving 12 bytes
+ /* 0000 */ "\x52\x46\x42\x20\x30\x30\x33\x2e\x30\x30\x38\x0a"                 // RFB 003.008.
+// Socket VNC Target (3) receiving 4 bytes
+ /* 0000 */ "\x00\x00\x00\x01"                                                 // ....
+// security level is 1 (1 = none, 2 = standard)
+// Socket VNC Target (3) receiving 24 bytes
+ /* 0000 */ "\x01\x00\x00\x80\x10\x10\x00\x01\x00\x1f\x00\x3f\x00\x1f\x0b\x05" // ...........?....
+ /* 0010 */ "\x00\x00\x00\x00\x00\x00\x00\x04"                                 // ........
+// VNC received: width=256 height=128 bpp=16 depth=16 endianess=0 true_color=1 red_max=31 green_max=63 blue_max=31 red_shift=11 green_shift=5 blue_shift=0
+// Socket VNC Target (3) receiving 4 bytes
+ /* 0000 */ "\x51\x45\x4d\x55"                                                 // QEMU
+// FramebufferUpdate, 2 rectangles:
+// - ZRLE (0, 0, 256, 128), first tile row: 3 blue solid tiles then a red one,
+//   second tile row: a 2 colors tile with a bar, a plain RLE tile, a 2 colors
+//   checkerboard tile and a blue solid tile
+// - CopyRect (0, 64, 64, 64) from (128, 0)
+ /* 0000 */ "\x00\x00\x00\x02\x00\x00\x00\x00\x01\x00\x00\x80\x00\x00\x00\x10" // ................
+ /* 0010 */ "\x00\x00\x00\xf4\x78\x9c\x62\x94\x67\x60\x84\x20\x86\x1f\x4c\xff" // ....x.b.g`. ..L.
+ /* 0020 */ "\xff\x33\x8c\x3c\xf0\x1f\x0c\x70\xd3\x23\x0c\x34\x30\x30\xd8\x2b" // .3.<...p.#.400.+
+ /* 0030 */ "\x72\xd8\x3b\x09\xd8\x27\x4b\xd8\xb7\x28\xd8\x2f\xd5\xb0\x3f\x66" // r.;..'K..(./...f
+ /* 0040 */ "\x60\xff\xdc\xc2\x9e\xc3\xd1\x5e\xd3\xd3\xde\x2b\xd0\x3e\x3b\xd2" // `......^...+.>;.
+ /* 0050 */ "\xbe\x27\xd1\x7e\x6d\xa6\xfd\xb9\x42\xfb\xf7\x95\xf6\x02\x4d\xf6" // .'.~m...B.....M.
+ /* 0060 */ "\x86\x5d\xf6\x41\x93\xec\x8b\x67\xd9\x4f\x59\x64\xbf\x75\x95\xfd" // .].A...g.OYd.u..
+ /* 0070 */ "\xb5\x4d\xf6\xdf\x77\xd9\x4b\x1c\xb6\xb7\x3c\x6d\x1f\x75\xd9\xbe" // .M..w.K...<m.u..
+ /* 0080 */ "\xfa\xb6\xfd\x9c\xc7\xf6\x7b\x5f\xdb\xdf\xfb\x6c\xff\xff\xb7\xbd" // ......{_...l....
+ /* 0090 */ "\x02\x8b\xbd\x23\x8f\x7d\x92\x88\x7d\xb3\x8c\xfd\x12\x15\xfb\xa3" // ...#.}..}.......
+ /* 00a0 */ "\x3a\xf6\xcf\x4c\xec\xd9\x6d\xed\x35\x5c\xed\x3d\x7d\xed\xb3\x42" // :..L..m.5..=}..B
+ /* 00b0 */ "\xed\xbb\x63\xed\xd7\xa4\xda\x9f\xcd\xb5\x7f\x57\x6a\xcf\x5f\x67" // ..c........Wj._g
+ /* 00c0 */ "\x6f\xd0\x66\x1f\xd8\x67\x5f\x34\xcd\x7e\xf2\x3c\xfb\x2d\xcb\xec" // o.f..g_4.~.<.-..
+ /* 00d0 */ "\xaf\xae\xb3\xff\xb6\xcd\x5e\x7c\xbf\xbd\xc5\x71\xfb\xc8\xf3\xf6" // ......^|...q....
+ /* 00e0 */ "\x55\xd7\xed\x67\xdf\xb7\xdf\xf3\xdc\xfe\xee\x7b\xfb\x7f\xdf\xed" // U..g.......{....
+ /* 00f0 */ "\xe5\x19\xec\x21\xa9\xf8\x3f\x65\x90\x42\xed\xa3\xf6\x0f\xb0\xfd" // ...!...e.B......
+ /* 0100 */ "\xc0\x02\x0d\x00\x00\x00\xff\xff\x00\x00\x00\x40\x00\x40\x00\x40" // ...........@.@.@
+ /* 0110 */ "\x00\x00\x00\x01\x00\x80\x00\x00"                                 // ........
+    };
+
+    run_update(front, info, "16,1,-239" /* encodings: ZRLE,CopyRect,Cursor pseudo-encoding */,
+               indata, sizeof(indata) - 1, outdata, sizeof(outdata) - 1);
+
+    // 3 blue tiles merged, red tile, background and bar of the 2 colors tile,
+    // last blue tile
+    BOOST_CHECK_EQUAL(5, front.nb_opaque_rect);
+    BOOST_CHECK_EQUAL(Rect(0, 0, 192, 64), front.first_opaque_rect);
+    BOOST_CHECK_EQUAL(0x001F, front.first_opaque_rect_color);
+    // plain RLE tile and checkerboard (too many orders)
+    BOOST_CHECK_EQUAL(2, front.nb_bitmap);
+    // CopyRect
+    BOOST_CHECK_EQUAL(1, front.nb_scr_blt);
+}
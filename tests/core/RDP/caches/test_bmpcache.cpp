@@ -21,13 +21,139 @@
 
 #define BOOST_AUTO_TEST_MAIN
 #define BOOST_TEST_DYN_LINK
-#define BOOST_TEST_MODULE TestXXX
+#define BOOST_TEST_MODULE TestBmpCache
 #include <boost/test/auto_unit_test.hpp>
 
 #define LOGNULL
 #include "log.hpp"
 
+#include "RDP/caches/bmpcache.hpp"
 
-BOOST_AUTO_TEST_CASE(TestXXX)
+static void fill_bitmap(Bitmap & bmp, uint32_t seed)
 {
+    uint8_t * p = const_cast<uint8_t*>(bmp.data());
+    for (size_t i = 0 ; i < bmp.bmp_size ; i++){
+        p[i] = static_cast<uint8_t>(seed >> ((i % 4) * 8));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestBmpCacheHitAndEviction)
+{
+    BmpCache cache(24, 3, 768, 2, 3072, 2, 12288);
+
+    Bitmap bmp1(24, NULL, 16, 16);
+    fill_bitmap(bmp1, 1);
+    Bitmap bmp2(24, NULL, 16, 16);
+    fill_bitmap(bmp2, 2);
+    Bitmap bmp3(24, NULL, 16, 16);
+    fill_bitmap(bmp3, 3);
+    Bitmap bmp4(24, NULL, 16, 16);
+    fill_bitmap(bmp4, 4);
+
+    // unused entries are used first, in order
+    BOOST_CHECK_EQUAL((BITMAP_ADDED_TO_CACHE << 24)|(0 << 16)|0, cache.cache_bitmap(bmp1));
+    BOOST_CHECK_EQUAL((BITMAP_ADDED_TO_CACHE << 24)|(0 << 16)|1, cache.cache_bitmap(bmp2));
+    BOOST_CHECK_EQUAL((BITMAP_FOUND_IN_CACHE << 24)|(0 << 16)|0, cache.cache_bitmap(bmp1));
+    BOOST_CHECK_EQUAL((BITMAP_ADDED_TO_CACHE << 24)|(0 << 16)|2, cache.cache_bitmap(bmp3));
+    BOOST_CHECK_EQUAL((BITMAP_FOUND_IN_CACHE << 24)|(0 << 16)|1, cache.cache_bitmap(bmp2));
+
+    // cache full: oldest stamped entry is replaced (hits do not restamp)
+    BOOST_CHECK_EQUAL((BITMAP_ADDED_TO_CACHE << 24)|(0 << 16)|0, cache.cache_bitmap(bmp4));
+    BOOST_CHECK_EQUAL((BITMAP_ADDED_TO_CACHE << 24)|(0 << 16)|1, cache.cache_bitmap(bmp1));
+    BOOST_CHECK_EQUAL((BITMAP_FOUND_IN_CACHE << 24)|(0 << 16)|0, cache.cache_bitmap(bmp4));
+    BOOST_CHECK_EQUAL((BITMAP_FOUND_IN_CACHE << 24)|(0 << 16)|2, cache.cache_bitmap(bmp3));
+
+    // restamp protects entry from eviction
+    cache.restamp(0, 2);
+    BOOST_CHECK_EQUAL((BITMAP_ADDED_TO_CACHE << 24)|(0 << 16)|0, cache.cache_bitmap(bmp2));
+    BOOST_CHECK_EQUAL((BITMAP_ADDED_TO_CACHE << 24)|(0 << 16)|1, cache.cache_bitmap(bmp4));
+    BOOST_CHECK_EQUAL((BITMAP_FOUND_IN_CACHE << 24)|(0 << 16)|2, cache.cache_bitmap(bmp3));
+    BOOST_CHECK(cache.get_stamp(0, 1) > cache.get_stamp(0, 2));
+
+    // bitmaps are dispatched by size
+    Bitmap medium(24, NULL, 32, 32);
+    fill_bitmap(medium, 5);
+    Bitmap big(24, NULL, 64, 64);
+    fill_bitmap(big, 5);
+    BOOST_CHECK_EQUAL((BITMAP_ADDED_TO_CACHE << 24)|(1 << 16)|0, cache.cache_bitmap(medium));
+    BOOST_CHECK_EQUAL((BITMAP_ADDED_TO_CACHE << 24)|(2 << 16)|0, cache.cache_bitmap(big));
+    BOOST_CHECK_EQUAL((BITMAP_FOUND_IN_CACHE << 24)|(1 << 16)|0, cache.cache_bitmap(medium));
+    BOOST_CHECK_EQUAL((BITMAP_FOUND_IN_CACHE << 24)|(2 << 16)|0, cache.cache_bitmap(big));
+
+    cache.reset();
+    BOOST_CHECK_EQUAL((BITMAP_ADDED_TO_CACHE << 24)|(0 << 16)|0, cache.cache_bitmap(bmp3));
+}
+
+BOOST_AUTO_TEST_CASE(TestBmpCacheEvictionAgainstSmallCacheFirstEntry)
+{
+    BmpCache cache(24, 2, 768, 3, 3072, 2, 12288);
+
+    Bitmap small(24, NULL, 16, 16);
+    fill_bitmap(small, 1);
+    Bitmap medium1(24, NULL, 32, 32);
+    fill_bitmap(medium1, 1);
+    Bitmap medium2(24, NULL, 32, 32);
+    fill_bitmap(medium2, 2);
+    Bitmap medium3(24, NULL, 32, 32);
+    fill_bitmap(medium3, 3);
+    Bitmap medium4(24, NULL, 32, 32);
+    fill_bitmap(medium4, 4);
+
+    // while entry 0 of small cache is unused, entry 0 is always replaced
+    BOOST_CHECK_EQUAL((BITMAP_ADDED_TO_CACHE << 24)|(1 << 16)|0, cache.cache_bitmap(medium1));
+    BOOST_CHECK_EQUAL((BITMAP_ADDED_TO_CACHE << 24)|(1 << 16)|0, cache.cache_bitmap(medium2));
+
+    // entries older than entry 0 of small cache are replaced first
+    BOOST_CHECK_EQUAL((BITMAP_ADDED_TO_CACHE << 24)|(0 << 16)|0, cache.cache_bitmap(small));
+    BOOST_CHECK_EQUAL((BITMAP_ADDED_TO_CACHE << 24)|(1 << 16)|1, cache.cache_bitmap(medium1));
+    BOOST_CHECK_EQUAL((BITMAP_ADDED_TO_CACHE << 24)|(1 << 16)|2, cache.cache_bitmap(medium3));
+    BOOST_CHECK_EQUAL((BITMAP_ADDED_TO_CACHE << 24)|(1 << 16)|0, cache.cache_bitmap(medium4));
+
+    // then entry 0 again, though entry 1 is the least recently stamped
+    BOOST_CHECK_EQUAL((BITMAP_ADDED_TO_CACHE << 24)|(1 << 16)|0, cache.cache_bitmap(medium2));
+}
+
+BOOST_AUTO_TEST_CASE(TestBmpCachePut)
+{
+    BmpCache cache(24, 4, 768, 2, 3072, 2, 12288);
+
+    Bitmap bmp1(24, NULL, 16, 16);
+    fill_bitmap(bmp1, 1);
+    Bitmap bmp2(24, NULL, 16, 16);
+    fill_bitmap(bmp2, 2);
+
+    // entries explicitly put are found by cache_bitmap and evicted after unused ones
+    cache.put(0, 2, new Bitmap(24, bmp1));
+    BOOST_CHECK_EQUAL((BITMAP_FOUND_IN_CACHE << 24)|(0 << 16)|2, cache.cache_bitmap(bmp1));
+    BOOST_CHECK_EQUAL((BITMAP_ADDED_TO_CACHE << 24)|(0 << 16)|0, cache.cache_bitmap(bmp2));
+
+    // duplicate content: lowest entry index wins
+    cache.put(0, 1, new Bitmap(24, bmp1));
+    BOOST_CHECK_EQUAL((BITMAP_FOUND_IN_CACHE << 24)|(0 << 16)|1, cache.cache_bitmap(bmp1));
+
+    // overwriting an entry removes previous content from lookup
+    cache.put(0, 1, new Bitmap(24, bmp2));
+    cache.put(0, 2, new Bitmap(24, bmp2));
+    BOOST_CHECK_EQUAL((BITMAP_FOUND_IN_CACHE << 24)|(0 << 16)|0, cache.cache_bitmap(bmp2));
+    BOOST_CHECK_EQUAL((BITMAP_ADDED_TO_CACHE << 24)|(0 << 16)|3, cache.cache_bitmap(bmp1));
+}
+
+BOOST_AUTO_TEST_CASE(TestBmpCacheFingerprintModes)
+{
+    Bitmap bmp1(24, NULL, 16, 16);
+    fill_bitmap(bmp1, 1);
+    Bitmap bmp2(24, NULL, 16, 16);
+    fill_bitmap(bmp2, 2);
+
+    BmpCache sha1_cache(24, 2, 768, 2, 3072, 2, 12288, BITMAP_FINGERPRINT_SHA1);
+    BmpCache verify_cache(24, 2, 768, 2, 3072, 2, 12288, BITMAP_FINGERPRINT_FAST, true);
+
+    BmpCache * caches[] = { &sha1_cache, &verify_cache };
+    for (size_t i = 0 ; i < sizeof(caches) / sizeof(caches[0]) ; i++){
+        BmpCache & cache = *caches[i];
+        BOOST_CHECK_EQUAL((BITMAP_ADDED_TO_CACHE << 24)|(0 << 16)|0, cache.cache_bitmap(bmp1));
+        BOOST_CHECK_EQUAL((BITMAP_ADDED_TO_CACHE << 24)|(0 << 16)|1, cache.cache_bitmap(bmp2));
+        BOOST_CHECK_EQUAL((BITMAP_FOUND_IN_CACHE << 24)|(0 << 16)|0, cache.cache_bitmap(bmp1));
+        BOOST_CHECK_EQUAL((BITMAP_FOUND_IN_CACHE << 24)|(0 << 16)|1, cache.cache_bitmap(bmp2));
+    }
 }
@@ -0,0 +1,243 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2013
+   Author(s): Christophe Grosjean
+
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestPersistentBmpStore
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+#include "log.hpp"
+
+#include <stdlib.h>
+#include <string>
+
+#include "RDP/caches/bmpcache.hpp"
+#include "RDP/caches/persistentbmpstore.hpp"
+
+// private directory for store files, removed at end of test
+struct StoreDirectory {
+    char path[64];
+
+    StoreDirectory()
+    {
+        strcpy(this->path, "/tmp/test_persistentbmpstore_XXXXXX");
+        BOOST_REQUIRE(mkdtemp(this->path));
+    }
+
+    ~StoreDirectory()
+    {
+        unlink(this->file().c_str());
+        rmdir(this->path);
+    }
+
+    std::string file() const
+    {
+        return std::string(this->path) + "/rdpproxy_bitmaps.store";
+    }
+};
+
+static void fill_bitmap(Bitmap & bmp, uint32_t seed)
+{
+    uint8_t * p = const_cast<uint8_t*>(bmp.data());
+    for (size_t i = 0 ; i < bmp.bmp_size ; i++){
+        p[i] = static_cast<uint8_t>((seed >> ((i % 4) * 8)) + i / 64);
+    }
+}
+
+// digests that all go to the same set of the store
+static void make_digest(uint8_t (&digest)[20], uint8_t n)
+{
+    memset(digest, 0, 20);
+    digest[0] = n;
+}
+
+BOOST_AUTO_TEST_CASE(TestPersistentBmpStoreShared)
+{
+    StoreDirectory store_dir;
+    const char * dir = store_dir.path;
+
+    Bitmap bmp(24, NULL, 32, 32);
+    fill_bitmap(bmp, 0x123456);
+    BStream expected(65536);
+    bmp.compress(expected);
+
+    uint8_t digest[20];
+    bmp.compute_fingerprint(digest, BITMAP_FINGERPRINT_SHA1);
+
+    // two stores on the same file, as used by two session processes
+    PersistentBmpStore store1(dir, 1, PersistentBmpStore::EVICTION_LRU);
+    PersistentBmpStore store2(dir, 1, PersistentBmpStore::EVICTION_LRU);
+    BOOST_CHECK(store1.is_open());
+    BOOST_CHECK(store2.is_open());
+
+    Bitmap bmp1(24, bmp);
+    BOOST_CHECK(!store1.load(digest, bmp1, BITMAP_FINGERPRINT_SHA1));
+    store1.save(digest, bmp1, BITMAP_FINGERPRINT_SHA1);
+
+    Bitmap bmp2(24, NULL, 32, 32);
+    BOOST_CHECK(store2.load(digest, bmp2, BITMAP_FINGERPRINT_SHA1));
+    // not the same bits per pixel
+    Bitmap bmp16(16, NULL, 32, 32);
+    BOOST_CHECK(!store2.load(digest, bmp16, BITMAP_FINGERPRINT_SHA1));
+    // not the same shape
+    Bitmap bmp64(24, NULL, 64, 16);
+    BOOST_CHECK(!store2.load(digest, bmp64, BITMAP_FINGERPRINT_SHA1));
+
+    // compressed form comes from store, not from bitmap content
+    BStream out(65536);
+    bmp2.compress(out);
+    BOOST_CHECK_EQUAL(expected.get_offset(), out.get_offset());
+    BOOST_CHECK(0 == memcmp(expected.get_data(), out.get_data(), out.get_offset()));
+
+    BOOST_CHECK_EQUAL(1, store2.header->hits);
+    BOOST_CHECK_EQUAL(3, store2.header->misses);
+    BOOST_CHECK_EQUAL(1, store2.header->stores);
+
+    // store content survives sessions
+    {
+        PersistentBmpStore store3(dir, 1, PersistentBmpStore::EVICTION_LRU);
+        Bitmap bmp3(24, NULL, 32, 32);
+        BOOST_CHECK(store3.load(digest, bmp3, BITMAP_FINGERPRINT_SHA1));
+    }
+
+    // a different size replaces the store file, sessions using the former
+    // one still can
+    {
+        PersistentBmpStore store4(dir, 2, PersistentBmpStore::EVICTION_LRU);
+        BOOST_CHECK(store4.is_open());
+        Bitmap bmp4(24, NULL, 32, 32);
+        BOOST_CHECK(!store4.load(digest, bmp4, BITMAP_FINGERPRINT_SHA1));
+    }
+    Bitmap bmp5(24, NULL, 32, 32);
+    BOOST_CHECK(store1.load(digest, bmp5, BITMAP_FINGERPRINT_SHA1));
+}
+
+BOOST_AUTO_TEST_CASE(TestPersistentBmpStoreForgedFingerprint)
+{
+    StoreDirectory store_dir;
+    PersistentBmpStore store(store_dir.path, 1, PersistentBmpStore::EVICTION_LRU);
+
+    Bitmap bmp(24, NULL, 32, 32);
+    fill_bitmap(bmp, 0x123456);
+    uint8_t digest[20];
+    bmp.compute_fingerprint(digest, BITMAP_FINGERPRINT_FAST);
+    store.save(digest, bmp, BITMAP_FINGERPRINT_FAST);
+
+    Bitmap same(24, bmp);
+    BOOST_CHECK(store.load(digest, same, BITMAP_FINGERPRINT_FAST));
+
+    // another content with the same fast fingerprint doesn't get stored bitmap
+    Bitmap other(24, NULL, 32, 32);
+    fill_bitmap(other, 0x654321);
+    BOOST_CHECK(!store.load(digest, other, BITMAP_FINGERPRINT_FAST));
+}
+
+BOOST_AUTO_TEST_CASE(TestPersistentBmpStoreFileSafety)
+{
+    // directory other users can access
+    {
+        StoreDirectory store_dir;
+        chmod(store_dir.path, 0755);
+        PersistentBmpStore store(store_dir.path, 1, PersistentBmpStore::EVICTION_LRU);
+        BOOST_CHECK(!store.is_open());
+    }
+
+    // store file is a symbolic link: link is replaced, its target untouched
+    {
+        StoreDirectory store_dir;
+        const std::string target = std::string(store_dir.path) + "/target";
+        close(open(target.c_str(), O_WRONLY | O_CREAT, 0600));
+        BOOST_REQUIRE_EQUAL(0, symlink(target.c_str(), store_dir.file().c_str()));
+
+        PersistentBmpStore store(store_dir.path, 1, PersistentBmpStore::EVICTION_LRU);
+        BOOST_CHECK(store.is_open());
+
+        struct stat st;
+        BOOST_CHECK_EQUAL(0, stat(target.c_str(), &st));
+        BOOST_CHECK_EQUAL(0, st.st_size);
+        BOOST_CHECK_EQUAL(0, lstat(store_dir.file().c_str(), &st));
+        BOOST_CHECK(S_ISREG(st.st_mode));
+        unlink(target.c_str());
+    }
+}
+
+static void check_eviction(PersistentBmpStore::EvictionPolicy policy, bool first_kept)
+{
+    StoreDirectory store_dir;
+    PersistentBmpStore store(store_dir.path, 1, policy);
+
+    Bitmap bmp(24, NULL, 32, 32);
+    fill_bitmap(bmp, 7);
+    Bitmap out(24, NULL, 32, 32);
+
+    uint8_t digest[PersistentBmpStore::WAYS + 1][20];
+    for (uint8_t i = 0 ; i < PersistentBmpStore::WAYS ; i++){
+        make_digest(digest[i], i);
+        store.save(digest[i], bmp, BITMAP_FINGERPRINT_SHA1);
+    }
+    // hit on first entry makes it most recently used with LRU policy
+    BOOST_CHECK(store.load(digest[0], out, BITMAP_FINGERPRINT_SHA1));
+
+    make_digest(digest[PersistentBmpStore::WAYS], PersistentBmpStore::WAYS);
+    store.save(digest[PersistentBmpStore::WAYS], bmp, BITMAP_FINGERPRINT_SHA1);
+    BOOST_CHECK_EQUAL(1, store.header->evictions);
+
+    BOOST_CHECK(store.load(digest[PersistentBmpStore::WAYS], out, BITMAP_FINGERPRINT_SHA1));
+    BOOST_CHECK_EQUAL(first_kept, store.load(digest[0], out, BITMAP_FINGERPRINT_SHA1));
+    BOOST_CHECK_EQUAL(!first_kept, store.load(digest[1], out, BITMAP_FINGERPRINT_SHA1));
+}
+
+BOOST_AUTO_TEST_CASE(TestPersistentBmpStoreEviction)
+{
+    check_eviction(PersistentBmpStore::EVICTION_LRU, true);
+    check_eviction(PersistentBmpStore::EVICTION_FIFO, false);
+}
+
+BOOST_AUTO_TEST_CASE(TestBmpCacheWithPersistentStore)
+{
+    StoreDirectory store_dir;
+    PersistentBmpStore store(store_dir.path, 1, PersistentBmpStore::EVICTION_LRU);
+
+    Bitmap bmp(24, NULL, 32, 32);
+    fill_bitmap(bmp, 42);
+
+    {
+        BmpCache cache(24, 2, 768, 2, 3072, 2, 12288);
+        cache.set_persistent_store(&store);
+        BOOST_CHECK_EQUAL((BITMAP_ADDED_TO_CACHE << 24)|(1 << 16)|0, cache.cache_bitmap(bmp));
+        BOOST_CHECK(cache.get(1, 0)->data_compressed != NULL);
+    }
+    BOOST_CHECK_EQUAL(0, store.header->hits);
+    BOOST_CHECK_EQUAL(1, store.header->stores);
+
+    // another session gets compressed bitmap from store
+    {
+        BmpCache cache(24, 2, 768, 2, 3072, 2, 12288);
+        cache.set_persistent_store(&store);
+        BOOST_CHECK_EQUAL((BITMAP_ADDED_TO_CACHE << 24)|(1 << 16)|0, cache.cache_bitmap(bmp));
+        BOOST_CHECK(cache.get(1, 0)->data_compressed != NULL);
+        // cache hit does not need store
+        BOOST_CHECK_EQUAL((BITMAP_FOUND_IN_CACHE << 24)|(1 << 16)|0, cache.cache_bitmap(bmp));
+    }
+    BOOST_CHECK_EQUAL(1, store.header->hits);
+    BOOST_CHECK_EQUAL(1, store.header->stores);
+}
@@ -17,6 +17,7 @@
    Copyright (C) Wallix 2013
    Author(s): Christophe Grosjean
 
+   Unit test of graphic update PDUs: no heap allocation when sending PDUs
 */
 
 #define BOOST_AUTO_TEST_MAIN
@@ -27,7 +28,94 @@
 #define LOGNULL
 #include "log.hpp"
 
+#include <stdlib.h>
+
+// count heap allocations
+static unsigned long nb_allocations = 0;
+extern "C" void * __libc_malloc(size_t size);
+extern "C" void * malloc(size_t size)
+{
+    nb_allocations++;
+    return __libc_malloc(size);
+}
+
+#include "RDP/RDPSerializer.hpp"
+#include "RDP/gcc.hpp"
+#include "RDP/GraphicUpdatePDU.hpp"
+#include "RDP/mppc_60.hpp"
+#include "counttransport.hpp"
+
 
 BOOST_AUTO_TEST_CASE(TestXXX)
 {
 }
+
+// Orders and bitmap updates sent once to allocate what is kept for the session,
+// next updates must not allocate anything
+static unsigned long allocations_per_updates(bool fastpath_support, bool compression)
+{
+    Inifile ini;
+    CountTransport trans;
+    uint16_t userid = 0;
+    int shareid = 0x103EA;
+    int encryptionLevel = 0;
+    CryptContext encrypt;
+    BmpCache bmp_cache(24, 120, 768, 120, 3072, 2553, 12288);
+    rdp_mppc_60_enc mppc_enc;
+
+    GraphicsUpdatePDU gpdu( &trans, userid, shareid, encryptionLevel, encrypt, ini, 24, bmp_cache
+                          , 2, 1, 0, fastpath_support, &mppc_enc, compression
+                          , compression ? PACKET_COMPR_TYPE_RDP6 : 0);
+
+    const Rect screen(0, 0, 800, 600);
+    uint8_t raw[32 * 32 * 3];
+    for (size_t i = 0; i < sizeof(raw); i++){
+        raw[i] = static_cast<uint8_t>(i * 7);
+    }
+    const Bitmap bmp(24, NULL, 32, 32, raw, sizeof(raw));
+    RDPBitmapData bitmap_data;
+    bitmap_data.dest_left      = 0;
+    bitmap_data.dest_top       = 0;
+    bitmap_data.dest_right     = 31;
+    bitmap_data.dest_bottom    = 31;
+    bitmap_data.width          = 32;
+    bitmap_data.height         = 32;
+    bitmap_data.bits_per_pixel = 24;
+    bitmap_data.flags          = 0;
+    bitmap_data.bitmap_length  = sizeof(raw);
+
+    unsigned long allocations = 0;
+    for (int update = 0; update < 10; update++){
+        const unsigned long before = nb_allocations;
+        for (int i = 0; i < 100; i++){
+            gpdu.draw(RDPOpaqueRect(Rect(i * 8, i * 6, 100 + update, 20), i * update), screen);
+        }
+        gpdu.draw(bitmap_data, raw, sizeof(raw), bmp);
+        gpdu.flush();
+        if (update > 0){
+            allocations += nb_allocations - before;
+        }
+    }
+    BOOST_CHECK(trans.total_sent > 0);
+    return allocations;
+}
+
+BOOST_AUTO_TEST_CASE(TestUpdateAllocationsSlowPath)
+{
+    BOOST_CHECK_EQUAL(0u, allocations_per_updates(false, false));
+}
+
+BOOST_AUTO_TEST_CASE(TestUpdateAllocationsSlowPathCompressed)
+{
+    BOOST_CHECK_EQUAL(0u, allocations_per_updates(false, true));
+}
+
+BOOST_AUTO_TEST_CASE(TestUpdateAllocationsFastPath)
+{
+    BOOST_CHECK_EQUAL(0u, allocations_per_updates(true, false));
+}
+
+BOOST_AUTO_TEST_CASE(TestUpdateAllocationsFastPathCompressed)
+{
+    BOOST_CHECK_EQUAL(0u, allocations_per_updates(true, true));
+}
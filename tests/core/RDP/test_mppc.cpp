@@ -114,6 +114,43 @@ BOOST_AUTO_TEST_CASE(TestMPPC_enc)
     delete rmppc;
 }
 
+BOOST_AUTO_TEST_CASE(TestMPPC_enc_levels)
+{
+    #include "../../fixtures/test_mppc_TestMPPC_enc.hpp"
+
+    int data_len = sizeof(decompressed_rd5_data);
+
+    // hash chains compressors give back same data and send less of it
+    uint16_t previous_datalen[2] = { 0xFFFF, 0xFFFF };
+    for (int level = 0; level <= rdp_mppc_enc_match_finder::LEVEL_MAX; level++) {
+        for (int type = PACKET_COMPR_TYPE_8K; type <= PACKET_COMPR_TYPE_64K; type++) {
+            rdp_mppc_unified_dec dec;
+            rdp_mppc_enc * enc = (type == PACKET_COMPR_TYPE_8K)
+                               ? static_cast<rdp_mppc_enc *>(new rdp_mppc_40_enc(level))
+                               : static_cast<rdp_mppc_enc *>(new rdp_mppc_50_enc(level));
+
+            uint8_t  compressionFlags;
+            uint16_t datalen;
+            BOOST_CHECK_EQUAL(true, enc->compress(decompressed_rd5_data, data_len, compressionFlags, datalen));
+            BOOST_CHECK(0 != (compressionFlags & PACKET_COMPRESSED));
+            BOOST_CHECK(datalen <= previous_datalen[type]);
+            previous_datalen[type] = datalen;
+
+            BStream stream(65536);
+            enc->get_compressed_data(stream);
+            stream.mark_end();
+
+            const uint8_t * rdata;
+            uint32_t        rlen;
+            BOOST_CHECK_EQUAL(true, dec.decompress(stream.get_data(), stream.size(), compressionFlags, rdata, rlen));
+            BOOST_CHECK_EQUAL(data_len, rlen);
+            BOOST_CHECK_EQUAL(0, memcmp(decompressed_rd5_data, rdata, rlen));
+
+            delete enc;
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(TestBitsSerializer)
 {
     char outputBuffer[256] ={};
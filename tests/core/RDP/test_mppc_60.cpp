@@ -26,7 +26,99 @@
 #define LOGNULL
 #include "log.hpp"
 
+#include "RDP/mppc.hpp"
 
-BOOST_AUTO_TEST_CASE(TestXXX)
+// compress data in packets of packet_size bytes then check decompressor
+// gives data back
+static void check_round_trip(rdp_mppc_enc & enc, rdp_mppc_dec & dec, const uint8_t * data,
+                             int len, int packet_size)
 {
+    for (int offset = 0; offset < len; offset += packet_size) {
+        int size = std::min(packet_size, len - offset);
+
+        uint8_t  compressionFlags;
+        uint16_t datalen;
+        BOOST_CHECK(enc.compress(const_cast<uint8_t *>(data + offset), size, compressionFlags, datalen));
+
+        BStream stream(65536);
+        const uint8_t * rdata;
+        uint32_t        rlen;
+        if (compressionFlags & PACKET_COMPRESSED) {
+            BOOST_CHECK(datalen < size);
+            enc.get_compressed_data(stream);
+            stream.mark_end();
+            dec.decompress(stream.get_data(), stream.size(), compressionFlags, rdata, rlen);
+            BOOST_CHECK_EQUAL(size, rlen);
+            BOOST_CHECK_EQUAL(0, memcmp(data + offset, rdata, size));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestRDP60BulkCompressionHuffmanCodes)
+{
+    // decompressor finds back every symbol from its code
+    struct dec : public rdp_mppc_60_dec {
+        static void check() {
+            for (uint16_t symbol = 0; symbol < sizeof(HuffLenLEC); symbol++) {
+                BOOST_CHECK_EQUAL(symbol, getLECindex(HuffCodeLEC[symbol]));
+            }
+            for (uint16_t symbol = 0; symbol < sizeof(HuffLenLOM); symbol++) {
+                BOOST_CHECK_EQUAL(symbol, getLOMindex(HuffCodeLOM[symbol]));
+            }
+        }
+    };
+    dec::check();
+}
+
+BOOST_AUTO_TEST_CASE(TestRDP60BulkCompression)
+{
+    #include "../../fixtures/test_mppc_TestMPPC_enc.hpp"
+
+    for (int level = 0; level <= rdp_mppc_enc_match_finder::LEVEL_MAX; level++) {
+        rdp_mppc_60_enc enc(level);
+        rdp_mppc_60_dec dec;
+        check_round_trip(enc, dec, decompressed_rd5_data, sizeof(decompressed_rd5_data), 2048);
+
+        // highest level must not compress less than lowest one
+        uint8_t  compressionFlags;
+        uint16_t datalen;
+        rdp_mppc_60_enc enc_one_packet(level);
+        enc_one_packet.compress(decompressed_rd5_data, sizeof(decompressed_rd5_data), compressionFlags, datalen);
+        BOOST_CHECK_EQUAL(PACKET_COMPRESSED | PACKET_FLUSHED | PACKET_COMPR_TYPE_RDP6, compressionFlags);
+        BOOST_CHECK(datalen < sizeof(decompressed_rd5_data) / 2);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestRDP60BulkCompressionHistorySlide)
+{
+    // more data than history buffer holds: history buffer slides, long
+    // matches and offset cache are used
+    const int len = 300000;
+    uint8_t * data = new uint8_t[len];
+    uint32_t seed = 1;
+    for (int i = 0; i < len; i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = ((i / 4096) & 1) ? (seed >> 16) % 5 : (i % 251);
+    }
+
+    for (int level = 0; level <= rdp_mppc_enc_match_finder::LEVEL_MAX; level++) {
+        rdp_mppc_60_enc enc(level);
+        rdp_mppc_60_dec dec;
+        check_round_trip(enc, dec, data, len, 16000);
+        check_round_trip(enc, dec, data, len, 100);
+    }
+
+    // random data does not compress: sent uncompressed, history is flushed
+    for (int i = 0; i < len; i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = seed >> 16;
+    }
+    rdp_mppc_60_enc enc;
+    rdp_mppc_60_dec dec;
+    check_round_trip(enc, dec, data, 4000, 4000);
+    BOOST_CHECK_EQUAL((unsigned)PACKET_FLUSHED, (unsigned)enc.flagsHold);
+    check_round_trip(enc, dec, data, 4000, 4000);
+    BOOST_CHECK_EQUAL(0, enc.flags & PACKET_COMPRESSED);
+
+    delete [] data;
 }
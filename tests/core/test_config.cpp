@@ -74,6 +74,7 @@ BOOST_AUTO_TEST_CASE(TestConfigFromFile)
     BOOST_CHECK_EQUAL(3000,                             ini.video.png_interval);
     BOOST_CHECK_EQUAL(40,                               ini.video.frame_interval);
     BOOST_CHECK_EQUAL(600,                              ini.video.break_interval);
+    BOOST_CHECK_EQUAL(1,                                ini.video.full_image_interval);
     BOOST_CHECK_EQUAL(600000000l,                       ini.globals.flv_break_interval);
     BOOST_CHECK_EQUAL(1000000L,                         ini.globals.flv_frame_interval);
     BOOST_CHECK_EQUAL(100,                              ini.video.ocr_interval);
@@ -81,6 +82,8 @@ BOOST_AUTO_TEST_CASE(TestConfigFromFile)
     BOOST_CHECK_EQUAL(40,                               ini.video.ocr_max_unrecog_char_rate);
 
     BOOST_CHECK_EQUAL(3,                                ini.video.png_limit);
+    BOOST_CHECK_EQUAL(6,                                ini.video.png_compression_level);
+    BOOST_CHECK_EQUAL(0,                                ini.video.png_filter);
 
     BOOST_CHECK_EQUAL(20000,                            ini.video.l_bitrate);
     BOOST_CHECK_EQUAL(5,                                ini.video.l_framerate);
@@ -110,6 +113,10 @@ BOOST_AUTO_TEST_CASE(TestConfigFromFile)
     BOOST_CHECK_EQUAL(false,                            ini.video.disable_keyboard_log_wrm);
     BOOST_CHECK_EQUAL(false,                            ini.video.disable_keyboard_log_ocr);
 
+    BOOST_CHECK_EQUAL(false,                            ini.video.capture_thread);
+    BOOST_CHECK_EQUAL(8192,                             ini.video.capture_queue_size);
+    BOOST_CHECK_EQUAL(0,                                ini.video.capture_queue_timeout);
+
     BOOST_CHECK_EQUAL(30,                               ini.globals.max_tick);
     BOOST_CHECK_EQUAL(30,                               ini.globals.keepalive_grace_delay);
 
@@ -119,6 +126,7 @@ BOOST_AUTO_TEST_CASE(TestConfigFromFile)
     BOOST_CHECK_EQUAL(false,                            ini.globals.enable_file_encryption.get());
     BOOST_CHECK_EQUAL(std::string("0.0.0.0"),           std::string(ini.globals.listen_address));
     BOOST_CHECK_EQUAL(false,                            ini.globals.enable_ip_transparent);
+    BOOST_CHECK_EQUAL(0,                                ini.globals.session_prefork);
     BOOST_CHECK_EQUAL(std::string("inquisition"),       std::string(ini.globals.certificate_password));
 
     BOOST_CHECK_EQUAL(std::string(PNG_PATH),            std::string(ini.globals.png_path));
@@ -161,6 +169,11 @@ BOOST_AUTO_TEST_CASE(TestConfigFromFile)
     BOOST_CHECK_EQUAL(true,                             ini.client.device_redirection.get());
     BOOST_CHECK_EQUAL(false,                            ini.client.rdp_compression);
     BOOST_CHECK_EQUAL(false,                            ini.client.disable_ctrl_alt_del.get());
+    BOOST_CHECK_EQUAL(0,                                ini.client.bitmap_tiling);
+    BOOST_CHECK_EQUAL(1,                                ini.client.rdp_compression_max_type);
+    BOOST_CHECK_EQUAL(0,                                ini.client.rdp_compression_level);
+    BOOST_CHECK_EQUAL(0,                                ini.client.bitmap_cache_fingerprint);
+    BOOST_CHECK_EQUAL(false,                            ini.client.bitmap_cache_verify_content);
 
     BOOST_CHECK_EQUAL(false,                            ini.mod_rdp.rdp_compression);
     BOOST_CHECK_EQUAL(false,                            ini.mod_rdp.disconnect_on_logon_user_change);
@@ -316,6 +329,7 @@ BOOST_AUTO_TEST_CASE(TestConfigDefaultEmpty)
     BOOST_CHECK_EQUAL(3000,                             ini.video.png_interval);
     BOOST_CHECK_EQUAL(40,                               ini.video.frame_interval);
     BOOST_CHECK_EQUAL(600,                              ini.video.break_interval);
+    BOOST_CHECK_EQUAL(1,                                ini.video.full_image_interval);
     BOOST_CHECK_EQUAL(600000000l,                       ini.globals.flv_break_interval);
     BOOST_CHECK_EQUAL(1000000L,                         ini.globals.flv_frame_interval);
     BOOST_CHECK_EQUAL(100,                              ini.video.ocr_interval);
@@ -323,6 +337,8 @@ BOOST_AUTO_TEST_CASE(TestConfigDefaultEmpty)
     BOOST_CHECK_EQUAL(40,                               ini.video.ocr_max_unrecog_char_rate);
 
     BOOST_CHECK_EQUAL(3,                                ini.video.png_limit);
+    BOOST_CHECK_EQUAL(6,                                ini.video.png_compression_level);
+    BOOST_CHECK_EQUAL(0,                                ini.video.png_filter);
 
     BOOST_CHECK_EQUAL(20000,                            ini.video.l_bitrate);
     BOOST_CHECK_EQUAL(5,                                ini.video.l_framerate);
@@ -567,6 +583,7 @@ BOOST_AUTO_TEST_CASE(TestConfigDefault)
     BOOST_CHECK_EQUAL(3000,                             ini.video.png_interval);
     BOOST_CHECK_EQUAL(40,                               ini.video.frame_interval);
     BOOST_CHECK_EQUAL(600,                              ini.video.break_interval);
+    BOOST_CHECK_EQUAL(1,                                ini.video.full_image_interval);
     BOOST_CHECK_EQUAL(600000000l,                       ini.globals.flv_break_interval);
     BOOST_CHECK_EQUAL(1000000L,                         ini.globals.flv_frame_interval);
     BOOST_CHECK_EQUAL(100,                              ini.video.ocr_interval);
@@ -574,6 +591,8 @@ BOOST_AUTO_TEST_CASE(TestConfigDefault)
     BOOST_CHECK_EQUAL(40,                               ini.video.ocr_max_unrecog_char_rate);
 
     BOOST_CHECK_EQUAL(3,                                ini.video.png_limit);
+    BOOST_CHECK_EQUAL(6,                                ini.video.png_compression_level);
+    BOOST_CHECK_EQUAL(0,                                ini.video.png_filter);
 
     BOOST_CHECK_EQUAL(20000,                            ini.video.l_bitrate);
     BOOST_CHECK_EQUAL(5,                                ini.video.l_framerate);
@@ -605,6 +624,10 @@ BOOST_AUTO_TEST_CASE(TestConfigDefault)
     BOOST_CHECK_EQUAL(false,                            ini.video.disable_keyboard_log_wrm);
     BOOST_CHECK_EQUAL(false,                            ini.video.disable_keyboard_log_ocr);
 
+    BOOST_CHECK_EQUAL(false,                            ini.video.capture_thread);
+    BOOST_CHECK_EQUAL(8192,                             ini.video.capture_queue_size);
+    BOOST_CHECK_EQUAL(0,                                ini.video.capture_queue_timeout);
+
     BOOST_CHECK_EQUAL(30,                               ini.globals.max_tick);
     BOOST_CHECK_EQUAL(30,                               ini.globals.keepalive_grace_delay);
 
@@ -700,6 +723,7 @@ BOOST_AUTO_TEST_CASE(TestConfig1)
                           "enable_file_encryption=yes\n"
                           "listen_address=192.168.1.1\n"
                           "enable_ip_transparent=yes\n"
+                          "session_prefork=8\n"
                           "certificate_password=redemption\n"
                           "png_path=/var/tmp/wab/recorded/rdp\n"
                           "wrm_path=/var/wab/recorded/rdp\n"
@@ -718,6 +742,11 @@ BOOST_AUTO_TEST_CASE(TestConfig1)
                           "tls_support=no\n"
                           "rdp_compression=yes\n"
                           "disable_ctrl_alt_del=yes\n"
+                          "bitmap_tiling=2\n"
+                          "rdp_compression_max_type=2\n"
+                          "rdp_compression_level=1\n"
+                          "bitmap_cache_fingerprint=sha1\n"
+                          "bitmap_cache_verify_content=yes\n"
                           "\n"
                           "[mod_rdp]\n"
                           "disconnect_on_logon_user_change=yes\n"
@@ -737,6 +766,12 @@ BOOST_AUTO_TEST_CASE(TestConfig1)
                           "ocr_on_title_bar_only=yes\n"
                           "ocr_max_unrecog_char_rate=50\n"
                           "disable_keyboard_log=1\n"
+                          "capture_thread=yes\n"
+                          "capture_queue_size=1024\n"
+                          "capture_queue_timeout=20\n"
+                          "full_image_interval=6\n"
+                          "png_compression_level=1\n"
+                          "png_filter=sub\n"
                           "\n"
                           "[debug]\n"
                           "log_type=file\n"
@@ -780,6 +815,7 @@ BOOST_AUTO_TEST_CASE(TestConfig1)
     BOOST_CHECK_EQUAL(3000,                             ini.video.png_interval);
     BOOST_CHECK_EQUAL(40,                               ini.video.frame_interval);
     BOOST_CHECK_EQUAL(600,                              ini.video.break_interval);
+    BOOST_CHECK_EQUAL(6,                                ini.video.full_image_interval);
     BOOST_CHECK_EQUAL(600000000l,                       ini.globals.flv_break_interval);
     BOOST_CHECK_EQUAL(1000000L,                         ini.globals.flv_frame_interval);
     BOOST_CHECK_EQUAL(50,                               ini.video.ocr_interval);
@@ -787,6 +823,8 @@ BOOST_AUTO_TEST_CASE(TestConfig1)
     BOOST_CHECK_EQUAL(50,                               ini.video.ocr_max_unrecog_char_rate);
 
     BOOST_CHECK_EQUAL(3,                                ini.video.png_limit);
+    BOOST_CHECK_EQUAL(1,                                ini.video.png_compression_level);
+    BOOST_CHECK_EQUAL(2,                                ini.video.png_filter);
 
     BOOST_CHECK_EQUAL(20000,                            ini.video.l_bitrate);
     BOOST_CHECK_EQUAL(5,                                ini.video.l_framerate);
@@ -815,6 +853,10 @@ BOOST_AUTO_TEST_CASE(TestConfig1)
     BOOST_CHECK_EQUAL(false,                            ini.video.disable_keyboard_log_wrm);
     BOOST_CHECK_EQUAL(false,                            ini.video.disable_keyboard_log_ocr);
 
+    BOOST_CHECK_EQUAL(true,                             ini.video.capture_thread);
+    BOOST_CHECK_EQUAL(1024,                             ini.video.capture_queue_size);
+    BOOST_CHECK_EQUAL(20,                               ini.video.capture_queue_timeout);
+
     BOOST_CHECK_EQUAL(30,                               ini.globals.max_tick);
     BOOST_CHECK_EQUAL(30,                               ini.globals.keepalive_grace_delay);
 
@@ -824,6 +866,7 @@ BOOST_AUTO_TEST_CASE(TestConfig1)
     BOOST_CHECK_EQUAL(true,                             ini.globals.enable_file_encryption.get());
     BOOST_CHECK_EQUAL(std::string("192.168.1.1"),       std::string(ini.globals.listen_address));
     BOOST_CHECK_EQUAL(true,                             ini.globals.enable_ip_transparent);
+    BOOST_CHECK_EQUAL(8,                                ini.globals.session_prefork);
     BOOST_CHECK_EQUAL(std::string("redemption"),        std::string(ini.globals.certificate_password));
 
     BOOST_CHECK_EQUAL(std::string("/var/tmp/wab/recorded/rdp"),
@@ -870,6 +913,11 @@ BOOST_AUTO_TEST_CASE(TestConfig1)
     BOOST_CHECK_EQUAL(false,                            ini.client.device_redirection.get());
     BOOST_CHECK_EQUAL(true,                             ini.client.rdp_compression);
     BOOST_CHECK_EQUAL(true,                             ini.client.disable_ctrl_alt_del.get());
+    BOOST_CHECK_EQUAL(2,                                ini.client.bitmap_tiling);
+    BOOST_CHECK_EQUAL(2,                                ini.client.rdp_compression_max_type);
+    BOOST_CHECK_EQUAL(1,                                ini.client.rdp_compression_level);
+    BOOST_CHECK_EQUAL(1,                                ini.client.bitmap_cache_fingerprint);
+    BOOST_CHECK_EQUAL(true,                             ini.client.bitmap_cache_verify_content);
 
     BOOST_CHECK_EQUAL(false,                            ini.mod_rdp.rdp_compression);
     BOOST_CHECK_EQUAL(true,                             ini.mod_rdp.disconnect_on_logon_user_change);
@@ -975,6 +1023,7 @@ BOOST_AUTO_TEST_CASE(TestConfig1bis)
     BOOST_CHECK_EQUAL(3000,                             ini.video.png_interval);
     BOOST_CHECK_EQUAL(40,                               ini.video.frame_interval);
     BOOST_CHECK_EQUAL(600,                              ini.video.break_interval);
+    BOOST_CHECK_EQUAL(1,                                ini.video.full_image_interval);
     BOOST_CHECK_EQUAL(600000000l,                       ini.globals.flv_break_interval);
     BOOST_CHECK_EQUAL(1000000L,                         ini.globals.flv_frame_interval);
     BOOST_CHECK_EQUAL(100,                              ini.video.ocr_interval);
@@ -982,6 +1031,8 @@ BOOST_AUTO_TEST_CASE(TestConfig1bis)
     BOOST_CHECK_EQUAL(40,                               ini.video.ocr_max_unrecog_char_rate);
 
     BOOST_CHECK_EQUAL(3,                                ini.video.png_limit);
+    BOOST_CHECK_EQUAL(6,                                ini.video.png_compression_level);
+    BOOST_CHECK_EQUAL(0,                                ini.video.png_filter);
 
     BOOST_CHECK_EQUAL(20000,                            ini.video.l_bitrate);
     BOOST_CHECK_EQUAL(5,                                ini.video.l_framerate);
@@ -1010,6 +1061,10 @@ BOOST_AUTO_TEST_CASE(TestConfig1bis)
     BOOST_CHECK_EQUAL(true,                             ini.video.disable_keyboard_log_wrm);
     BOOST_CHECK_EQUAL(false,                            ini.video.disable_keyboard_log_ocr);
 
+    BOOST_CHECK_EQUAL(false,                            ini.video.capture_thread);
+    BOOST_CHECK_EQUAL(8192,                             ini.video.capture_queue_size);
+    BOOST_CHECK_EQUAL(0,                                ini.video.capture_queue_timeout);
+
     BOOST_CHECK_EQUAL(30,                               ini.globals.max_tick);
     BOOST_CHECK_EQUAL(30,                               ini.globals.keepalive_grace_delay);
 
@@ -1156,6 +1211,7 @@ BOOST_AUTO_TEST_CASE(TestConfig2)
     BOOST_CHECK_EQUAL(3000,                             ini.video.png_interval);
     BOOST_CHECK_EQUAL(40,                               ini.video.frame_interval);
     BOOST_CHECK_EQUAL(600,                              ini.video.break_interval);
+    BOOST_CHECK_EQUAL(1,                                ini.video.full_image_interval);
     BOOST_CHECK_EQUAL(600000000l,                       ini.globals.flv_break_interval);
     BOOST_CHECK_EQUAL(1000000L,                         ini.globals.flv_frame_interval);
     BOOST_CHECK_EQUAL(100,                              ini.video.ocr_interval);
@@ -1163,6 +1219,8 @@ BOOST_AUTO_TEST_CASE(TestConfig2)
     BOOST_CHECK_EQUAL(40,                               ini.video.ocr_max_unrecog_char_rate);
 
     BOOST_CHECK_EQUAL(3,                                ini.video.png_limit);
+    BOOST_CHECK_EQUAL(6,                                ini.video.png_compression_level);
+    BOOST_CHECK_EQUAL(0,                                ini.video.png_filter);
 
     BOOST_CHECK_EQUAL(20000,                            ini.video.l_bitrate);
     BOOST_CHECK_EQUAL(5,                                ini.video.l_framerate);
@@ -1194,6 +1252,10 @@ BOOST_AUTO_TEST_CASE(TestConfig2)
     BOOST_CHECK_EQUAL(false,                            ini.video.disable_keyboard_log_wrm);
     BOOST_CHECK_EQUAL(true,                             ini.video.disable_keyboard_log_ocr);
 
+    BOOST_CHECK_EQUAL(false,                            ini.video.capture_thread);
+    BOOST_CHECK_EQUAL(8192,                             ini.video.capture_queue_size);
+    BOOST_CHECK_EQUAL(0,                                ini.video.capture_queue_timeout);
+
     BOOST_CHECK_EQUAL(30,                               ini.globals.max_tick);
     BOOST_CHECK_EQUAL(30,                               ini.globals.keepalive_grace_delay);
 
@@ -1331,6 +1393,7 @@ BOOST_AUTO_TEST_CASE(TestMultiple)
     BOOST_CHECK_EQUAL(3000,                             ini.video.png_interval);
     BOOST_CHECK_EQUAL(40,                               ini.video.frame_interval);
     BOOST_CHECK_EQUAL(600,                              ini.video.break_interval);
+    BOOST_CHECK_EQUAL(1,                                ini.video.full_image_interval);
     BOOST_CHECK_EQUAL(600000000l,                       ini.globals.flv_break_interval);
     BOOST_CHECK_EQUAL(1000000L,                         ini.globals.flv_frame_interval);
     BOOST_CHECK_EQUAL(100,                              ini.video.ocr_interval);
@@ -1338,6 +1401,8 @@ BOOST_AUTO_TEST_CASE(TestMultiple)
     BOOST_CHECK_EQUAL(40,                               ini.video.ocr_max_unrecog_char_rate);
 
     BOOST_CHECK_EQUAL(3,                                ini.video.png_limit);
+    BOOST_CHECK_EQUAL(6,                                ini.video.png_compression_level);
+    BOOST_CHECK_EQUAL(0,                                ini.video.png_filter);
 
     BOOST_CHECK_EQUAL(20000,                            ini.video.l_bitrate);
     BOOST_CHECK_EQUAL(5,                                ini.video.l_framerate);
@@ -1369,6 +1434,10 @@ BOOST_AUTO_TEST_CASE(TestMultiple)
     BOOST_CHECK_EQUAL(false,                            ini.video.disable_keyboard_log_wrm);
     BOOST_CHECK_EQUAL(false,                            ini.video.disable_keyboard_log_ocr);
 
+    BOOST_CHECK_EQUAL(false,                            ini.video.capture_thread);
+    BOOST_CHECK_EQUAL(8192,                             ini.video.capture_queue_size);
+    BOOST_CHECK_EQUAL(0,                                ini.video.capture_queue_timeout);
+
     BOOST_CHECK_EQUAL(30,                               ini.globals.max_tick);
     BOOST_CHECK_EQUAL(30,                               ini.globals.keepalive_grace_delay);
 
@@ -1496,6 +1565,7 @@ BOOST_AUTO_TEST_CASE(TestMultiple)
     BOOST_CHECK_EQUAL(3000,                             ini.video.png_interval);
     BOOST_CHECK_EQUAL(40,                               ini.video.frame_interval);
     BOOST_CHECK_EQUAL(600,                              ini.video.break_interval);
+    BOOST_CHECK_EQUAL(1,                                ini.video.full_image_interval);
     BOOST_CHECK_EQUAL(600000000l,                       ini.globals.flv_break_interval);
     BOOST_CHECK_EQUAL(1000000L,                         ini.globals.flv_frame_interval);
     BOOST_CHECK_EQUAL(100,                              ini.video.ocr_interval);
@@ -1503,6 +1573,8 @@ BOOST_AUTO_TEST_CASE(TestMultiple)
     BOOST_CHECK_EQUAL(40,                               ini.video.ocr_max_unrecog_char_rate);
 
     BOOST_CHECK_EQUAL(3,                                ini.video.png_limit);
+    BOOST_CHECK_EQUAL(6,                                ini.video.png_compression_level);
+    BOOST_CHECK_EQUAL(0,                                ini.video.png_filter);
 
     BOOST_CHECK_EQUAL(20000,                            ini.video.l_bitrate);
     BOOST_CHECK_EQUAL(5,                                ini.video.l_framerate);
@@ -1534,6 +1606,10 @@ BOOST_AUTO_TEST_CASE(TestMultiple)
     BOOST_CHECK_EQUAL(false,                            ini.video.disable_keyboard_log_wrm);
     BOOST_CHECK_EQUAL(false,                            ini.video.disable_keyboard_log_ocr);
 
+    BOOST_CHECK_EQUAL(false,                            ini.video.capture_thread);
+    BOOST_CHECK_EQUAL(8192,                             ini.video.capture_queue_size);
+    BOOST_CHECK_EQUAL(0,                                ini.video.capture_queue_timeout);
+
     BOOST_CHECK_EQUAL(30,                               ini.globals.max_tick);
     BOOST_CHECK_EQUAL(30,                               ini.globals.keepalive_grace_delay);
 
@@ -1661,6 +1737,7 @@ BOOST_AUTO_TEST_CASE(TestNewConf)
     BOOST_CHECK_EQUAL(3000,                             ini.video.png_interval);
     BOOST_CHECK_EQUAL(40,                               ini.video.frame_interval);
     BOOST_CHECK_EQUAL(600,                              ini.video.break_interval);
+    BOOST_CHECK_EQUAL(1,                                ini.video.full_image_interval);
     BOOST_CHECK_EQUAL(600000000l,                       ini.globals.flv_break_interval);
     BOOST_CHECK_EQUAL(1000000L,                         ini.globals.flv_frame_interval);
     BOOST_CHECK_EQUAL(100,                              ini.video.ocr_interval);
@@ -1668,6 +1745,8 @@ BOOST_AUTO_TEST_CASE(TestNewConf)
     BOOST_CHECK_EQUAL(40,                               ini.video.ocr_max_unrecog_char_rate);
 
     BOOST_CHECK_EQUAL(3,                                ini.video.png_limit);
+    BOOST_CHECK_EQUAL(6,                                ini.video.png_compression_level);
+    BOOST_CHECK_EQUAL(0,                                ini.video.png_filter);
 
     BOOST_CHECK_EQUAL(20000,                            ini.video.l_bitrate);
     BOOST_CHECK_EQUAL(5,                                ini.video.l_framerate);
@@ -1699,6 +1778,10 @@ BOOST_AUTO_TEST_CASE(TestNewConf)
     BOOST_CHECK_EQUAL(false,                            ini.video.disable_keyboard_log_wrm);
     BOOST_CHECK_EQUAL(false,                            ini.video.disable_keyboard_log_ocr);
 
+    BOOST_CHECK_EQUAL(false,                            ini.video.capture_thread);
+    BOOST_CHECK_EQUAL(8192,                             ini.video.capture_queue_size);
+    BOOST_CHECK_EQUAL(0,                                ini.video.capture_queue_timeout);
+
     BOOST_CHECK_EQUAL(30,                               ini.globals.max_tick);
     BOOST_CHECK_EQUAL(30,                               ini.globals.keepalive_grace_delay);
 
@@ -1825,6 +1908,7 @@ BOOST_AUTO_TEST_CASE(TestNewConf)
     BOOST_CHECK_EQUAL(3000,                             ini.video.png_interval);
     BOOST_CHECK_EQUAL(40,                               ini.video.frame_interval);
     BOOST_CHECK_EQUAL(600,                              ini.video.break_interval);
+    BOOST_CHECK_EQUAL(1,                                ini.video.full_image_interval);
     BOOST_CHECK_EQUAL(600000000l,                       ini.globals.flv_break_interval);
     BOOST_CHECK_EQUAL(1000000L,                         ini.globals.flv_frame_interval);
     BOOST_CHECK_EQUAL(100,                              ini.video.ocr_interval);
@@ -1832,6 +1916,8 @@ BOOST_AUTO_TEST_CASE(TestNewConf)
     BOOST_CHECK_EQUAL(40,                               ini.video.ocr_max_unrecog_char_rate);
 
     BOOST_CHECK_EQUAL(3,                                ini.video.png_limit);
+    BOOST_CHECK_EQUAL(6,                                ini.video.png_compression_level);
+    BOOST_CHECK_EQUAL(0,                                ini.video.png_filter);
 
     BOOST_CHECK_EQUAL(20000,                            ini.video.l_bitrate);
     BOOST_CHECK_EQUAL(5,                                ini.video.l_framerate);
@@ -1863,6 +1949,10 @@ BOOST_AUTO_TEST_CASE(TestNewConf)
     BOOST_CHECK_EQUAL(false,                            ini.video.disable_keyboard_log_wrm);
     BOOST_CHECK_EQUAL(false,                            ini.video.disable_keyboard_log_ocr);
 
+    BOOST_CHECK_EQUAL(false,                            ini.video.capture_thread);
+    BOOST_CHECK_EQUAL(8192,                             ini.video.capture_queue_size);
+    BOOST_CHECK_EQUAL(0,                                ini.video.capture_queue_timeout);
+
     BOOST_CHECK_EQUAL(30,                               ini.globals.max_tick);
     BOOST_CHECK_EQUAL(30,                               ini.globals.keepalive_grace_delay);
 
@@ -1979,6 +2069,7 @@ BOOST_AUTO_TEST_CASE(TestNewConf)
     BOOST_CHECK_EQUAL(3000,                             ini.video.png_interval);
     BOOST_CHECK_EQUAL(40,                               ini.video.frame_interval);
     BOOST_CHECK_EQUAL(600,                              ini.video.break_interval);
+    BOOST_CHECK_EQUAL(1,                                ini.video.full_image_interval);
     BOOST_CHECK_EQUAL(600000000l,                       ini.globals.flv_break_interval);
     BOOST_CHECK_EQUAL(1000000L,                         ini.globals.flv_frame_interval);
     BOOST_CHECK_EQUAL(100,                              ini.video.ocr_interval);
@@ -1986,6 +2077,8 @@ BOOST_AUTO_TEST_CASE(TestNewConf)
     BOOST_CHECK_EQUAL(40,                               ini.video.ocr_max_unrecog_char_rate);
 
     BOOST_CHECK_EQUAL(3,                                ini.video.png_limit);
+    BOOST_CHECK_EQUAL(6,                                ini.video.png_compression_level);
+    BOOST_CHECK_EQUAL(0,                                ini.video.png_filter);
 
     BOOST_CHECK_EQUAL(20000,                            ini.video.l_bitrate);
     BOOST_CHECK_EQUAL(5,                                ini.video.l_framerate);
@@ -2017,6 +2110,10 @@ BOOST_AUTO_TEST_CASE(TestNewConf)
     BOOST_CHECK_EQUAL(false,                            ini.video.disable_keyboard_log_wrm);
     BOOST_CHECK_EQUAL(false,                            ini.video.disable_keyboard_log_ocr);
 
+    BOOST_CHECK_EQUAL(false,                            ini.video.capture_thread);
+    BOOST_CHECK_EQUAL(8192,                             ini.video.capture_queue_size);
+    BOOST_CHECK_EQUAL(0,                                ini.video.capture_queue_timeout);
+
     BOOST_CHECK_EQUAL(30,                               ini.globals.max_tick);
     BOOST_CHECK_EQUAL(30,                               ini.globals.keepalive_grace_delay);
 
@@ -2099,6 +2196,35 @@ BOOST_AUTO_TEST_CASE(TestNewConf)
     BOOST_CHECK_EQUAL(24,                               ini.context.opt_bpp.get());
 }
 
+BOOST_AUTO_TEST_CASE(TestConfigBitmapStore)
+{
+    Inifile ini;
+
+    BOOST_CHECK_EQUAL(false,                            ini.bitmap_store.enable);
+    BOOST_CHECK_EQUAL(std::string("/tmp/rdpproxy_bitmaps/"), std::string(ini.bitmap_store.path));
+    BOOST_CHECK_EQUAL(64,                               ini.bitmap_store.size);
+    BOOST_CHECK_EQUAL(0,                                ini.bitmap_store.eviction_policy);
+    BOOST_CHECK_EQUAL(false,                            ini.bitmap_store.log_statistics);
+
+    std::stringstream oss(
+                          "[bitmap_store]\n"
+                          "enable=yes\n"
+                          "path=/var/rdpproxy/store\n"
+                          "size=256\n"
+                          "eviction_policy=fifo\n"
+                          "log_statistics=yes\n"
+                          "\n"
+                          );
+
+    ConfigurationLoader cfg_loader(ini, oss);
+
+    BOOST_CHECK_EQUAL(true,                             ini.bitmap_store.enable);
+    BOOST_CHECK_EQUAL(std::string("/var/rdpproxy/store/"), std::string(ini.bitmap_store.path));
+    BOOST_CHECK_EQUAL(256,                              ini.bitmap_store.size);
+    BOOST_CHECK_EQUAL(1,                                ini.bitmap_store.eviction_policy);
+    BOOST_CHECK_EQUAL(true,                             ini.bitmap_store.log_statistics);
+}
+
 BOOST_AUTO_TEST_CASE(TestConfigTools)
 {
     BOOST_CHECK_EQUAL(0,        ulong_from_cstr("0"));
@@ -0,0 +1,184 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2013
+   Author(s): Christophe Grosjean
+
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestReactor
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+#include "log.hpp"
+#include "reactor.hpp"
+
+#include <sys/socket.h>
+
+BOOST_AUTO_TEST_CASE(TestReactorSocket)
+{
+    int sv[2];
+    BOOST_CHECK_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+
+    wait_obj event(sv[0]);
+    Reactor reactor;
+    struct timeval timeout = { 0, 1000 };
+
+    reactor.watch(event);
+    BOOST_CHECK_EQUAL(0, reactor.wait(timeout));
+    BOOST_CHECK(!reactor.is_set(event));
+
+    BOOST_CHECK_EQUAL(1, write(sv[1], "x", 1));
+    reactor.watch(event);
+    BOOST_CHECK_EQUAL(1, reactor.wait(timeout));
+    BOOST_CHECK(reactor.is_set(event));
+
+    // watching again the same object does not touch epoll
+    unsigned ctl_count = reactor.epoll_ctl_count;
+    for (int i = 0; i < 10; i++){
+        reactor.watch(event);
+        reactor.wait(timeout);
+        BOOST_CHECK(reactor.is_set(event));
+    }
+    BOOST_CHECK_EQUAL(ctl_count, reactor.epoll_ctl_count);
+
+    // not watched anymore: no wake up even if data is available
+    reactor.wait(timeout);
+    BOOST_CHECK_EQUAL(0, reactor.wait(timeout));
+    BOOST_CHECK(!reactor.is_set(event));
+    BOOST_CHECK(event.watcher == NULL);
+
+    close(sv[1]);
+}
+
+BOOST_AUTO_TEST_CASE(TestReactorTimers)
+{
+    wait_obj early(0);
+    wait_obj late(0);
+    wait_obj never(0);
+    Reactor reactor;
+    struct timeval timeout = { 2, 0 };
+
+    late.set(200000);
+    early.set(20000);
+
+    reactor.watch(never);
+    reactor.watch(late);
+    reactor.watch(early);
+    BOOST_CHECK_EQUAL(2u, reactor.nb_timers());
+
+    // wakes up on earliest timer, not on the 2s timeout
+    unsigned long long start = ustime();
+    BOOST_CHECK_EQUAL(0, reactor.wait(timeout));
+    unsigned long long elapsed = ustime() - start;
+    BOOST_CHECK(elapsed >= 19000);
+    BOOST_CHECK(elapsed < 150000);
+    BOOST_CHECK(reactor.is_set(early));
+    BOOST_CHECK(early.waked_up_by_time);
+    BOOST_CHECK(!reactor.is_set(late));
+    BOOST_CHECK(!reactor.is_set(never));
+
+    // reset timers are forgotten
+    early.reset();
+    reactor.watch(never);
+    reactor.watch(late);
+    reactor.watch(early);
+    BOOST_CHECK_EQUAL(0, reactor.wait(timeout));
+    BOOST_CHECK(!reactor.is_set(early));
+    BOOST_CHECK(reactor.is_set(late));
+    BOOST_CHECK_EQUAL(1u, reactor.nb_timers());
+
+    // a timer set again while watched moves in heap
+    late.set(10000);
+    early.set(1000000);
+    reactor.watch(never);
+    reactor.watch(late);
+    reactor.watch(early);
+    BOOST_CHECK_EQUAL(0, reactor.wait(timeout));
+    BOOST_CHECK(reactor.is_set(late));
+    BOOST_CHECK(!reactor.is_set(early));
+}
+
+BOOST_AUTO_TEST_CASE(TestReactorDestroyedObject)
+{
+    Reactor reactor;
+    struct timeval timeout = { 0, 1000 };
+    int sv[2];
+    BOOST_CHECK_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+
+    {
+        wait_obj * event = new wait_obj(sv[0]);
+        event->set(0);
+        reactor.watch(*event);
+        // closes sv[0], reactor must forget it
+        delete event;
+    }
+    BOOST_CHECK_EQUAL(0u, reactor.nb_timers());
+
+    // a new object gets the same fd number
+    int sv2[2];
+    BOOST_CHECK_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv2));
+    BOOST_CHECK_EQUAL(sv[0], sv2[0]);
+    wait_obj event2(sv2[0]);
+    reactor.watch(event2);
+    BOOST_CHECK_EQUAL(1, write(sv2[1], "x", 1));
+    BOOST_CHECK_EQUAL(1, reactor.wait(timeout));
+    BOOST_CHECK(reactor.is_set(event2));
+
+    close(sv[1]);
+    close(sv2[1]);
+}
+
+BOOST_AUTO_TEST_CASE(TestReactorSetReady)
+{
+    int sv[2];
+    BOOST_CHECK_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+
+    wait_obj event(sv[0]);
+    wait_obj other(0);
+    Reactor reactor;
+    struct timeval timeout = { 2, 0 };
+
+    // nothing on socket, but data is pending in user space: no wait
+    reactor.watch(event);
+    reactor.watch(other);
+    reactor.set_ready(event);
+    unsigned long long start = ustime();
+    BOOST_CHECK_EQUAL(1, reactor.wait(timeout));
+    BOOST_CHECK(ustime() - start < 1000000);
+    BOOST_CHECK(reactor.is_set(event));
+    BOOST_CHECK(!reactor.is_set(other));
+
+    // counted once when socket is also readable
+    BOOST_CHECK_EQUAL(1, write(sv[1], "x", 1));
+    reactor.watch(event);
+    reactor.set_ready(event);
+    BOOST_CHECK_EQUAL(1, reactor.wait(timeout));
+    BOOST_CHECK(reactor.is_set(event));
+
+    // set_ready() only lasts for one wait()
+    char c;
+    BOOST_CHECK_EQUAL(1, read(sv[0], &c, 1));
+    reactor.watch(event);
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 1000;
+    BOOST_CHECK_EQUAL(0, reactor.wait(timeout));
+    BOOST_CHECK(!reactor.is_set(event));
+
+    close(sv[1]);
+}
@@ -0,0 +1,128 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2013
+   Author(s): Christophe Grosjean
+
+   Fake Front counting orders sent by VNC module and helper running a
+   VNC framebuffer update, for Unit Testing
+*/
+
+#include <sys/socket.h>
+#include <vector>
+
+#include "testtransport.hpp"
+#include "client_info.hpp"
+#include "vnc/vnc.hpp"
+#include "fake_front.hpp"
+
+class CountFront : public FakeFront {
+public:
+    unsigned nb_opaque_rect;
+    unsigned nb_scr_blt;
+    unsigned nb_bitmap;
+
+    Rect     first_opaque_rect;
+    uint32_t first_opaque_rect_color;
+
+    std::vector<std::vector<uint8_t> > bitmaps;
+
+    CountFront(const ClientInfo & info, uint32_t verbose)
+    : FakeFront(info, verbose)
+    , nb_opaque_rect(0)
+    , nb_scr_blt(0)
+    , nb_bitmap(0)
+    , first_opaque_rect_color(0)
+    {}
+
+    void reset_counters()
+    {
+        this->nb_opaque_rect = 0;
+        this->nb_scr_blt     = 0;
+        this->nb_bitmap      = 0;
+        this->bitmaps.clear();
+    }
+
+    virtual void draw(const RDPOpaqueRect & cmd, const Rect & clip) {
+        if (!this->nb_opaque_rect) {
+            this->first_opaque_rect       = cmd.rect;
+            this->first_opaque_rect_color = cmd.color;
+        }
+        this->nb_opaque_rect++;
+    }
+
+    virtual void draw(const RDPScrBlt & cmd, const Rect & clip) {
+        this->nb_scr_blt++;
+    }
+
+    virtual void draw_vnc(const Rect & rect, const uint8_t bpp, const BGRPalette & palette332,
+                          const uint8_t * raw, uint32_t need_size) {
+        BOOST_CHECK_EQUAL(static_cast<uint32_t>(rect.cx * rect.cy * 2), need_size);
+        this->bitmaps.push_back(std::vector<uint8_t>(raw, raw + need_size));
+        this->nb_bitmap++;
+    }
+};
+
+// Connects to recorded server (security none, 256x128 16 bpp), then runs
+// framebuffer update from server data
+static void run_update(CountFront & front, const ClientInfo & info, const char * encodings,
+                       const char * indata, size_t indata_length,
+                       const char * outdata, size_t outdata_length)
+{
+    int verbose = 0;
+
+    TestTransport t("test_vnc_client", indata, indata_length, outdata, outdata_length, verbose);
+
+    Inifile ini;
+
+    mod_vnc mod( &t
+               , ini
+               , "user"
+               , ""
+               , front
+               , info.width
+               , info.height
+               , info.keylayout
+               , 0             /* key_flags */
+               , false         /* clipboard */
+               , encodings
+               , false         /* allow authentification retries */
+               , verbose);
+    mod.event.set();
+
+    mod_api & api = mod;
+    api.draw_event(time(NULL));
+    api.on_front_up_and_running();
+    api.draw_event(time(NULL));
+
+    // initial clear screen
+    BOOST_CHECK_EQUAL(1, front.nb_opaque_rect);
+    front.reset_counters();
+
+    // server data is available
+    int sck[2];
+    BOOST_CHECK_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sck));
+    BOOST_CHECK_EQUAL(1, ::write(sck[1], "", 1));
+    mod.event.obj = sck[0];
+
+    api.draw_event(time(NULL));
+
+    BOOST_CHECK(mod.event.signal != BACK_EVENT_NEXT);
+    BOOST_CHECK(t.get_status());
+
+    close(sck[0]);
+    close(sck[1]);
+}
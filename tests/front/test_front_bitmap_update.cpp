@@ -0,0 +1,214 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2013
+   Author(s): Christophe Grosjean
+
+   Unit test of bitmap updates received from server and sent by front
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestFrontBitmapUpdate
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+#include "log.hpp"
+
+#undef SHARE_PATH
+#define SHARE_PATH FIXTURES_PATH
+
+#undef DEFAULT_FONT_NAME
+#define DEFAULT_FONT_NAME "sans-10.fv1"
+
+#include "front.hpp"
+#include "counttransport.hpp"
+#include "testtransport.hpp"
+
+// Keeps type of slow-path graphic updates in the order they are sent
+class UpdateTypeTransport : public CountTransport {
+public:
+    uint16_t update_types[256];
+    unsigned nb_updates;
+
+    UpdateTypeTransport()
+    : nb_updates(0)
+    {
+    }
+
+    using CountTransport::send;
+    virtual void send(const char * const buffer, size_t len) throw (Error) {
+        CountTransport::send(buffer, len);
+
+        GeneratorTransport gen(buffer, len);
+        BStream stream(65536);
+        X224::DT_TPDU_Recv x224(gen, stream);
+        MCS::SendDataIndication_Recv mcs(x224.payload, MCS::PER_ENCODING);
+        CryptContext decrypt;
+        SEC::Sec_Recv sec(mcs.payload, decrypt, 0);
+        ShareControl_Recv sctrl(sec.payload);
+        if (sctrl.pdu_type1 != PDUTYPE_DATAPDU) {
+            return;
+        }
+        ShareData sdata(sctrl.payload);
+        sdata.recv_begin();
+        if (sdata.pdutype2 == PDUTYPE2_UPDATE && this->nb_updates < 256) {
+            SlowPath::GraphicsUpdate_Recv gur(sdata.payload);
+            this->update_types[this->nb_updates++] = gur.update_type;
+        }
+    }
+};
+
+static void init_front(Front & front, bool bitmap_compression)
+{
+    front.client_info.bpp                  = 16;
+    front.client_info.width                = 800;
+    front.client_info.height               = 600;
+    front.client_info.bitmap_cache_version = 2;
+    front.client_info.use_bitmap_comp      = bitmap_compression;
+    front.client_info.cache1_entries       = 120;
+    front.client_info.cache1_size          = 256 * 2;
+    front.client_info.cache2_entries       = 120;
+    front.client_info.cache2_size          = 1024 * 2;
+    front.client_info.cache3_entries       = 2553;
+    front.client_info.cache3_size          = 4096 * 2;
+    front.reset();
+    front.up_and_running = 1;
+}
+
+// compressed 16 bpp bitmap update as sent by server
+struct CompressedUpdate {
+    uint8_t       raw[64 * 64 * 2];
+    Bitmap        bmp;
+    BStream       stream;
+    RDPBitmapData bitmap_data;
+
+    CompressedUpdate()
+    : bmp(16, NULL, 64, 64, this->fill(), sizeof(this->raw))
+    , stream(65536)
+    {
+        this->bmp.compress(this->stream);
+        this->bitmap_data.dest_left              = 100;
+        this->bitmap_data.dest_top               = 50;
+        this->bitmap_data.dest_right             = 163;
+        this->bitmap_data.dest_bottom            = 113;
+        this->bitmap_data.width                  = 64;
+        this->bitmap_data.height                 = 64;
+        this->bitmap_data.bits_per_pixel         = 16;
+        this->bitmap_data.flags                  = BITMAP_COMPRESSION;
+        this->bitmap_data.bitmap_length          = this->stream.get_offset() + 8;
+        this->bitmap_data.cb_comp_main_body_size = this->stream.get_offset();
+        this->bitmap_data.cb_scan_width          = this->bmp.line_size;
+        this->bitmap_data.cb_uncompressed_size   = this->bmp.bmp_size;
+    }
+
+    const uint8_t * fill()
+    {
+        for (size_t i = 0; i < sizeof(this->raw); i++) {
+            this->raw[i] = (i / 128) * 4 + (i % 7 == 0);
+        }
+        return this->raw;
+    }
+};
+
+BOOST_AUTO_TEST_CASE(TestPassThroughBitmapUpdate)
+{
+    Inifile ini;
+    CountTransport trans;
+    LCGRandom gen(0);
+    Front front(&trans, SHARE_PATH "/" DEFAULT_FONT_NAME, &gen, &ini, false, false);
+    init_front(front, true);
+
+    CompressedUpdate update;
+    BOOST_CHECK(update.stream.get_offset() < update.bmp.bmp_size);
+
+    uint64_t sent = trans.total_sent;
+    front.begin_update();
+    BOOST_CHECK(front.pass_through_bitmap_update( update.bitmap_data, update.stream.get_data()
+                                                , update.stream.get_offset()));
+    front.end_update();
+    // compressed payload sent as it is
+    BOOST_CHECK(trans.total_sent > sent + update.stream.get_offset());
+    BOOST_CHECK(trans.total_sent < sent + update.bmp.bmp_size);
+    BOOST_CHECK_EQUAL(0, front.bitmap_update_count);
+
+    // server color depth is not client one
+    update.bitmap_data.bits_per_pixel = 24;
+    sent = trans.total_sent;
+    BOOST_CHECK(!front.pass_through_bitmap_update( update.bitmap_data, update.stream.get_data()
+                                                 , update.stream.get_offset()));
+    front.begin_update();
+    front.end_update();
+    BOOST_CHECK_EQUAL(sent, trans.total_sent);
+}
+
+BOOST_AUTO_TEST_CASE(TestBitmapUpdateClientWithoutCompression)
+{
+    Inifile ini;
+    CountTransport trans;
+    LCGRandom gen(0);
+    Front front(&trans, SHARE_PATH "/" DEFAULT_FONT_NAME, &gen, &ini, false, false);
+    init_front(front, false);
+
+    CompressedUpdate update;
+
+    BOOST_CHECK(!front.pass_through_bitmap_update( update.bitmap_data, update.stream.get_data()
+                                                 , update.stream.get_offset()));
+
+    // decoded bitmap is sent uncompressed
+    uint64_t sent = trans.total_sent;
+    front.begin_update();
+    front.draw(update.bitmap_data, update.stream.get_data(), update.stream.get_offset(), update.bmp);
+    front.end_update();
+    BOOST_CHECK(front.bitmap_update_count > 0);
+    BOOST_CHECK(trans.total_sent > sent + update.bmp.bmp_size);
+}
+
+BOOST_AUTO_TEST_CASE(TestOrdersSentBeforeBitmapUpdate)
+{
+    Inifile ini;
+    ini.client.bitmap_tiling = 2;
+    UpdateTypeTransport trans;
+    LCGRandom gen(0);
+    Front front(&trans, SHARE_PATH "/" DEFAULT_FONT_NAME, &gen, &ini, false, false);
+    // no encryption: sent PDUs are read back
+    front.client_info.encryptionLevel = 0;
+    init_front(front, true);
+    front.mod_bpp = 16;
+
+    const Rect screen(0, 0, front.client_info.width, front.client_info.height);
+    const size_t raw_size = screen.cx * screen.cy * 2;
+    uint8_t * raw = new uint8_t[raw_size];
+    for (size_t i = 0; i < raw_size; i++) {
+        raw[i] = (i / 64) + (i % 5 == 0);
+    }
+    const Bitmap bmp(16, NULL, screen.cx, screen.cy, raw, raw_size);
+    delete [] raw;
+
+    // order drawn first is painted under the full screen refresh
+    trans.nb_updates = 0;
+    front.begin_update();
+    front.draw(RDPOpaqueRect(Rect(10, 10, 100, 100), 0xFF00), screen);
+    front.draw(RDPMemBlt(0, screen, 0xCC, 0, 0, 0), screen, bmp);
+    front.end_update();
+
+    BOOST_CHECK(front.bitmap_update_count > 0);
+    BOOST_CHECK(trans.nb_updates > 1);
+    BOOST_CHECK_EQUAL(RDP_UPDATE_ORDERS, trans.update_types[0]);
+    for (unsigned i = 1; i < trans.nb_updates; i++) {
+        BOOST_CHECK_EQUAL(RDP_UPDATE_BITMAP, trans.update_types[i]);
+    }
+}
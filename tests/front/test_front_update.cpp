@@ -0,0 +1,172 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2013
+   Author(s): Christophe Grosjean
+
+   Unit test of batches of PDUs sent by front during updates
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestFrontUpdate
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+#include "log.hpp"
+
+#undef SHARE_PATH
+#define SHARE_PATH FIXTURES_PATH
+
+#undef DEFAULT_FONT_NAME
+#define DEFAULT_FONT_NAME "sans-10.fv1"
+
+#include "front.hpp"
+#include "counttransport.hpp"
+
+// Keeps batch level, outermost end_batch() fails when write_failed is set
+class BatchCountTransport : public CountTransport {
+public:
+    int      batch_level;
+    unsigned nb_batches;
+    bool     write_failed;
+
+    BatchCountTransport()
+    : batch_level(0)
+    , nb_batches(0)
+    , write_failed(false)
+    {
+    }
+
+    virtual void begin_batch()
+    {
+        this->batch_level++;
+    }
+
+    virtual void end_batch()
+    {
+        this->batch_level--;
+        if (this->batch_level == 0) {
+            this->nb_batches++;
+            if (this->write_failed) {
+                throw Error(ERR_TRANSPORT_WRITE_FAILED);
+            }
+        }
+    }
+};
+
+static void init_front(Front & front)
+{
+    front.client_info.bpp                  = 16;
+    front.client_info.width                = 800;
+    front.client_info.height               = 600;
+    front.client_info.bitmap_cache_version = 2;
+    front.client_info.cache1_entries       = 120;
+    front.client_info.cache1_size          = 256 * 2;
+    front.client_info.cache2_entries       = 120;
+    front.client_info.cache2_size          = 1024 * 2;
+    front.client_info.cache3_entries       = 2553;
+    front.client_info.cache3_size          = 4096 * 2;
+    front.reset();
+    front.up_and_running = 1;
+    front.mod_bpp = 16;
+}
+
+BOOST_AUTO_TEST_CASE(TestFrontNestedUpdates)
+{
+    Inifile ini;
+    BatchCountTransport trans;
+    LCGRandom gen(0);
+    Front front(&trans, SHARE_PATH "/" DEFAULT_FONT_NAME, &gen, &ini, false, false);
+    init_front(front);
+
+    // one batch for outermost update
+    front.begin_update();
+    front.begin_update();
+    BOOST_CHECK_EQUAL(1, trans.batch_level);
+    front.draw(RDPOpaqueRect(Rect(0, 0, 10, 10), 0xFF), Rect(0, 0, 800, 600));
+    front.end_update();
+    BOOST_CHECK_EQUAL(1, trans.batch_level);
+    front.end_update();
+    BOOST_CHECK_EQUAL(0, trans.batch_level);
+    BOOST_CHECK_EQUAL(1u, trans.nb_batches);
+}
+
+BOOST_AUTO_TEST_CASE(TestFrontCancelUpdate)
+{
+    Inifile ini;
+    BatchCountTransport trans;
+    LCGRandom gen(0);
+    Front front(&trans, SHARE_PATH "/" DEFAULT_FONT_NAME, &gen, &ini, false, false);
+    init_front(front);
+
+    // mod interrupted by an exception before end_update()
+    front.begin_update();
+    front.begin_update();
+    front.draw(RDPOpaqueRect(Rect(0, 0, 10, 10), 0xFF), Rect(0, 0, 800, 600));
+    front.cancel_update();
+    BOOST_CHECK_EQUAL(0, trans.batch_level);
+    BOOST_CHECK_EQUAL(1u, trans.nb_batches);
+
+    // nothing left open
+    front.cancel_update();
+    BOOST_CHECK_EQUAL(0, trans.batch_level);
+
+    uint64_t sent = trans.total_sent;
+    front.begin_update();
+    front.draw(RDPOpaqueRect(Rect(0, 0, 10, 10), 0xFF00), Rect(0, 0, 800, 600));
+    front.end_update();
+    BOOST_CHECK_EQUAL(0, trans.batch_level);
+    BOOST_CHECK(trans.total_sent > sent);
+}
+
+BOOST_AUTO_TEST_CASE(TestFrontUpdateWriteError)
+{
+    Inifile ini;
+    BatchCountTransport trans;
+    LCGRandom gen(0);
+    Front front(&trans, SHARE_PATH "/" DEFAULT_FONT_NAME, &gen, &ini, false, false);
+    init_front(front);
+
+    // write error of batch is thrown by end_update()
+    trans.write_failed = true;
+    front.begin_update();
+    front.draw(RDPOpaqueRect(Rect(0, 0, 10, 10), 0xFF), Rect(0, 0, 800, 600));
+    try {
+        front.end_update();
+        BOOST_CHECK(false);
+    }
+    catch (const Error & e) {
+        BOOST_CHECK_EQUAL((uint32_t)ERR_TRANSPORT_WRITE_FAILED, (uint32_t)e.id);
+    }
+    BOOST_CHECK_EQUAL(0, trans.batch_level);
+
+    // same with TransportBatch::end(), destructor restores batch level
+    {
+        TransportBatch batch(trans);
+        BOOST_CHECK_THROW(batch.end(), Error);
+    }
+    BOOST_CHECK_EQUAL(0, trans.batch_level);
+    trans.write_failed = false;
+    try {
+        TransportBatch batch(trans);
+        throw Error(ERR_RDP_EXPECTING_CONFIRMACTIVEPDU);
+    }
+    catch (const Error & e) {
+        BOOST_CHECK_EQUAL((uint32_t)ERR_RDP_EXPECTING_CONFIRMACTIVEPDU, (uint32_t)e.id);
+    }
+    BOOST_CHECK_EQUAL(0, trans.batch_level);
+}
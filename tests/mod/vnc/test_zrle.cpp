@@ -0,0 +1,313 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2013
+   Author(s): Christophe Grosjean
+
+   Unit test of VNC ZRLE decoder
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestZRLE
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+#include "log.hpp"
+
+#include <vector>
+
+#include "vnc/zrle.hpp"
+
+// Draws decoded tiles in a 16 bpp frame buffer
+class FrameBuffer : public ZRLEDrawApi {
+public:
+    uint16_t              width;
+    uint16_t              height;
+    std::vector<uint16_t> pixels;
+    unsigned              nb_solid;
+    unsigned              nb_two_colors;
+    unsigned              nb_tiles;
+
+    FrameBuffer(uint16_t width, uint16_t height)
+    : width(width)
+    , height(height)
+    , pixels(width * height, 0xDEAD)
+    , nb_solid(0)
+    , nb_two_colors(0)
+    , nb_tiles(0)
+    {}
+
+    virtual bool draw_zrle_solid_tile(const Rect & tile, uint32_t color) {
+        for (int y = tile.y; y < tile.y + tile.cy; y++) {
+            for (int x = tile.x; x < tile.x + tile.cx; x++) {
+                this->pixels[y * this->width + x] = color;
+            }
+        }
+        this->nb_solid++;
+        return true;
+    }
+
+    virtual void draw_zrle_tile(const Rect & tile, const uint8_t * pixels, size_t length,
+                                const uint8_t * two_colors_palette) {
+        BOOST_CHECK_EQUAL(static_cast<size_t>(tile.cx * tile.cy * 2), length);
+        for (int y = tile.y; y < tile.y + tile.cy; y++) {
+            for (int x = tile.x; x < tile.x + tile.cx; x++, pixels += 2) {
+                this->pixels[y * this->width + x] = pixels[0] | (pixels[1] << 8);
+            }
+        }
+        this->nb_two_colors += (two_colors_palette != NULL);
+        this->nb_tiles++;
+    }
+};
+
+static void out_cpixel(std::vector<uint8_t> & v, uint16_t pixel)
+{
+    v.push_back(pixel & 0xFF);
+    v.push_back(pixel >> 8);
+}
+
+static void out_run_length(std::vector<uint8_t> & v, unsigned length)
+{
+    for (length--; length >= 255; length -= 255) {
+        v.push_back(255);
+    }
+    v.push_back(length);
+}
+
+static std::vector<uint8_t> sync_flush_deflate(z_stream & zstrm, const std::vector<uint8_t> & data)
+{
+    std::vector<uint8_t> out(data.size() + 1024);
+    zstrm.next_in   = const_cast<uint8_t *>(&data[0]);
+    zstrm.avail_in  = data.size();
+    zstrm.next_out  = &out[0];
+    zstrm.avail_out = out.size();
+    BOOST_REQUIRE_EQUAL(Z_OK, deflate(&zstrm, Z_SYNC_FLUSH));
+    out.resize(out.size() - zstrm.avail_out);
+    return out;
+}
+
+// 70x70 rectangle at (10, 20): a solid tile, a 6x64 packed palette tile
+// (3 colors), a 64x6 plain RLE tile (runs longer than 255 pixels) and a 6x6
+// palette RLE tile (2 colors)
+static uint16_t expected_pixel(int x, int y)
+{
+    if (y < 64) {
+        return (x < 64) ? 0x1234 : (0x100 * ((x - 64 + y) % 3));
+    }
+    if (x < 64) {
+        return ((y - 64) * 64 + x < 300) ? 0xF800 : 0x07E0;
+    }
+    return (((y - 64) * 6 + (x - 64)) % 4 == 0) ? 0xFFFF : 0x001F;
+}
+
+static std::vector<uint8_t> tiles_data()
+{
+    std::vector<uint8_t> v;
+
+    v.push_back(1);
+    out_cpixel(v, 0x1234);
+
+    v.push_back(3);
+    for (int i = 0; i < 3; i++) {
+        out_cpixel(v, 0x100 * i);
+    }
+    for (int y = 0; y < 64; y++) {
+        // 2 bits per pixel, 6 pixels: 2 bytes, last one padded
+        uint8_t bytes[2] = { 0, 0 };
+        for (int x = 0; x < 6; x++) {
+            bytes[x / 4] |= ((x + y) % 3) << (6 - (x % 4) * 2);
+        }
+        v.push_back(bytes[0]);
+        v.push_back(bytes[1]);
+    }
+
+    v.push_back(128);
+    out_cpixel(v, 0xF800);
+    out_run_length(v, 300);
+    out_cpixel(v, 0x07E0);
+    out_run_length(v, 64 * 6 - 300);
+
+    v.push_back(130);
+    out_cpixel(v, 0x001F);
+    out_cpixel(v, 0xFFFF);
+    for (int i = 0; i < 36; i += 4) {
+        v.push_back(1);
+        v.push_back(0x80);
+        out_run_length(v, 3);
+    }
+
+    return v;
+}
+
+static void check_frame_buffer(const FrameBuffer & fb)
+{
+    for (int y = 0; y < 70; y++) {
+        for (int x = 0; x < 70; x++) {
+            if (fb.pixels[(y + 20) * fb.width + x + 10] != expected_pixel(x, y)) {
+                BOOST_CHECK_EQUAL(expected_pixel(x, y), fb.pixels[(y + 20) * fb.width + x + 10]);
+                return;
+            }
+        }
+    }
+    BOOST_CHECK_EQUAL(1, fb.nb_solid);
+    BOOST_CHECK_EQUAL(3, fb.nb_tiles);
+    BOOST_CHECK_EQUAL(1, fb.nb_two_colors);
+}
+
+BOOST_AUTO_TEST_CASE(TestZRLEDecode)
+{
+    z_stream zstrm;
+    memset(&zstrm, 0, sizeof(zstrm));
+    BOOST_REQUIRE_EQUAL(Z_OK, deflateInit(&zstrm, Z_DEFAULT_COMPRESSION));
+    const std::vector<uint8_t> compressed = sync_flush_deflate(zstrm, tiles_data());
+    deflateEnd(&zstrm);
+
+    // whole rectangle at once
+    {
+        FrameBuffer fb(100, 100);
+        ZRLEDecoder zrle;
+        zrle.start(10, 20, 70, 70, 2);
+        zrle.decode(&compressed[0], compressed.size(), fb);
+        BOOST_CHECK(zrle.done());
+        check_frame_buffer(fb);
+    }
+
+    // one byte at a time, decoding resumes in middle of tiles
+    {
+        FrameBuffer fb(100, 100);
+        ZRLEDecoder zrle;
+        zrle.start(10, 20, 70, 70, 2);
+        for (size_t i = 0; i < compressed.size(); i++) {
+            zrle.decode(&compressed[i], 1, fb);
+            if (i == compressed.size() / 2) {
+                BOOST_CHECK(!zrle.done());
+            }
+        }
+        BOOST_CHECK(zrle.done());
+        check_frame_buffer(fb);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestZRLEStreamAcrossRectangles)
+{
+    z_stream zstrm;
+    memset(&zstrm, 0, sizeof(zstrm));
+    BOOST_REQUIRE_EQUAL(Z_OK, deflateInit(&zstrm, Z_DEFAULT_COMPRESSION));
+
+    // raw 3x2 tile then the 70x70 rectangle, one zlib stream for both
+    std::vector<uint8_t> raw;
+    raw.push_back(0);
+    for (int i = 0; i < 6; i++) {
+        out_cpixel(raw, 0x4000 + i);
+    }
+    const std::vector<uint8_t> compressed1 = sync_flush_deflate(zstrm, raw);
+    const std::vector<uint8_t> compressed2 = sync_flush_deflate(zstrm, tiles_data());
+    deflateEnd(&zstrm);
+
+    FrameBuffer fb(100, 100);
+    ZRLEDecoder zrle;
+
+    zrle.start(0, 0, 3, 2, 2);
+    zrle.decode(&compressed1[0], compressed1.size(), fb);
+    BOOST_CHECK(zrle.done());
+    BOOST_CHECK_EQUAL(0x4000, fb.pixels[0]);
+    BOOST_CHECK_EQUAL(0x4005, fb.pixels[100 + 2]);
+
+    fb.nb_tiles = 0;
+    zrle.start(10, 20, 70, 70, 2);
+    zrle.decode(&compressed2[0], compressed2.size(), fb);
+    BOOST_CHECK(zrle.done());
+    check_frame_buffer(fb);
+}
+
+BOOST_AUTO_TEST_CASE(TestZRLEProtocolErrors)
+{
+    z_stream zstrm;
+    memset(&zstrm, 0, sizeof(zstrm));
+    BOOST_REQUIRE_EQUAL(Z_OK, deflateInit(&zstrm, Z_DEFAULT_COMPRESSION));
+
+    std::vector<uint8_t> data;
+    data.push_back(17); // unused subencoding
+    const std::vector<uint8_t> compressed = sync_flush_deflate(zstrm, data);
+    deflateEnd(&zstrm);
+
+    FrameBuffer fb(100, 100);
+    ZRLEDecoder zrle;
+    zrle.start(0, 0, 10, 10, 2);
+    try {
+        zrle.decode(&compressed[0], compressed.size(), fb);
+        BOOST_CHECK(false);
+    }
+    catch (const Error & e) {
+        BOOST_CHECK_EQUAL((unsigned)ERR_VNC_ZRLE_PROTOCOL, (unsigned)e.id);
+    }
+
+    // packed palette index (3) out of a 3 colors palette
+    z_stream zstrm2;
+    memset(&zstrm2, 0, sizeof(zstrm2));
+    BOOST_REQUIRE_EQUAL(Z_OK, deflateInit(&zstrm2, Z_DEFAULT_COMPRESSION));
+    std::vector<uint8_t> packed;
+    packed.push_back(3);
+    for (int i = 0; i < 3; i++) {
+        out_cpixel(packed, 0x100 * i);
+    }
+    packed.push_back(0x1B); // indexes 0, 1, 2, 3
+    const std::vector<uint8_t> compressed_packed = sync_flush_deflate(zstrm2, packed);
+    deflateEnd(&zstrm2);
+
+    ZRLEDecoder zrle_packed;
+    zrle_packed.start(0, 0, 4, 1, 2);
+    try {
+        zrle_packed.decode(&compressed_packed[0], compressed_packed.size(), fb);
+        BOOST_CHECK(false);
+    }
+    catch (const Error & e) {
+        BOOST_CHECK_EQUAL((unsigned)ERR_VNC_ZRLE_PROTOCOL, (unsigned)e.id);
+    }
+
+    // solid tile followed by bytes not belonging to rectangle
+    z_stream zstrm3;
+    memset(&zstrm3, 0, sizeof(zstrm3));
+    BOOST_REQUIRE_EQUAL(Z_OK, deflateInit(&zstrm3, Z_DEFAULT_COMPRESSION));
+    std::vector<uint8_t> solid;
+    solid.push_back(1);
+    out_cpixel(solid, 0x1234);
+    solid.push_back(0);
+    const std::vector<uint8_t> compressed_solid = sync_flush_deflate(zstrm3, solid);
+    deflateEnd(&zstrm3);
+
+    ZRLEDecoder zrle_solid;
+    zrle_solid.start(0, 0, 4, 4, 2);
+    try {
+        zrle_solid.decode(&compressed_solid[0], compressed_solid.size(), fb);
+        BOOST_CHECK(false);
+    }
+    catch (const Error & e) {
+        BOOST_CHECK_EQUAL((unsigned)ERR_VNC_ZRLE_PROTOCOL, (unsigned)e.id);
+    }
+
+    // not zlib data
+    ZRLEDecoder zrle2;
+    zrle2.start(0, 0, 10, 10, 2);
+    try {
+        zrle2.decode(reinterpret_cast<const uint8_t *>("\xFF\xFF\xFF\xFF"), 4, fb);
+        BOOST_CHECK(false);
+    }
+    catch (const Error & e) {
+        BOOST_CHECK_EQUAL((unsigned)ERR_VNC_ZLIB_INFLATE, (unsigned)e.id);
+    }
+}
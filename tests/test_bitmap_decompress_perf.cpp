@@ -0,0 +1,212 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2013
+   Author(s): Christophe Grosjean
+
+   Unit test for bitmap class, decompression performance over the bitmaps
+   of recorded sessions
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestBitmapDecompressPerf
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+#include "test_orders.hpp"
+
+#include <vector>
+
+#include "stream.hpp"
+#include "transport.hpp"
+#include "testtransport.hpp"
+#include "client_info.hpp"
+#include "rdp/rdp.hpp"
+#include "difftimeval.hpp"
+
+#include "front/fake_front.hpp"
+
+// Front keeping every bitmap it is given in RLE compressed form
+class CollectFront : public FakeFront {
+public:
+    struct Sample {
+        uint8_t bpp;
+        uint16_t cx;
+        uint16_t cy;
+        std::vector<uint8_t> raw;
+        std::vector<uint8_t> compressed;
+    };
+    std::vector<Sample> samples;
+
+    CollectFront(const ClientInfo & info, uint32_t verbose)
+        : FakeFront(info, verbose)
+    {
+    }
+
+    void collect(const Bitmap & bmp)
+    {
+        BStream out(2 * bmp.bmp_size + 1024);
+        bmp.compress(out);
+
+        Sample sample;
+        sample.bpp = bmp.original_bpp;
+        sample.cx = bmp.cx;
+        sample.cy = bmp.cy;
+        sample.raw.assign(bmp.data(), bmp.data() + bmp.bmp_size);
+        sample.compressed.assign(out.get_data(), out.p);
+        this->samples.push_back(sample);
+    }
+
+    virtual void draw(const RDPMemBlt & cmd, const Rect & clip, const Bitmap & bitmap) {
+        this->collect(bitmap);
+        FakeFront::draw(cmd, clip, bitmap);
+    }
+
+    virtual void draw(const RDPMem3Blt & cmd, const Rect & clip, const Bitmap & bitmap) {
+        this->collect(bitmap);
+        FakeFront::draw(cmd, clip, bitmap);
+    }
+
+    void report(const char * session, unsigned loops)
+    {
+        unsigned long long nb_bytes = 0;
+        unsigned long long nb_compressed = 0;
+        unsigned long long usec = ustime();
+        for (unsigned loop = 0 ; loop < loops ; loop++){
+            for (size_t i = 0 ; i < this->samples.size() ; i++){
+                const Sample & s = this->samples[i];
+                Bitmap bmp(s.bpp, NULL, s.cx, s.cy, &s.compressed[0], s.compressed.size(), true);
+                nb_bytes += bmp.bmp_size;
+                nb_compressed += s.compressed.size();
+            }
+        }
+        unsigned long long elapsed = ustime() - usec;
+        printf("%s: %u bitmaps, %llu compressed bytes -> %llu bytes in %llu us, %.1f MB/s\n",
+            session, (unsigned)this->samples.size(), nb_compressed / loops, nb_bytes / loops,
+            elapsed / loops, (double)nb_bytes / (double)(elapsed + 1));
+    }
+
+    void check()
+    {
+        for (size_t i = 0 ; i < this->samples.size() ; i++){
+            const Sample & s = this->samples[i];
+            Bitmap bmp(s.bpp, NULL, s.cx, s.cy, &s.compressed[0], s.compressed.size(), true);
+            BOOST_CHECK_EQUAL(bmp.bmp_size, s.raw.size());
+            BOOST_CHECK(0 == memcmp(bmp.data(), &s.raw[0], s.raw.size()));
+        }
+    }
+};
+
+static void init_client_info(ClientInfo & info)
+{
+    info.keylayout = 0x04C;
+    info.console_session = 0;
+    info.brush_cache_code = 0;
+    info.bpp = 24;
+    info.width = 800;
+    info.height = 600;
+    info.rdp5_performanceflags = PERF_DISABLE_WALLPAPER;
+    snprintf(info.hostname,sizeof(info.hostname),"test");
+}
+
+BOOST_AUTO_TEST_CASE(TestDecompressXPSession)
+{
+    ClientInfo info(1, true, true);
+    init_client_info(info);
+    int verbose = 0;
+
+    CollectFront front(info, verbose);
+
+    #include "fixtures/dump_xp_mem3blt.hpp"
+    TestTransport t("RDP XP Target", indata, sizeof(indata), outdata, sizeof(outdata), verbose);
+
+    // To always get the same client random, in tests
+    LCGRandom gen(0);
+
+    try {
+        mod_rdp mod(&t, "xavier", "SecureLinux", "10.10.9.161", front,
+            false,      // tls
+            info, &gen,
+            7,          // key flags
+            NULL,       // auth_api
+            "",         // auth channel
+            "",         // alternate_shell
+            "",         // shell_working_directory
+            true,       // clipboard
+            false,      // fast-path support
+            true,       // mem3blt support
+            false,      // bitmap update support
+            verbose,
+            false       // enable new pointer
+        );
+
+        for (uint32_t count = 0 ; count < 25 ; count++){
+            mod.draw_event(time(NULL));
+        }
+    }
+    catch (const Error & e) {
+        // end of recorded data
+    };
+
+    BOOST_CHECK(front.samples.size() > 0);
+    front.check();
+    front.report("dump_xp_mem3blt", 20);
+}
+
+BOOST_AUTO_TEST_CASE(TestDecompressW2000Session)
+{
+    ClientInfo info(1, true, true);
+    init_client_info(info);
+    int verbose = 0;
+
+    CollectFront front(info, verbose);
+
+    #include "fixtures/dump_w2000_mem3blt.hpp"
+    TestTransport t("RDP W2000 Target", indata, sizeof(indata), outdata, sizeof(outdata), verbose);
+
+    // To always get the same client random, in tests
+    LCGRandom gen(0);
+
+    try {
+        mod_rdp mod(&t, "administrateur", "SecureLinux$42", "0.0.0.0", front,
+            false,      // tls
+            info, &gen,
+            2,          // key flags
+            NULL,       // auth_api
+            "",         // auth channel
+            "",         // alternate_shell
+            "",         // shell_working_directory
+            true,       // clipboard
+            false,      // fast-path support
+            true,       // mem3blt support
+            false,      // bitmap update support
+            verbose,
+            false       // enable new pointer
+        );
+
+        for (uint32_t count = 0 ; count < 25 ; count++){
+            mod.draw_event(time(NULL));
+        }
+    }
+    catch (const Error & e) {
+        // end of recorded data
+    };
+
+    BOOST_CHECK(front.samples.size() > 0);
+    front.check();
+    front.report("dump_w2000_mem3blt", 20);
+}
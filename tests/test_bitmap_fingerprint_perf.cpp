@@ -0,0 +1,187 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2013
+   Author(s): Christophe Grosjean
+
+   Unit test for bitmap fingerprints, hashing performance over recorded sessions
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestBitmapFingerprintPerf
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+#include "test_orders.hpp"
+
+#include "stream.hpp"
+#include "transport.hpp"
+#include "testtransport.hpp"
+#include "client_info.hpp"
+#include "rdp/rdp.hpp"
+#include "rdtsc.hpp"
+
+#include "front/fake_front.hpp"
+
+// Front computing fingerprints of every bitmap it is given, in every mode
+class FingerprintFront : public FakeFront {
+public:
+    unsigned long long nb_bitmaps;
+    unsigned long long nb_bytes;
+    unsigned long long cycles[2];
+
+    FingerprintFront(const ClientInfo & info, uint32_t verbose)
+        : FakeFront(info, verbose)
+        , nb_bitmaps(0)
+        , nb_bytes(0)
+    {
+        this->cycles[BITMAP_FINGERPRINT_FAST] = 0;
+        this->cycles[BITMAP_FINGERPRINT_SHA1] = 0;
+    }
+
+    void fingerprint(const Bitmap & bmp)
+    {
+        uint8_t sig[20];
+        this->nb_bitmaps++;
+        this->nb_bytes += bmp.bmp_size;
+        for (unsigned mode = BITMAP_FINGERPRINT_FAST ; mode <= BITMAP_FINGERPRINT_SHA1 ; mode++){
+            unsigned long long start = rdtsc();
+            bmp.compute_fingerprint(sig, static_cast<BitmapFingerprint>(mode));
+            this->cycles[mode] += rdtsc() - start;
+        }
+    }
+
+    virtual void draw(const RDPMemBlt & cmd, const Rect & clip, const Bitmap & bitmap) {
+        this->fingerprint(bitmap);
+        FakeFront::draw(cmd, clip, bitmap);
+    }
+
+    virtual void draw(const RDPMem3Blt & cmd, const Rect & clip, const Bitmap & bitmap) {
+        this->fingerprint(bitmap);
+        FakeFront::draw(cmd, clip, bitmap);
+    }
+
+    void report(const char * session)
+    {
+        printf("%s: %llu bitmaps, %llu bytes, fast=%llu cycles (%f bytes/cycle) sha1=%llu cycles (%f bytes/cycle)\n",
+            session, this->nb_bitmaps, this->nb_bytes,
+            this->cycles[BITMAP_FINGERPRINT_FAST],
+            (double)this->nb_bytes / (double)(this->cycles[BITMAP_FINGERPRINT_FAST] + 1),
+            this->cycles[BITMAP_FINGERPRINT_SHA1],
+            (double)this->nb_bytes / (double)(this->cycles[BITMAP_FINGERPRINT_SHA1] + 1));
+    }
+};
+
+BOOST_AUTO_TEST_CASE(TestFingerprintXPSession)
+{
+    ClientInfo info(1, true, true);
+    info.keylayout = 0x04C;
+    info.console_session = 0;
+    info.brush_cache_code = 0;
+    info.bpp = 24;
+    info.width = 800;
+    info.height = 600;
+    info.rdp5_performanceflags = PERF_DISABLE_WALLPAPER;
+    snprintf(info.hostname,sizeof(info.hostname),"test");
+    int verbose = 0;
+
+    FingerprintFront front(info, verbose);
+
+    #include "fixtures/dump_xp_mem3blt.hpp"
+    TestTransport t("RDP XP Target", indata, sizeof(indata), outdata, sizeof(outdata), verbose);
+
+    // To always get the same client random, in tests
+    LCGRandom gen(0);
+
+    try {
+        mod_rdp mod(&t, "xavier", "SecureLinux", "10.10.9.161", front,
+            false,      // tls
+            info, &gen,
+            7,          // key flags
+            NULL,       // auth_api
+            "",         // auth channel
+            "",         // alternate_shell
+            "",         // shell_working_directory
+            true,       // clipboard
+            false,      // fast-path support
+            true,       // mem3blt support
+            false,      // bitmap update support
+            verbose,
+            false       // enable new pointer
+        );
+
+        for (uint32_t count = 0 ; count < 25 ; count++){
+            mod.draw_event(time(NULL));
+        }
+    }
+    catch (const Error & e) {
+        // end of recorded data
+    };
+
+    BOOST_CHECK(front.nb_bitmaps > 0);
+    front.report("dump_xp");
+}
+
+BOOST_AUTO_TEST_CASE(TestFingerprintW2008Session)
+{
+    ClientInfo info(1, true, true);
+    info.keylayout = 0x04C;
+    info.console_session = 0;
+    info.brush_cache_code = 0;
+    info.bpp = 24;
+    info.width = 800;
+    info.height = 600;
+    info.rdp5_performanceflags = PERF_DISABLE_WALLPAPER;
+    snprintf(info.hostname,sizeof(info.hostname),"test");
+    int verbose = 0;
+
+    FingerprintFront front(info, verbose);
+
+    #include "fixtures/dump_w2008.hpp"
+    TestTransport t("RDP W2008 Target", indata, sizeof(indata), outdata, sizeof(outdata), verbose);
+
+    // To always get the same client random, in tests
+    LCGRandom gen(0);
+
+    try {
+        mod_rdp mod(&t, "administrateur@qa", "S3cur3!1nux", "10.10.9.161", front,
+            false,      // tls
+            info, &gen,
+            2,          // key flags
+            NULL,       // auth_api
+            "",         // auth channel
+            "",         // alternate_shell
+            "",         // shell_working_directory
+            true,       // clipboard
+            false,      // fast-path support
+            false,      // mem3blt support
+            false,      // bitmap update support
+            verbose,
+            false       // enable new pointer
+        );
+
+        for (uint32_t count = 0 ; count < 38 ; count++){
+            mod.draw_event(time(NULL));
+        }
+    }
+    catch (const Error & e) {
+        // end of recorded data
+    };
+
+    BOOST_CHECK(front.nb_bitmaps > 0);
+    front.report("dump_w2008");
+}
@@ -126,3 +126,57 @@ BOOST_AUTO_TEST_CASE(TestBitmapCompressPerformancePNG)
         BOOST_CHECK(0 == memcmp(bmp2.data(), bigbmp.data(), bigbmp.bmp_size));
     }
 }
+
+BOOST_AUTO_TEST_CASE(TestBitmapCompressKernelsThroughput)
+{
+    const char * fixtures[] = {
+        FIXTURES_PATH "/color_image.bmp",
+        FIXTURES_PATH "/logo-redemption.bmp",
+        FIXTURES_PATH "/Philips_PM5544_640.bmp",
+        FIXTURES_PATH "/ad24b.bmp",
+    };
+    const uint8_t bpps[] = { 8, 15, 16, 24 };
+    const char * names[] = { "scalar", "sse2", "avx2" };
+    const unsigned loops = 5;
+
+    for (size_t f = 0 ; f < sizeof(fixtures) / sizeof(fixtures[0]) ; f++){
+        const Bitmap source(fixtures[f]);
+        for (size_t b = 0 ; b < sizeof(bpps) ; b++){
+            const Bitmap bmp(bpps[b], source);
+
+            BStream reference(2 * bmp.bmp_size + 1024);
+            for (unsigned level = RLE_KERNEL_SCALAR ; level <= RLE_KERNEL_AVX2 ; level++){
+                rle_kernels().select(static_cast<RLEKernelLevel>(level));
+                if (rle_kernels().level != level){
+                    // not supported by this CPU
+                    continue;
+                }
+
+                BStream out(2 * bmp.bmp_size + 1024);
+                unsigned long long usec = ustime();
+                for (unsigned i = 0 ; i < loops ; i++){
+                    out.reset();
+                    Bitmap::compress(bmp.view(), out);
+                }
+                unsigned long long elapusec = ustime() - usec;
+                out.mark_end();
+
+                printf("%s %ubpp %s: %u bytes -> %u bytes, %.1f MB/s\n",
+                    fixtures[f] + strlen(FIXTURES_PATH) + 1, bpps[b], names[level],
+                    (unsigned)bmp.bmp_size, (unsigned)out.size(),
+                    (double)bmp.bmp_size * loops / (double)(elapusec + 1));
+
+                if (level == RLE_KERNEL_SCALAR){
+                    reference.out_copy_bytes(out.get_data(), out.size());
+                    reference.mark_end();
+                }
+                else {
+                    // all kernels must give exactly the same compressed stream
+                    BOOST_CHECK_EQUAL(reference.size(), out.size());
+                    BOOST_CHECK(0 == memcmp(reference.get_data(), out.get_data(), out.size()));
+                }
+            }
+        }
+    }
+    rle_kernels().select(RLE_KERNEL_AVX2);
+}
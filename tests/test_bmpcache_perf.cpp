@@ -0,0 +1,77 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2013
+   Author(s): Christophe Grosjean
+
+   Unit test for bitmap cache, lookup performance
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestBmpCachePerf
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+#include "log.hpp"
+
+#include "RDP/caches/bmpcache.hpp"
+#include "difftimeval.hpp"
+#include "rdtsc.hpp"
+
+BOOST_AUTO_TEST_CASE(TestBmpCacheLookupPerformance)
+{
+    const uint16_t entries[3] = { 8192, 4096, 1024 };
+    const uint16_t side[3] = { 16, 32, 64 };
+
+    BmpCache cache(24, entries[0], 768, entries[1], 3072, entries[2], 12288);
+
+    for (uint8_t id = 0 ; id < 3 ; id++){
+        Bitmap * bmps[8192];
+        for (uint16_t i = 0 ; i < entries[id] ; i++){
+            bmps[i] = new Bitmap(24, NULL, side[id], side[id]);
+            uint8_t * p = const_cast<uint8_t*>(bmps[i]->data());
+            memset(p, 0, bmps[i]->bmp_size);
+            p[0] = i;
+            p[1] = i >> 8;
+        }
+
+        // fill cache
+        for (uint16_t i = 0 ; i < entries[id] ; i++){
+            BOOST_CHECK_EQUAL((BITMAP_ADDED_TO_CACHE << 24)|(id << 16)|i, cache.cache_bitmap(*bmps[i]));
+        }
+
+        // lookups, all hits
+        const unsigned rounds = 4;
+        unsigned long long usec = ustime();
+        unsigned long long cycles = rdtsc();
+        for (unsigned r = 0 ; r < rounds ; r++){
+            for (uint16_t i = 0 ; i < entries[id] ; i++){
+                BOOST_CHECK_EQUAL((BITMAP_FOUND_IN_CACHE << 24)|(id << 16)|i, cache.cache_bitmap(*bmps[i]));
+            }
+        }
+        unsigned long long elapusec = ustime() - usec;
+        unsigned long long elapcyc = rdtsc() - cycles;
+        unsigned long long lookups = rounds * entries[id];
+        printf("cache %u (%ux%u, %u entries): %llu lookups, elapsed time = %llu %llu, %f lookups/s\n",
+            id, side[id], side[id], entries[id], lookups, elapusec, elapcyc,
+            (double)lookups * 1000000.0 / (double)(elapusec ? elapusec : 1));
+
+        for (uint16_t i = 0 ; i < entries[id] ; i++){
+            delete bmps[i];
+        }
+    }
+}
@@ -0,0 +1,154 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2013
+   Author(s): Christophe Grosjean
+
+   Time spent by session thread drawing frames without recording, with
+   recording made by session thread and with recording made by a capture
+   thread
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestCaptureAsyncPerf
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+#include "log.hpp"
+
+#undef SHARE_PATH
+#define SHARE_PATH FIXTURES_PATH
+
+#undef DEFAULT_FONT_NAME
+#define DEFAULT_FONT_NAME "sans-10.fv1"
+
+#include "front.hpp"
+#include "counttransport.hpp"
+#include "difftimeval.hpp"
+
+enum { NO_CAPTURE, CAPTURE, CAPTURE_THREAD };
+
+static void draw_frames(int mode, unsigned frames)
+{
+    Inifile ini;
+    ini.video.frame_interval = 4;       // one timestamp every 40 ms
+    ini.video.png_limit = 3;
+    ini.video.png_interval = 5;         // one png every 500 ms
+    ini.video.capture_wrm = true;
+    ini.video.capture_thread = (mode == CAPTURE_THREAD);
+    ini.globals.enable_file_encryption.set(false);
+    ini.globals.movie.set(mode != NO_CAPTURE);
+    ini.globals.movie_path.set_from_cstr("./perf_capture");
+    strcpy(ini.video.record_path, "./");
+    strcpy(ini.video.record_tmp_path, "./");
+    strcpy(ini.video.hash_path, "/tmp/");
+
+    CountTransport trans;
+    LCGRandom gen(0);
+    Front front(&trans, SHARE_PATH "/" DEFAULT_FONT_NAME, &gen, &ini, false, false);
+
+    const uint8_t bpp = 16;
+    const uint8_t Bpp = nbbytes(bpp);
+    front.client_info.bpp                  = bpp;
+    front.client_info.width                = 800;
+    front.client_info.height               = 600;
+    front.client_info.bitmap_cache_version = 2;
+    front.client_info.use_bitmap_comp      = 1;
+    front.client_info.cache1_entries       = 120;
+    front.client_info.cache1_size          = 256 * Bpp;
+    front.client_info.cache2_entries       = 120;
+    front.client_info.cache2_size          = 1024 * Bpp;
+    front.client_info.cache3_entries       = 2553;
+    front.client_info.cache3_size          = 4096 * Bpp;
+    front.reset();
+    front.up_and_running = 1;
+    front.mod_bpp = bpp;
+    front.start_capture(front.client_info.width, front.client_info.height, ini, NULL);
+
+    const Bitmap screen_bmp(FIXTURES_PATH "/color_image.bmp");
+    const Rect screen(0, 0, front.client_info.width, front.client_info.height);
+    uint8_t * raw = new uint8_t[screen_bmp.bmp_size];
+
+    uint64_t total = 0;
+    uint64_t worst = 0;
+    for (unsigned frame = 0; frame < frames; frame++){
+        // same picture slightly altered for every frame so that nothing can
+        // be served from cache
+        for (size_t i = 0; i < screen_bmp.bmp_size; i++){
+            raw[i] = screen_bmp.data()[i] ^ static_cast<uint8_t>(frame << 3);
+        }
+        const Bitmap bmp(24, NULL, screen_bmp.cx, screen_bmp.cy, raw, screen_bmp.bmp_size);
+
+        uint64_t start = ustime();
+        front.begin_update();
+        // full screen picture now and then, small updates otherwise
+        if (frame % 10 == 0){
+            front.draw(RDPMemBlt(0, screen, 0xCC, 0, 0, 0), screen, bmp);
+        }
+        else {
+            const Rect tile((frame * 64) % 768, (frame * 48) % 576, 64, 64);
+            front.draw(RDPMemBlt(0, tile, 0xCC, 0, 0, 0), screen, Bitmap(bmp, Rect(tile.x, tile.y, 64, 64)));
+        }
+        for (int i = 0; i < 50; i++){
+            front.draw(RDPOpaqueRect(Rect(i * 16, i * 12, 100, 20), frame * i), screen);
+        }
+        front.end_update();
+        front.periodic_snapshot();
+        uint64_t elapsed = ustime() - start;
+        total += elapsed;
+        worst = std::max(worst, elapsed);
+
+        // a frame every 40 ms
+        if (elapsed < 40000){
+            usleep(40000 - elapsed);
+        }
+    }
+    delete [] raw;
+
+    unsigned long dropped = 0;
+    unsigned long waits = 0;
+    if (mode == CAPTURE_THREAD){
+        dropped = static_cast<AsyncCapture*>(front.capture)->nb_dropped;
+        waits = static_cast<AsyncCapture*>(front.capture)->nb_waits;
+    }
+    uint64_t start = ustime();
+    front.stop_capture();
+    uint64_t stop = ustime() - start;
+
+    SQ wrm_seq;
+    sq_init_outfilename(&wrm_seq, SQF_PATH_FILE_PID_COUNT_EXTENSION, "./", "perf_capture", ".wrm", 0);
+    for (uint32_t i = 0; sq_outfilename_filesize(&wrm_seq, i) > 0; i++){
+        sq_outfilename_unlink(&wrm_seq, i);
+    }
+    SQ meta_seq;
+    sq_init_outfilename(&meta_seq, SQF_PATH_FILE_PID_EXTENSION, "./", "perf_capture", ".mwrm", 0);
+    sq_outfilename_unlink(&meta_seq, 0);
+
+    static const char * names[] = { "no recording", "recording", "capture_thread" };
+    printf("%-14s: %u frames, %llu us/frame, worst frame %llu us, %lu waits, %lu dropped, stopped in %llu us\n",
+        names[mode], frames, (unsigned long long)(total / frames), (unsigned long long)worst,
+        waits, dropped, (unsigned long long)stop);
+
+    BOOST_CHECK_EQUAL(0u, dropped);
+}
+
+BOOST_AUTO_TEST_CASE(TestCaptureAsyncPerf)
+{
+    draw_frames(NO_CAPTURE, 50);
+    draw_frames(CAPTURE, 50);
+    draw_frames(CAPTURE_THREAD, 50);
+}
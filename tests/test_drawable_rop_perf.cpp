@@ -0,0 +1,363 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2013
+   Author(s): Christophe Grosjean
+
+   Performance of RDPDrawable over the drawing orders of recorded sessions
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestDrawableRopPerf
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+#include "test_orders.hpp"
+
+#include <vector>
+
+#include "stream.hpp"
+#include "transport.hpp"
+#include "testtransport.hpp"
+#include "client_info.hpp"
+#include "rdp/rdp.hpp"
+#include "difftimeval.hpp"
+#include "rdtsc.hpp"
+
+#include "front/fake_front.hpp"
+
+// Front keeping every drawing order it is given (colors already converted
+// to 24 bits) to replay them later into an RDPDrawable. Glyphs are not kept,
+// they depend on mod glyph cache.
+class ReplayFront : public FakeFront {
+public:
+    enum OrderType {
+        OPAQUERECT, SCRBLT, DESTBLT, MULTIDSTBLT, PATBLT, MEMBLT, MEM3BLT, LINETO, NB_ORDER_TYPES
+    };
+
+    struct Order {
+        OrderType type;
+        size_t    index;
+        Rect      clip;
+    };
+
+    std::vector<Order>          orders;
+    std::vector<RDPOpaqueRect>  opaquerects;
+    std::vector<RDPScrBlt>      scrblts;
+    std::vector<RDPDestBlt>     destblts;
+    std::vector<RDPMultiDstBlt> multidstblts;
+    std::vector<RDPPatBlt>      patblts;
+    std::vector<RDPMemBlt>      memblts;
+    std::vector<RDPMem3Blt>     mem3blts;
+    std::vector<RDPLineTo>      linetos;
+    std::vector<Bitmap *>       bitmaps;
+    unsigned                    nb_glyphs;
+
+    ReplayFront(const ClientInfo & info, uint32_t verbose)
+        : FakeFront(info, verbose)
+        , nb_glyphs(0)
+    {
+    }
+
+    ~ReplayFront()
+    {
+        for (size_t i = 0 ; i < this->bitmaps.size() ; i++){
+            delete this->bitmaps[i];
+        }
+    }
+
+    void add_order(OrderType type, size_t index, const Rect & clip)
+    {
+        Order order;
+        order.type = type;
+        order.index = index;
+        order.clip = clip;
+        this->orders.push_back(order);
+    }
+
+    virtual void draw(const RDPOpaqueRect & cmd, const Rect & clip) {
+        RDPOpaqueRect new_cmd24 = cmd;
+        new_cmd24.color = color_decode_opaquerect(cmd.color, this->mod_bpp, this->mod_palette);
+        this->add_order(OPAQUERECT, this->opaquerects.size(), clip);
+        this->opaquerects.push_back(new_cmd24);
+    }
+
+    virtual void draw(const RDPScrBlt & cmd, const Rect & clip) {
+        this->add_order(SCRBLT, this->scrblts.size(), clip);
+        this->scrblts.push_back(cmd);
+    }
+
+    virtual void draw(const RDPDestBlt & cmd, const Rect & clip) {
+        this->add_order(DESTBLT, this->destblts.size(), clip);
+        this->destblts.push_back(cmd);
+    }
+
+    virtual void draw(const RDPMultiDstBlt & cmd, const Rect & clip) {
+        this->add_order(MULTIDSTBLT, this->multidstblts.size(), clip);
+        this->multidstblts.push_back(cmd);
+    }
+
+    virtual void draw(const RDPPatBlt & cmd, const Rect & clip) {
+        RDPPatBlt new_cmd24 = cmd;
+        new_cmd24.back_color = color_decode_opaquerect(cmd.back_color, this->mod_bpp, this->mod_palette);
+        new_cmd24.fore_color = color_decode_opaquerect(cmd.fore_color, this->mod_bpp, this->mod_palette);
+        this->add_order(PATBLT, this->patblts.size(), clip);
+        this->patblts.push_back(new_cmd24);
+    }
+
+    virtual void draw(const RDPMemBlt & cmd, const Rect & clip, const Bitmap & bitmap) {
+        this->add_order(MEMBLT, this->memblts.size(), clip);
+        this->memblts.push_back(cmd);
+        this->bitmaps.push_back(new Bitmap(bitmap, Rect(0, 0, bitmap.cx, bitmap.cy)));
+    }
+
+    virtual void draw(const RDPMem3Blt & cmd, const Rect & clip, const Bitmap & bitmap) {
+        this->add_order(MEM3BLT, this->mem3blts.size(), clip);
+        this->mem3blts.push_back(cmd);
+        this->bitmaps.push_back(new Bitmap(bitmap, Rect(0, 0, bitmap.cx, bitmap.cy)));
+    }
+
+    virtual void draw(const RDPLineTo & cmd, const Rect & clip) {
+        RDPLineTo new_cmd24 = cmd;
+        new_cmd24.back_color = color_decode_opaquerect(cmd.back_color, this->mod_bpp, this->mod_palette);
+        new_cmd24.pen.color  = color_decode_opaquerect(cmd.pen.color,  this->mod_bpp, this->mod_palette);
+        this->add_order(LINETO, this->linetos.size(), clip);
+        this->linetos.push_back(new_cmd24);
+    }
+
+    virtual void draw(const RDPGlyphIndex & cmd, const Rect & clip, const GlyphCache * gly_cache) {
+        this->nb_glyphs++;
+    }
+
+    void replay(RDPDrawable & gd, unsigned long long (&cycles)[NB_ORDER_TYPES])
+    {
+        size_t bitmap_index = 0;
+        for (size_t i = 0 ; i < this->orders.size() ; i++){
+            const Order & order = this->orders[i];
+            const unsigned long long tsc = rdtsc();
+            switch (order.type){
+            case OPAQUERECT:
+                gd.draw(this->opaquerects[order.index], order.clip);
+            break;
+            case SCRBLT:
+                gd.draw(this->scrblts[order.index], order.clip);
+            break;
+            case DESTBLT:
+                gd.draw(this->destblts[order.index], order.clip);
+            break;
+            case MULTIDSTBLT:
+                gd.draw(this->multidstblts[order.index], order.clip);
+            break;
+            case PATBLT:
+                gd.draw(this->patblts[order.index], order.clip);
+            break;
+            case MEMBLT:
+                gd.draw(this->memblts[order.index], order.clip, *this->bitmaps[bitmap_index++]);
+            break;
+            case MEM3BLT:
+                gd.draw(this->mem3blts[order.index], order.clip, *this->bitmaps[bitmap_index++]);
+            break;
+            case LINETO:
+                gd.draw(this->linetos[order.index], order.clip);
+            break;
+            default:
+            break;
+            }
+            cycles[order.type] += rdtsc() - tsc;
+        }
+    }
+
+    void report(const char * session, unsigned loops)
+    {
+        static const char * names[NB_ORDER_TYPES] = {
+            "OpaqueRect", "ScrBlt", "DestBlt", "MultiDstBlt", "PatBlt", "MemBlt", "Mem3Blt", "LineTo"
+        };
+        unsigned counts[NB_ORDER_TYPES] = {};
+        for (size_t i = 0 ; i < this->orders.size() ; i++){
+            counts[this->orders[i].type]++;
+        }
+
+        RDPDrawable gd(this->info.width, this->info.height);
+        unsigned long long cycles[NB_ORDER_TYPES] = {};
+        unsigned long long usec = ustime();
+        for (unsigned loop = 0 ; loop < loops ; loop++){
+            this->replay(gd, cycles);
+        }
+        unsigned long long elapsed = ustime() - usec;
+
+        printf("%s: %u orders (%u glyphs not replayed) in %llu us, %.0f orders/s\n",
+            session, (unsigned)this->orders.size(), this->nb_glyphs, elapsed / loops,
+            (double)this->orders.size() * loops * 1000000 / (double)(elapsed + 1));
+        for (unsigned t = 0 ; t < NB_ORDER_TYPES ; t++){
+            if (counts[t]){
+                printf("    %-11s %6u orders, %10llu cycles/order\n",
+                    names[t], counts[t], cycles[t] / loops / counts[t]);
+            }
+        }
+    }
+};
+
+static void init_client_info(ClientInfo & info, uint8_t bpp, uint16_t width, uint16_t height)
+{
+    info.keylayout = 0x04C;
+    info.console_session = 0;
+    info.brush_cache_code = 0;
+    info.bpp = bpp;
+    info.width = width;
+    info.height = height;
+    info.rdp5_performanceflags = PERF_DISABLE_WALLPAPER;
+    snprintf(info.hostname,sizeof(info.hostname),"test");
+}
+
+BOOST_AUTO_TEST_CASE(TestDrawableXPSession)
+{
+    ClientInfo info(1, true, true);
+    init_client_info(info, 24, 800, 600);
+    int verbose = 0;
+
+    ReplayFront front(info, verbose);
+
+    #include "fixtures/dump_xp_mem3blt.hpp"
+    TestTransport t("RDP XP Target", indata, sizeof(indata), outdata, sizeof(outdata), verbose);
+
+    // To always get the same client random, in tests
+    LCGRandom gen(0);
+
+    try {
+        mod_rdp mod(&t, "xavier", "SecureLinux", "10.10.9.161", front,
+            false,      // tls
+            info, &gen,
+            7,          // key flags
+            NULL,       // auth_api
+            "",         // auth channel
+            "",         // alternate_shell
+            "",         // shell_working_directory
+            true,       // clipboard
+            false,      // fast-path support
+            true,       // mem3blt support
+            false,      // bitmap update support
+            verbose,
+            false       // enable new pointer
+        );
+
+        for (uint32_t count = 0 ; count < 25 ; count++){
+            mod.draw_event(time(NULL));
+        }
+    }
+    catch (const Error & e) {
+        // end of recorded data
+    };
+
+    BOOST_CHECK(front.orders.size() > 0);
+    front.report("dump_xp_mem3blt", 50);
+}
+
+BOOST_AUTO_TEST_CASE(TestDrawableTLSW2008Session)
+{
+    ClientInfo info(1, true, true);
+    init_client_info(info, 16, 1024, 768);
+    info.keylayout = 0x040C;
+    info.rdp5_performanceflags =   PERF_DISABLE_WALLPAPER
+                                 | PERF_DISABLE_FULLWINDOWDRAG | PERF_DISABLE_MENUANIMATIONS;
+    int verbose = 0;
+
+    ReplayFront front(info, verbose);
+
+    #include "fixtures/dump_TLSw2008.hpp"
+    TestTransport t("RDP W2008 TLS Target", indata, sizeof(indata), outdata, sizeof(outdata), verbose);
+
+    // To always get the same client random, in tests
+    LCGRandom gen(0);
+
+    snprintf(info.hostname,sizeof(info.hostname),"192-168-1-100");
+
+    try {
+        mod_rdp mod(&t, "administrateur@qa", "S3cur3!1nux", "192.168.1.100", front,
+            true,       // tls
+            info, &gen,
+            7,          // key flags
+            NULL,       // auth_api
+            "",         // auth channel
+            "",         // alternate_shell
+            "",         // shell_working_directory
+            true,       // clipboard
+            false,      // fast-path support
+            false,      // mem3blt support
+            false,      // bitmap update support
+            verbose,
+            false       // enable new pointer
+        );
+
+        for (uint32_t count = 0 ; count < 40 ; count++){
+            mod.draw_event(time(NULL));
+        }
+    }
+    catch (const Error & e) {
+        // end of recorded data
+    };
+
+    BOOST_CHECK(front.orders.size() > 0);
+    front.report("dump_TLSw2008", 50);
+}
+
+BOOST_AUTO_TEST_CASE(TestDrawableWabSession)
+{
+    ClientInfo info(1, true, true);
+    init_client_info(info, 16, 1024, 768);
+    info.keylayout = 0x040C;
+    info.rdp5_performanceflags =   PERF_DISABLE_WALLPAPER
+                                 | PERF_DISABLE_FULLWINDOWDRAG | PERF_DISABLE_MENUANIMATIONS;
+    int verbose = 0;
+
+    ReplayFront front(info, verbose);
+
+    #include "fixtures/dump_wab.hpp"
+    TestTransport t("RDP Wab Target", indata, sizeof(indata), outdata, sizeof(outdata), verbose);
+
+    // To always get the same client random, in tests
+    LCGRandom gen(0);
+
+    snprintf(info.hostname,sizeof(info.hostname),"192-168-1-100");
+
+    try {
+        mod_rdp mod(&t, "x", "x", "192.168.1.100", front,
+            false,      // tls
+            info, &gen,
+            7,          // key flags
+            NULL,       // auth_api
+            "",         // auth channel
+            "",         // alternate_shell
+            "",         // shell_working_directory
+            true,       // clipboard
+            false,      // fast-path support
+            false,      // mem3blt support
+            false,      // bitmap update support
+            verbose,
+            false       // enable new pointer
+        );
+
+        for (uint32_t count = 0 ; count < 40 ; count++){
+            mod.draw_event(time(NULL));
+        }
+    }
+    catch (const Error & e) {
+        // end of recorded data
+    };
+
+    BOOST_CHECK(front.orders.size() > 0);
+    front.report("dump_wab", 50);
+}
@@ -0,0 +1,142 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2013
+   Author(s): Christophe Grosjean
+
+   Performance of full screen MemBlt sent by front with each bitmap tiling mode
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestFrontMemBltPerf
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+#include "log.hpp"
+
+#undef SHARE_PATH
+#define SHARE_PATH FIXTURES_PATH
+
+#undef DEFAULT_FONT_NAME
+#define DEFAULT_FONT_NAME "sans-10.fv1"
+
+#include "front.hpp"
+#include "counttransport.hpp"
+#include "difftimeval.hpp"
+#include "rdtsc.hpp"
+
+// count heap allocations made while a frame is drawn
+static unsigned long nb_allocations = 0;
+extern "C" void * __libc_malloc(size_t size);
+extern "C" void * malloc(size_t size)
+{
+    nb_allocations++;
+    return __libc_malloc(size);
+}
+
+static void replay_full_screen_memblt(unsigned tiling, unsigned frames)
+{
+    Inifile ini;
+    ini.client.bitmap_tiling = tiling;
+
+    CountTransport trans;
+    LCGRandom gen(0);
+    Front front(&trans, SHARE_PATH "/" DEFAULT_FONT_NAME, &gen, &ini, false, false);
+
+    const uint8_t bpp = 16;
+    const uint8_t Bpp = nbbytes(bpp);
+    front.client_info.bpp                  = bpp;
+    front.client_info.width                = 800;
+    front.client_info.height               = 600;
+    front.client_info.bitmap_cache_version = 2;
+    front.client_info.use_bitmap_comp      = 1;
+    front.client_info.cache1_entries       = 120;
+    front.client_info.cache1_size          = 256 * Bpp;
+    front.client_info.cache2_entries       = 120;
+    front.client_info.cache2_size          = 1024 * Bpp;
+    front.client_info.cache3_entries       = 2553;
+    front.client_info.cache3_size          = 4096 * Bpp;
+    front.reset();
+    front.up_and_running = 1;
+
+    const Bitmap screen_bmp(FIXTURES_PATH "/color_image.bmp");
+    const uint16_t cx = front.client_info.width;
+    const uint16_t cy = front.client_info.height;
+    const Rect screen(0, 0, cx, cy);
+
+    // while entry 0 of the small bitmap cache is unused, bitmap caches always
+    // replace their entry 0: cache a small bitmap as any session does early
+    const Rect small_rect(0, 0, 16, 16);
+    const Bitmap small_bmp(screen_bmp, small_rect);
+    front.begin_update();
+    front.draw(RDPMemBlt(0, small_rect, 0xCC, 0, 0, 0), small_rect, small_bmp);
+    front.end_update();
+
+    uint8_t * raw = new uint8_t[screen_bmp.bmp_size];
+    unsigned long long elapsed = 0;
+    unsigned long long cycles = 0;
+    unsigned long allocations = 0;
+    for (unsigned frame = 0; frame < frames; frame++) {
+        // same picture slightly altered for every frame so that nothing can
+        // be served from cache
+        for (size_t i = 0; i < screen_bmp.bmp_size; i++) {
+            raw[i] = screen_bmp.data()[i] ^ static_cast<uint8_t>(frame << 3);
+        }
+        Bitmap bmp(24, NULL, screen_bmp.cx, screen_bmp.cy, raw, screen_bmp.bmp_size);
+
+        unsigned long long usec = ustime();
+        unsigned long long tsc = rdtsc();
+        unsigned long alloc_start = nb_allocations;
+        front.begin_update();
+        front.draw(RDPMemBlt(0, screen, 0xCC, 0, 0, 0), screen, bmp);
+        front.end_update();
+        allocations += nb_allocations - alloc_start;
+        cycles += rdtsc() - tsc;
+        elapsed += ustime() - usec;
+    }
+
+    // replaying the last frame again, every tile is found in cache
+    Bitmap bmp(24, NULL, screen_bmp.cx, screen_bmp.cy, raw, screen_bmp.bmp_size);
+    unsigned long alloc_start = nb_allocations;
+    front.begin_update();
+    front.draw(RDPMemBlt(0, screen, 0xCC, 0, 0, 0), screen, bmp);
+    front.end_update();
+    unsigned long cached_allocations = nb_allocations - alloc_start;
+    delete [] raw;
+
+    printf("bitmap_tiling=%u: %u frames, %llu us/frame, %llu cycles/frame, %llu bytes/frame, %u bitmap updates, "
+           "%lu allocations/frame, %lu allocations/cached frame\n",
+        tiling, frames, elapsed / frames, cycles / frames,
+        (unsigned long long)trans.total_sent / frames, front.bitmap_update_count,
+        allocations / frames, cached_allocations);
+
+    BOOST_CHECK(trans.total_sent > 0);
+    BOOST_CHECK_EQUAL(tiling >= 2, front.bitmap_update_count > 0);
+    if (tiling == 1){
+        // all tiles fit in cache 3: cache hits must not copy tiles
+        BOOST_CHECK(cached_allocations < 8);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestFrontFullScreenMemBltPerf)
+{
+    // with bitmap_tiling=1 frames are made of 130 tiles, all the frames
+    // must fit in the 2553 entries of cache 3
+    replay_full_screen_memblt(0, 16);
+    replay_full_screen_memblt(1, 16);
+    replay_full_screen_memblt(2, 16);
+}
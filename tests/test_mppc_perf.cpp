@@ -0,0 +1,175 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2013
+   Author(s): Christophe Grosjean
+
+   Bulk compressors ratio and speed for each compression type and effort
+   level over the data of MPPC fixtures
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestMPPCPerf
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+#include "log.hpp"
+
+#include <string>
+#include <vector>
+
+#include "RDP/mppc.hpp"
+#include "difftimeval.hpp"
+
+typedef std::vector<std::string> Samples;
+
+// fixtures arrays all have the same names: one function for each file
+
+static void add_samples_2(Samples & samples)
+{
+    #include "fixtures/test_mppc_2.hpp"
+    samples.push_back(std::string(reinterpret_cast<char *>(historyBuffer), sizeof(historyBuffer)));
+    samples.push_back(std::string(reinterpret_cast<char *>(uncompressed_data), sizeof(uncompressed_data)));
+}
+
+static void add_samples_3(Samples & samples)
+{
+    #include "fixtures/test_mppc_3.hpp"
+    samples.push_back(std::string(reinterpret_cast<char *>(uncompressed_data), sizeof(uncompressed_data)));
+}
+
+static void add_samples_4(Samples & samples)
+{
+    #include "fixtures/test_mppc_4.hpp"
+    samples.push_back(std::string(reinterpret_cast<char *>(historyBuffer), sizeof(historyBuffer)));
+    samples.push_back(std::string(reinterpret_cast<char *>(uncompressed_data), sizeof(uncompressed_data)));
+}
+
+static void add_samples_5(Samples & samples)
+{
+    #include "fixtures/test_mppc_5.hpp"
+    samples.push_back(std::string(reinterpret_cast<char *>(historyBuffer), sizeof(historyBuffer)));
+    samples.push_back(std::string(reinterpret_cast<char *>(uncompressed_data), sizeof(uncompressed_data)));
+}
+
+static void add_samples_6(Samples & samples)
+{
+    #include "fixtures/test_mppc_6.hpp"
+    samples.push_back(std::string(reinterpret_cast<char *>(historyBuffer), sizeof(historyBuffer)));
+    samples.push_back(std::string(reinterpret_cast<char *>(uncompressed_data), sizeof(uncompressed_data)));
+}
+
+static void add_samples_TestMPPC(Samples & samples)
+{
+    #include "fixtures/test_mppc_TestMPPC.hpp"
+    samples.push_back(std::string(reinterpret_cast<char *>(decompressed_rd5), sizeof(decompressed_rd5)));
+}
+
+static void add_samples_TestMPPC_enc(Samples & samples)
+{
+    #include "fixtures/test_mppc_TestMPPC_enc.hpp"
+    samples.push_back(std::string(reinterpret_cast<char *>(decompressed_rd5_data), sizeof(decompressed_rd5_data)));
+}
+
+static rdp_mppc_enc * new_encoder(int type, int level)
+{
+    switch (type) {
+    case PACKET_COMPR_TYPE_8K:
+        return new rdp_mppc_40_enc(level);
+    case PACKET_COMPR_TYPE_64K:
+        return new rdp_mppc_50_enc(level);
+    default:
+        return new rdp_mppc_60_enc(level);
+    }
+}
+
+// Send samples as a session would, in PDUs of at most 16K, through one
+// compressor. Returns compression ratio.
+static double replay_samples(const Samples & samples, int type, int level, unsigned iterations)
+{
+    const int max_pdu_size = (type == PACKET_COMPR_TYPE_8K) ? 4096 : 16384;
+
+    unsigned long long total_in  = 0;
+    unsigned long long total_out = 0;
+    unsigned long long elapsed   = 0;
+    bool               same_data = true;
+    BStream            stream(65536);
+
+    for (unsigned i = 0; i < iterations; i++) {
+        rdp_mppc_enc * enc = new_encoder(type, level);
+        rdp_mppc_unified_dec dec;
+        for (size_t s = 0; s < samples.size(); s++) {
+            uint8_t * data = reinterpret_cast<uint8_t *>(const_cast<char *>(samples[s].data()));
+            int       len  = samples[s].size();
+            for (int offset = 0; offset < len; offset += max_pdu_size) {
+                int size = std::min(max_pdu_size, len - offset);
+
+                uint8_t  compressionFlags;
+                uint16_t datalen;
+                unsigned long long usec = ustime();
+                enc->compress(data + offset, size, compressionFlags, datalen);
+                elapsed += ustime() - usec;
+
+                total_in  += size;
+                total_out += (compressionFlags & PACKET_COMPRESSED) ? datalen : size;
+
+                // decompressed data must be the same
+                if ((i == 0) && (compressionFlags & PACKET_COMPRESSED)) {
+                    stream.reset();
+                    enc->get_compressed_data(stream);
+                    stream.mark_end();
+                    const uint8_t * rdata;
+                    uint32_t        rlen;
+                    dec.decompress(stream.get_data(), stream.size(), compressionFlags, rdata, rlen);
+                    same_data = same_data && (rlen == static_cast<uint32_t>(size))
+                                          && (0 == memcmp(data + offset, rdata, size));
+                }
+            }
+        }
+        delete enc;
+    }
+
+    const char * names[] = { "RDP 4.0", "RDP 5.0", "RDP 6.0" };
+    double ratio = static_cast<double>(total_in) / total_out;
+    printf("%s level=%d: %llu bytes, ratio %.3f, %.1f MB/s\n", names[type], level, total_in / iterations,
+        ratio, elapsed ? static_cast<double>(total_in) / elapsed : 0.);
+
+    BOOST_CHECK(same_data);
+    return ratio;
+}
+
+BOOST_AUTO_TEST_CASE(TestMPPCPerf)
+{
+    Samples samples;
+    add_samples_2(samples);
+    add_samples_3(samples);
+    add_samples_4(samples);
+    add_samples_5(samples);
+    add_samples_6(samples);
+    add_samples_TestMPPC(samples);
+    add_samples_TestMPPC_enc(samples);
+
+    const unsigned iterations = 20;
+    for (int type = PACKET_COMPR_TYPE_8K; type <= PACKET_COMPR_TYPE_RDP6; type++) {
+        double fast = replay_samples(samples, type, rdp_mppc_enc_match_finder::LEVEL_FAST, iterations);
+        for (int level = rdp_mppc_enc_match_finder::LEVEL_FAST + 1; level <= rdp_mppc_enc_match_finder::LEVEL_MAX; level++) {
+            double ratio = replay_samples(samples, type, level, iterations);
+            // higher effort levels never send more data
+            BOOST_CHECK(ratio >= fast);
+        }
+    }
+}
@@ -0,0 +1,97 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2013
+   Author(s): Christophe Grosjean
+
+   Png encoding time and size of screenshots for every compression level
+   and filter setting
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestPngPerf
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+#include "log.hpp"
+
+#include <vector>
+
+#include "png.hpp"
+#include "counttransport.hpp"
+#include "difftimeval.hpp"
+
+static void bench(const char * filename, size_t width, size_t height, unsigned loops)
+{
+    // screenshot in BGR order, like drawable data
+    std::vector<uint8_t> image(width * height * 3);
+    FILE * f = fopen(filename, "rb");
+    BOOST_REQUIRE(f);
+    read_png24(f, &image[0], width, height, width * 3);
+    fclose(f);
+    png_swap_bgr(&image[0], &image[0], width * height);
+
+    static const char * names[] = { "adaptive", "none", "sub", "up", "paeth" };
+    static const int levels[] = { 1, 6, 9 };
+    for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++){
+        for (unsigned filter = PngParams::FILTER_ADAPTIVE; filter <= PngParams::FILTER_PAETH; filter++){
+            CountTransport trans;
+            uint64_t start = ustime();
+            for (unsigned i = 0; i < loops; i++){
+                transport_dump_png24(&trans, &image[0], width, height, width * 3, true, PngParams(levels[l], filter));
+            }
+            uint64_t elapsed = ustime() - start;
+            printf("%s: level %d, %-8s: %7llu bytes, %6llu us/image\n",
+                filename, levels[l], names[filter],
+                (unsigned long long)(trans.total_sent / loops), (unsigned long long)(elapsed / loops));
+            BOOST_CHECK(trans.total_sent > 0);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestPngPerfScreenshots)
+{
+    bench(FIXTURES_PATH "/win2008capture10.png", 800, 600, 10);
+    bench(FIXTURES_PATH "/color_image.png", 800, 600, 10);
+    bench(FIXTURES_PATH "/Philips_PM5544_640.png", 640, 480, 10);
+}
+
+BOOST_AUTO_TEST_CASE(TestPngPerfSwapBgr)
+{
+    const size_t npixels = 800 * 600;
+    std::vector<uint8_t> src(npixels * 3);
+    std::vector<uint8_t> dst(npixels * 3);
+    for (size_t i = 0; i < src.size(); i++){
+        src[i] = static_cast<uint8_t>(i * 31);
+    }
+
+    uint64_t start = ustime();
+    for (unsigned i = 0; i < 100; i++){
+        png_swap_bgr_scalar(&dst[0], &src[0], npixels);
+    }
+    uint64_t scalar = ustime() - start;
+
+    start = ustime();
+    for (unsigned i = 0; i < 100; i++){
+        png_swap_bgr(&dst[0], &src[0], npixels);
+    }
+    uint64_t best = ustime() - start;
+
+    printf("swap bgr 800x600: scalar %llu us, best kernel %llu us\n",
+        (unsigned long long)(scalar / 100), (unsigned long long)(best / 100));
+    BOOST_CHECK(dst[0] == src[2]);
+}
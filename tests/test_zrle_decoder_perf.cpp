@@ -0,0 +1,268 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2013
+   Author(s): Christophe Grosjean
+
+   Performance of VNC ZRLE decoder on a full 1920x1080 16 bpp update
+*/
+
+#define BOOST_AUTO_TEST_MAIN
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE TestZRLEDecoderPerf
+#include <boost/test/auto_unit_test.hpp>
+
+#define LOGNULL
+#include "log.hpp"
+
+#include <stdio.h>
+#include <vector>
+
+#include "vnc/zrle.hpp"
+#include "difftimeval.hpp"
+
+enum { WIDTH = 1920, HEIGHT = 1080 };
+
+// Desktop like screen: plain background and title bars, windows with text
+// (two colors), a gradient and a picture (noise)
+static void make_screen(std::vector<uint16_t> & screen)
+{
+    uint32_t seed = 12345;
+    for (int y = 0; y < HEIGHT; y++) {
+        for (int x = 0; x < WIDTH; x++) {
+            uint16_t pixel = 0x3186;                              // background
+            if ((x >= 100) && (x < 1100) && (y >= 80) && (y < 880)) {
+                if (y < 110) {
+                    pixel = 0x001F;                               // title bar
+                }
+                else if ((((x / 7) * 31 + (y / 14) * 17) % 5) && ((x % 7) < 5)
+                     && ((y % 14) > 3) && (((x * 13) ^ (y * 7)) & 4)) {
+                    pixel = 0x0000;                               // text
+                }
+                else {
+                    pixel = 0xFFFF;
+                }
+            }
+            else if ((x >= 1200) && (x < 1800) && (y >= 100) && (y < 500)) {
+                pixel = ((y - 100) / 13) << 11 | ((x - 1200) / 10) << 5; // gradient
+            }
+            else if ((x >= 1200) && (x < 1800) && (y >= 550) && (y < 950)) {
+                seed = seed * 1103515245 + 12345;
+                pixel = seed >> 16;                               // picture
+            }
+            else if (y >= HEIGHT - 40) {
+                pixel = 0x2945;                                   // task bar
+            }
+            screen[y * WIDTH + x] = pixel;
+        }
+    }
+}
+
+static void out_cpixel(std::vector<uint8_t> & v, uint16_t pixel)
+{
+    v.push_back(pixel & 0xFF);
+    v.push_back(pixel >> 8);
+}
+
+static void out_run_length(std::vector<uint8_t> & v, unsigned length)
+{
+    for (length--; length >= 255; length -= 255) {
+        v.push_back(255);
+    }
+    v.push_back(length);
+}
+
+// ZRLE encoding of a tile as a server would choose it
+static void encode_tile(std::vector<uint8_t> & v, const std::vector<uint16_t> & screen,
+                        int tx, int ty, int cx, int cy)
+{
+    std::vector<uint16_t> pixels;
+    for (int y = ty; y < ty + cy; y++) {
+        pixels.insert(pixels.end(), &screen[y * WIDTH + tx], &screen[y * WIDTH + tx + cx]);
+    }
+
+    std::vector<uint16_t> palette;
+    unsigned nb_runs = 1;
+    for (size_t i = 0; i < pixels.size(); i++) {
+        if ((palette.size() <= 16) && (std::find(palette.begin(), palette.end(), pixels[i]) == palette.end())) {
+            palette.push_back(pixels[i]);
+        }
+        nb_runs += (i > 0) && (pixels[i] != pixels[i - 1]);
+    }
+
+    if (palette.size() == 1) {
+        v.push_back(1);
+        out_cpixel(v, palette[0]);
+    }
+    else if (palette.size() <= 16) {
+        const unsigned bits = (palette.size() == 2) ? 1 : (palette.size() <= 4) ? 2 : 4;
+        if (nb_runs * 2 < pixels.size() * bits / 8) {
+            v.push_back(128 + palette.size());
+            for (size_t i = 0; i < palette.size(); i++) {
+                out_cpixel(v, palette[i]);
+            }
+            for (size_t i = 0; i < pixels.size(); ) {
+                size_t j = i + 1;
+                while ((j < pixels.size()) && (pixels[j] == pixels[i])) {
+                    j++;
+                }
+                const uint8_t index = std::find(palette.begin(), palette.end(), pixels[i]) - palette.begin();
+                if (j - i == 1) {
+                    v.push_back(index);
+                }
+                else {
+                    v.push_back(index | 0x80);
+                    out_run_length(v, j - i);
+                }
+                i = j;
+            }
+        }
+        else {
+            v.push_back(palette.size());
+            for (size_t i = 0; i < palette.size(); i++) {
+                out_cpixel(v, palette[i]);
+            }
+            for (int y = 0; y < cy; y++) {
+                uint8_t byte  = 0;
+                int     nbits = 0;
+                for (int x = 0; x < cx; x++) {
+                    const uint8_t index = std::find(palette.begin(), palette.end(), pixels[y * cx + x]) - palette.begin();
+                    byte  |= index << (8 - bits - nbits);
+                    nbits += bits;
+                    if (nbits == 8) {
+                        v.push_back(byte);
+                        byte  = 0;
+                        nbits = 0;
+                    }
+                }
+                if (nbits) {
+                    v.push_back(byte);
+                }
+            }
+        }
+    }
+    else if (nb_runs * 3 < pixels.size() * 2) {
+        v.push_back(128);
+        for (size_t i = 0; i < pixels.size(); ) {
+            size_t j = i + 1;
+            while ((j < pixels.size()) && (pixels[j] == pixels[i])) {
+                j++;
+            }
+            out_cpixel(v, pixels[i]);
+            out_run_length(v, j - i);
+            i = j;
+        }
+    }
+    else {
+        v.push_back(0);
+        for (size_t i = 0; i < pixels.size(); i++) {
+            out_cpixel(v, pixels[i]);
+        }
+    }
+}
+
+static void encode_screen(const std::vector<uint16_t> & screen, std::vector<uint8_t> & compressed)
+{
+    std::vector<uint8_t> tiles;
+    for (int y = 0; y < HEIGHT; y += 64) {
+        for (int x = 0; x < WIDTH; x += 64) {
+            encode_tile(tiles, screen, x, y, std::min(64, WIDTH - x), std::min(64, HEIGHT - y));
+        }
+    }
+
+    z_stream zstrm;
+    memset(&zstrm, 0, sizeof(zstrm));
+    BOOST_REQUIRE_EQUAL(Z_OK, deflateInit(&zstrm, Z_DEFAULT_COMPRESSION));
+    compressed.resize(tiles.size() + 4096);
+    zstrm.next_in   = &tiles[0];
+    zstrm.avail_in  = tiles.size();
+    zstrm.next_out  = &compressed[0];
+    zstrm.avail_out = compressed.size();
+    BOOST_REQUIRE_EQUAL(Z_OK, deflate(&zstrm, Z_SYNC_FLUSH));
+    compressed.resize(compressed.size() - zstrm.avail_out);
+    deflateEnd(&zstrm);
+}
+
+// Draws decoded tiles in a 16 bpp frame buffer
+class FrameBuffer : public ZRLEDrawApi {
+public:
+    std::vector<uint16_t> pixels;
+    unsigned              nb_solid;
+    unsigned              nb_tiles;
+
+    FrameBuffer()
+    : pixels(WIDTH * HEIGHT)
+    , nb_solid(0)
+    , nb_tiles(0)
+    {}
+
+    virtual bool draw_zrle_solid_tile(const Rect & tile, uint32_t color) {
+        for (int y = tile.y; y < tile.y + tile.cy; y++) {
+            std::fill(&this->pixels[y * WIDTH + tile.x], &this->pixels[y * WIDTH + tile.x + tile.cx], color);
+        }
+        this->nb_solid++;
+        return true;
+    }
+
+    virtual void draw_zrle_tile(const Rect & tile, const uint8_t * pixels, size_t length,
+                                const uint8_t * two_colors_palette) {
+        for (int y = tile.y; y < tile.y + tile.cy; y++, pixels += tile.cx * 2) {
+            memcpy(&this->pixels[y * WIDTH + tile.x], pixels, tile.cx * 2);
+        }
+        this->nb_tiles++;
+    }
+};
+
+static void decode(const std::vector<uint8_t> & compressed, size_t chunk_size, FrameBuffer & fb)
+{
+    ZRLEDecoder zrle;
+    zrle.start(0, 0, WIDTH, HEIGHT, 2);
+    for (size_t i = 0; i < compressed.size(); i += chunk_size) {
+        zrle.decode(&compressed[i], std::min(chunk_size, compressed.size() - i), fb);
+    }
+    BOOST_CHECK(zrle.done());
+}
+
+BOOST_AUTO_TEST_CASE(TestZRLEDecoderPerf)
+{
+    std::vector<uint16_t> screen(WIDTH * HEIGHT);
+    make_screen(screen);
+
+    std::vector<uint8_t> compressed;
+    encode_screen(screen, compressed);
+
+    // whole update at once (as received in 64 KB reads) and split as TCP
+    // segments
+    const size_t   chunk_sizes[] = { 65536, 1448 };
+    const unsigned loops         = 20;
+    for (size_t c = 0; c < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); c++) {
+        FrameBuffer fb;
+        decode(compressed, chunk_sizes[c], fb);
+        BOOST_CHECK(fb.pixels == screen);
+
+        unsigned long long usec = ustime();
+        for (unsigned loop = 0; loop < loops; loop++) {
+            decode(compressed, chunk_sizes[c], fb);
+        }
+        unsigned long long elapsed = ustime() - usec;
+
+        printf("%ux%u ZRLE update: %u bytes in %u bytes chunks, %u solid tiles, %u other tiles, "
+               "%llu us per update, %.1f Mpixels/s\n",
+            WIDTH, HEIGHT, (unsigned)compressed.size(), (unsigned)chunk_sizes[c],
+            fb.nb_solid / (loops + 1), fb.nb_tiles / (loops + 1), elapsed / loops,
+            (double)WIDTH * HEIGHT * loops / (double)(elapsed + 1));
+    }
+}
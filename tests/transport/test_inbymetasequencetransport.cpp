@@ -175,3 +175,117 @@ BOOST_AUTO_TEST_CASE(TestSequenceFollowedTransportWRM2_RIO)
 
 }
 
+
+BOOST_AUTO_TEST_CASE(TestSequenceSkipUnitsBefore)
+{
+    timeval tv;
+    tv.tv_usec = 0;
+
+    {
+        // inside first chunk, nothing to skip
+        InByMetaSequenceTransport mwrm_trans("./tests/fixtures/sample", ".mwrm");
+        tv.tv_sec = 1352304869;
+        BOOST_CHECK(!mwrm_trans.skip_units_before(tv));
+        BOOST_CHECK_EQUAL(1, mwrm_trans.chunk_num);
+    }
+
+    {
+        InByMetaSequenceTransport mwrm_trans("./tests/fixtures/sample", ".mwrm");
+        tv.tv_sec = 1352304940;
+        BOOST_CHECK(mwrm_trans.skip_units_before(tv));
+        BOOST_CHECK_EQUAL("./tests/fixtures/sample2.wrm", mwrm_trans.path);
+        BOOST_CHECK_EQUAL(1352304930, mwrm_trans.begin_chunk_time);
+        BOOST_CHECK_EQUAL(3, mwrm_trans.chunk_num);
+
+        // data read is data of last chunk
+        char buffer[10000];
+        size_t total = 0;
+        try {
+            for (;;){
+                char * pbuffer = buffer;
+                try {
+                    mwrm_trans.recv(&pbuffer, sizeof(buffer));
+                }
+                catch (const Error & e) {
+                    total += pbuffer - buffer;
+                    throw;
+                }
+                total += pbuffer - buffer;
+            }
+        } catch (const Error & e) {
+            BOOST_CHECK_EQUAL((unsigned)ERR_TRANSPORT_NO_MORE_DATA, (unsigned)e.id);
+        };
+        BOOST_CHECK_EQUAL(290245, total);
+    }
+
+    {
+        // after end of movie
+        InByMetaSequenceTransport mwrm_trans("./tests/fixtures/sample", ".mwrm");
+        tv.tv_sec = 1352305000;
+        BOOST_CHECK(mwrm_trans.skip_units_before(tv));
+        char buffer[16];
+        char * pbuffer = buffer;
+        BOOST_CHECK_THROW(mwrm_trans.recv(&pbuffer, sizeof(buffer)), Error);
+    }
+}
+
+// Accepts the unit checked in accepted_unit position (from 1) if it starts
+// like wrm files of fixtures (META chunk)
+static unsigned nb_checked_units = 0;
+static unsigned accepted_unit = 0;
+static bool is_accepted_unit(const uint8_t * data, size_t len)
+{
+    nb_checked_units++;
+    return (len > 2) && (data[0] == 0xEE) && (data[1] == 0x03) && (nb_checked_units == accepted_unit);
+}
+
+BOOST_AUTO_TEST_CASE(TestSequenceSkipUnitsBeforeStartUnit)
+{
+    timeval tv;
+    tv.tv_usec = 0;
+
+    {
+        // third chunk contains tv, second one is the last that can start
+        InByMetaSequenceTransport mwrm_trans("./tests/fixtures/sample", ".mwrm");
+        tv.tv_sec = 1352304940;
+        nb_checked_units = 0;
+        accepted_unit = 2;
+        BOOST_CHECK(mwrm_trans.skip_units_before(tv, &is_accepted_unit));
+        BOOST_CHECK_EQUAL("./tests/fixtures/sample1.wrm", mwrm_trans.path);
+        BOOST_CHECK_EQUAL(2, mwrm_trans.chunk_num);
+        BOOST_CHECK_EQUAL(3, nb_checked_units);
+    }
+
+    {
+        // no chunk can start, stays on first one
+        InByMetaSequenceTransport mwrm_trans("./tests/fixtures/sample", ".mwrm");
+        tv.tv_sec = 1352304940;
+        nb_checked_units = 0;
+        accepted_unit = 0;
+        BOOST_CHECK(!mwrm_trans.skip_units_before(tv, &is_accepted_unit));
+        BOOST_CHECK_EQUAL("./tests/fixtures/sample0.wrm", mwrm_trans.path);
+        BOOST_CHECK_EQUAL(1, mwrm_trans.chunk_num);
+    }
+
+    {
+        // chunks after the one containing tv are not checked
+        InByMetaSequenceTransport mwrm_trans("./tests/fixtures/sample", ".mwrm");
+        tv.tv_sec = 1352304900;
+        nb_checked_units = 0;
+        accepted_unit = 3;
+        BOOST_CHECK(!mwrm_trans.skip_units_before(tv, &is_accepted_unit));
+        BOOST_CHECK_EQUAL(1, mwrm_trans.chunk_num);
+        BOOST_CHECK_EQUAL(2, nb_checked_units);
+    }
+
+    {
+        // after end of movie, last chunk that can start
+        InByMetaSequenceTransport mwrm_trans("./tests/fixtures/sample", ".mwrm");
+        tv.tv_sec = 1352305000;
+        nb_checked_units = 0;
+        accepted_unit = 3;
+        BOOST_CHECK(mwrm_trans.skip_units_before(tv, &is_accepted_unit));
+        BOOST_CHECK_EQUAL("./tests/fixtures/sample2.wrm", mwrm_trans.path);
+        BOOST_CHECK_EQUAL(3, mwrm_trans.chunk_num);
+    }
+}
@@ -46,6 +46,7 @@
 #include "ssl_calls.hpp"
 #include "wait_obj.hpp"
 #include "server.hpp"
+#include "RDP/x224.hpp"
 
 
 // This test is somewhat tricky
@@ -178,9 +179,12 @@ BOOST_AUTO_TEST_CASE(TestSocketTransport)
             for (int i = 0 ; i < nb_recv_sck ; i++){
                 if (FD_ISSET(recv_sck[i], & rfds)){
                     LOG(LOG_INFO, "activity on %d", recv_sck[i]);
-                    sck_trans[i]->recv(&p, 5);
-                    nb_inbuffer += 5;
-                    LOG(LOG_INFO, "received %*s\n", nb_inbuffer, buffer);
+                    // data read ahead is not signaled again by select
+                    do {
+                        sck_trans[i]->recv(&p, 5);
+                        nb_inbuffer += 5;
+                        LOG(LOG_INFO, "received %*s\n", nb_inbuffer, buffer);
+                    } while (sck_trans[i]->has_pending_data());
                     if (nb_inbuffer == 20){
                         run = false;
                     }
@@ -224,3 +228,139 @@ BOOST_AUTO_TEST_CASE(TestSocketTransport)
     }
 
 }
+
+// Writes nb X224 data PDUs with payloads of various sizes on sck
+static void send_pdus(int sck, unsigned nb)
+{
+    for (unsigned i = 0; i < nb; i++){
+        size_t payload_len = 20 + (i * 97) % 1000;
+        BStream stream(65536);
+        X224::DT_TPDU_Send(stream, payload_len);
+        for (size_t k = 0; k < payload_len; k++){
+            stream.out_uint8(i + k);
+        }
+        stream.mark_end();
+        BOOST_CHECK_EQUAL((ssize_t)stream.size(), write(sck, stream.get_data(), stream.size()));
+    }
+}
+
+// Reads PDUs first to last - 1 the way front and mod_rdp do (header bytes,
+// then body)
+static void recv_pdus(SocketTransport & t, unsigned first, unsigned last)
+{
+    for (unsigned i = first; i < last; i++){
+        BStream stream(65536);
+        X224::RecvFactory f(t, stream);
+        X224::DT_TPDU_Recv x224(t, stream);
+        size_t payload_len = 20 + (i * 97) % 1000;
+        BOOST_CHECK_EQUAL(payload_len, x224.payload.size());
+        BOOST_CHECK_EQUAL((uint8_t)(i + payload_len - 1), x224.payload.get_data()[payload_len - 1]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestSocketTransportReadAhead)
+{
+    const unsigned nb_pdus = 50;
+    uint64_t nb_reads[2];
+
+    for (int read_ahead = 0; read_ahead < 2; read_ahead++){
+        int sv[2];
+        BOOST_CHECK_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+        send_pdus(sv[0], nb_pdus);
+
+        SocketTransport t("Reader", sv[1], "", 0, 0);
+        if (!read_ahead){
+            t.read_ahead = 0;
+        }
+        recv_pdus(t, 0, 1);
+        BOOST_CHECK_EQUAL(read_ahead != 0, t.has_pending_data());
+        recv_pdus(t, 1, nb_pdus);
+        BOOST_CHECK(!t.has_pending_data());
+        nb_reads[read_ahead] = t.nb_reads;
+        close(sv[0]);
+    }
+
+    BOOST_TEST_MESSAGE("reads per PDU without read-ahead: " << double(nb_reads[0]) / nb_pdus
+                    << ", with read-ahead: " << double(nb_reads[1]) / nb_pdus);
+    // tpkt version, tpkt header, tpdu header and body
+    BOOST_CHECK_EQUAL(4u * nb_pdus, nb_reads[0]);
+    // every read returns up to READ_AHEAD_SIZE bytes already sent
+    BOOST_CHECK(nb_reads[1] <= 4);
+}
+
+// Reads nb small PDUs written by TestSocketTransportBatch
+static void recv_pdus_small(SocketTransport & t, unsigned nb)
+{
+    for (unsigned i = 0; i < nb; i++){
+        BStream stream(65536);
+        X224::RecvFactory f(t, stream);
+        X224::DT_TPDU_Recv x224(t, stream);
+        size_t payload_len = 20 + i % 30;
+        BOOST_CHECK_EQUAL(payload_len, x224.payload.size());
+        BOOST_CHECK_EQUAL((uint8_t)(i + payload_len - 1), x224.payload.get_data()[payload_len - 1]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestSocketTransportBatch)
+{
+    const unsigned nb_pdus = 100;
+    uint64_t nb_writes[2];
+
+    for (int batch = 0; batch < 2; batch++){
+        int sv[2];
+        BOOST_CHECK_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+        SocketTransport t("Writer", sv[0], "", 0, 0);
+        if (batch){
+            t.begin_batch();
+        }
+        for (unsigned i = 0; i < nb_pdus; i++){
+            // small orders PDU
+            size_t payload_len = 20 + i % 30;
+            BStream stream(65536);
+            X224::DT_TPDU_Send(stream, payload_len);
+            for (size_t k = 0; k < payload_len; k++){
+                stream.out_uint8(i + k);
+            }
+            stream.mark_end();
+            t.send(stream);
+        }
+        BOOST_CHECK_EQUAL(batch ? 0u : nb_pdus, t.nb_writes);
+        if (batch){
+            t.end_batch();
+        }
+        nb_writes[batch] = t.nb_writes;
+
+        SocketTransport r("Reader", sv[1], "", 0, 0);
+        recv_pdus_small(r, nb_pdus);
+        BOOST_CHECK_EQUAL(t.total_sent, r.total_received);
+    }
+
+    BOOST_TEST_MESSAGE("writes per PDU without batch: " << double(nb_writes[0]) / nb_pdus
+                    << ", with batch: " << double(nb_writes[1]) / nb_pdus);
+    BOOST_CHECK_EQUAL(nb_pdus, nb_writes[0]);
+    BOOST_CHECK_EQUAL(1u, nb_writes[1]);
+
+    // nested batches are written by outermost end_batch(), data is
+    // written before waiting for an answer
+    int sv[2];
+    BOOST_CHECK_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+    SocketTransport t("Writer", sv[0], "", 0, 0);
+    {
+        TransportBatch outer(t);
+        {
+            TransportBatch inner(t);
+            t.send("ping", 4);
+        }
+        BOOST_CHECK_EQUAL(0u, t.nb_writes);
+        BOOST_CHECK_EQUAL(4, write(sv[1], "pong", 4));
+        char answer[4];
+        char * p = answer;
+        t.recv(&p, 4);
+        BOOST_CHECK_EQUAL(1u, t.nb_writes);
+    }
+    BOOST_CHECK_EQUAL(1u, t.nb_writes);
+    char ping[4];
+    BOOST_CHECK_EQUAL(4, read(sv[1], ping, 4));
+    BOOST_CHECK_EQUAL(0, memcmp(ping, "ping", 4));
+    close(sv[1]);
+}
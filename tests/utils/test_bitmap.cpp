@@ -4061,3 +4061,71 @@ BOOST_AUTO_TEST_CASE(TestBitmapOpenFiles) {
         BOOST_CHECK_EQUAL((uint32_t)0, (uint32_t)e.id);
     }
 }
+
+BOOST_AUTO_TEST_CASE(TestBitmapFingerprint)
+{
+    BGRPalette palette332;
+    init_palette332(palette332);
+
+    uint8_t data[16 * 16 * 3];
+    for (size_t i = 0 ; i < sizeof(data) ; i++){
+        data[i] = i * 7;
+    }
+    Bitmap bmp1(24, &palette332, 16, 16, data, sizeof(data));
+    Bitmap bmp2(24, &palette332, 16, 16, data, sizeof(data));
+    data[sizeof(data) - 1] ^= 1;
+    Bitmap bmp3(24, &palette332, 16, 16, data, sizeof(data));
+
+    uint8_t sha1[20];
+    uint8_t sig[20];
+    bmp1.compute_sha1(sha1);
+    bmp1.compute_fingerprint(sig, BITMAP_FINGERPRINT_SHA1);
+    BOOST_CHECK(0 == memcmp(sha1, sig, 20));
+
+    uint8_t sig1[20];
+    uint8_t sig2[20];
+    uint8_t sig3[20];
+    bmp1.compute_fingerprint(sig1, BITMAP_FINGERPRINT_FAST);
+    bmp2.compute_fingerprint(sig2, BITMAP_FINGERPRINT_FAST);
+    bmp3.compute_fingerprint(sig3, BITMAP_FINGERPRINT_FAST);
+    BOOST_CHECK(0 == memcmp(sig1, sig2, 20));
+    BOOST_CHECK(0 != memcmp(sig1, sig3, 20));
+    BOOST_CHECK(0 != memcmp(sig1, sha1, 20));
+}
+
+BOOST_AUTO_TEST_CASE(TestBitmapView)
+{
+    BGRPalette palette332;
+    init_palette332(palette332);
+
+    uint8_t data[24 * 16 * 3];
+    for (size_t i = 0 ; i < sizeof(data) ; i++){
+        data[i] = (i / 5) * 3;
+    }
+    const Bitmap bmp(24, &palette332, 24, 16, data, sizeof(data));
+
+    // a view on the whole bitmap compresses exactly like the bitmap
+    BStream out1(65536);
+    bmp.compress(out1);
+    BStream out2(65536);
+    Bitmap::compress(bmp.view(), out2);
+    BOOST_CHECK_EQUAL(out1.get_offset(), out2.get_offset());
+    BOOST_CHECK(0 == memcmp(out1.get_data(), out2.get_data(), out1.get_offset()));
+
+    // a copy of a sub view is the same as a copy of the sub rectangle
+    const Rect r(3, 2, 13, 9);
+    const Bitmap copy(bmp, r);
+    const Bitmap view_copy(24, bmp.view(r));
+    BOOST_CHECK_EQUAL(copy.cx, view_copy.cx);
+    BOOST_CHECK_EQUAL(copy.cy, view_copy.cy);
+    BOOST_CHECK_EQUAL(copy.bmp_size, view_copy.bmp_size);
+    BOOST_CHECK(0 == memcmp(copy.data(), view_copy.data(), copy.bmp_size));
+
+    // and the sub view (not packed) compresses like the copy
+    BStream out3(65536);
+    copy.compress(out3);
+    BStream out4(65536);
+    Bitmap::compress(bmp.view(r), out4);
+    BOOST_CHECK_EQUAL(out3.get_offset(), out4.get_offset());
+    BOOST_CHECK(0 == memcmp(out3.get_data(), out4.get_data(), out3.get_offset()));
+}
@@ -33,6 +33,7 @@
 
 #include <errno.h>
 #include <algorithm>
+#include <vector>
 #include "ssl_calls.hpp"
 #include "png.hpp"
 #include "RDP/RDPDrawable.hpp"
@@ -863,3 +864,182 @@ BOOST_AUTO_TEST_CASE(TestBgr2RGB)
     }
     //dump_png("./testBGR2RGB", gd.drawable);
 }
+
+BOOST_AUTO_TEST_CASE(TestDirtyTiles)
+{
+    uint16_t width = 200;
+    uint16_t height = 100;
+    Rect screen_rect(0, 0, width, height);
+    RDPDrawable gd(width, height);
+
+    // 64x64 tiles, last column and row are smaller
+    BOOST_CHECK_EQUAL(4, gd.drawable.dirty_tiles_x);
+    BOOST_CHECK_EQUAL(2, gd.drawable.dirty_tiles_y);
+    BOOST_CHECK(Rect(192, 64, 8, 36).equal(gd.drawable.tile_rect(3, 1)));
+
+    uint64_t count = gd.drawable.change_count;
+    BOOST_CHECK(!gd.drawable.changed_since(count));
+
+    gd.draw(RDPOpaqueRect(Rect(70, 10, 10, 10), 0xFF0000), screen_rect);
+    BOOST_CHECK(gd.drawable.changed_since(count));
+    BOOST_CHECK(gd.drawable.tile_changed_since(1, 0, count));
+    BOOST_CHECK(!gd.drawable.tile_changed_since(0, 0, count));
+    BOOST_CHECK(!gd.drawable.tile_changed_since(1, 1, count));
+    BOOST_CHECK(gd.drawable.changed_since(Rect(0, 0, 65, 5), count));
+    BOOST_CHECK(!gd.drawable.changed_since(Rect(0, 0, 64, 100), count));
+
+    // orders are clipped
+    count = gd.drawable.change_count;
+    gd.draw(RDPOpaqueRect(Rect(150, 80, 100, 100), 0x00FF00), Rect(0, 0, 190, 100));
+    BOOST_CHECK(gd.drawable.tile_changed_since(2, 1, count));
+    BOOST_CHECK(!gd.drawable.tile_changed_since(3, 1, count));
+    BOOST_CHECK(!gd.drawable.tile_changed_since(1, 0, count));
+
+    // nothing drawn
+    count = gd.drawable.change_count;
+    gd.draw(RDPOpaqueRect(Rect(300, 300, 10, 10), 0x00FF00), screen_rect);
+    BOOST_CHECK(!gd.drawable.changed_since(count));
+}
+
+// ROP3 evaluated bit by bit: bit (P << 2 | S << 1 | D) of rop is the result
+static uint8_t rop3_reference(uint8_t rop, uint8_t d, uint8_t s, uint8_t p)
+{
+    uint8_t res = 0;
+    for (unsigned bit = 0; bit < 8; bit++){
+        const unsigned index = (((p >> bit) & 1) << 2) | (((s >> bit) & 1) << 1) | ((d >> bit) & 1);
+        res |= ((rop >> index) & 1) << bit;
+    }
+    return res;
+}
+
+static void fill_random(Drawable & d, uint32_t seed)
+{
+    for (size_t i = 0; i < d.pix_len; i++){
+        seed = seed * 1103515245 + 12345;
+        d.data[i] = seed >> 16;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestDrawableRopKernels)
+{
+    const int w = 100;
+    const int h = 40;
+    Drawable d(w, h);
+    std::vector<uint8_t> expected(w * h * 3);
+    std::vector<uint8_t> before(w * h * 3);
+
+    // widths around vector and pattern sizes
+    const Rect rects[] = {
+        Rect(0, 0, 1, 1), Rect(3, 2, 5, 3), Rect(1, 1, 16, 4), Rect(7, 3, 17, 5),
+        Rect(10, 5, 33, 7), Rect(0, 0, 100, 40), Rect(31, 9, 64, 20)
+    };
+    const uint8_t pat_rops[] = { 0x00, 0x05, 0x0F, 0x50, 0x55, 0x5A, 0x5F, 0xA0, 0xA5, 0xAF, 0xF0, 0xF5, 0xFA, 0xFF };
+    // 0x11 left out: Op_0x11 computes SDna, not DSon, and existing
+    // signatures depend on it
+    const uint8_t scr_rops[] = { 0x00, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF };
+    const int deltas[][2] = { {0, 0}, {1, 0}, {-1, 0}, {7, 0}, {-7, 0}, {0, 1}, {0, -1}, {5, -3}, {-6, 2} };
+    const uint32_t color = 0x123456;
+
+    for (size_t r = 0; r < sizeof(rects) / sizeof(rects[0]); r++){
+        const Rect & rect = rects[r];
+
+        for (size_t i = 0; i < sizeof(pat_rops); i++){
+            fill_random(d, r * 100 + i);
+            memcpy(&expected[0], d.data, d.pix_len);
+            for (int y = rect.y; y < rect.y + rect.cy; y++){
+                for (int x = rect.x; x < rect.x + rect.cx; x++){
+                    for (int b = 0; b < 3; b++){
+                        uint8_t & px = expected[(y * w + x) * 3 + b];
+                        px = rop3_reference(pat_rops[i], px, 0, color >> (8 * b));
+                    }
+                }
+            }
+            d.patblt(rect, pat_rops[i], color);
+            BOOST_CHECK_MESSAGE(0 == memcmp(&expected[0], d.data, d.pix_len),
+                "patblt rop=" << int(pat_rops[i]) << " rect=" << r);
+        }
+
+        for (size_t i = 0; i < sizeof(scr_rops); i++){
+            for (size_t k = 0; k < sizeof(deltas) / sizeof(deltas[0]); k++){
+                const Rect srect = rect.offset(deltas[k][0], deltas[k][1]);
+                if (!srect.intersect(Rect(0, 0, w, h)).equal(srect)){
+                    continue;
+                }
+                fill_random(d, r * 1000 + i * 10 + k);
+                memcpy(&before[0], d.data, d.pix_len);
+                memcpy(&expected[0], d.data, d.pix_len);
+                for (int y = 0; y < rect.cy; y++){
+                    for (int x = 0; x < rect.cx * 3; x++){
+                        uint8_t & px = expected[((rect.y + y) * w + rect.x) * 3 + x];
+                        const uint8_t s = before[((srect.y + y) * w + srect.x) * 3 + x];
+                        px = rop3_reference(scr_rops[i], px, s, 0);
+                    }
+                }
+                d.scrblt(srect.x, srect.y, rect, scr_rops[i]);
+                BOOST_CHECK_MESSAGE(0 == memcmp(&expected[0], d.data, d.pix_len),
+                    "scrblt rop=" << int(scr_rops[i]) << " rect=" << r << " delta=" << k);
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestDrawableMemBltKernels)
+{
+    const int w = 100;
+    const int h = 40;
+    Drawable d(w, h);
+    std::vector<uint8_t> expected(w * h * 3);
+
+    BGRPalette palette;
+    for (unsigned i = 0; i < 256; i++){
+        palette[i] = (i * 0x010203) & 0xFFFFFF;
+    }
+    const uint8_t bpps[] = { 8, 15, 16, 24, 32 };
+    const uint8_t mem_rops[] = { 0x22, 0x66, 0x88, 0xBB, 0xEE };
+    const Rect rect(5, 3, 70, 30);
+    const uint16_t srcx = 3;
+    const uint16_t srcy = 2;
+
+    for (size_t k = 0; k < sizeof(bpps); k++){
+        const uint8_t Bpp = nbbytes(bpps[k]);
+        std::vector<uint8_t> raw(80 * 40 * Bpp);
+        for (size_t i = 0; i < raw.size(); i++){
+            raw[i] = (i * 7 + k) ^ (i >> 5);
+        }
+        Bitmap bmp(bpps[k], &palette, 80, 40, &raw[0], raw.size());
+        const BitmapView view = bmp.view();
+
+        for (int bgr = 0; bgr < 2; bgr++){
+            for (size_t i = 0; i <= sizeof(mem_rops); i++){
+                const uint8_t rop = (i < sizeof(mem_rops)) ? mem_rops[i] : 0xCC;
+                fill_random(d, k * 100 + i);
+                memcpy(&expected[0], d.data, d.pix_len);
+                for (int y = 0; y < rect.cy; y++){
+                    const uint8_t * src = view.row(srcy + y) + srcx * Bpp;
+                    for (int x = 0; x < rect.cx; x++, src += Bpp){
+                        uint32_t px = 0;
+                        for (int b = Bpp - 1; b >= 0; b--){
+                            px = (px << 8) | src[b];
+                        }
+                        uint32_t c = color_decode(px, bpps[k], palette);
+                        if (bgr){
+                            c = ((c << 16) & 0xFF0000) | (c & 0xFF00) | ((c >> 16) & 0xFF);
+                        }
+                        for (int b = 0; b < 3; b++){
+                            uint8_t & t = expected[((rect.y + y) * w + rect.x + x) * 3 + b];
+                            t = rop3_reference(rop, t, c >> (8 * b), 0);
+                        }
+                    }
+                }
+                if (rop == 0xCC){
+                    d.mem_blt(rect, view, srcx, srcy, 0, bgr);
+                }
+                else {
+                    d.mem_blt_ex(rect, view, srcx, srcy, rop, bgr);
+                }
+                BOOST_CHECK_MESSAGE(0 == memcmp(&expected[0], d.data, d.pix_len),
+                    "memblt rop=" << int(rop) << " bpp=" << int(bpps[k]) << " bgr=" << bgr);
+            }
+        }
+    }
+}
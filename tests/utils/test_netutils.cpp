@@ -27,7 +27,37 @@
 #define LOGNULL
 #include "log.hpp"
 
+#include "netutils.hpp"
+
 
 BOOST_AUTO_TEST_CASE(TestXXX)
 {
 }
+
+BOOST_AUTO_TEST_CASE(TestSendRecvFd)
+{
+    int sv[2];
+    BOOST_CHECK_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+    int pipefd[2];
+    BOOST_CHECK_EQUAL(0, pipe(pipefd));
+
+    BOOST_CHECK(send_fd(sv[0], pipefd[1]));
+    int fd = recv_fd(sv[1]);
+    BOOST_CHECK(fd >= 0);
+    BOOST_CHECK(fd != pipefd[1]);
+
+    // received descriptor is another reference to the same pipe
+    close(pipefd[1]);
+    BOOST_CHECK_EQUAL(5, write(fd, "hello", 5));
+    char buffer[5];
+    BOOST_CHECK_EQUAL(5, read(pipefd[0], buffer, 5));
+    BOOST_CHECK_EQUAL(0, memcmp(buffer, "hello", 5));
+    close(fd);
+    close(pipefd[0]);
+
+    // peer gone
+    close(sv[0]);
+    BOOST_CHECK_EQUAL(-1, recv_fd(sv[1]));
+    BOOST_CHECK(!send_fd(sv[1], 0));
+    close(sv[1]);
+}
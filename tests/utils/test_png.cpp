@@ -37,8 +37,11 @@
 #include <png.h>
 #include <stdint.h>
 
+#include <vector>
+
 #include "png.hpp"
 #include "rio/rio.h"
+#include "testtransport.hpp"
 
 BOOST_AUTO_TEST_CASE(TestCreateFrenchFlagPngFile)
 {
@@ -165,3 +168,92 @@ BOOST_AUTO_TEST_CASE(TestCreateFrenchFlagPngFile)
     // ----------------------------------------------------------------------
 
 }
+
+BOOST_AUTO_TEST_CASE(TestSwapBgr)
+{
+    uint8_t src[64 * 3];
+    for (size_t i = 0; i < sizeof(src); i++){
+        src[i] = static_cast<uint8_t>(i * 7 + 3);
+    }
+
+    // every tail length of simd kernel, in place too
+    for (size_t npixels = 0; npixels <= 64; npixels++){
+        uint8_t expected[64 * 3 + 1];
+        uint8_t got[64 * 3 + 1];
+        memset(expected, 0xAA, sizeof(expected));
+        memset(got, 0xAA, sizeof(got));
+        png_swap_bgr_scalar(expected, src, npixels);
+        png_swap_bgr(got, src, npixels);
+        BOOST_CHECK(0 == memcmp(expected, got, sizeof(got)));
+
+        memcpy(got, src, npixels * 3);
+        png_swap_bgr(got, got, npixels);
+        BOOST_CHECK(0 == memcmp(expected, got, npixels * 3));
+    }
+
+    uint8_t pixel[3];
+    png_swap_bgr(pixel, src, 1);
+    BOOST_CHECK_EQUAL(src[2], pixel[0]);
+    BOOST_CHECK_EQUAL(src[1], pixel[1]);
+    BOOST_CHECK_EQUAL(src[0], pixel[2]);
+}
+
+class MemoryTransport : public Transport {
+public:
+    std::vector<uint8_t> data;
+
+    using Transport::recv;
+    virtual void recv(char ** pbuffer, size_t len) throw (Error) {
+        throw Error(ERR_TRANSPORT_OUTPUT_ONLY_USED_FOR_SEND);
+    }
+
+    using Transport::send;
+    virtual void send(const char * const buffer, size_t len) throw (Error) {
+        this->data.insert(this->data.end(), buffer, buffer + len);
+    }
+
+    virtual void seek(int64_t offset, int whence) throw (Error) { throw Error(ERR_TRANSPORT_SEEK_NOT_AVAILABLE); }
+};
+
+BOOST_AUTO_TEST_CASE(TestDumpPng24Params)
+{
+    // odd width, rows with padding
+    const size_t width = 37;
+    const size_t height = 23;
+    const size_t rowsize = width * 3 + 5;
+    std::vector<uint8_t> image(rowsize * height);
+    for (size_t y = 0; y < height; y++){
+        for (size_t x = 0; x < width * 3; x++){
+            image[y * rowsize + x] = static_cast<uint8_t>((x * x + y * 13) ^ (x > 50 ? y : 0));
+        }
+    }
+
+    const unsigned filters[] = {
+        PngParams::FILTER_ADAPTIVE, PngParams::FILTER_NONE, PngParams::FILTER_SUB,
+        PngParams::FILTER_UP, PngParams::FILTER_PAETH
+    };
+    for (size_t f = 0; f < sizeof(filters) / sizeof(filters[0]); f++){
+        for (int level = 0; level <= 9; level += 9){
+            for (int bgr = 0; bgr <= 1; bgr++){
+                MemoryTransport out;
+                transport_dump_png24(&out, &image[0], width, height, rowsize, bgr, PngParams(level, filters[f]));
+                BOOST_CHECK(out.data.size() > 0);
+
+                GeneratorTransport in(reinterpret_cast<const char *>(&out.data[0]), out.data.size());
+                std::vector<uint8_t> decoded(width * 3 * height);
+                transport_read_png24(&in, &decoded[0], width, height, width * 3);
+
+                for (size_t y = 0; y < height; y++){
+                    uint8_t expected[width * 3];
+                    if (bgr){
+                        png_swap_bgr_scalar(expected, &image[y * rowsize], width);
+                    }
+                    else {
+                        memcpy(expected, &image[y * rowsize], width * 3);
+                    }
+                    BOOST_CHECK(0 == memcmp(expected, &decoded[y * width * 3], width * 3));
+                }
+            }
+        }
+    }
+}
@@ -29,6 +29,8 @@
 class InByMetaSequenceTransport : public Transport {
 public:
     char path[1024];
+    char prefix[1024];
+    char extension[128];
     unsigned begin_chunk_time;
     unsigned end_chunk_time;
     unsigned chunk_num;
@@ -40,6 +42,8 @@ public:
     : Transport()
     {
         memset(this->path, 0, sizeof(path));
+        snprintf(this->prefix, sizeof(this->prefix), "%s", filename);
+        snprintf(this->extension, sizeof(this->extension), "%s", extension);
         this->begin_chunk_time = 0;
         this->end_chunk_time = 0;
         this->chunk_num = 0;
@@ -67,21 +71,98 @@ public:
 
     void next_chunk_info()
     {
-        {
-            timeval tv_begin = {};
-            timeval tv_end = {};
-            RIO_ERROR status = sq_get_chunk_info(this->seq, &this->chunk_num, this->path, sizeof(this->path), &tv_begin, &tv_end);
-            if (status != RIO_ERROR_OK){
-                throw Error(ERR_TRANSPORT_READ_FAILED);
-            }
-            this->begin_chunk_time = tv_begin.tv_sec;
-            this->end_chunk_time = tv_end.tv_sec;
-        }
+        this->chunk_info();
         // if some error occurs calling sq_next
         // it will be took care of when opening next chunk, not now
         sq_next(this->seq);
     }
 
+    // Info of current chunk, stays on current chunk
+    void chunk_info()
+    {
+        timeval tv_begin = {};
+        timeval tv_end = {};
+        RIO_ERROR status = sq_get_chunk_info(this->seq, &this->chunk_num, this->path, sizeof(this->path), &tv_begin, &tv_end);
+        if (status != RIO_ERROR_OK){
+            throw Error(ERR_TRANSPORT_READ_FAILED);
+        }
+        this->begin_chunk_time = tv_begin.tv_sec;
+        this->end_chunk_time = tv_end.tv_sec;
+    }
+
+    // Lines of mwrm are the index of breakpoints : every chunk starts with
+    // one and times of chunk are known without reading it.
+    // If tv is after the last chunk the transport is left at end of data
+    // (or at the last chunk can_start accepts).
+    virtual bool skip_units_before(const timeval & tv, unit_start_fn can_start = NULL)
+    {
+        // chunks are numbered from 1
+        unsigned target = can_start ? this->last_start_chunk(tv, can_start) : 0;
+        bool skipped = false;
+        try {
+            for (this->chunk_info()
+                ; target ? this->chunk_num < target : this->end_chunk_time <= tv.tv_sec
+                ; this->chunk_info()){
+                sq_next(this->seq);
+                skipped = true;
+            }
+        }
+        catch (const Error &){
+            // no more chunk, next recv will tell
+        }
+        return skipped;
+    }
+
+    // Number of the last chunk up to the one containing tv whose first bytes
+    // are accepted by can_start (1 if none is), read from an index of its own
+    // as current chunk can not go backward.
+    unsigned last_start_chunk(const timeval & tv, unit_start_fn can_start)
+    {
+        RIO_ERROR status = RIO_ERROR_OK;
+        SQ * index = sq_new_inmeta(&status, this->prefix, this->extension);
+        if (status != RIO_ERROR_OK){
+            throw Error(ERR_TRANSPORT_OPEN_FAILED);
+        }
+        unsigned start_chunk = 1;
+        unsigned chunk = 0;
+        char path[1024];
+        timeval tv_begin = {};
+        timeval tv_end = {};
+        while (sq_get_chunk_info(index, &chunk, path, sizeof(path), &tv_begin, &tv_end) == RIO_ERROR_OK){
+            // enough for a chunk header and a META chunk
+            uint8_t data[64];
+            size_t len = 0;
+            status = RIO_ERROR_OK;
+            RIO * unit = sq_get_trans(index, &status);
+            while (unit && (len < sizeof(data))){
+                ssize_t res = rio_recv(unit, data + len, sizeof(data) - len);
+                if (res <= 0){
+                    break;
+                }
+                len += res;
+            }
+            if (can_start(data, len)){
+                start_chunk = chunk;
+            }
+            if (tv_end.tv_sec > tv.tv_sec){
+                break;
+            }
+            sq_next(index);
+        }
+        sq_delete(index);
+        return start_chunk;
+    }
+
+    // Makes chunk num (numbered from 1, see chunk_info()) the current one,
+    // chunks before it are not read. Must only be called between two chunks
+    // of data.
+    void skip_to_chunk(unsigned num)
+    {
+        for (this->chunk_info(); this->chunk_num < num; this->chunk_info()){
+            sq_next(this->seq);
+        }
+    }
+
     using Transport::recv;
     virtual void recv(char ** pbuffer, size_t len) throw (Error)
     {
@@ -113,6 +194,8 @@ public:
 class CryptoInByMetaSequenceTransport : public Transport {
 public:
     char path[1024];
+    char prefix[1024];
+    char extension[128];
     unsigned begin_chunk_time;
     unsigned end_chunk_time;
     unsigned chunk_num;
@@ -124,6 +207,8 @@ public:
     : Transport()
     {
         memset(this->path, 0, sizeof(path));
+        snprintf(this->prefix, sizeof(this->prefix), "%s", filename);
+        snprintf(this->extension, sizeof(this->extension), "%s", extension);
         this->begin_chunk_time = 0;
         this->end_chunk_time = 0;
         this->chunk_num = 0;
@@ -146,21 +231,98 @@ public:
 
     void next_chunk_info()
     {
-        {
-            timeval tv_begin = {};
-            timeval tv_end = {};
-            RIO_ERROR status = sq_get_chunk_info(this->seq, &this->chunk_num, this->path, sizeof(this->path), &tv_begin, &tv_end);
-            if (status != RIO_ERROR_OK){
-                throw Error(ERR_TRANSPORT_READ_FAILED);
-            }
-            this->begin_chunk_time = tv_begin.tv_sec;
-            this->end_chunk_time = tv_end.tv_sec;
-        }
+        this->chunk_info();
         // if some error occurs calling sq_next
         // it will be took care of when opening next chunk, not now
         sq_next(this->seq);
     }
 
+    // Info of current chunk, stays on current chunk
+    void chunk_info()
+    {
+        timeval tv_begin = {};
+        timeval tv_end = {};
+        RIO_ERROR status = sq_get_chunk_info(this->seq, &this->chunk_num, this->path, sizeof(this->path), &tv_begin, &tv_end);
+        if (status != RIO_ERROR_OK){
+            throw Error(ERR_TRANSPORT_READ_FAILED);
+        }
+        this->begin_chunk_time = tv_begin.tv_sec;
+        this->end_chunk_time = tv_end.tv_sec;
+    }
+
+    // Lines of mwrm are the index of breakpoints : every chunk starts with
+    // one and times of chunk are known without reading it.
+    // If tv is after the last chunk the transport is left at end of data
+    // (or at the last chunk can_start accepts).
+    virtual bool skip_units_before(const timeval & tv, unit_start_fn can_start = NULL)
+    {
+        // chunks are numbered from 1
+        unsigned target = can_start ? this->last_start_chunk(tv, can_start) : 0;
+        bool skipped = false;
+        try {
+            for (this->chunk_info()
+                ; target ? this->chunk_num < target : this->end_chunk_time <= tv.tv_sec
+                ; this->chunk_info()){
+                sq_next(this->seq);
+                skipped = true;
+            }
+        }
+        catch (const Error &){
+            // no more chunk, next recv will tell
+        }
+        return skipped;
+    }
+
+    // Number of the last chunk up to the one containing tv whose first bytes
+    // are accepted by can_start (1 if none is), read from an index of its own
+    // as current chunk can not go backward.
+    unsigned last_start_chunk(const timeval & tv, unit_start_fn can_start)
+    {
+        RIO_ERROR status = RIO_ERROR_OK;
+        SQ * index = sq_new_cryptoinmeta(&status, this->prefix, this->extension);
+        if (status != RIO_ERROR_OK){
+            throw Error(ERR_TRANSPORT_OPEN_FAILED);
+        }
+        unsigned start_chunk = 1;
+        unsigned chunk = 0;
+        char path[1024];
+        timeval tv_begin = {};
+        timeval tv_end = {};
+        while (sq_get_chunk_info(index, &chunk, path, sizeof(path), &tv_begin, &tv_end) == RIO_ERROR_OK){
+            // enough for a chunk header and a META chunk
+            uint8_t data[64];
+            size_t len = 0;
+            status = RIO_ERROR_OK;
+            RIO * unit = sq_get_trans(index, &status);
+            while (unit && (len < sizeof(data))){
+                ssize_t res = rio_recv(unit, data + len, sizeof(data) - len);
+                if (res <= 0){
+                    break;
+                }
+                len += res;
+            }
+            if (can_start(data, len)){
+                start_chunk = chunk;
+            }
+            if (tv_end.tv_sec > tv.tv_sec){
+                break;
+            }
+            sq_next(index);
+        }
+        sq_delete(index);
+        return start_chunk;
+    }
+
+    // Makes chunk num (numbered from 1, see chunk_info()) the current one,
+    // chunks before it are not read. Must only be called between two chunks
+    // of data.
+    void skip_to_chunk(unsigned num)
+    {
+        for (this->chunk_info(); this->chunk_num < num; this->chunk_info()){
+            sq_next(this->seq);
+        }
+    }
+
     using Transport::recv;
     virtual void recv(char ** pbuffer, size_t len) throw (Error)
     {
@@ -143,6 +143,7 @@ extern "C" {
     RIO_ERROR rio_sign(RIO * rt, unsigned char * buf, size_t size, size_t * len);
 
     ssize_t rio_recv(RIO * rt, void * data, size_t len);
+    ssize_t rio_recv_some(RIO * rt, void * data, size_t min_len, size_t max_len);
     ssize_t rio_send(RIO * rt, const void * data, size_t len);
     RIO_ERROR rio_seek(RIO * rt, int64_t offset, int whence);
     RIO_ERROR rio_get_status(RIO * rt);
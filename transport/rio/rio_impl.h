@@ -1204,6 +1204,34 @@ ssize_t rio_recv(RIO * rt, void * data, size_t len)
     return -rt->err;
 }
 
+/* Receive at least min_len bytes and at most max_len bytes: sockets return
+   in one call whatever is already available up to max_len (read-ahead),
+   other transports receive exactly min_len bytes.
+*/
+ssize_t rio_recv_some(RIO * rt, void * data, size_t min_len, size_t max_len)
+{
+    if (rt->err != RIO_ERROR_OK){
+        if (rt->err == RIO_ERROR_EOF){
+            return 0;
+        }
+        return -rt->err;
+    }
+    switch (rt->rt_type){
+    case RIO_TYPE_SOCKET:{
+        ssize_t res = rio_m_RIOSocket_recv_some(&(rt->u.socket), data, min_len, max_len);
+        if (res < 0){ rt->err = (RIO_ERROR)-res; }
+        return res;
+    }
+    case RIO_TYPE_SOCKET_TLS:{
+        ssize_t res = rio_m_RIOSocketTLS_recv_some(&(rt->u.socket_tls), data, min_len, max_len);
+        if (res < 0){ rt->err = (RIO_ERROR)-res; }
+        return res;
+    }
+    default:
+        return rio_recv(rt, data, min_len);
+    }
+}
+
 ssize_t rio_send(RIO * rt, const void * data, size_t len)
 {
     if (rt->err != RIO_ERROR_OK){ return -rt->err; }
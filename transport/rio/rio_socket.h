@@ -56,21 +56,23 @@ extern "C" {
         return RIO_ERROR_OK;
     }
 
-    /* This method receive len bytes of data into buffer
-       target buffer *MUST* be large enough to contains len data
+    /* This method receive at least min_len bytes and at most max_len bytes
+       of data into buffer, every recv asks for max_len so that data already
+       available on socket is returned by the same call.
+       target buffer *MUST* be large enough to contains max_len data
        returns len actually received (may be 0),
        or negative value to signal some error.
        If an error occurs after reading some data, the return buffer
        has been changed but an error is returned anyway
        and an error returned on subsequent call.
     */
-    inline ssize_t rio_m_RIOSocket_recv(RIOSocket * self, void * data, size_t len)
+    inline ssize_t rio_m_RIOSocket_recv_some(RIOSocket * self, void * data, size_t min_len, size_t max_len)
     {
         char * pbuffer = (char*)data;
-        size_t remaining_len = len;
+        size_t received = 0;
 
-        while (remaining_len > 0) {
-            ssize_t res = ::recv(self->sck, pbuffer, remaining_len, 0);
+        while (received < min_len) {
+            ssize_t res = ::recv(self->sck, pbuffer + received, max_len - received, 0);
             switch (res) {
                 case -1: /* error, maybe EAGAIN */
                     if (try_again(errno)) {
@@ -81,8 +83,8 @@ extern "C" {
                         select(self->sck + 1, &fds, NULL, NULL, &time);
                         continue;
                     }
-                    if (len != remaining_len){
-                        return len - remaining_len;
+                    if (received){
+                        return received;
                     }
                     TODO("replace this with actual error management, EOF is not even an option for sockets");
                     rio_m_RIOSocket_destructor(self);
@@ -93,12 +95,24 @@ extern "C" {
                     rio_m_RIOSocket_destructor(self);
                     return -RIO_ERROR_EOF;
                 default: /* some data received */
-                    pbuffer += res;
-                    remaining_len -= res;
+                    received += res;
                 break;
             }
         }
-        return len;
+        return received;
+    }
+
+    /* This method receive len bytes of data into buffer
+       target buffer *MUST* be large enough to contains len data
+       returns len actually received (may be 0),
+       or negative value to signal some error.
+       If an error occurs after reading some data, the return buffer
+       has been changed but an error is returned anyway
+       and an error returned on subsequent call.
+    */
+    inline ssize_t rio_m_RIOSocket_recv(RIOSocket * self, void * data, size_t len)
+    {
+        return rio_m_RIOSocket_recv_some(self, data, len, len);
     }
 
     /* This method send len bytes of data from buffer to current transport
@@ -57,17 +57,19 @@ extern "C" {
         return RIO_ERROR_OK;
     }
 
-    static inline ssize_t rio_m_RIOSocketTLS_recv(RIOSocketTLS * self, void * data, size_t len)
+    /* Receive at least min_len bytes and at most max_len bytes, SSL_read
+       returns at most the content of one TLS record.
+    */
+    static inline ssize_t rio_m_RIOSocketTLS_recv_some(RIOSocketTLS * self, void * data, size_t min_len, size_t max_len)
     {
         char * pbuffer = (char*)data;
-        size_t remaining_len = len;
-        while (remaining_len > 0) {
-            ssize_t rcvd = ::SSL_read(self->ssl, pbuffer, remaining_len);
+        size_t received = 0;
+        while (received < min_len) {
+            ssize_t rcvd = ::SSL_read(self->ssl, pbuffer + received, max_len - received);
             unsigned long error = SSL_get_error(self->ssl, rcvd);
             switch (error) {
                 case SSL_ERROR_NONE:
-                    pbuffer += rcvd;
-                    remaining_len -= rcvd;
+                    received += rcvd;
                     break;
 
                 case SSL_ERROR_WANT_READ:
@@ -91,11 +93,11 @@ extern "C" {
                     continue;
 
                 case SSL_ERROR_ZERO_RETURN:
-                    if (remaining_len - len){
+                    if (received){
                         LOG(LOG_WARNING, "TLS receive for %u bytes, ZERO RETURN got %u",
-                            (unsigned)len, (unsigned)(remaining_len - len));
+                            (unsigned)min_len, (unsigned)received);
                     }
-                    return remaining_len - len;
+                    return received;
                 default:
                 {
                     uint32_t errcount = 0;
@@ -115,7 +117,12 @@ extern "C" {
                 break;
             }
         }
-        return len;
+        return received;
+    }
+
+    static inline ssize_t rio_m_RIOSocketTLS_recv(RIOSocketTLS * self, void * data, size_t len)
+    {
+        return rio_m_RIOSocketTLS_recv_some(self, data, len, len);
     }
 
     static inline ssize_t rio_m_RIOSocketTLS_send(RIOSocketTLS * self, const void * data, size_t len)
@@ -23,6 +23,8 @@
 #ifndef _REDEMPTION_TRANSPORT_SOCKETTRANSPORT_HPP_
 #define _REDEMPTION_TRANSPORT_SOCKETTRANSPORT_HPP_
 
+#include <algorithm>
+
 #include "config.hpp"
 #include "transport.hpp"
 #include "rio/rio.h"
@@ -105,10 +107,32 @@ class SocketTransport : public Transport {
         SSL_CTX * allocated_ctx;
         SSL     * allocated_ssl;
 
+        // Read-ahead: recv() asks socket (or TLS layer) for up to read_ahead
+        // bytes at once and serves following reads (header, then body...)
+        // from read_buffer. 0 disables read-ahead.
+        enum { READ_AHEAD_SIZE = 16384 };
+        size_t  read_ahead;
+        size_t  read_begin;
+        size_t  read_end;
+        uint8_t read_buffer[READ_AHEAD_SIZE];
+
+        // Batch: between begin_batch() and end_batch() sent data is gathered
+        // in write_buffer (allocated on first use) and written at once.
+        enum { WRITE_BATCH_SIZE = 65536 };
+        unsigned  batch_level;
+        size_t    write_end;
+        uint8_t * write_buffer;
+
+        uint64_t nb_reads;  // number of reads on socket (or TLS layer)
+        uint64_t nb_writes; // number of writes on socket (or TLS layer)
+
     SocketTransport( const char * name, int sck, const char *ip_address, int port
                    , uint32_t verbose, redemption::string * error_message = 0)
         : Transport(), tls(false), name(name), verbose(verbose)
         , error_message(error_message), allocated_ctx(0), allocated_ssl(0)
+        , read_ahead(READ_AHEAD_SIZE), read_begin(0), read_end(0)
+        , batch_level(0), write_end(0), write_buffer(0)
+        , nb_reads(0), nb_writes(0)
     {
         RIO_ERROR res = rio_init_socket(&this->rio, sck);
         this->sck = sck;
@@ -123,6 +147,14 @@ class SocketTransport : public Transport {
     }
 
     virtual ~SocketTransport(){
+        // data still batched is sent before TLS layer is released
+        try {
+            this->flush();
+        }
+        catch (...) {
+        }
+        delete [] this->write_buffer;
+
         if (this->allocated_ssl) {
 //            SSL_shutdown(this->allocated_ssl);
             SSL_free(this->allocated_ssl);
@@ -137,8 +169,9 @@ class SocketTransport : public Transport {
 
         if (verbose) {
             LOG( LOG_INFO
-               , "%s (%d): total_received=%llu, total_sent=%llu"
-               , this->name, this->sck, this->total_received, this->total_sent);
+               , "%s (%d): total_received=%llu, total_sent=%llu, reads=%llu, writes=%llu"
+               , this->name, this->sck, this->total_received, this->total_sent
+               , this->nb_reads, this->nb_writes);
         }
     }
 
@@ -150,6 +183,8 @@ class SocketTransport : public Transport {
         }
         LOG(LOG_INFO, "RIO *::enable_server_tls() start");
 
+        this->flush();
+        this->check_no_data_before_tls();
         rio_clear(&this->rio);
 
         // SSL_CTX_new - create a new SSL_CTX object as framework for TLS/SSL enabled functions
@@ -435,6 +470,8 @@ class SocketTransport : public Transport {
         }
         LOG(LOG_INFO, "Client TLS start");
 
+        this->flush();
+        this->check_no_data_before_tls();
         rio_clear(&this->rio);
 
 
@@ -1068,7 +1105,25 @@ class SocketTransport : public Transport {
        return;
     }
 
+    // Bytes read ahead before TLS handshake would be handshake data lost for
+    // TLS layer, peer must wait for the end of negotiation before sending them
+    void check_no_data_before_tls() throw (Error)
+    {
+        if (this->read_end > this->read_begin) {
+            LOG(LOG_ERR, "Socket %s (%d) : %u bytes received before TLS handshake",
+                this->name, this->sck, (unsigned)(this->read_end - this->read_begin));
+            throw Error(ERR_TRANSPORT, 0);
+        }
+    }
+
     void disconnect(){
+        try {
+            this->flush();
+        }
+        catch (...) {
+        }
+        this->write_end = 0;
+        this->read_begin = this->read_end = 0;
         rio_clear(&this->rio);
         LOG(LOG_INFO, "Socket %s (%d) : closing connection\n", this->name, this->sck);
         TODO("add code to disconnect TLS if needed");
@@ -1102,14 +1157,51 @@ class SocketTransport : public Transport {
         }
         char * start = *pbuffer;
 
-        ssize_t res = rio_recv(&this->rio, *pbuffer, len);
-        if (res < 0){
-            throw Error(ERR_TRANSPORT_NO_MORE_DATA, 0);
+        size_t buffered = this->read_end - this->read_begin;
+        if (len > buffered) {
+            // peer may be waiting for batched data before answering
+            this->flush();
         }
-        *pbuffer += res;
+        if (len <= buffered) {
+            memcpy(*pbuffer, this->read_buffer + this->read_begin, len);
+            *pbuffer += len;
+            this->read_begin += len;
+        }
+        else {
+            memcpy(*pbuffer, this->read_buffer + this->read_begin, buffered);
+            *pbuffer += buffered;
+            this->read_begin = this->read_end = 0;
+            size_t remaining = len - buffered;
+
+            // large reads go directly to target buffer
+            if (remaining >= this->read_ahead) {
+                this->nb_reads++;
+                ssize_t res = rio_recv(&this->rio, *pbuffer, remaining);
+                if (res < 0){
+                    throw Error(ERR_TRANSPORT_NO_MORE_DATA, 0);
+                }
+                *pbuffer += res;
 
-        if (static_cast<size_t>(res) < len){
-            throw Error(ERR_TRANSPORT_NO_MORE_DATA, 0);
+                if (static_cast<size_t>(res) < remaining){
+                    throw Error(ERR_TRANSPORT_NO_MORE_DATA, 0);
+                }
+            }
+            else {
+                this->nb_reads++;
+                ssize_t res = rio_recv_some(&this->rio, this->read_buffer, remaining, this->read_ahead);
+                if (res < 0){
+                    throw Error(ERR_TRANSPORT_NO_MORE_DATA, 0);
+                }
+                size_t used = std::min<size_t>(res, remaining);
+                memcpy(*pbuffer, this->read_buffer, used);
+                *pbuffer += used;
+
+                if (used < remaining){
+                    throw Error(ERR_TRANSPORT_NO_MORE_DATA, 0);
+                }
+                this->read_begin = used;
+                this->read_end = res;
+            }
         }
 
         if (this->verbose & 0x100){
@@ -1134,6 +1226,60 @@ class SocketTransport : public Transport {
             LOG(LOG_INFO, "Sent dumped on %s (%u) %u bytes", this->name, this->sck, len);
         }
 
+        if (this->batch_level > 0) {
+            if (this->write_end + len > WRITE_BATCH_SIZE) {
+                this->flush();
+            }
+            if (len < WRITE_BATCH_SIZE) {
+                if (!this->write_buffer) {
+                    this->write_buffer = new uint8_t[WRITE_BATCH_SIZE];
+                }
+                memcpy(this->write_buffer + this->write_end, buffer, len);
+                this->write_end += len;
+            }
+            else {
+                this->send_now(buffer, len);
+            }
+        }
+        else {
+            this->send_now(buffer, len);
+        }
+
+        TODO("move that to base class : accounting_send(len)");
+        this->total_sent += len;
+        this->last_quantum_sent += len;
+    }
+
+    virtual void begin_batch()
+    {
+        this->batch_level++;
+    }
+
+    virtual void end_batch() throw (Error)
+    {
+        if (this->batch_level > 0) {
+            this->batch_level--;
+        }
+        if (this->batch_level == 0) {
+            this->flush();
+        }
+    }
+
+    // sends batched data
+    virtual void flush() throw (Error)
+    {
+        if (this->write_end > 0) {
+            size_t len = this->write_end;
+            this->write_end = 0;
+            this->send_now(reinterpret_cast<const char *>(this->write_buffer), len);
+        }
+    }
+
+private:
+    // one send() or SSL_write() call (or more for partial writes)
+    void send_now(const char * const buffer, size_t len) throw (Error)
+    {
+        this->nb_writes++;
         ssize_t res = rio_send(&this->rio, buffer, len);
         if (res < 0) {
             LOG(LOG_WARNING,
@@ -1144,12 +1290,10 @@ class SocketTransport : public Transport {
         if (res < (ssize_t)len) {
             throw Error(ERR_TRANSPORT_NO_MORE_DATA);
         }
-
-        TODO("move that to base class : accounting_send(len)");
-        this->total_sent += len;
-        this->last_quantum_sent += len;
     }
 
+public:
+
     virtual void seek(int64_t offset, int whence) throw (Error) { throw Error(ERR_TRANSPORT_SEEK_NOT_AVAILABLE); }
 
     virtual bool get_status()
@@ -1160,6 +1304,12 @@ class SocketTransport : public Transport {
     virtual int get_native_object() {
         return this->sck;
     }
+
+    virtual bool has_pending_data()
+    {
+        return (this->read_end > this->read_begin)
+            || (this->tls && this->allocated_ssl && SSL_pending(this->allocated_ssl) > 0);
+    }
 };
 
 #endif
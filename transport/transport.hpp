@@ -157,12 +157,77 @@ public:
         return true;
     }
 
+    // Tells from the first bytes of a unit if it can be read alone
+    typedef bool (*unit_start_fn)(const uint8_t * data, size_t len);
+
+    virtual bool skip_units_before(const timeval & tv, unit_start_fn can_start = NULL)
+    REDOC("Input transports splitted between units that can be read alone"
+          " (a wrm file of a sequence starts with a breakpoint) skip the units"
+          " ending before tv, the unit containing tv becomes the current one."
+          "When only some units can be read alone (can_start is given) the last one"
+          " up to the unit containing tv becomes the current one instead (the first"
+          " unit if none can)."
+          "Must only be called between two chunks of data."
+          "Returns true if some unit was skipped.")
+    {
+        return false;
+    }
+
     virtual void request_full_cleaning()
     {
         this->full_cleaning_requested = true;
     }
 
     virtual int get_native_object() { return -1; }
+
+    virtual void begin_batch()
+    REDOC("Until matching end_batch(), data sent may be gathered by transport"
+          " and written at once (one TCP segment or TLS record instead of one"
+          " per PDU). Calls can be nested, data is written by outermost end_batch().")
+    {
+    }
+
+    virtual void end_batch()
+    {
+    }
+
+    virtual bool has_pending_data()
+    REDOC("Transports reading ahead return true when data was already received"
+          " and will be returned by next recv() without waiting on native object.")
+    {
+        return false;
+    }
+};
+
+// Data sent on trans is batched until end() or TransportBatch destruction
+struct TransportBatch {
+    Transport & trans;
+    bool ended;
+
+    TransportBatch(Transport & trans) : trans(trans), ended(false)
+    {
+        this->trans.begin_batch();
+    }
+
+    // Writes batched data (outermost batch), write errors are thrown
+    void end()
+    {
+        this->ended = true;
+        this->trans.end_batch();
+    }
+
+    ~TransportBatch()
+    {
+        if (!this->ended) {
+            // left without end() on an exception: batch level is restored,
+            // the exception in flight is the one reported
+            try {
+                this->trans.end_batch();
+            }
+            catch (...) {
+            }
+        }
+    }
 };
 
 #endif
@@ -48,8 +48,76 @@
 #include "colors.hpp"
 #include "stream.hpp"
 #include "ssl_calls.hpp"
+#include "fasthash.hpp"
+#include "rlesimd.hpp"
 #include "rect.hpp"
 
+// How bitmap content is identified by bitmap caches.
+enum BitmapFingerprint {
+    // 128 bits non cryptographic hash followed by bitmap dimensions
+    BITMAP_FINGERPRINT_FAST,
+    // SHA1 of bitmap data
+    BITMAP_FINGERPRINT_SHA1
+};
+
+// Non owning view on the pixels of a bitmap, or of a part of it, used to send
+// tiles of a large bitmap without copying them first.
+// Like in Bitmap rows are stored bottom-up: data points to the first pixel of
+// the bottom row and line_size is the distance from a row to the row above
+// (negative for top-down buffers like VNC raw data). cx is not aligned, pixels
+// of an aligned row beyond cx are considered to be black.
+struct BitmapView {
+    const uint8_t * data;
+    ptrdiff_t line_size;
+    uint16_t cx;
+    uint16_t cy;
+    uint8_t original_bpp;
+    const BGRPalette * original_palette;
+
+    BitmapView(uint8_t bpp, const BGRPalette * palette, uint16_t cx, uint16_t cy, const uint8_t * data, ptrdiff_t line_size)
+        : data(data)
+        , line_size(line_size)
+        , cx(cx)
+        , cy(cy)
+        , original_bpp(bpp)
+        , original_palette(palette)
+    {
+    }
+
+    // view on a top-down raw buffer (VNC framebuffer updates)
+    static BitmapView from_top_down(uint8_t bpp, const BGRPalette * palette, uint16_t cx, uint16_t cy, const uint8_t * raw)
+    {
+        const ptrdiff_t row_size = cx * nbbytes(bpp);
+        return BitmapView(bpp, palette, cx, cy, raw + row_size * (cy - 1), -row_size);
+    }
+
+    // r is given top-down, as for Bitmap(const Bitmap & src_bmp, const Rect & r)
+    BitmapView sub_view(const Rect & r) const
+    {
+        return BitmapView(this->original_bpp, this->original_palette, r.cx, r.cy
+                         , this->row(r.y + r.cy - 1) + r.x * nbbytes(this->original_bpp)
+                         , this->line_size);
+    }
+
+    // y is counted from the top of the view
+    const uint8_t * row(unsigned y) const
+    {
+        return this->data + (static_cast<ptrdiff_t>(this->cy) - 1 - y) * this->line_size;
+    }
+
+    // true if pixels are laid out exactly like in a Bitmap of the same size
+    bool is_packed() const
+    {
+        return (this->cx % 4) == 0
+            && this->line_size == static_cast<ptrdiff_t>(this->cx * nbbytes(this->original_bpp));
+    }
+
+    size_t aligned_line_size(uint8_t bpp) const
+    {
+        return align4(this->cx) * nbbytes(bpp);
+    }
+};
+
 class Bitmap {
 public:
     uint8_t original_bpp;
@@ -617,13 +685,35 @@ private:
 
     void decompress(const uint8_t* input, uint16_t src_cx, uint16_t src_cy, size_t size) const
     {
-        const uint8_t Bpp = nbbytes(this->original_bpp);
-        const uint16_t & dst_cx = this->cx;
+        switch (nbbytes(this->original_bpp)){
+        case 1:
+            this->decompress_bpp<1>(input, src_cx, size);
+            break;
+        case 2:
+            this->decompress_bpp<2>(input, src_cx, size);
+            break;
+        case 3:
+            this->decompress_bpp<3>(input, src_cx, size);
+            break;
+        default:
+            this->decompress_bpp<4>(input, src_cx, size);
+            break;
+        }
+    }
+
+    // Decoder specialised for each pixel size. Runs are written one
+    // scanline segment at a time: FILL and COPY as memset/memcpy, MIX and
+    // COLOR through the wide run writers of rlesimd.hpp.
+    template <uint8_t Bpp>
+    void decompress_bpp(const uint8_t* input, uint16_t src_cx, size_t size) const
+    {
         uint8_t* pmin = this->data_bitmap.get();
         uint8_t* pmax = pmin + this->bmp_size;
-        uint16_t out_x_count = 0;
-        unsigned yprev = 0;
+        const size_t line_size = this->line_size;
+        const uint8_t* first_line_end = pmin + line_size;
+        const size_t padding = (this->cx - src_cx) * Bpp;
         uint8_t* out = pmin;
+        uint8_t* row_end = pmin + line_size;
         const uint8_t* end = input + size;
         unsigned color1;
         unsigned color2;
@@ -638,6 +728,13 @@ private:
         color2 = 0;
         mix = 0xFFFFFFFF;
 
+        uint8_t mix_pattern[RLE_RUN_PATTERN_SIZE];
+        unsigned mix_pattern_pixel = mix;
+        rle_run_pattern(mix_pattern, Bpp, mix);
+        uint8_t color_pattern[RLE_RUN_PATTERN_SIZE];
+        unsigned color_pattern_pixel = 0;
+        rle_run_pattern(color_pattern, Bpp, 0);
+
         enum {
             FILL    = 0,
             MIX     = 1,
@@ -767,6 +864,10 @@ private:
             case COLOR:
                 color2 = this->get_pixel(Bpp, input);
                 input += Bpp;
+                if (color2 != color_pattern_pixel){
+                    color_pattern_pixel = color2;
+                    rle_run_pattern(color_pattern, Bpp, color2);
+                }
                 break;
             case MIX_SET:
                 mix = this->get_pixel(Bpp, input);
@@ -785,86 +886,100 @@ private:
             // MAGIC MIX of one pixel to comply with crap in Bitmap RLE compression
             if ((opcode == FILL)
             && (opcode == lastopcode)
-            && (out != pmin + this->line_size)){
-                yprev = (out - this->line_size < pmin) ? 0 : this->get_pixel(Bpp, out - this->line_size);
+            && (out != first_line_end)){
+                if(out >= pmax) {
+                    LOG(LOG_WARNING, "Decompressed bitmap too large. Dying.");
+                    throw Error(ERR_BITMAP_DECOMPRESSED_DATA_TOO_LARGE);
+                }
+                unsigned yprev = (out < first_line_end) ? 0 : this->get_pixel(Bpp, out - line_size);
                 out_bytes_le(out, Bpp, yprev ^ mix);
                 count--;
                 out += Bpp;
-                out_x_count += 1;
-                if (out_x_count == dst_cx){
-                    bzero(out, (dst_cx - src_cx) * Bpp);
-                    out_x_count = 0;
+                if (out == row_end){
+                    bzero(out, std::min<size_t>(padding, pmax - out));
+                    row_end += line_size;
                 }
             }
             lastopcode = opcode;
 
+            if ((opcode == MIX || opcode == MIX_SET) && mix != mix_pattern_pixel){
+                mix_pattern_pixel = mix;
+                rle_run_pattern(mix_pattern, Bpp, mix);
+            }
+
 //            LOG(LOG_INFO, "%s %u", this->get_opcode(opcode), count);
 
-            /* Output body */
+            /* Output body, one segment of scanline at a time */
             while (count > 0) {
                 if(out >= pmax) {
                     LOG(LOG_WARNING, "Decompressed bitmap too large. Dying.");
                     throw Error(ERR_BITMAP_DECOMPRESSED_DATA_TOO_LARGE);
                 }
-                yprev = (out - this->line_size < pmin) ? 0 : this->get_pixel(Bpp, out - this->line_size);
+                const unsigned n = std::min<unsigned>(count, (row_end - out) / Bpp);
+                const size_t nbytes = n * Bpp;
+                const bool first_line = (out < first_line_end);
+                const uint8_t * above = out - line_size;
 
                 switch (opcode) {
                 case FILL:
-                    out_bytes_le(out, Bpp, yprev);
+                    if (first_line){
+                        memset(out, 0, nbytes);
+                    }
+                    else {
+                        memcpy(out, above, nbytes);
+                    }
                     break;
                 case MIX_SET:
                 case MIX:
-                    out_bytes_le(out, Bpp, yprev ^ mix);
+                    if (first_line){
+                        rle_fill_run(out, mix_pattern, nbytes);
+                    }
+                    else {
+                        rle_xor_run(out, above, mix_pattern, nbytes);
+                    }
                     break;
                 case FOM_SET:
                 case FOM:
-                    if (mask == 0x100){
-                        mask = 1;
-                        fom_mask = input[0]; input++;
-                    }
                 case SPECIAL_FGBG_1:
                 case SPECIAL_FGBG_2:
-                    if (mask & fom_mask){
-                        out_bytes_le(out, Bpp, yprev ^ mix);
-                    }
-                    else {
-                        out_bytes_le(out, Bpp, yprev);
+                    for (unsigned i = 0; i < n; i++){
+                        if (mask == 0x100 && (opcode == FOM || opcode == FOM_SET)){
+                            mask = 1;
+                            fom_mask = input[0]; input++;
+                        }
+                        unsigned yprev = first_line ? 0 : this->get_pixel(Bpp, above + i * Bpp);
+                        out_bytes_le(out + i * Bpp, Bpp, (mask & fom_mask) ? (yprev ^ mix) : yprev);
+                        mask <<= 1;
                     }
-                    mask <<= 1;
                     break;
                 case COLOR:
-                    out_bytes_le(out, Bpp, color2);
+                    rle_fill_run(out, color_pattern, nbytes);
                     break;
                 case COPY:
-                    out_bytes_le(out, Bpp, this->get_pixel(Bpp, input));
-                    input += Bpp;
+                    memcpy(out, input, nbytes);
+                    input += nbytes;
                     break;
                 case BICOLOR:
-                    if (bicolor) {
-                        out_bytes_le(out, Bpp, color2);
-                        bicolor = 0;
-                    }
-                    else {
-                        out_bytes_le(out, Bpp, color1);
-                        bicolor = 1;
+                    for (unsigned i = 0; i < n; i++){
+                        out_bytes_le(out + i * Bpp, Bpp, bicolor ? color2 : color1);
+                        bicolor ^= 1;
                     }
                 break;
                 case WHITE:
-                    out_bytes_le(out, Bpp, 0xFFFFFFFF);
+                    memset(out, 0xFF, nbytes);
                 break;
                 case BLACK:
-                    out_bytes_le(out, Bpp, 0);
+                    memset(out, 0, nbytes);
                 break;
                 default:
                     assert(false);
                     break;
                 }
-                count--;
-                out += Bpp;
-                out_x_count += 1;
-                if (out_x_count == dst_cx){
-                    bzero(out, (dst_cx - src_cx) * Bpp);
-                    out_x_count = 0;
+                count -= n;
+                out += nbytes;
+                if (out == row_end){
+                    bzero(out, std::min<size_t>(padding, pmax - out));
+                    row_end += line_size;
                 }
             }
         }
@@ -884,77 +999,97 @@ public:
         FLAG_BICOLOR = 9,
     };
 
-    unsigned get_pixel(const uint8_t Bpp, const uint8_t * const p) const
+    static unsigned get_pixel(const uint8_t Bpp, const uint8_t * const p)
     {
         return in_uint32_from_nb_bytes_le(Bpp, p);
     }
 
-    unsigned get_pixel_above(const uint8_t Bpp, const uint8_t * pmin, const uint8_t * const p) const
+    static unsigned get_pixel_above(const uint8_t Bpp, const size_t line_size, const uint8_t * pmin, const uint8_t * const p)
     {
-        return ((p-this->line_size) < pmin)
+        return ((p-line_size) < pmin)
         ? 0
-        : this->get_pixel(Bpp, p - this->line_size);
+        : get_pixel(Bpp, p - line_size);
     }
 
-    unsigned get_color_count(const uint8_t Bpp, const uint8_t * pmax, const uint8_t * p, unsigned color) const
+    // Runs are measured with the byte scanning kernels of rlesimd.hpp, they
+    // give the same counts as a pixel by pixel scan.
+
+    static unsigned get_color_count(const uint8_t Bpp, const uint8_t * pmax, const uint8_t * p, unsigned color)
     {
-        unsigned acc = 0;
-        while (p < pmax && this->get_pixel(Bpp, p) == color){
-            acc++;
-            p = p + Bpp;
+        if (p + Bpp > pmax || get_pixel(Bpp, p) != color){
+            return 0;
         }
-        return acc;
+        // every following pixel is equal to the one before it
+        return 1 + rle_kernels().mismatch(p + Bpp, p, pmax - p - Bpp) / Bpp;
     }
 
-    unsigned get_bicolor_count(const uint8_t Bpp, const uint8_t * pmax, const uint8_t * p, unsigned color1, unsigned color2) const
+    static unsigned get_bicolor_count(const uint8_t Bpp, const uint8_t * pmax, const uint8_t * p, unsigned color1, unsigned color2)
     {
-        unsigned acc = 0;
-        while ((p < pmax)
-            && (color1 == this->get_pixel(Bpp, p))
-            && (p + Bpp < pmax)
-            && (color2 == this->get_pixel(Bpp, p + Bpp))) {
-                acc = acc + 2;
-                p = p + 2 * Bpp;
+        if (p + 2 * Bpp > pmax
+        || (color1 != get_pixel(Bpp, p))
+        || (color2 != get_pixel(Bpp, p + Bpp))) {
+            return 0;
         }
-        return acc;
+        // every following pixel is equal to the one two pixels before it
+        unsigned count = 2 + rle_kernels().mismatch(p + 2 * Bpp, p, pmax - p - 2 * Bpp) / Bpp;
+        return count & ~1u;
     }
 
-    unsigned get_fill_count(const uint8_t Bpp, const uint8_t * pmin, const uint8_t * pmax, const uint8_t * p) const
+    static unsigned get_fill_count(const uint8_t Bpp, const size_t line_size, const uint8_t * pmin, const uint8_t * pmax, const uint8_t * p)
     {
-        unsigned acc = 0;
-        while  (p + Bpp <= pmax) {
-            unsigned pixel = this->get_pixel(Bpp, p);
-            unsigned ypixel = this->get_pixel_above(Bpp, pmin, p);
-            if (ypixel != pixel){
-                break;
+        const uint8_t * q = p;
+        const uint8_t * const first_line_end = pmin + line_size;
+        if (q < first_line_end){
+            // no previous scanline, background is black
+            const uint8_t * end = (pmax < first_line_end) ? pmax : first_line_end;
+            if (q >= end){
+                return 0;
+            }
+            size_t n = end - q;
+            size_t m = rle_kernels().nonzero(q, n);
+            if (m < n){
+                return m / Bpp;
             }
-            p += Bpp;
-            acc += 1;
+            q = end;
         }
-        return acc;
+        if (q < pmax){
+            q += rle_kernels().mismatch(q, q - line_size, pmax - q);
+        }
+        return (q - p) / Bpp;
     }
 
-    unsigned get_mix_count(const uint8_t Bpp, const uint8_t * pmin, const uint8_t * pmax, const uint8_t * p, unsigned foreground) const
+    static unsigned get_mix_count(const uint8_t Bpp, const size_t line_size, const uint8_t * pmin, const uint8_t * pmax, const uint8_t * p, unsigned foreground)
     {
-        unsigned acc = 0;
-        while (p + Bpp <= pmax){
-            if (this->get_pixel_above(Bpp, pmin, p) ^ foreground ^ this->get_pixel(Bpp, p)){
-                break;
+        const uint8_t * q = p;
+        const uint8_t * const first_line_end = pmin + line_size;
+        if (q < first_line_end){
+            // no previous scanline, pixels are foreground
+            const uint8_t * end = (pmax < first_line_end) ? pmax : first_line_end;
+            if (q + Bpp > end || get_pixel(Bpp, q) != foreground){
+                return 0;
+            }
+            size_t n = end - q - Bpp;
+            size_t m = rle_kernels().mismatch(q + Bpp, q, n);
+            if (m < n){
+                return 1 + m / Bpp;
             }
-            p += Bpp;
-            acc += 1;
+            q = end;
         }
-        return acc;
+        if (q + Bpp <= pmax && (get_pixel(Bpp, q - line_size) ^ get_pixel(Bpp, q)) == foreground){
+            // pixel xor above pixel is the same all along the run
+            q += Bpp + rle_kernels().mismatch_xor(q + Bpp, q + Bpp - line_size, q, q - line_size, pmax - q - Bpp);
+        }
+        return (q - p) / Bpp;
     }
 
-    unsigned get_fom_count(const uint8_t Bpp, const uint8_t * pmin, const uint8_t * pmax, const uint8_t * p, unsigned foreground, bool fill) const
+    static unsigned get_fom_count(const uint8_t Bpp, const size_t line_size, const uint8_t * pmin, const uint8_t * pmax, const uint8_t * p, unsigned foreground, bool fill)
     {
         unsigned acc = 0;
         while (true){
             unsigned count = 0;
             while  (p + Bpp <= pmax) {
-                unsigned pixel = this->get_pixel(Bpp, p);
-                unsigned ypixel = this->get_pixel_above(Bpp, pmin, p);
+                unsigned pixel = get_pixel(Bpp, p);
+                unsigned ypixel = get_pixel_above(Bpp, line_size, pmin, p);
                 if (ypixel ^ pixel ^ (fill?0:foreground)){
                     break;
                 }
@@ -973,8 +1108,18 @@ public:
         return acc;
     }
 
-    void get_fom_masks(const uint8_t Bpp, const uint8_t * pmin, const uint8_t * p, uint8_t * mask, const unsigned count) const
+    static void get_fom_masks(const uint8_t Bpp, const size_t line_size, const uint8_t * pmin, const uint8_t * p, uint8_t * mask, const unsigned count)
     {
+        const uint8_t * const first_line_end = pmin + line_size;
+        if (p + count * Bpp <= first_line_end){
+            rle_kernels().diff_mask(Bpp, p, NULL, mask, count);
+            return;
+        }
+        if (p >= first_line_end){
+            rle_kernels().diff_mask(Bpp, p, p - line_size, mask, count);
+            return;
+        }
+        // run crosses the end of first scanline
         unsigned i = 0;
         for (i = 0; i < count; i += 8)
         {
@@ -982,20 +1127,20 @@ public:
         }
         for (i = 0 ; i < count; i++, p += Bpp)
         {
-            if (get_pixel(Bpp, p) != get_pixel_above(Bpp, pmin, p)){
+            if (get_pixel(Bpp, p) != get_pixel_above(Bpp, line_size, pmin, p)){
                 mask[i>>3] |= static_cast<uint8_t>(0x01 << (i & 7));
             }
         }
     }
 
-    unsigned get_fom_count_set(const uint8_t Bpp, const uint8_t * pmin, const uint8_t * pmax, const uint8_t * p, unsigned & foreground, unsigned & flags) const
+    static unsigned get_fom_count_set(const uint8_t Bpp, const size_t line_size, const uint8_t * pmin, const uint8_t * pmax, const uint8_t * p, unsigned & foreground, unsigned & flags)
     {
         // flags : 1 = fill, 2 = MIX, 3 = (1+2) = FOM
         flags = FLAG_FILL;
-        unsigned fill_count = this->get_fill_count(Bpp, pmin, pmax, p);
+        unsigned fill_count = get_fill_count(Bpp, line_size, pmin, pmax, p);
         if (fill_count) {
             if (fill_count < 8) {
-                unsigned fom_count = this->get_fom_count(Bpp, pmin, pmax, p + fill_count * Bpp, foreground, false);
+                unsigned fom_count = get_fom_count(Bpp, line_size, pmin, pmax, p + fill_count * Bpp, foreground, false);
                 if (fom_count){
                     flags = FLAG_FOM;
                     fill_count += fom_count;
@@ -1010,11 +1155,11 @@ public:
         if  (p + Bpp <= pmax) {
             flags = FLAG_MIX;
             // if there is a pixel we are always able to mix (at worse we will set foreground ourself)
-            foreground = this->get_pixel_above(Bpp, pmin, p) ^ this->get_pixel(Bpp, p);
-            unsigned mix_count = 1 + this->get_mix_count(Bpp, pmin, pmax, p + Bpp, foreground);
+            foreground = get_pixel_above(Bpp, line_size, pmin, p) ^ get_pixel(Bpp, p);
+            unsigned mix_count = 1 + get_mix_count(Bpp, line_size, pmin, pmax, p + Bpp, foreground);
             if (mix_count < 8) {
                 unsigned fom_count = 0;
-                fom_count = this->get_fom_count(Bpp, pmin, pmax, p + mix_count * Bpp, foreground, true);
+                fom_count = get_fom_count(Bpp, line_size, pmin, pmax, p + mix_count * Bpp, foreground, true);
                 if (fom_count){
                     flags = FLAG_FOM;
                     mix_count += fom_count;
@@ -1026,6 +1171,38 @@ public:
         return 0;
     }
 
+    // Same helpers working on rows of this bitmap
+
+    unsigned get_pixel_above(const uint8_t Bpp, const uint8_t * pmin, const uint8_t * const p) const
+    {
+        return get_pixel_above(Bpp, this->line_size, pmin, p);
+    }
+
+    unsigned get_fill_count(const uint8_t Bpp, const uint8_t * pmin, const uint8_t * pmax, const uint8_t * p) const
+    {
+        return get_fill_count(Bpp, this->line_size, pmin, pmax, p);
+    }
+
+    unsigned get_mix_count(const uint8_t Bpp, const uint8_t * pmin, const uint8_t * pmax, const uint8_t * p, unsigned foreground) const
+    {
+        return get_mix_count(Bpp, this->line_size, pmin, pmax, p, foreground);
+    }
+
+    unsigned get_fom_count(const uint8_t Bpp, const uint8_t * pmin, const uint8_t * pmax, const uint8_t * p, unsigned foreground, bool fill) const
+    {
+        return get_fom_count(Bpp, this->line_size, pmin, pmax, p, foreground, fill);
+    }
+
+    void get_fom_masks(const uint8_t Bpp, const uint8_t * pmin, const uint8_t * p, uint8_t * mask, const unsigned count) const
+    {
+        get_fom_masks(Bpp, this->line_size, pmin, p, mask, count);
+    }
+
+    unsigned get_fom_count_set(const uint8_t Bpp, const uint8_t * pmin, const uint8_t * pmax, const uint8_t * p, unsigned & foreground, unsigned & flags) const
+    {
+        return get_fom_count_set(Bpp, this->line_size, pmin, pmax, p, foreground, flags);
+    }
+
     TODO(" simplify and enhance compression using 1 pixel orders BLACK or WHITE.");
     void compress(Stream & outbuffer) const
     {
@@ -1034,6 +1211,29 @@ public:
             return;
         }
 
+        uint8_t * tmp_data_compressed = outbuffer.p;
+
+        compress(this->view(), outbuffer);
+
+        // Memoize result of compression
+        this->data_compressed_size = outbuffer.p - tmp_data_compressed;
+        this->data_compressed = static_cast<uint8_t*>(malloc(this->data_compressed_size));
+        if (this->data_compressed) {
+            memcpy(this->data_compressed, tmp_data_compressed, this->data_compressed_size);
+        }
+    }
+
+    // Compress pixels of view as a bitmap of width align4(view.cx).
+    // Packed views (e.g. whole width parts of a bitmap) are read in place,
+    // other views are copied first.
+    static void compress(const BitmapView & view, Stream & outbuffer)
+    {
+        if (!view.is_packed()) {
+            const Bitmap packed(view.original_bpp, view);
+            compress(packed.view(), outbuffer);
+            return;
+        }
+
         struct RLE_OutStream {
             Stream & stream;
             RLE_OutStream(Stream & outbuffer)
@@ -1413,10 +1613,9 @@ public:
 
         } out(outbuffer);
 
-        uint8_t * tmp_data_compressed = out.stream.p;
-
-        const uint8_t Bpp = nbbytes(this->original_bpp);
-        const uint8_t * pmin = this->data_bitmap.get();
+        const uint8_t Bpp = nbbytes(view.original_bpp);
+        const size_t line_size = view.line_size;
+        const uint8_t * pmin = view.data;
         const uint8_t * p = pmin;
 
         // white with the right length : either 0xFF or 0xFFFF or 0xFFFFFF
@@ -1440,26 +1639,26 @@ public:
             // orders, a magic MIX pixel is inserted between fills.
             // This explains the surprising loop above and the test below.pp
             if (part){
-                pmax = pmin + this->bmp_size;
+                pmax = pmin + line_size * view.cy;
             }
             else {
-                pmax = pmin + align4(this->cx * nbbytes(this->original_bpp));
+                pmax = pmin + line_size;
             }
             while (p < pmax)
             {
-                uint32_t fom_count = this->get_fom_count_set(Bpp, pmin, pmax, p, new_foreground, flags);
+                uint32_t fom_count = get_fom_count_set(Bpp, line_size, pmin, pmax, p, new_foreground, flags);
                 uint32_t color_count = 0;
                 uint32_t bicolor_count = 0;
 
                 if (p + Bpp < pmax){
-                    color = this->get_pixel(Bpp, p);
-                    color2 = this->get_pixel(Bpp, p + Bpp);
+                    color = get_pixel(Bpp, p);
+                    color2 = get_pixel(Bpp, p + Bpp);
 
                     if (color == color2){
-                        color_count = this->get_color_count(Bpp, pmax, p, color);
+                        color_count = get_color_count(Bpp, pmax, p, color);
                     }
                     else {
-                        bicolor_count = this->get_bicolor_count(Bpp, pmax, p, color, color2);
+                        bicolor_count = get_bicolor_count(Bpp, pmax, p, color, color2);
                     }
                 }
 
@@ -1475,7 +1674,7 @@ public:
                 && fom_cost < copy_fom_cost) {
                     switch (flags){
                         case FLAG_FOM:
-                            this->get_fom_masks(Bpp, pmin, p, masks, fom_count);
+                            get_fom_masks(Bpp, line_size, pmin, p, masks, fom_count);
                             if (new_foreground != foreground){
                                 flags = FLAG_FOM_SET;
                             }
@@ -1559,25 +1758,109 @@ public:
                 copy_count = 0;
             }
         }
+    }
 
-        // Memoize result of compression
-        this->data_compressed_size = out.stream.p - tmp_data_compressed;
+    // Memoize an already known compressed form of this bitmap (e.g. from a
+    // shared bitmap store), next compress() calls will only copy it.
+    void set_compressed_data(const uint8_t * data, size_t size) const
+    {
+        if (this->data_compressed) {
+            free(this->data_compressed);
+        }
+        this->data_compressed_size = size;
         this->data_compressed = static_cast<uint8_t*>(malloc(this->data_compressed_size));
         if (this->data_compressed) {
-            memcpy(this->data_compressed, tmp_data_compressed, this->data_compressed_size);
+            memcpy(this->data_compressed, data, this->data_compressed_size);
         }
     }
 
     void compute_sha1(uint8_t (&sig)[20]) const
+    {
+        compute_sha1(this->data_bitmap.get(), this->cx, this->cy, this->original_bpp, sig);
+    }
+
+    // data holds cy packed rows of cx pixels (cx already aligned)
+    static void compute_sha1(const uint8_t * data, uint16_t cx, uint16_t cy, uint8_t bpp, uint8_t (&sig)[20])
     {
         SslSha1 sha1;
-        uint16_t rowsize = static_cast<uint16_t>(this->cx * nbbytes(this->original_bpp));
-        for (size_t y = 0; y < static_cast<size_t>(this->cy); y++){
-            sha1.update(FixedSizeStream(this->data_bitmap.get() + y * rowsize, rowsize));
+        uint16_t rowsize = static_cast<uint16_t>(cx * nbbytes(bpp));
+        for (size_t y = 0; y < static_cast<size_t>(cy); y++){
+            sha1.update(FixedSizeStream(const_cast<uint8_t*>(data) + y * rowsize, rowsize));
         }
         sha1.final(sig);
     }
 
+    // Fingerprint is only used to identify content (not a security feature),
+    // hence a fast hash is enough unless SHA1 is explicitly asked for.
+    void compute_fingerprint(uint8_t (&sig)[20], BitmapFingerprint mode) const
+    {
+        compute_fingerprint(this->data_bitmap.get(), this->cx, this->cy, this->original_bpp, sig, mode);
+    }
+
+    static void compute_fingerprint(const uint8_t * data, uint16_t cx, uint16_t cy, uint8_t bpp, uint8_t (&sig)[20], BitmapFingerprint mode)
+    {
+        if (mode == BITMAP_FINGERPRINT_SHA1){
+            compute_sha1(data, cx, cy, bpp, sig);
+            return;
+        }
+        uint8_t hash[16];
+        fasthash128(data, cx * nbbytes(bpp) * cy, 0, hash);
+        memcpy(sig, hash, sizeof(hash));
+        sig[16] = cx;
+        sig[17] = cx >> 8;
+        sig[18] = cy;
+        sig[19] = cy >> 8;
+    }
+
+    BitmapView view() const
+    {
+        return BitmapView(this->original_bpp, &this->original_palette, this->cx, this->cy
+                         , this->data_bitmap.get(), this->line_size);
+    }
+
+    // r is given top-down, as for Bitmap(const Bitmap & src_bmp, const Rect & r)
+    BitmapView view(const Rect & r) const
+    {
+        return this->view().sub_view(r);
+    }
+
+    // Write pixels of view at out_bpp in dest, as align4(view.cx) wide rows
+    // stored bottom-up (the layout of Bitmap data).
+    static void copy_view(const BitmapView & view, uint8_t out_bpp, uint8_t * dest)
+    {
+        const uint8_t src_nbbytes = nbbytes(view.original_bpp);
+        const uint8_t Bpp = nbbytes(out_bpp);
+        const size_t line_to_copy = view.cx * Bpp;
+        const size_t dest_line_size = view.aligned_line_size(out_bpp);
+        const uint8_t * src = view.data;
+
+        for (size_t y = 0; y < view.cy ; y++, src += view.line_size, dest += dest_line_size) {
+            if (out_bpp == view.original_bpp){
+                memcpy(dest, src, line_to_copy);
+            }
+            else {
+                const uint8_t * s = src;
+                uint8_t * d = dest;
+                for (size_t x = 0; x < view.cx ; x++) {
+                    uint32_t pixel = in_uint32_from_nb_bytes_le(src_nbbytes, s);
+
+                    pixel = color_decode(pixel, view.original_bpp, *view.original_palette);
+                    if (out_bpp == 16 || out_bpp == 15 || out_bpp == 8){
+                        pixel = RGBtoBGR(pixel);
+                    }
+                    pixel = color_encode(pixel, out_bpp);
+
+                    out_bytes_le(d, Bpp, pixel);
+                    s += src_nbbytes;
+                    d += Bpp;
+                }
+            }
+            if (line_to_copy < dest_line_size){
+                bzero(dest + line_to_copy, dest_line_size - line_to_copy);
+            }
+        }
+    }
+
     ~Bitmap(){
         if (this->data_compressed) {
             free(this->data_compressed);
@@ -1643,6 +1926,29 @@ public:
         }
     }
 
+    Bitmap(uint8_t out_bpp, const BitmapView & view)
+    : original_bpp(out_bpp)
+    , cx(align4(view.cx))
+    , cy(view.cy)
+    , line_size(this->cx * nbbytes(this->original_bpp))
+    , bmp_size(this->line_size * cy)
+    , data_bitmap()
+    , data_compressed(NULL)
+    , data_compressed_size(0)
+    {
+        this->data_bitmap.alloc(this->bmp_size);
+        copy_view(view, out_bpp, this->data_bitmap.get());
+
+        if (out_bpp == 8){
+            if (view.original_palette){
+                memcpy(&this->original_palette, view.original_palette, sizeof(BGRPalette));
+            }
+            else {
+                init_palette332(this->original_palette);
+            }
+        }
+    }
+
     Bitmap(uint8_t bpp, const BGRPalette * palette, uint16_t cx, uint16_t cy)
         : original_bpp(bpp)
         , cx(align4(cx))
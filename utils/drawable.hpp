@@ -24,6 +24,7 @@
 
 #include <algorithm>
 #include "bitmap.hpp"
+#include "ropsimd.hpp"
 
 #include "colors.hpp"
 #include "rect.hpp"
@@ -80,6 +81,20 @@ struct Drawable {
     Rect tracked_area;
     bool tracked_area_changed;
 
+    // Screen is divided in dirty_tile_size squares, drawing primitives
+    // stamp tiles they write to with change_count. Each user of the image
+    // (png or wrm keyframe writers) keeps the change_count of its last
+    // image and knows what was drawn since. Mouse and timestamp traces are
+    // not changes, they are always cleared before drawing again.
+    enum {
+        dirty_tile_size = 64
+    };
+
+    uint64_t   change_count;
+    uint16_t   dirty_tiles_x;
+    uint16_t   dirty_tiles_y;
+    uint64_t * dirty_tiles;
+
     Drawable(int width, int height)
     : width(width)
     , height(height)
@@ -87,6 +102,10 @@ struct Drawable {
     , pix_len(this->rowsize * height)
     , tracked_area(0, 0, 0, 0)
     , tracked_area_changed(false)
+    , change_count(0)
+    , dirty_tiles_x((width + dirty_tile_size - 1) / dirty_tile_size)
+    , dirty_tiles_y((height + dirty_tile_size - 1) / dirty_tile_size)
+    , dirty_tiles(NULL)
     {
         static const Mouse_t default_mouse_cursor[] =
         {
@@ -126,6 +145,13 @@ struct Drawable {
         }
         std::fill<>(this->data, this->data + this->pix_len, 0);
 
+        this->dirty_tiles = new (std::nothrow) uint64_t[this->dirty_tiles_x * this->dirty_tiles_y];
+        if (this->dirty_tiles == 0){
+            delete[] this->data;
+            throw Error(ERR_RECORDER_FRAME_ALLOCATION_FAILED);
+        }
+        std::fill<>(this->dirty_tiles, this->dirty_tiles + this->dirty_tiles_x * this->dirty_tiles_y, 0);
+
         memset(this->timestamp_data, 0xFF, sizeof(this->timestamp_data));
         memset(this->previous_timestamp, 0x07, sizeof(this->previous_timestamp));
         this->previous_timestamp_length = 0;
@@ -133,11 +159,71 @@ struct Drawable {
 
     ~Drawable()
     {
+        delete[] this->dirty_tiles;
         delete[] this->data;
     }
 
+    // Must be called by anything writing to data (but mouse and timestamp traces)
+    void mark_dirty(const Rect & rect)
+    {
+        const Rect & trect = rect.intersect(Rect(0, 0, this->width, this->height));
+        if (trect.isempty()) {
+            return;
+        }
+
+        if (this->tracked_area.has_intersection(trect)) {
+            this->tracked_area_changed = true;
+        }
+
+        this->change_count++;
+        const unsigned tx_end = (trect.x + trect.cx - 1) / dirty_tile_size;
+        const unsigned ty_end = (trect.y + trect.cy - 1) / dirty_tile_size;
+        for (unsigned ty = trect.y / dirty_tile_size; ty <= ty_end; ty++) {
+            uint64_t * tiles = this->dirty_tiles + ty * this->dirty_tiles_x;
+            for (unsigned tx = trect.x / dirty_tile_size; tx <= tx_end; tx++) {
+                tiles[tx] = this->change_count;
+            }
+        }
+    }
+
+    bool changed_since(uint64_t count) const
+    {
+        return this->change_count != count;
+    }
+
+    bool tile_changed_since(unsigned tx, unsigned ty, uint64_t count) const
+    {
+        return this->dirty_tiles[ty * this->dirty_tiles_x + tx] > count;
+    }
+
+    // area of tile (tx, ty), last row and column of tiles may be smaller
+    Rect tile_rect(unsigned tx, unsigned ty) const
+    {
+        return Rect(tx * dirty_tile_size, ty * dirty_tile_size, dirty_tile_size, dirty_tile_size)
+              .intersect(Rect(0, 0, this->width, this->height));
+    }
+
+    bool changed_since(const Rect & rect, uint64_t count) const
+    {
+        const Rect & trect = rect.intersect(Rect(0, 0, this->width, this->height));
+        if (trect.isempty() || !this->changed_since(count)) {
+            return false;
+        }
+        const unsigned tx_end = (trect.x + trect.cx - 1) / dirty_tile_size;
+        const unsigned ty_end = (trect.y + trect.cy - 1) / dirty_tile_size;
+        for (unsigned ty = trect.y / dirty_tile_size; ty <= ty_end; ty++) {
+            for (unsigned tx = trect.x / dirty_tile_size; tx <= tx_end; tx++) {
+                if (this->tile_changed_since(tx, ty, count)) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
     void bgr2rgb()
     {
+        this->mark_dirty(Rect(0, 0, this->width, this->height));
         const uint32_t * s = reinterpret_cast<const uint32_t *>(this->data);
         uint32_t * t = reinterpret_cast<uint32_t *>(this->data);
         for (size_t y = 0; y < this->height ; y++){
@@ -773,7 +859,7 @@ struct Drawable {
      * a cache (data) and insert a subpart (srcx, srcy) to the local
      * image cache (this->data) a the given position (rect).
      */
-    void mem_blt(const Rect& rect, const Bitmap & bmp, const uint16_t srcx, const uint16_t srcy, const uint32_t xormask, const bool bgr)
+    void mem_blt(const Rect& rect, const BitmapView & bmp, const uint16_t srcx, const uint16_t srcy, const uint32_t xormask, const bool bgr)
     {
         if (bmp.cx < srcx || bmp.cy < srcy){
             return ;
@@ -787,23 +873,51 @@ struct Drawable {
         }
         const Rect & trect = Rect(rect.x, rect.y, mincx, mincy);
 
-        if (this->tracked_area.has_intersection(trect)) {
-            this->tracked_area_changed = true;
-        }
+        this->mark_dirty(trect);
 
         const uint8_t Bpp = ::nbbytes(bmp.original_bpp);
         uint8_t * target = this->first_pixel(trect);
-        const uint8_t * source = bmp.data() + (bmp.cy - srcy - 1) * (bmp.bmp_size / bmp.cy) + srcx * Bpp;
-        int steptarget = (this->width - trect.cx) * 3;
-        int stepsource = (bmp.bmp_size / bmp.cy) + trect.cx * Bpp;
+        const uint8_t * source = bmp.row(srcy) + srcx * Bpp;
 
-        for (int y = 0; y < trect.cy ; y++, target += steptarget, source -= stepsource){
-            for (int x = 0; x < trect.cx ; x++, target += 3, source += Bpp){
+        for (int y = 0; y < trect.cy ; y++, target += this->rowsize, source -= bmp.line_size){
+            decode_row(target, source, trect.cx, bmp, xormask, bgr);
+        }
+    }
+
+    // Decodes count pixels of a bitmap row to packed 24 bits pixels, xormask
+    // applied before bgr swap.
+    static void decode_row( uint8_t * target, const uint8_t * source, size_t count
+                          , const BitmapView & bmp, const uint32_t xormask, const bool bgr)
+    {
+        switch (bmp.original_bpp){
+        case 8:
+            decode_row<1, 8>(target, source, count, *bmp.original_palette, xormask, bgr);
+        break;
+        case 15:
+            decode_row<2, 15>(target, source, count, *bmp.original_palette, xormask, bgr);
+        break;
+        case 16:
+            decode_row<2, 16>(target, source, count, *bmp.original_palette, xormask, bgr);
+        break;
+        case 24:
+            if (!xormask && !bgr){
+                memcpy(target, source, count * 3);
+            }
+            else {
+                decode_row<3, 24>(target, source, count, *bmp.original_palette, xormask, bgr);
+            }
+        break;
+        case 32:
+            decode_row<4, 32>(target, source, count, *bmp.original_palette, xormask, bgr);
+        break;
+        default:
+            const uint8_t Bpp = ::nbbytes(bmp.original_bpp);
+            for (size_t x = 0; x < count; x++, target += 3, source += Bpp){
                 uint32_t px = source[Bpp-1];
                 for (int b = 1 ; b < Bpp ; b++){
                     px = (px << 8) + source[Bpp-1-b];
                 }
-                uint32_t color = xormask ^ color_decode(px, bmp.original_bpp, bmp.original_palette);
+                uint32_t color = xormask ^ color_decode(px, bmp.original_bpp, *bmp.original_palette);
                 if (bgr){
                     color = ((color << 16) & 0xFF0000) | (color & 0xFF00) |((color >> 16) & 0xFF);
                 }
@@ -811,12 +925,32 @@ struct Drawable {
                 target[1] = color >> 8;
                 target[2] = color >> 16;
             }
+        break;
+        }
+    }
+
+    template <uint8_t Bpp, uint8_t bpp>
+    static void decode_row( uint8_t * target, const uint8_t * source, size_t count
+                          , const BGRPalette & palette, const uint32_t xormask, const bool bgr)
+    {
+        for (size_t x = 0; x < count; x++, target += 3, source += Bpp){
+            uint32_t px = source[Bpp-1];
+            for (int b = 1 ; b < Bpp ; b++){
+                px = (px << 8) + source[Bpp-1-b];
+            }
+            uint32_t color = xormask ^ color_decode(px, bpp, palette);
+            if (bgr){
+                color = ((color << 16) & 0xFF0000) | (color & 0xFF00) |((color >> 16) & 0xFF);
+            }
+            target[0] = color;
+            target[1] = color >> 8;
+            target[2] = color >> 16;
         }
     }
 
     template <typename Op>
     void memblt_op( const Rect & rect
-                  , const Bitmap & bmp
+                  , const BitmapView & bmp
                   , const uint16_t srcx
                   , const uint16_t srcy
                   , const bool bgr) {
@@ -836,44 +970,27 @@ struct Drawable {
         }
         const Rect & trect = Rect(rect.x, rect.y, mincx, mincy);
 
-        if (this->tracked_area.has_intersection(trect)) {
-            this->tracked_area_changed = true;
-        }
+        this->mark_dirty(trect);
 
         const uint8_t   Bpp = ::nbbytes(bmp.original_bpp);
         uint8_t       * target = this->first_pixel(trect);
-        const uint8_t * source = bmp.data() + (bmp.cy - srcy - 1) * (bmp.bmp_size / bmp.cy) +
-            srcx * Bpp;
-
-        int steptarget = (this->width - trect.cx) * 3;
-        int stepsource = (bmp.bmp_size / bmp.cy) + trect.cx * Bpp;
+        const uint8_t * source = bmp.row(srcy) + srcx * Bpp;
 
-        uint8_t s0, s1, s2;
+        // source pixels are decoded by blocks, then combined with target
+        const size_t block = 64;
+        uint8_t decoded[block * 3];
 
-        for (int y = 0; y < trect.cy ; y++, target += steptarget, source -= stepsource){
-            for (int x = 0; x < trect.cx ; x++, target += 3, source += Bpp){
-                uint32_t px = source[Bpp-1];
-                for (int b = 1 ; b < Bpp ; b++){
-                    px = (px << 8) + source[Bpp-1-b];
-                }
-                uint32_t color = /* xormask ^ */color_decode(px, bmp.original_bpp, bmp.original_palette);
-                if (bgr){
-                    color = ((color << 16) & 0xFF0000) | (color & 0xFF00) |((color >> 16) & 0xFF);
-                }
-
-                s0 = color         & 0xFF;
-                s1 = (color >> 8 ) & 0xFF;
-                s2 = (color >> 16) & 0xFF;
-
-                target[0] = op(target[0], s0);
-                target[1] = op(target[1], s1);
-                target[2] = op(target[2], s2);
+        for (int y = 0; y < trect.cy ; y++, target += this->rowsize, source -= bmp.line_size){
+            for (size_t x = 0; x < static_cast<size_t>(trect.cx); x += block){
+                const size_t count = std::min<size_t>(block, trect.cx - x);
+                decode_row(decoded, source + x * Bpp, count, bmp, 0, bgr);
+                rop_source_row(target + x * 3, decoded, count * 3, op);
             }
         }
     }
 
     void mem_blt_ex( const Rect & rect
-                   , const Bitmap & bmp
+                   , const BitmapView & bmp
                    , const uint16_t srcx
                    , const uint16_t srcy
                    , uint8_t rop
@@ -922,7 +1039,7 @@ struct Drawable {
     }
 
 
-    void draw_bitmap(const Rect & rect, const Bitmap & bmp, bool bgr) {
+    void draw_bitmap(const Rect & rect, const BitmapView & bmp, bool bgr) {
         const int16_t mincx =
             std::min<int16_t>(bmp.cx, std::min<int16_t>(this->width  - rect.x, rect.cx));
         const int16_t mincy =
@@ -933,31 +1050,13 @@ struct Drawable {
         }
         const Rect & trect = Rect(rect.x, rect.y, mincx, mincy);
 
-        if (this->tracked_area.has_intersection(trect)) {
-            this->tracked_area_changed = true;
-        }
+        this->mark_dirty(trect);
 
-        const uint8_t   Bpp    = ::nbbytes(bmp.original_bpp);
         uint8_t       * target = this->first_pixel(trect);
-        const uint8_t * source = bmp.data() + (bmp.cy - 1) * (bmp.bmp_size / bmp.cy);
-
-        int steptarget = (this->width - trect.cx) * 3;
-        int stepsource = (bmp.bmp_size / bmp.cy) + trect.cx * Bpp;
+        const uint8_t * source = bmp.row(0);
 
-        for (int y = 0; y < trect.cy; y++, target += steptarget, source -= stepsource) {
-            for (int x = 0; x < trect.cx; x++, target += 3, source += Bpp) {
-                uint32_t px = source[Bpp - 1];
-                for (int b = 1; b < Bpp; b++) {
-                    px = (px << 8) + source[Bpp - 1 - b];
-                }
-                uint32_t color = color_decode(px, bmp.original_bpp, bmp.original_palette);
-                if (bgr){
-                    color = ((color << 16) & 0xFF0000) | (color & 0xFF00) |((color >> 16) & 0xFF);
-                }
-                target[0] = color      ;
-                target[1] = color >> 8 ;
-                target[2] = color >> 16;
-            }
+        for (int y = 0; y < trect.cy; y++, target += this->rowsize, source -= bmp.line_size) {
+            decode_row(target, source, trect.cx, bmp, 0, bgr);
         }
     }
 
@@ -971,7 +1070,7 @@ struct Drawable {
 
     template <typename Op>
     void mem3blt_op( const Rect & rect
-                   , const Bitmap & bmp
+                   , const BitmapView & bmp
                    , const uint16_t srcx
                    , const uint16_t srcy
                    , const uint32_t pattern_color
@@ -992,17 +1091,14 @@ struct Drawable {
         }
         const Rect & trect = Rect(rect.x, rect.y, mincx, mincy);
 
-        if (this->tracked_area.has_intersection(trect)) {
-            this->tracked_area_changed = true;
-        }
+        this->mark_dirty(trect);
 
         const uint8_t   Bpp    = ::nbbytes(bmp.original_bpp);
         uint8_t *       target = this->first_pixel(trect);
-        const uint8_t * source = bmp.data() + (bmp.cy - srcy - 1) * (bmp.bmp_size / bmp.cy) +
-            srcx * Bpp;
+        const uint8_t * source = bmp.row(srcy) + srcx * Bpp;
 
         int steptarget = (this->width - trect.cx) * 3;
-        int stepsource = (bmp.bmp_size / bmp.cy) + trect.cx * Bpp;
+        ptrdiff_t stepsource = bmp.line_size + trect.cx * Bpp;
 
         uint8_t s0, s1, s2;
         uint8_t p0, p1, p2;
@@ -1013,7 +1109,7 @@ struct Drawable {
                 for (int b = 1 ; b < Bpp ; b++){
                     px = (px << 8) + source[Bpp-1-b];
                 }
-                uint32_t color = color_decode(px, bmp.original_bpp, bmp.original_palette);
+                uint32_t color = color_decode(px, bmp.original_bpp, *bmp.original_palette);
                 if (bgr){
                     color =   ((color << 16) & 0xFF0000)
                             | ( color        & 0xFF00)
@@ -1036,7 +1132,7 @@ struct Drawable {
     }
 
     void mem_3_blt( const Rect & rect
-                  , const Bitmap & bmp
+                  , const BitmapView & bmp
                   , const uint16_t srcx
                   , const uint16_t srcy
                   , uint8_t rop
@@ -1061,9 +1157,7 @@ struct Drawable {
     {
         const Rect & trect = rect.intersect(Rect(0, 0, this->width, this->height));
 
-        if (this->tracked_area.has_intersection(trect)) {
-            this->tracked_area_changed = true;
-        }
+        this->mark_dirty(trect);
 
         uint8_t * p = this->first_pixel(trect);
         const size_t step = this->rowsize;
@@ -1075,9 +1169,7 @@ struct Drawable {
 
     void white_color(const Rect & rect)
     {
-        if (this->tracked_area.has_intersection(rect)) {
-            this->tracked_area_changed = true;
-        }
+        this->mark_dirty(rect);
 
         uint8_t * p = this->first_pixel(rect);
 
@@ -1092,18 +1184,16 @@ struct Drawable {
     {
         const Rect & trect = rect.intersect(Rect(0, 0, this->width, this->height));
 
-        if (this->tracked_area.has_intersection(trect)) {
-            this->tracked_area_changed = true;
-        }
+        this->mark_dirty(trect);
+
+        Op_0x5A op;
+        uint8_t pattern[ROP_PATTERN_SIZE];
+        rop_pattern24(pattern, 0xFFFFFF);
 
         uint8_t * p = this->first_pixel(trect);
         const size_t rect_rowsize = trect.cx * this->Bpp;
-        const size_t step = this->rowsize - rect_rowsize;
-        for (int j = 0; j < trect.cy ; j++, p += step){
-            for (int i = 0; i < trect.cx ; i++, p += 3){
-                TODO("Applying inversion on blocks of 32 bits instead of bytes should be faster");
-                p[0] ^= 0xFF; p[1] ^= 0xFF; p[2] ^= 0xFF;
-            }
+        for (int j = 0; j < trect.cy ; j++, p += this->rowsize){
+            rop_pattern_row(p, pattern, rect_rowsize, op);
         }
     }
 
@@ -1232,9 +1322,7 @@ struct Drawable {
 
     void ellipse(const Ellipse & el, const uint8_t rop,
                       const uint8_t fill, const uint32_t color) {
-        if (this->tracked_area.has_intersection(el.get_rect())) {
-            this->tracked_area_changed = true;
-        }
+        this->mark_dirty(el.get_rect());
         switch (rop) {
         case 0x01: // R2_BLACK
             this->draw_ellipse<Op2_0x01>(el, fill, color);
@@ -1421,16 +1509,13 @@ struct Drawable {
     // also we already swapped color if we are using BGR instead of RGB
     void opaquerect(const Rect & rect, const uint32_t color)
     {
-        if (this->tracked_area.has_intersection(rect)) {
-            this->tracked_area_changed = true;
-        }
+        this->mark_dirty(rect);
         uint8_t * const base = this->first_pixel(rect);
-        uint8_t * p = base;
 
-        for (size_t x = 0; x < static_cast<size_t>(rect.cx) ; x++){
-            p[0] = color; p[1] = color >> 8; p[2] = color >> 16;
-            p += 3;
-        }
+        uint8_t pattern[ROP_PATTERN_SIZE];
+        rop_pattern24(pattern, color);
+        rop_fill_row(base, pattern, rect.cx * this->Bpp);
+
         uint8_t * target = base;
         size_t line_size = rect.cx * this->Bpp;
         for (size_t y = 1; y < static_cast<size_t>(rect.cy) ; y++){
@@ -1444,30 +1529,22 @@ struct Drawable {
     {
         Op op;
 
-        if (this->tracked_area.has_intersection(rect)) {
-            this->tracked_area_changed = true;
-        }
+        this->mark_dirty(rect);
 
-        uint8_t * const base = this->first_pixel(rect);
-        uint8_t * p = base;
-        uint8_t p0 = color & 0xFF;
-        uint8_t p1 = (color >> 8) & 0xFF;
-        uint8_t p2 = (color >> 16) & 0xFF;
+        uint8_t pattern[ROP_PATTERN_SIZE];
+        rop_pattern24(pattern, color);
 
-        for (size_t y = 0; y < static_cast<size_t>(rect.cy) ; y++){
-            p = base + this->rowsize * y;
-            for (size_t x = 0; x < static_cast<size_t>(rect.cx) ; x++){
-                p[0] = op(p[0], p0);
-                p[1] = op(p[1], p1);
-                p[2] = op(p[2], p2);
-                p += 3;
-            }
+        uint8_t * p = this->first_pixel(rect);
+        const size_t rect_rowsize = rect.cx * this->Bpp;
+        for (size_t y = 0; y < static_cast<size_t>(rect.cy) ; y++, p += this->rowsize){
+            rop_pattern_row(p, pattern, rect_rowsize, op);
         }
     }
 
     struct Op_0x05
     {
-        uint8_t operator()(uint8_t target, uint8_t source)
+        template <typename T>
+        T operator()(T target, T source)
         {
             return ~(target | source);
         }
@@ -1475,7 +1552,8 @@ struct Drawable {
 
     struct Op_0x0F
     {
-        uint8_t operator()(uint8_t target, uint8_t source)
+        template <typename T>
+        T operator()(T target, T source)
         {
             return ~source;
         }
@@ -1483,7 +1561,8 @@ struct Drawable {
 
     struct Op_0x50
     {
-        uint8_t operator()(uint8_t target, uint8_t source)
+        template <typename T>
+        T operator()(T target, T source)
         {
             return ~target & source;
         }
@@ -1491,7 +1570,8 @@ struct Drawable {
 
     struct Op_0x5A
     {
-        uint8_t operator()(uint8_t target, uint8_t source)
+        template <typename T>
+        T operator()(T target, T source)
         {
             return target ^ source;
         }
@@ -1499,7 +1579,8 @@ struct Drawable {
 
     struct Op_0x5F
     {
-        uint8_t operator()(uint8_t target, uint8_t source)
+        template <typename T>
+        T operator()(T target, T source)
         {
             return ~(target & source);
         }
@@ -1507,7 +1588,8 @@ struct Drawable {
 
     struct Op_0xA0
     {
-        uint8_t operator()(uint8_t target, uint8_t source)
+        template <typename T>
+        T operator()(T target, T source)
         {
             return target & source;
         }
@@ -1515,7 +1597,8 @@ struct Drawable {
 
     struct Op_0xA5
     {
-        uint8_t operator()(uint8_t target, uint8_t source)
+        template <typename T>
+        T operator()(T target, T source)
         {
             return ~(target ^ source);
         }
@@ -1523,16 +1606,17 @@ struct Drawable {
 
     struct Op_0xAF
     {
-        uint8_t operator()(uint8_t target, uint8_t source)
+        template <typename T>
+        T operator()(T target, T source)
         {
             return target | ~source;
         }
     };
 
-    TODO("This one is a memset and should be simplified");
     struct Op_0xF0
     {
-        uint8_t operator()(uint8_t target, uint8_t source)
+        template <typename T>
+        T operator()(T target, T source)
         {
             return source;
         }
@@ -1540,7 +1624,8 @@ struct Drawable {
 
     struct Op_0xF5
     {
-        uint8_t operator()(uint8_t target, uint8_t source)
+        template <typename T>
+        T operator()(T target, T source)
         {
             return ~target | source;
         }
@@ -1548,7 +1633,8 @@ struct Drawable {
 
     struct Op_0xFA
     {
-        uint8_t operator()(uint8_t target, uint8_t source)
+        template <typename T>
+        T operator()(T target, T source)
         {
             return target | source;
         }
@@ -1640,7 +1726,7 @@ struct Drawable {
                 // |      | RPN: P                        |
                 // +------+-------------------------------+
             case 0xF0:
-                this->patblt_op<Op_0xF0>(rect, color);
+                this->opaquerect(rect, color);
                 break;
                 // +------+-------------------------------+
                 // | 0xF5 | ROP: 0x00F50225               |
@@ -1675,9 +1761,7 @@ struct Drawable {
     {
         Op op;
 
-        if (this->tracked_area.has_intersection(rect)) {
-            this->tracked_area_changed = true;
-        }
+        this->mark_dirty(rect);
 
         uint8_t * const base = this->first_pixel(rect);
         uint8_t *       p    = base;
@@ -1761,7 +1845,8 @@ struct Drawable {
 
     struct Op_0x11
     {
-        uint8_t operator()(uint8_t target, uint8_t source)
+        template <typename T>
+        T operator()(T target, T source)
         {
             return ~(target | ~source);
         }
@@ -1769,7 +1854,8 @@ struct Drawable {
 
     struct Op_0x22
     {
-        uint8_t operator()(uint8_t target, uint8_t source)
+        template <typename T>
+        T operator()(T target, T source)
         {
             return target & ~source;
         }
@@ -1777,7 +1863,8 @@ struct Drawable {
 
     struct Op_0x33
     {
-        uint8_t operator()(uint8_t target, uint8_t source)
+        template <typename T>
+        T operator()(T target, T source)
         {
             TODO("The templated function can be optimize in the case the target is not read.");
             (void)target;
@@ -1787,7 +1874,8 @@ struct Drawable {
 
     struct Op_0x44
     {
-        uint8_t operator()(uint8_t target, uint8_t source)
+        template <typename T>
+        T operator()(T target, T source)
         {
             return ~target & source;
         }
@@ -1795,7 +1883,8 @@ struct Drawable {
 
     struct Op_0x66
     {
-        uint8_t operator()(uint8_t target, uint8_t source)
+        template <typename T>
+        T operator()(T target, T source)
         {
             return target ^ source;
         }
@@ -1803,7 +1892,8 @@ struct Drawable {
 
     struct Op_0x77
     {
-        uint8_t operator()(uint8_t target, uint8_t source)
+        template <typename T>
+        T operator()(T target, T source)
         {
             return ~(target & source);
         }
@@ -1811,7 +1901,8 @@ struct Drawable {
 
     struct Op_0x88
     {
-        uint8_t operator()(uint8_t target, uint8_t source)
+        template <typename T>
+        T operator()(T target, T source)
         {
             return target & source;
         }
@@ -1819,7 +1910,8 @@ struct Drawable {
 
     struct Op_0x99
     {
-        uint8_t operator()(uint8_t target, uint8_t source)
+        template <typename T>
+        T operator()(T target, T source)
         {
             return ~(target ^ source);
         }
@@ -1827,7 +1919,8 @@ struct Drawable {
 
     struct Op_0xBB
     {
-        uint8_t operator()(uint8_t target, uint8_t source)
+        template <typename T>
+        T operator()(T target, T source)
         {
             return target | ~source;
         }
@@ -1835,9 +1928,9 @@ struct Drawable {
 
     struct Op_0xCC
     {
-        uint8_t operator()(uint8_t target, uint8_t source)
+        template <typename T>
+        T operator()(T target, T source)
         {
-            TODO("The templated function can be optimized because in the case the target is not read. See commented code in src_blt (and add performance benchmark)");
             (void)target;
             return source;
         }
@@ -1845,7 +1938,8 @@ struct Drawable {
 
     struct Op_0xDD
     {
-        uint8_t operator()(uint8_t target, uint8_t source)
+        template <typename T>
+        T operator()(T target, T source)
         {
             return ~target | source;
         }
@@ -1853,7 +1947,8 @@ struct Drawable {
 
     struct Op_0xEE
     {
-        uint8_t operator()(uint8_t target, uint8_t source)
+        template <typename T>
+        T operator()(T target, T source)
         {
             return target | source;
         }
@@ -1865,9 +1960,7 @@ struct Drawable {
     {
         Op op;
 
-        if (this->tracked_area.has_intersection(drect)) {
-            this->tracked_area_changed = true;
-        }
+        this->mark_dirty(drect);
 
         const int16_t deltax = static_cast<int16_t>(srcx - drect.x);
         const int16_t deltay = static_cast<int16_t>(srcy - drect.y);
@@ -1882,23 +1975,33 @@ struct Drawable {
         const signed int to_nextrow = static_cast<signed int>(((deltay >= 0)||overlap.isempty())
         ?  this->rowsize
         : -this->rowsize);
-        const signed to_nextpixel = ((deltay != 0)||(deltax >= 0))?this->Bpp:-this->Bpp;
-        const unsigned offset = static_cast<unsigned>(((deltay != 0)||(deltax >= 0))?0:this->Bpp*(drect.cx - 1));
+        // source at the left of target on the same rows: rows done backward
+        const bool backward = (deltay == 0) && (deltax < 0);
+        const size_t rect_rowsize = drect.cx * this->Bpp;
         for (size_t y = 0; y < drect.cy ; y++) {
-            uint8_t * linetarget = target + offset;
-            uint8_t * linesource = source + offset;
-            for (size_t x = 0; x < drect.cx ; x++) {
-                for (uint8_t b = 0 ; b < this->Bpp; b++){
-                    linetarget[b] = op(linetarget[b], linesource[b]);
-                }
-                linetarget += to_nextpixel;
-                linesource += to_nextpixel;
-            }
+            scr_blt_row(target, source, rect_rowsize, backward, op);
             target += to_nextrow;
             source += to_nextrow;
         }
     };
 
+    template <typename Op>
+    static void scr_blt_row(uint8_t * target, const uint8_t * source, size_t nbytes, bool backward, Op & op)
+    {
+        if (backward){
+            rop_source_row_backward(target, source, nbytes, op);
+        }
+        else {
+            rop_source_row(target, source, nbytes, op);
+        }
+    }
+
+    // source copy does not read target
+    static void scr_blt_row(uint8_t * target, const uint8_t * source, size_t nbytes, bool backward, Op_0xCC & op)
+    {
+        memmove(target, source, nbytes);
+    }
+
     // low level scrblt, mostly avoid considering clipping
     // because we already took care of it
     void scrblt(unsigned srcx, unsigned srcy, const Rect drect, uint8_t rop)
@@ -2034,9 +2137,7 @@ struct Drawable {
             };
 
         const Rect & line_rect = Rect(startx, starty, 1, 1).enlarge_to(endx, endy);
-        if (this->tracked_area.has_intersection(line_rect)) {
-            this->tracked_area_changed = true;
-        }
+        this->mark_dirty(line_rect);
 
         // Prep
         int x = startx;
@@ -2085,6 +2186,8 @@ struct Drawable {
             , static_cast<uint8_t>(color >> 8)
             , static_cast<uint8_t>(color >> 16)};
 
+        this->mark_dirty(Rect(x, starty, 1, endy - starty + 1));
+
         uint8_t * p = this->data + (starty * this->width + x) * 3;
         for (int dy = starty; dy <= endy ; dy++) {
             switch (rop)
@@ -2112,6 +2215,8 @@ struct Drawable {
             , static_cast<uint8_t>(color >> 16)
             };
 
+        this->mark_dirty(Rect(startx, y, endx - startx + 1, 1));
+
         uint8_t * p = this->data + (y * this->width + startx) * 3;
         for (int dx = startx; dx <= endx ; dx++) {
             switch (rop)
@@ -0,0 +1,121 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2013
+   Author(s): Christophe Grosjean
+
+   Fast non cryptographic 128 bits hash (MurmurHash3 x64 128 bits variant,
+   from public domain code by Austin Appleby). Only use it to identify
+   content, never where security matters.
+*/
+
+#ifndef _REDEMPTION_UTILS_FASTHASH_HPP_
+#define _REDEMPTION_UTILS_FASTHASH_HPP_
+
+#include <stdint.h>
+#include <string.h>
+
+static inline uint64_t fasthash_rotl64(uint64_t x, int8_t r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fasthash_fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+// Reads a little endian 64 bits block whatever the alignment of p
+static inline uint64_t fasthash_block64(const uint8_t * p)
+{
+    return  static_cast<uint64_t>(p[0])
+         | (static_cast<uint64_t>(p[1]) << 8)
+         | (static_cast<uint64_t>(p[2]) << 16)
+         | (static_cast<uint64_t>(p[3]) << 24)
+         | (static_cast<uint64_t>(p[4]) << 32)
+         | (static_cast<uint64_t>(p[5]) << 40)
+         | (static_cast<uint64_t>(p[6]) << 48)
+         | (static_cast<uint64_t>(p[7]) << 56);
+}
+
+static inline void fasthash128(const uint8_t * data, size_t len, uint32_t seed, uint8_t (&out)[16])
+{
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+
+    uint64_t h1 = seed;
+    uint64_t h2 = seed;
+
+    const size_t nblocks = len / 16;
+    for (size_t i = 0; i < nblocks; i++) {
+        uint64_t k1 = fasthash_block64(data + i * 16);
+        uint64_t k2 = fasthash_block64(data + i * 16 + 8);
+
+        k1 *= c1; k1 = fasthash_rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = fasthash_rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= c2; k2 = fasthash_rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = fasthash_rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    const uint8_t * tail = data + nblocks * 16;
+    uint64_t k1 = 0;
+    uint64_t k2 = 0;
+
+    switch (len & 15) {
+    case 15: k2 ^= static_cast<uint64_t>(tail[14]) << 48;
+    case 14: k2 ^= static_cast<uint64_t>(tail[13]) << 40;
+    case 13: k2 ^= static_cast<uint64_t>(tail[12]) << 32;
+    case 12: k2 ^= static_cast<uint64_t>(tail[11]) << 24;
+    case 11: k2 ^= static_cast<uint64_t>(tail[10]) << 16;
+    case 10: k2 ^= static_cast<uint64_t>(tail[9]) << 8;
+    case  9: k2 ^= static_cast<uint64_t>(tail[8]);
+             k2 *= c2; k2 = fasthash_rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+    case  8: k1 ^= static_cast<uint64_t>(tail[7]) << 56;
+    case  7: k1 ^= static_cast<uint64_t>(tail[6]) << 48;
+    case  6: k1 ^= static_cast<uint64_t>(tail[5]) << 40;
+    case  5: k1 ^= static_cast<uint64_t>(tail[4]) << 32;
+    case  4: k1 ^= static_cast<uint64_t>(tail[3]) << 24;
+    case  3: k1 ^= static_cast<uint64_t>(tail[2]) << 16;
+    case  2: k1 ^= static_cast<uint64_t>(tail[1]) << 8;
+    case  1: k1 ^= static_cast<uint64_t>(tail[0]);
+             k1 *= c1; k1 = fasthash_rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= len;
+    h2 ^= len;
+
+    h1 += h2;
+    h2 += h1;
+
+    h1 = fasthash_fmix64(h1);
+    h2 = fasthash_fmix64(h2);
+
+    h1 += h2;
+    h2 += h1;
+
+    for (int i = 0; i < 8; i++) {
+        out[i]     = static_cast<uint8_t>(h1 >> (i * 8));
+        out[i + 8] = static_cast<uint8_t>(h2 >> (i * 8));
+    }
+}
+
+#endif
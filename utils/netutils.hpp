@@ -27,6 +27,7 @@
 #include <arpa/inet.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <netinet/tcp.h>
 #include <signal.h>
 #include <stddef.h>
@@ -36,6 +37,7 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <unistd.h>
 #include <netdb.h>
@@ -172,4 +174,78 @@ static inline int ip_connect(const char* ip, int port,
     return sck;
 }
 
+// Give a copy of file descriptor fd to the process at the other end of unix
+// socket sck. Returns false on failure (peer gone...)
+static inline bool send_fd(int sck, int fd)
+{
+    char byte = 0;
+    struct iovec iov;
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+
+    union {
+        struct cmsghdr cm;
+        char control[CMSG_SPACE(sizeof(int))];
+    } u;
+    memset(&u, 0, sizeof(u));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = u.control;
+    msg.msg_controllen = sizeof(u.control);
+
+    struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    ssize_t res;
+    while (((res = sendmsg(sck, &msg, MSG_NOSIGNAL)) < 0) && (errno == EINTR)){
+    }
+    return res == 1;
+}
+
+// Wait for a file descriptor sent by send_fd() on unix socket sck.
+// Returns -1 on failure or when peer closed sck.
+static inline int recv_fd(int sck)
+{
+    char byte = 0;
+    struct iovec iov;
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+
+    union {
+        struct cmsghdr cm;
+        char control[CMSG_SPACE(sizeof(int))];
+    } u;
+    memset(&u, 0, sizeof(u));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = u.control;
+    msg.msg_controllen = sizeof(u.control);
+
+    ssize_t res;
+    while (((res = recvmsg(sck, &msg, 0)) < 0) && (errno == EINTR)){
+    }
+    if (res != 1){
+        return -1;
+    }
+    struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg
+    || (cmsg->cmsg_level != SOL_SOCKET)
+    || (cmsg->cmsg_type != SCM_RIGHTS)
+    || (cmsg->cmsg_len != CMSG_LEN(sizeof(int)))){
+        return -1;
+    }
+    int fd = -1;
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    return fd;
+}
+
 #endif
@@ -22,9 +22,89 @@
 #define _REDEMPTION_UTILS_PNG_HPP_
 
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <png.h>
+#include <zlib.h>
+
+#include <vector>
 
 #include "transport.hpp"
+#include "zlib.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define REDEMPTION_PNG_SIMD 1
+#include <immintrin.h>
+#endif
+
+// Png encoder settings, default values make the same files as libpng defaults.
+struct PngParams {
+    enum {
+        FILTER_ADAPTIVE,    // libpng chooses the filter of every row (smallest files)
+        FILTER_NONE,        // other filters: same filter for all rows, rows
+        FILTER_SUB,         //  given straight to zlib without libpng
+        FILTER_UP,
+        FILTER_PAETH
+    };
+
+    int      compression_level; // zlib level, 0 (fastest) to 9 (smallest)
+    unsigned filter;
+
+    explicit PngParams(int compression_level = Z_DEFAULT_COMPRESSION, unsigned filter = FILTER_ADAPTIVE)
+    : compression_level(compression_level)
+    , filter(filter)
+    {
+    }
+};
+
+// dst = src with first and third bytes of every pixel swapped (BGR <-> RGB),
+// dst may be src
+static inline void png_swap_bgr_scalar(uint8_t * dst, const uint8_t * src, size_t npixels)
+{
+    for (size_t i = 0; i < npixels; i++, src += 3, dst += 3){
+        const uint8_t b = src[0];
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = b;
+    }
+}
+
+#if defined(REDEMPTION_PNG_SIMD)
+// 5 pixels for every 16 bytes load, last byte is stored unchanged and
+// overwritten by next store
+__attribute__((target("ssse3")))
+static inline void png_swap_bgr_ssse3(uint8_t * dst, const uint8_t * src, size_t npixels)
+{
+    const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15);
+    size_t i = 0;
+    // 6 pixels left at least, load and store stay inside rows
+    for (; i + 6 <= npixels; i += 5){
+        const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 3));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 3), _mm_shuffle_epi8(p, shuffle));
+    }
+    png_swap_bgr_scalar(dst + i * 3, src + i * 3, npixels - i);
+}
+#endif
+
+typedef void (*png_swap_bgr_fn)(uint8_t * dst, const uint8_t * src, size_t npixels);
+
+// best kernel supported by CPU
+static inline png_swap_bgr_fn png_select_swap_bgr()
+{
+#if defined(REDEMPTION_PNG_SIMD)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3")){
+        return png_swap_bgr_ssse3;
+    }
+#endif
+    return png_swap_bgr_scalar;
+}
+
+static inline void png_swap_bgr(uint8_t * dst, const uint8_t * src, size_t npixels)
+{
+    static const png_swap_bgr_fn kernel = png_select_swap_bgr();
+    kernel(dst, src, npixels);
+}
 
 static inline void png_write_data(png_structp png_ptr, png_bytep data, png_size_t length){
     ((Transport *)(png_ptr->io_ptr))->send(data, length);
@@ -34,14 +114,167 @@ static inline void png_flush_data(png_structp png_ptr){
     ((Transport *)(png_ptr->io_ptr))->flush();
 }
 
+static inline void png_send_chunk(Transport * trans, const char (&type)[5], const uint8_t * data, size_t len)
+{
+    uint8_t header[8];
+    png_save_uint_32(header, len);
+    memcpy(header + 4, type, 4);
+    uLong crc = crc32(0, header + 4, 4);
+    if (len){
+        crc = crc32(crc, data, len);
+    }
+    uint8_t trailer[4];
+    png_save_uint_32(trailer, crc);
+
+    trans->send(header, sizeof(header));
+    if (len){
+        trans->send(data, len);
+    }
+    trans->send(trailer, sizeof(trailer));
+}
+
+// compress data to IDAT chunks, out is the IDAT chunk buffer
+static inline void png_deflate_idat(Transport * trans, z_stream & zstrm, const uint8_t * data, size_t len,
+                                    int flush, uint8_t * out, size_t out_size)
+{
+    zstrm.next_in  = const_cast<uint8_t *>(data);
+    zstrm.avail_in = len;
+    for (;;) {
+        if (!zstrm.avail_out){
+            png_send_chunk(trans, "IDAT", out, out_size);
+            zstrm.next_out  = out;
+            zstrm.avail_out = out_size;
+        }
+        const int res = deflate(&zstrm, flush);
+        if (res == Z_STREAM_ERROR){
+            LOG(LOG_ERR, "png_deflate_idat: deflate failed");
+            throw Error(ERR_RECORDER_SNAPSHOT_FAILED);
+        }
+        if ((flush == Z_FINISH) ? (res == Z_STREAM_END) : !zstrm.avail_in){
+            break;
+        }
+    }
+}
+
+REDOC("Png with the same filter for all rows: rows (BGR swapped and filtered"
+      " in place of libpng per row transformations) go straight to zlib and"
+      " png chunks are written without libpng. Same deflate parameters as libpng.")
+static inline void zlib_dump_png24(Transport * trans, const uint8_t * data,
+                            const size_t width,
+                            const size_t height,
+                            const size_t rowsize,
+                            const bool bgr,
+                            const PngParams & params)
+{
+    static const uint8_t signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+    trans->send(signature, sizeof(signature));
+
+    uint8_t ihdr[13];
+    png_save_uint_32(ihdr, width);
+    png_save_uint_32(ihdr + 4, height);
+    ihdr[8]  = 8;
+    ihdr[9]  = PNG_COLOR_TYPE_RGB;
+    ihdr[10] = PNG_COMPRESSION_TYPE_BASE;
+    ihdr[11] = PNG_FILTER_TYPE_BASE;
+    ihdr[12] = PNG_INTERLACE_NONE;
+    png_send_chunk(trans, "IHDR", ihdr, sizeof(ihdr));
+
+    z_stream zstrm;
+    memset(&zstrm, 0, sizeof(zstrm));
+    if (deflateInit2(&zstrm, params.compression_level, Z_DEFLATED, 15, 8,
+                     (params.filter == PngParams::FILTER_NONE) ? Z_DEFAULT_STRATEGY : Z_FILTERED) != Z_OK){
+        LOG(LOG_ERR, "zlib_dump_png24: deflateInit failed");
+        throw Error(ERR_RECORDER_SNAPSHOT_FAILED);
+    }
+    ZRaiiDeflateEnd zend(zstrm);
+
+    uint8_t out[32768];
+    zstrm.next_out  = out;
+    zstrm.avail_out = sizeof(out);
+
+    const uint8_t filter_type = (params.filter == PngParams::FILTER_SUB)   ? 1
+                              : (params.filter == PngParams::FILTER_UP)    ? 2
+                              : (params.filter == PngParams::FILTER_PAETH) ? 4
+                              : 0;
+    const size_t rowbytes = width * 3;
+    // filter type and filtered row, RGB rows (current and previous one)
+    std::vector<uint8_t> buffer(1 + 3 * rowbytes);
+    uint8_t * line = &buffer[0];
+    uint8_t * rgb_rows[2] = { line + 1 + rowbytes, line + 1 + 2 * rowbytes };
+    line[0] = filter_type;
+
+    const uint8_t * prev = NULL;
+    const uint8_t * row = data;
+    for (size_t k = 0 ; k < height ; ++k, row += rowsize) {
+        if (filter_type == 0){
+            if (bgr){
+                png_swap_bgr(line + 1, row, width);
+                png_deflate_idat(trans, zstrm, line, 1 + rowbytes, Z_NO_FLUSH, out, sizeof(out));
+            }
+            else {
+                png_deflate_idat(trans, zstrm, line, 1, Z_NO_FLUSH, out, sizeof(out));
+                png_deflate_idat(trans, zstrm, row, rowbytes, Z_NO_FLUSH, out, sizeof(out));
+            }
+            continue;
+        }
+
+        const uint8_t * cur = row;
+        if (bgr){
+            png_swap_bgr(rgb_rows[k & 1], row, width);
+            cur = rgb_rows[k & 1];
+        }
+        uint8_t * f = line + 1;
+        switch (filter_type){
+        case 1:
+            memcpy(f, cur, 3);
+            for (size_t i = 3; i < rowbytes; i++){
+                f[i] = cur[i] - cur[i - 3];
+            }
+            break;
+        case 2:
+            for (size_t i = 0; i < rowbytes; i++){
+                f[i] = cur[i] - (prev ? prev[i] : 0);
+            }
+            break;
+        default:
+            for (size_t i = 0; i < rowbytes; i++){
+                const int a = (i >= 3) ? cur[i - 3] : 0;
+                const int b = prev ? prev[i] : 0;
+                const int c = (prev && i >= 3) ? prev[i - 3] : 0;
+                const int pa = abs(b - c);
+                const int pb = abs(a - c);
+                const int pc = abs(a + b - 2 * c);
+                f[i] = cur[i] - ((pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c);
+            }
+            break;
+        }
+        png_deflate_idat(trans, zstrm, line, 1 + rowbytes, Z_NO_FLUSH, out, sizeof(out));
+        prev = cur;
+    }
+    png_deflate_idat(trans, zstrm, NULL, 0, Z_FINISH, out, sizeof(out));
+    if (zstrm.avail_out < sizeof(out)){
+        png_send_chunk(trans, "IDAT", out, sizeof(out) - zstrm.avail_out);
+    }
+    png_send_chunk(trans, "IEND", NULL, 0);
+
+    trans->flush();
+}
+
 static inline void transport_dump_png24(Transport * trans, const uint8_t * data,
                             const size_t width,
                             const size_t height,
                             const size_t rowsize,
-                            const bool bgr)
+                            const bool bgr,
+                            const PngParams & params = PngParams())
 {
+    if (params.filter != PngParams::FILTER_ADAPTIVE){
+        zlib_dump_png24(trans, data, width, height, rowsize, bgr, params);
+        return;
+    }
+
     png_struct * ppng = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
     png_set_write_fn(ppng, trans, &png_write_data, &png_flush_data);
+    png_set_compression_level(ppng, params.compression_level);
 
     png_info * pinfo = png_create_info_struct(ppng);
     png_set_IHDR(ppng, pinfo, width, height, 8,
@@ -52,30 +285,12 @@ static inline void transport_dump_png24(Transport * trans, const uint8_t * data,
     png_write_info(ppng, pinfo);
 
     // send image buffer to file, one pixel row at once
+    std::vector<uint8_t> rgb(bgr ? width * 3 : 0);
     const uint8_t * row = data;
     for (size_t k = 0 ; k < height ; ++k) {
         if (bgr){
-            uint32_t bgrtmp[8192];
-            const uint32_t * s = reinterpret_cast<const uint32_t*>(row);
-            uint32_t * t = bgrtmp;
-            for (size_t n = 0; n < (width / 4) ; n++){
-                unsigned bRGB = *s++;
-                unsigned GBrg = *s++;
-                unsigned rgbR = *s++;
-                *t++ = ((GBrg << 16) & 0xFF000000)
-                   | ((bRGB << 16) & 0x00FF0000)
-                   | (bRGB         & 0x0000FF00)
-                   | ((bRGB >> 16) & 0x000000FF) ;
-                *t++ = (GBrg         & 0xFF000000)
-                   | ((rgbR << 16) & 0x00FF0000)
-                   | ((bRGB >> 16) & 0x0000FF00)
-                   | ( GBrg        & 0x000000FF) ;
-                *t++ = ((rgbR << 16) & 0xFF000000)
-                   | (rgbR         & 0x00FF0000)
-                   | ((rgbR >> 16) & 0x0000FF00)
-                   | ((GBrg >> 16) & 0x000000FF) ;
-            }
-            png_write_row(ppng, (unsigned char*)bgrtmp);
+            png_swap_bgr(&rgb[0], row, width);
+            png_write_row(ppng, &rgb[0]);
         }
         else {
             png_write_row(ppng, (unsigned char*)row);
@@ -110,31 +325,12 @@ static inline void dump_png24(FILE * fd, const uint8_t * data,
     png_write_info(ppng, pinfo);
 
     // send image buffer to file, one pixel row at once
+    std::vector<uint8_t> rgb(bgr ? width * 3 : 0);
     const uint8_t * row = data;
-
     for (size_t k = 0 ; k < height ; ++k) {
         if (bgr){
-            uint32_t bgrtmp[8192];
-            const uint32_t * s = reinterpret_cast<const uint32_t*>(row);
-            uint32_t * t = bgrtmp;
-            for (size_t n = 0; n < (width / 4) ; n++){
-                unsigned bRGB = *s++;
-                unsigned GBrg = *s++;
-                unsigned rgbR = *s++;
-                *t++ = ((GBrg << 16) & 0xFF000000)
-                   | ((bRGB << 16) & 0x00FF0000)
-                   | (bRGB         & 0x0000FF00)
-                   | ((bRGB >> 16) & 0x000000FF) ;
-                *t++ = (GBrg         & 0xFF000000)
-                   | ((rgbR << 16) & 0x00FF0000)
-                   | ((bRGB >> 16) & 0x0000FF00)
-                   | ( GBrg        & 0x000000FF) ;
-                *t++ = ((rgbR << 16) & 0xFF000000)
-                   | (rgbR         & 0x00FF0000)
-                   | ((rgbR >> 16) & 0x0000FF00)
-                   | ((GBrg >> 16) & 0x000000FF) ;
-            }
-            png_write_row(ppng, (unsigned char*)bgrtmp);
+            png_swap_bgr(&rgb[0], row, width);
+            png_write_row(ppng, &rgb[0]);
         }
         else {
             png_write_row(ppng, (unsigned char*)row);
@@ -0,0 +1,382 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2013
+   Author(s): Christophe Grosjean
+
+   Byte scanning kernels used by the bitmap RLE compressor. Each kernel has
+   a scalar, an SSE2 and an AVX2 version, the best one supported by the CPU
+   is chosen at runtime. All versions return exactly the same results.
+
+   Also run writers used by the bitmap RLE decompressor.
+*/
+
+#ifndef _REDEMPTION_UTILS_RLESIMD_HPP_
+#define _REDEMPTION_UTILS_RLESIMD_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define REDEMPTION_RLE_SIMD 1
+#include <immintrin.h>
+#endif
+
+enum RLEKernelLevel {
+    RLE_KERNEL_SCALAR,
+    RLE_KERNEL_SSE2,
+    RLE_KERNEL_AVX2
+};
+
+// ===========================================================================
+// Scalar kernels (reference)
+// ===========================================================================
+
+// first index i < n such that a[i] != b[i], n if none
+static inline size_t rle_mismatch_scalar(const uint8_t * a, const uint8_t * b, size_t n)
+{
+    size_t i = 0;
+    while (i < n && a[i] == b[i]){
+        i++;
+    }
+    return i;
+}
+
+// first index i < n such that a[i] != 0, n if none
+static inline size_t rle_nonzero_scalar(const uint8_t * a, size_t n)
+{
+    size_t i = 0;
+    while (i < n && a[i] == 0){
+        i++;
+    }
+    return i;
+}
+
+// first index i < n such that (a[i] ^ b[i]) != (c[i] ^ d[i]), n if none
+static inline size_t rle_mismatch_xor_scalar(const uint8_t * a, const uint8_t * b,
+                                             const uint8_t * c, const uint8_t * d, size_t n)
+{
+    size_t i = 0;
+    while (i < n && (a[i] ^ b[i]) == (c[i] ^ d[i])){
+        i++;
+    }
+    return i;
+}
+
+// bit i of mask set if pixel i of p differs from pixel i of above
+// (or is not black when above is NULL), for count pixels of Bpp bytes.
+static inline void rle_diff_mask_scalar(uint8_t Bpp, const uint8_t * p, const uint8_t * above,
+                                        uint8_t * mask, unsigned count)
+{
+    for (unsigned i = 0; i < count; i += 8){
+        mask[i >> 3] = 0;
+    }
+    for (unsigned i = 0; i < count; i++, p += Bpp){
+        bool diff = false;
+        for (unsigned b = 0; b < Bpp; b++){
+            diff |= (p[b] != (above ? above[i * Bpp + b] : 0));
+        }
+        if (diff){
+            mask[i >> 3] |= static_cast<uint8_t>(0x01 << (i & 7));
+        }
+    }
+}
+
+#if defined(REDEMPTION_RLE_SIMD)
+
+// ===========================================================================
+// SSE2 kernels
+// ===========================================================================
+
+__attribute__((target("sse2")))
+static inline size_t rle_mismatch_sse2(const uint8_t * a, const uint8_t * b, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16){
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        unsigned eq = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)));
+        if (eq != 0xFFFF){
+            return i + __builtin_ctz(~eq);
+        }
+    }
+    return i + rle_mismatch_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static inline size_t rle_nonzero_sse2(const uint8_t * a, size_t n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16){
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        unsigned eq = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(va, zero)));
+        if (eq != 0xFFFF){
+            return i + __builtin_ctz(~eq);
+        }
+    }
+    return i + rle_nonzero_scalar(a + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static inline size_t rle_mismatch_xor_sse2(const uint8_t * a, const uint8_t * b,
+                                           const uint8_t * c, const uint8_t * d, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16){
+        __m128i vab = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)),
+                                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+        __m128i vcd = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(c + i)),
+                                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(d + i)));
+        unsigned eq = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(vab, vcd)));
+        if (eq != 0xFFFF){
+            return i + __builtin_ctz(~eq);
+        }
+    }
+    return i + rle_mismatch_xor_scalar(a + i, b + i, c + i, d + i, n - i);
+}
+
+// one bit per pixel for 16 pixels, 1 if pixel differs
+__attribute__((target("sse2")))
+static inline unsigned rle_diff16_sse2(uint8_t Bpp, const uint8_t * p, const uint8_t * above)
+{
+    const __m128i zero = _mm_setzero_si128();
+    switch (Bpp){
+    case 1:
+    {
+        __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i a0 = above ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(above)) : zero;
+        return ~static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(v0, a0))) & 0xFFFF;
+    }
+    case 2:
+    {
+        __m128i eq[2];
+        for (int k = 0; k < 2; k++){
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + k * 16));
+            __m128i a = above ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + k * 16)) : zero;
+            eq[k] = _mm_cmpeq_epi16(v, a);
+        }
+        return ~static_cast<unsigned>(_mm_movemask_epi8(_mm_packs_epi16(eq[0], eq[1]))) & 0xFFFF;
+    }
+    default: // 4
+    {
+        __m128i eq[4];
+        for (int k = 0; k < 4; k++){
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + k * 16));
+            __m128i a = above ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + k * 16)) : zero;
+            eq[k] = _mm_cmpeq_epi32(v, a);
+        }
+        __m128i packed = _mm_packs_epi16(_mm_packs_epi32(eq[0], eq[1]), _mm_packs_epi32(eq[2], eq[3]));
+        return ~static_cast<unsigned>(_mm_movemask_epi8(packed)) & 0xFFFF;
+    }
+    }
+}
+
+__attribute__((target("sse2")))
+static inline void rle_diff_mask_sse2(uint8_t Bpp, const uint8_t * p, const uint8_t * above,
+                                      uint8_t * mask, unsigned count)
+{
+    if (Bpp == 3){
+        rle_diff_mask_scalar(Bpp, p, above, mask, count);
+        return;
+    }
+    unsigned i = 0;
+    for (; i + 16 <= count; i += 16){
+        unsigned diff = rle_diff16_sse2(Bpp, p + i * Bpp, above ? above + i * Bpp : NULL);
+        mask[i >> 3] = static_cast<uint8_t>(diff);
+        mask[(i >> 3) + 1] = static_cast<uint8_t>(diff >> 8);
+    }
+    if (i < count){
+        rle_diff_mask_scalar(Bpp, p + i * Bpp, above ? above + i * Bpp : NULL, mask + (i >> 3), count - i);
+    }
+}
+
+// ===========================================================================
+// AVX2 kernels
+// ===========================================================================
+
+__attribute__((target("avx2")))
+static inline size_t rle_mismatch_avx2(const uint8_t * a, const uint8_t * b, size_t n)
+{
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32){
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        unsigned eq = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb)));
+        if (eq != 0xFFFFFFFFu){
+            return i + __builtin_ctz(~eq);
+        }
+    }
+    return i + rle_mismatch_sse2(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static inline size_t rle_nonzero_avx2(const uint8_t * a, size_t n)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32){
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        unsigned eq = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, zero)));
+        if (eq != 0xFFFFFFFFu){
+            return i + __builtin_ctz(~eq);
+        }
+    }
+    return i + rle_nonzero_sse2(a + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static inline size_t rle_mismatch_xor_avx2(const uint8_t * a, const uint8_t * b,
+                                           const uint8_t * c, const uint8_t * d, size_t n)
+{
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32){
+        __m256i vab = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)),
+                                       _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)));
+        __m256i vcd = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(c + i)),
+                                       _mm256_loadu_si256(reinterpret_cast<const __m256i*>(d + i)));
+        unsigned eq = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(vab, vcd)));
+        if (eq != 0xFFFFFFFFu){
+            return i + __builtin_ctz(~eq);
+        }
+    }
+    return i + rle_mismatch_xor_sse2(a + i, b + i, c + i, d + i, n - i);
+}
+
+#endif
+
+// ===========================================================================
+// Runtime selection
+// ===========================================================================
+
+struct RLEKernels {
+    size_t (*mismatch)(const uint8_t * a, const uint8_t * b, size_t n);
+    size_t (*nonzero)(const uint8_t * a, size_t n);
+    size_t (*mismatch_xor)(const uint8_t * a, const uint8_t * b, const uint8_t * c, const uint8_t * d, size_t n);
+    void (*diff_mask)(uint8_t Bpp, const uint8_t * p, const uint8_t * above, uint8_t * mask, unsigned count);
+    RLEKernelLevel level;
+
+    // Use the given level, or the best level available if CPU does not support it.
+    void select(RLEKernelLevel wanted)
+    {
+        this->level = RLE_KERNEL_SCALAR;
+        this->mismatch = rle_mismatch_scalar;
+        this->nonzero = rle_nonzero_scalar;
+        this->mismatch_xor = rle_mismatch_xor_scalar;
+        this->diff_mask = rle_diff_mask_scalar;
+#if defined(REDEMPTION_RLE_SIMD)
+        __builtin_cpu_init();
+        if (wanted >= RLE_KERNEL_SSE2 && __builtin_cpu_supports("sse2")){
+            this->level = RLE_KERNEL_SSE2;
+            this->mismatch = rle_mismatch_sse2;
+            this->nonzero = rle_nonzero_sse2;
+            this->mismatch_xor = rle_mismatch_xor_sse2;
+            this->diff_mask = rle_diff_mask_sse2;
+            if (wanted >= RLE_KERNEL_AVX2 && __builtin_cpu_supports("avx2")){
+                this->level = RLE_KERNEL_AVX2;
+                this->mismatch = rle_mismatch_avx2;
+                this->nonzero = rle_nonzero_avx2;
+                this->mismatch_xor = rle_mismatch_xor_avx2;
+            }
+        }
+#else
+        (void)wanted;
+#endif
+    }
+};
+
+static inline RLEKernels best_rle_kernels()
+{
+    RLEKernels kernels;
+    kernels.select(RLE_KERNEL_AVX2);
+    return kernels;
+}
+
+// Kernels used by the compressor, best available level unless changed
+// with rle_kernels().select() (tests and benchmarks do that).
+// Bitmaps are also compressed by the capture thread, kernels are selected
+// by the (thread safe) initialization of the local static.
+static inline RLEKernels & rle_kernels()
+{
+    static RLEKernels kernels = best_rle_kernels();
+    return kernels;
+}
+
+// ===========================================================================
+// Run writers (decompressor)
+// ===========================================================================
+
+// A run pattern holds the same pixel repeated, its size is a multiple of
+// 16 bytes and of every pixel size.
+enum { RLE_RUN_PATTERN_SIZE = 48 };
+
+static inline void rle_run_pattern(uint8_t (&pattern)[RLE_RUN_PATTERN_SIZE], uint8_t Bpp, unsigned pixel)
+{
+    for (unsigned i = 0; i < RLE_RUN_PATTERN_SIZE; i += Bpp){
+        for (unsigned b = 0; b < Bpp; b++){
+            pattern[i + b] = static_cast<uint8_t>(pixel >> (8 * b));
+        }
+    }
+}
+
+// out = pattern repeated for nbytes
+static inline void rle_fill_run(uint8_t * out, const uint8_t (&pattern)[RLE_RUN_PATTERN_SIZE], size_t nbytes)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i p0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pattern));
+    const __m128i p1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pattern + 16));
+    const __m128i p2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pattern + 32));
+    for (; i + RLE_RUN_PATTERN_SIZE <= nbytes; i += RLE_RUN_PATTERN_SIZE){
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), p0);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 16), p1);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 32), p2);
+    }
+#else
+    for (; i + RLE_RUN_PATTERN_SIZE <= nbytes; i += RLE_RUN_PATTERN_SIZE){
+        memcpy(out + i, pattern, RLE_RUN_PATTERN_SIZE);
+    }
+#endif
+    memcpy(out + i, pattern, nbytes - i);
+}
+
+// out = above xor pattern repeated for nbytes (out and above do not overlap)
+static inline void rle_xor_run(uint8_t * out, const uint8_t * above, const uint8_t (&pattern)[RLE_RUN_PATTERN_SIZE], size_t nbytes)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i p0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pattern));
+    const __m128i p1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pattern + 16));
+    const __m128i p2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pattern + 32));
+    for (; i + RLE_RUN_PATTERN_SIZE <= nbytes; i += RLE_RUN_PATTERN_SIZE){
+        __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + i));
+        __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + i + 16));
+        __m128i a2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + i + 32));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_xor_si128(a0, p0));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 16), _mm_xor_si128(a1, p1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 32), _mm_xor_si128(a2, p2));
+    }
+#endif
+    for (size_t k = 0; i < nbytes; i++, k++){
+        if (k == RLE_RUN_PATTERN_SIZE){
+            k = 0;
+        }
+        out[i] = above[i] ^ pattern[k];
+    }
+}
+
+#endif
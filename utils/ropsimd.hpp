@@ -0,0 +1,122 @@
+/*
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+   Product name: redemption, a FLOSS RDP proxy
+   Copyright (C) Wallix 2013
+   Author(s): Christophe Grosjean
+
+   Raster operation kernels used by Drawable on rows of packed 24 bits
+   pixels. Raster operations are bitwise, the same operator functor is
+   applied to 16 bytes vectors (compiled to SSE2 or NEON instructions when
+   available, to scalar code otherwise) and to the remaining bytes.
+*/
+
+#ifndef _REDEMPTION_UTILS_ROPSIMD_HPP_
+#define _REDEMPTION_UTILS_ROPSIMD_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+typedef uint8_t rop_vec __attribute__((vector_size(16)));
+
+static inline rop_vec rop_load(const uint8_t * p)
+{
+    rop_vec v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void rop_store(uint8_t * p, const rop_vec & v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+// A pattern holds the same 24 bits pixel repeated, its size is a multiple
+// of 16 bytes and of 3 bytes.
+enum { ROP_PATTERN_SIZE = 48 };
+
+static inline void rop_pattern24(uint8_t (&pattern)[ROP_PATTERN_SIZE], uint32_t color)
+{
+    for (unsigned i = 0; i < ROP_PATTERN_SIZE; i += 3){
+        pattern[i]     = color;
+        pattern[i + 1] = color >> 8;
+        pattern[i + 2] = color >> 16;
+    }
+}
+
+// dst = pattern repeated for nbytes
+static inline void rop_fill_row(uint8_t * dst, const uint8_t (&pattern)[ROP_PATTERN_SIZE], size_t nbytes)
+{
+    const rop_vec p0 = rop_load(pattern);
+    const rop_vec p1 = rop_load(pattern + 16);
+    const rop_vec p2 = rop_load(pattern + 32);
+    size_t i = 0;
+    for (; i + ROP_PATTERN_SIZE <= nbytes; i += ROP_PATTERN_SIZE){
+        rop_store(dst + i, p0);
+        rop_store(dst + i + 16, p1);
+        rop_store(dst + i + 32, p2);
+    }
+    memcpy(dst + i, pattern, nbytes - i);
+}
+
+// dst = op(dst, pattern) for nbytes
+template <typename Op>
+static inline void rop_pattern_row(uint8_t * dst, const uint8_t (&pattern)[ROP_PATTERN_SIZE], size_t nbytes, Op & op)
+{
+    const rop_vec p0 = rop_load(pattern);
+    const rop_vec p1 = rop_load(pattern + 16);
+    const rop_vec p2 = rop_load(pattern + 32);
+    size_t i = 0;
+    for (; i + ROP_PATTERN_SIZE <= nbytes; i += ROP_PATTERN_SIZE){
+        rop_store(dst + i,      op(rop_load(dst + i),      p0));
+        rop_store(dst + i + 16, op(rop_load(dst + i + 16), p1));
+        rop_store(dst + i + 32, op(rop_load(dst + i + 32), p2));
+    }
+    for (size_t k = 0; i < nbytes; i++, k++){
+        dst[i] = op(dst[i], pattern[k]);
+    }
+}
+
+// dst = op(dst, src) for nbytes, from first byte to last one: src and dst
+// may only overlap if src >= dst
+template <typename Op>
+static inline void rop_source_row(uint8_t * dst, const uint8_t * src, size_t nbytes, Op & op)
+{
+    size_t i = 0;
+    for (; i + 16 <= nbytes; i += 16){
+        rop_store(dst + i, op(rop_load(dst + i), rop_load(src + i)));
+    }
+    for (; i < nbytes; i++){
+        dst[i] = op(dst[i], src[i]);
+    }
+}
+
+// dst = op(dst, src) for nbytes, from last byte to first one: src and dst
+// may only overlap if src <= dst
+template <typename Op>
+static inline void rop_source_row_backward(uint8_t * dst, const uint8_t * src, size_t nbytes, Op & op)
+{
+    size_t i = nbytes;
+    for (; i >= 16; i -= 16){
+        rop_store(dst + i - 16, op(rop_load(dst + i - 16), rop_load(src + i - 16)));
+    }
+    while (i > 0){
+        i--;
+        dst[i] = op(dst[i], src[i]);
+    }
+}
+
+#endif